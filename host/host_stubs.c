@@ -0,0 +1,39 @@
+/*
+ * host_stubs.c - No-op UI and TIP pieces for the host build
+ *
+ * Tooltip, language bar, tray and compartment updates have no meaning
+ * without a desktop; the key path only needs them to link.
+ */
+
+#include "kolemak.h"
+
+void KolemakTooltip_Init(HINSTANCE hInst)
+{
+    (void)hInst;
+}
+
+void KolemakTooltip_Show(UINT label)
+{
+    (void)label;
+}
+
+void LangBarButton_UpdateState(LangBarButton *button)
+{
+    (void)button;
+}
+
+void TextService_SetKeyboardOpen(TextService *ts, BOOL open)
+{
+    (void)ts; (void)open;
+}
+
+void KolemakTray_EnsureIcon(TextService *ts)
+{
+    (void)ts;
+}
+
+/* Never posted: no message matches */
+UINT KolemakTray_Message(void)
+{
+    return 0;
+}
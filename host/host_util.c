@@ -0,0 +1,126 @@
+/*
+ * host_util.c - Helpers shared by the host tools
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "host_util.h"
+
+unsigned long long Host_NowNs(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (unsigned long long)t.tv_sec * 1000000000ull + (unsigned long long)t.tv_nsec;
+}
+
+/* ===== US layout ===== */
+
+typedef struct { BYTE vk; char normal; char shifted; } UsKey;
+
+static const UsKey g_usKeys[] = {
+    { VK_SPACE, ' ', ' ' }, { VK_RETURN, '\n', '\n' }, { VK_TAB, '\t', '\t' },
+    { '0', '0', ')' }, { '1', '1', '!' }, { '2', '2', '@' }, { '3', '3', '#' },
+    { '4', '4', '$' }, { '5', '5', '%' }, { '6', '6', '^' }, { '7', '7', '&' },
+    { '8', '8', '*' }, { '9', '9', '(' },
+    { VK_OEM_1, ';', ':' }, { VK_OEM_PLUS, '=', '+' }, { VK_OEM_COMMA, ',', '<' },
+    { VK_OEM_MINUS, '-', '_' }, { VK_OEM_PERIOD, '.', '>' }, { VK_OEM_2, '/', '?' },
+    { VK_OEM_3, '`', '~' }, { VK_OEM_4, '[', '{' }, { VK_OEM_5, '\\', '|' },
+    { VK_OEM_6, ']', '}' }, { VK_OEM_7, '\'', '"' },
+};
+
+WCHAR Host_UsChar(UINT vk, BOOL shift, BOOL caps)
+{
+    size_t i;
+
+    if (vk >= 'A' && vk <= 'Z')
+        return (WCHAR)((shift != caps) ? vk : vk + 32);
+    for (i = 0; i < sizeof(g_usKeys) / sizeof(g_usKeys[0]); i++) {
+        if (g_usKeys[i].vk == vk)
+            return (WCHAR)(shift ? g_usKeys[i].shifted : g_usKeys[i].normal);
+    }
+    return 0;
+}
+
+/* ===== Output ===== */
+
+void Host_PrintUtf8(const WCHAR *text, int len)
+{
+    int i;
+
+    for (i = 0; i < len; i++) {
+        unsigned int c = text[i];
+        if (c >= 0xD800 && c <= 0xDBFF && i + 1 < len) {
+            c = 0x10000 + ((c - 0xD800) << 10) + (text[i + 1] - 0xDC00);
+            i++;
+        }
+        if (c < 0x80) {
+            putchar((int)c);
+        } else if (c < 0x800) {
+            putchar((int)(0xC0 | (c >> 6)));
+            putchar((int)(0x80 | (c & 0x3F)));
+        } else if (c < 0x10000) {
+            putchar((int)(0xE0 | (c >> 12)));
+            putchar((int)(0x80 | ((c >> 6) & 0x3F)));
+            putchar((int)(0x80 | (c & 0x3F)));
+        } else {
+            putchar((int)(0xF0 | (c >> 18)));
+            putchar((int)(0x80 | ((c >> 12) & 0x3F)));
+            putchar((int)(0x80 | ((c >> 6) & 0x3F)));
+            putchar((int)(0x80 | (c & 0x3F)));
+        }
+    }
+    putchar('\n');
+    fflush(stdout);
+}
+
+static int CompareU64(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a;
+    unsigned long long y = *(const unsigned long long *)b;
+    return (x > y) - (x < y);
+}
+
+void Host_PrintLatency(const char *label, unsigned long long *samples, size_t count)
+{
+    unsigned long long total = 0;
+    size_t i;
+
+    if (count == 0)
+        return;
+
+    for (i = 0; i < count; i++)
+        total += samples[i];
+    qsort(samples, count, sizeof(samples[0]), CompareU64);
+    fprintf(stderr, "%s: mean %llu  min %llu  p50 %llu  p99 %llu  max %llu\n",
+            label, total / count, samples[0], samples[count / 2],
+            samples[(count * 99) / 100], samples[count - 1]);
+}
+
+/* ===== Tooltip labels ===== */
+
+void Host_RasterizeLabel(UINT label, UINT dpi, DWORD *pixels,
+                         TipLabelLayout *l)
+{
+    const WCHAR *text = tiplabel_text(label);
+    int px = -tiplabel_font_height(dpi);
+    int cell = px * 3 / 5, len = 0, x, y;
+
+    while (text[len])
+        len++;
+    tiplabel_layout(len * cell, px * 4 / 3, dpi, l);
+
+    for (y = 0; y < l->height; y++) {
+        for (x = 0; x < l->width; x++) {
+            int tx = x - l->textX, ty = y - l->textY;
+            DWORD c = 0;
+
+            if (tx >= 0 && tx < len * cell && ty >= px / 6 && ty < px) {
+                int cx = tx % cell;
+                c = (cx == 0 || cx == cell - 1 || ty == px / 6 ||
+                     ty == px - 1) ? 128 : 255;
+            }
+            pixels[y * l->width + x] = c | (c << 8) | (c << 16);
+        }
+    }
+}
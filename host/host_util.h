@@ -0,0 +1,31 @@
+/*
+ * host_util.h - Helpers shared by the host tools
+ */
+
+#ifndef HOST_UTIL_H
+#define HOST_UTIL_H
+
+#include <stddef.h>
+#include <windows.h>
+#include "tiplabel.h"
+
+/* Monotonic clock in nanoseconds */
+unsigned long long Host_NowNs(void);
+
+/* Character a US QWERTY layout produces for vk, or 0 if none */
+WCHAR Host_UsChar(UINT vk, BOOL shift, BOOL caps);
+
+/* Write UTF-16 text to stdout as UTF-8, followed by a newline */
+void Host_PrintUtf8(const WCHAR *text, int len);
+
+/* Sort samples in place and print "label: mean .. min .. p50 .. p99 .. max" */
+void Host_PrintLatency(const char *label, unsigned long long *samples, size_t count);
+
+/* Stand-in for GDI's text output into a tooltip label bitmap: a cell of
+ * 3/5 the font height per character, fully covered inside with
+ * half-covered edges.  Fills in the layout used; pixels must hold
+ * l->width * l->height values (512 x 128 at up to 192 DPI). */
+void Host_RasterizeLabel(UINT label, UINT dpi, DWORD *pixels,
+                         TipLabelLayout *l);
+
+#endif /* HOST_UTIL_H */
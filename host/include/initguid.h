@@ -0,0 +1,15 @@
+/*
+ * initguid.h - Win32 stand-in for the host build
+ *
+ * Makes DEFINE_GUID emit definitions instead of extern declarations.
+ */
+
+#ifndef INITGUID
+#define INITGUID
+#endif
+
+#include <windows.h>
+
+#undef DEFINE_GUID
+#define DEFINE_GUID(n, l, w1, w2, b1, b2, b3, b4, b5, b6, b7, b8) \
+    const GUID n = { l, w1, w2, { b1, b2, b3, b4, b5, b6, b7, b8 } }
@@ -0,0 +1,203 @@
+/*
+ * msctf.h - Text Services Framework stand-in for the host build
+ *
+ * Declares the TSF interfaces and constants that the key path
+ * (key_handler.c, edit_session.c, settings.c) uses.  Vtables list only the
+ * methods those sources call, in the same relative order as the real SDK;
+ * vtables the sources initialize positionally are declared in full.
+ * The in-memory implementations live in host/tsf_mock.c.
+ */
+
+#ifndef KOLEMAK_HOST_MSCTF_H
+#define KOLEMAK_HOST_MSCTF_H
+
+#include <windows.h>
+
+typedef DWORD TfClientId;
+typedef DWORD TfEditCookie;
+
+#define TF_INVALID_COOKIE   ((DWORD)0xFFFFFFFF)
+
+/* RequestEditSession flags */
+#define TF_ES_ASYNCDONTCARE 0x0
+#define TF_ES_SYNC          0x1
+#define TF_ES_READ          0x2
+#define TF_ES_READWRITE     0x6
+#define TF_ES_ASYNC         0x8
+
+#define TF_E_SYNCHRONOUS    ((HRESULT)0x80040505)
+#define TF_S_ASYNC          ((HRESULT)0x00040300)
+
+/* InsertTextAtSelection flags */
+#define TF_IAS_NOQUERY      0x1
+#define TF_IAS_QUERYONLY    0x2
+
+/* Preserved key modifiers */
+#define TF_MOD_ALT          0x0001
+#define TF_MOD_CONTROL      0x0002
+#define TF_MOD_SHIFT        0x0004
+#define TF_MOD_RALT         0x0008
+#define TF_MOD_RCONTROL     0x0010
+#define TF_MOD_RSHIFT       0x0020
+#define TF_MOD_LALT         0x0040
+#define TF_MOD_LCONTROL     0x0080
+#define TF_MOD_LSHIFT       0x0100
+#define TF_MOD_ON_KEYUP     0x0200
+
+typedef enum { TF_ANCHOR_START = 0, TF_ANCHOR_END = 1 } TfAnchor;
+typedef enum { TF_AE_NONE = 0, TF_AE_START = 1, TF_AE_END = 2 } TfActiveSelEnd;
+
+typedef struct {
+    UINT uVKey;
+    UINT uModifiers;
+} TF_PRESERVEDKEY;
+
+typedef struct ITfRange ITfRange;
+
+typedef struct {
+    TfActiveSelEnd ase;
+    BOOL           fInterimChar;
+} TF_SELECTIONSTYLE;
+
+typedef struct {
+    ITfRange         *range;
+    TF_SELECTIONSTYLE style;
+} TF_SELECTION;
+
+typedef struct {
+    DWORD dwDynamicFlags;
+    DWORD dwStaticFlags;
+} TF_STATUS;
+
+#define TS_SD_READONLY      0x001
+#define TS_SD_LOADING       0x002
+#define TS_SS_TRANSITORY    0x004
+
+#define TF_DECLARE_INTERFACE(name) \
+    typedef struct name##Vtbl name##Vtbl; \
+    typedef struct name { const name##Vtbl *lpVtbl; } name
+
+#define TF_IUNKNOWN_METHODS(name) \
+    HRESULT (STDMETHODCALLTYPE *QueryInterface)(name *This, REFIID riid, void **ppvObj); \
+    ULONG   (STDMETHODCALLTYPE *AddRef)(name *This); \
+    ULONG   (STDMETHODCALLTYPE *Release)(name *This)
+
+TF_DECLARE_INTERFACE(IUnknown);
+TF_DECLARE_INTERFACE(IClassFactory);
+TF_DECLARE_INTERFACE(ITfThreadMgr);
+TF_DECLARE_INTERFACE(ITfDocumentMgr);
+TF_DECLARE_INTERFACE(ITfContext);
+TF_DECLARE_INTERFACE(ITfEditSession);
+TF_DECLARE_INTERFACE(ITfInsertAtSelection);
+TF_DECLARE_INTERFACE(ITfContextComposition);
+TF_DECLARE_INTERFACE(ITfComposition);
+TF_DECLARE_INTERFACE(ITfCompositionSink);
+TF_DECLARE_INTERFACE(ITfKeystrokeMgr);
+TF_DECLARE_INTERFACE(ITfKeyEventSink);
+TF_DECLARE_INTERFACE(ITfThreadMgrEventSink);
+TF_DECLARE_INTERFACE(ITfTextInputProcessorEx);
+
+struct ITfRange { const struct ITfRangeVtbl *lpVtbl; };
+typedef struct ITfRangeVtbl ITfRangeVtbl;
+
+struct IUnknownVtbl {
+    TF_IUNKNOWN_METHODS(IUnknown);
+};
+
+struct ITfThreadMgrVtbl {
+    TF_IUNKNOWN_METHODS(ITfThreadMgr);
+    HRESULT (STDMETHODCALLTYPE *GetFocus)(ITfThreadMgr *This, ITfDocumentMgr **ppdimFocus);
+};
+
+struct ITfDocumentMgrVtbl {
+    TF_IUNKNOWN_METHODS(ITfDocumentMgr);
+    HRESULT (STDMETHODCALLTYPE *GetTop)(ITfDocumentMgr *This, ITfContext **ppic);
+};
+
+struct ITfContextVtbl {
+    TF_IUNKNOWN_METHODS(ITfContext);
+    HRESULT (STDMETHODCALLTYPE *RequestEditSession)(ITfContext *This, TfClientId tid,
+        ITfEditSession *pes, DWORD dwFlags, HRESULT *phrSession);
+    HRESULT (STDMETHODCALLTYPE *SetSelection)(ITfContext *This, TfEditCookie ec,
+        ULONG ulCount, const TF_SELECTION *pSelection);
+    HRESULT (STDMETHODCALLTYPE *GetStatus)(ITfContext *This, TF_STATUS *pdcs);
+};
+
+struct ITfEditSessionVtbl {
+    TF_IUNKNOWN_METHODS(ITfEditSession);
+    HRESULT (STDMETHODCALLTYPE *DoEditSession)(ITfEditSession *This, TfEditCookie ec);
+};
+
+struct ITfInsertAtSelectionVtbl {
+    TF_IUNKNOWN_METHODS(ITfInsertAtSelection);
+    HRESULT (STDMETHODCALLTYPE *InsertTextAtSelection)(ITfInsertAtSelection *This,
+        TfEditCookie ec, DWORD dwFlags, const WCHAR *pchText, LONG cch,
+        ITfRange **ppRange);
+};
+
+struct ITfContextCompositionVtbl {
+    TF_IUNKNOWN_METHODS(ITfContextComposition);
+    HRESULT (STDMETHODCALLTYPE *StartComposition)(ITfContextComposition *This,
+        TfEditCookie ecWrite, ITfRange *pCompositionRange,
+        ITfCompositionSink *pSink, ITfComposition **ppComposition);
+};
+
+struct ITfCompositionVtbl {
+    TF_IUNKNOWN_METHODS(ITfComposition);
+    HRESULT (STDMETHODCALLTYPE *GetRange)(ITfComposition *This, ITfRange **ppRange);
+    HRESULT (STDMETHODCALLTYPE *EndComposition)(ITfComposition *This, TfEditCookie ecWrite);
+};
+
+struct ITfCompositionSinkVtbl {
+    TF_IUNKNOWN_METHODS(ITfCompositionSink);
+    HRESULT (STDMETHODCALLTYPE *OnCompositionTerminated)(ITfCompositionSink *This,
+        TfEditCookie ecWrite, ITfComposition *pComposition);
+};
+
+struct ITfRangeVtbl {
+    TF_IUNKNOWN_METHODS(ITfRange);
+    HRESULT (STDMETHODCALLTYPE *SetText)(ITfRange *This, TfEditCookie ec,
+        DWORD dwFlags, const WCHAR *pchText, LONG cch);
+    HRESULT (STDMETHODCALLTYPE *Collapse)(ITfRange *This, TfEditCookie ec, TfAnchor aPos);
+    HRESULT (STDMETHODCALLTYPE *GetContext)(ITfRange *This, ITfContext **ppContext);
+};
+
+struct ITfKeystrokeMgrVtbl {
+    TF_IUNKNOWN_METHODS(ITfKeystrokeMgr);
+    HRESULT (STDMETHODCALLTYPE *PreserveKey)(ITfKeystrokeMgr *This, TfClientId tid,
+        REFGUID rguid, const TF_PRESERVEDKEY *prekey, const WCHAR *pchDesc,
+        ULONG cchDesc);
+    HRESULT (STDMETHODCALLTYPE *UnpreserveKey)(ITfKeystrokeMgr *This, REFGUID rguid,
+        const TF_PRESERVEDKEY *pprekey);
+};
+
+struct ITfKeyEventSinkVtbl {
+    TF_IUNKNOWN_METHODS(ITfKeyEventSink);
+    HRESULT (STDMETHODCALLTYPE *OnSetFocus)(ITfKeyEventSink *This, BOOL fForeground);
+    HRESULT (STDMETHODCALLTYPE *OnTestKeyDown)(ITfKeyEventSink *This, ITfContext *pic,
+        WPARAM wParam, LPARAM lParam, BOOL *pfEaten);
+    HRESULT (STDMETHODCALLTYPE *OnTestKeyUp)(ITfKeyEventSink *This, ITfContext *pic,
+        WPARAM wParam, LPARAM lParam, BOOL *pfEaten);
+    HRESULT (STDMETHODCALLTYPE *OnKeyDown)(ITfKeyEventSink *This, ITfContext *pic,
+        WPARAM wParam, LPARAM lParam, BOOL *pfEaten);
+    HRESULT (STDMETHODCALLTYPE *OnKeyUp)(ITfKeyEventSink *This, ITfContext *pic,
+        WPARAM wParam, LPARAM lParam, BOOL *pfEaten);
+    HRESULT (STDMETHODCALLTYPE *OnPreservedKey)(ITfKeyEventSink *This, ITfContext *pic,
+        REFGUID rguid, BOOL *pfEaten);
+};
+
+struct ITfThreadMgrEventSinkVtbl {
+    TF_IUNKNOWN_METHODS(ITfThreadMgrEventSink);
+};
+
+struct ITfTextInputProcessorExVtbl {
+    TF_IUNKNOWN_METHODS(ITfTextInputProcessorEx);
+};
+
+extern const IID IID_IUnknown;
+extern const IID IID_ITfInsertAtSelection;
+extern const IID IID_ITfContextComposition;
+extern const IID IID_ITfKeystrokeMgr;
+extern const IID IID_ITfEditSession;
+
+#endif /* KOLEMAK_HOST_MSCTF_H */
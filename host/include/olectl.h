@@ -0,0 +1,3 @@
+/*
+ * olectl.h - Win32 stand-in for the host build (nothing needed)
+ */
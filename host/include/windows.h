@@ -0,0 +1,293 @@
+/*
+ * windows.h - Win32 stand-in for the host (non-Windows) build
+ *
+ * Declares only the subset of the Win32 API that the portable and
+ * key-path sources use.  Implementations live in host/win32_shim.c.
+ * Requires -fshort-wchar so that WCHAR and L"" literals are UTF-16.
+ */
+
+#ifndef KOLEMAK_HOST_WINDOWS_H
+#define KOLEMAK_HOST_WINDOWS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+_Static_assert(sizeof(wchar_t) == 2, "host build requires -fshort-wchar");
+
+/* ===== Calling conventions ===== */
+
+#define WINAPI
+#define CALLBACK
+#define STDMETHODCALLTYPE
+#define STDAPI HRESULT
+
+/* ===== Basic types ===== */
+
+typedef int             BOOL;
+typedef uint8_t         BYTE;
+typedef uint16_t        WORD;
+typedef int16_t         SHORT;
+typedef uint32_t        DWORD;
+typedef int32_t         LONG;
+typedef uint32_t        ULONG;
+typedef unsigned int    UINT;
+typedef wchar_t         WCHAR;
+typedef int32_t         HRESULT;
+typedef uintptr_t       ULONG_PTR;
+typedef uintptr_t       UINT_PTR;
+typedef intptr_t        LONG_PTR;
+typedef uintptr_t       WPARAM;
+typedef intptr_t        LPARAM;
+typedef intptr_t        LRESULT;
+typedef const WCHAR    *LPCWSTR;
+typedef void           *HANDLE;
+
+typedef struct HWND__      *HWND;
+typedef struct HHOOK__     *HHOOK;
+typedef struct HKEY__      *HKEY;
+typedef struct HINSTANCE__ *HINSTANCE;
+typedef HINSTANCE           HMODULE;
+typedef struct HICON__     *HICON;
+
+typedef struct {
+    DWORD nLength;
+    void *lpSecurityDescriptor;
+    BOOL  bInheritHandle;
+} SECURITY_ATTRIBUTES;
+
+#define TRUE  1
+#define FALSE 0
+
+#define MAX_PATH 260
+
+#define ZeroMemory(p, n)   memset((p), 0, (n))
+
+#define MAKELANGID(p, s)   ((WORD)(((WORD)(s) << 10) | (WORD)(p)))
+#define LOWORD(l)          ((WORD)((ULONG_PTR)(l) & 0xFFFF))
+#define LANG_KOREAN        0x12
+#define SUBLANG_KOREAN     0x01
+
+/* ===== HRESULT ===== */
+
+#define SUCCEEDED(hr)   (((HRESULT)(hr)) >= 0)
+#define FAILED(hr)      (((HRESULT)(hr)) < 0)
+
+#define S_OK                    ((HRESULT)0x00000000)
+#define S_FALSE                 ((HRESULT)0x00000001)
+#define E_NOTIMPL               ((HRESULT)0x80004001)
+#define E_NOINTERFACE           ((HRESULT)0x80004002)
+#define E_FAIL                  ((HRESULT)0x80004005)
+#define E_OUTOFMEMORY           ((HRESULT)0x8007000E)
+#define E_INVALIDARG            ((HRESULT)0x80070057)
+#define CLASS_E_NOAGGREGATION   ((HRESULT)0x80040110)
+
+#define ERROR_SUCCESS           0L
+#define ERROR_FILE_NOT_FOUND    2L
+#define ERROR_ALREADY_EXISTS    183L
+
+/* ===== GUIDs ===== */
+
+typedef struct {
+    DWORD Data1;
+    WORD  Data2;
+    WORD  Data3;
+    BYTE  Data4[8];
+} GUID;
+
+typedef GUID IID;
+typedef GUID CLSID;
+typedef const GUID *REFGUID;
+typedef const GUID *REFIID;
+typedef const GUID *REFCLSID;
+
+#define IsEqualGUID(a, b)   (memcmp((a), (b), sizeof(GUID)) == 0)
+#define IsEqualIID(a, b)    IsEqualGUID(a, b)
+#define IsEqualCLSID(a, b)  IsEqualGUID(a, b)
+
+#ifdef INITGUID
+#define DEFINE_GUID(n, l, w1, w2, b1, b2, b3, b4, b5, b6, b7, b8) \
+    const GUID n = { l, w1, w2, { b1, b2, b3, b4, b5, b6, b7, b8 } }
+#else
+#define DEFINE_GUID(n, l, w1, w2, b1, b2, b3, b4, b5, b6, b7, b8) \
+    extern const GUID n
+#endif
+
+/* ===== Virtual keys ===== */
+
+#define VK_BACK       0x08
+#define VK_TAB        0x09
+#define VK_RETURN     0x0D
+#define VK_SHIFT      0x10
+#define VK_CONTROL    0x11
+#define VK_MENU       0x12
+#define VK_CAPITAL    0x14
+#define VK_HANGUL     0x15
+#define VK_ESCAPE     0x1B
+#define VK_SPACE      0x20
+#define VK_END        0x23
+#define VK_HOME       0x24
+#define VK_LEFT       0x25
+#define VK_UP         0x26
+#define VK_RIGHT      0x27
+#define VK_DOWN       0x28
+#define VK_DELETE     0x2E
+#define VK_LWIN       0x5B
+#define VK_RWIN       0x5C
+#define VK_F1         0x70
+#define VK_F13        0x7C
+#define VK_F24        0x87
+#define VK_LSHIFT     0xA0
+#define VK_RSHIFT     0xA1
+#define VK_LCONTROL   0xA2
+#define VK_RCONTROL   0xA3
+#define VK_LMENU      0xA4
+#define VK_RMENU      0xA5
+#define VK_OEM_1      0xBA
+#define VK_OEM_PLUS   0xBB
+#define VK_OEM_COMMA  0xBC
+#define VK_OEM_MINUS  0xBD
+#define VK_OEM_PERIOD 0xBE
+#define VK_OEM_2      0xBF
+#define VK_OEM_3      0xC0
+#define VK_OEM_4      0xDB
+#define VK_OEM_5      0xDC
+#define VK_OEM_6      0xDD
+#define VK_OEM_7      0xDE
+#define VK_PACKET     0xE7
+
+/* ===== Messages and hooks ===== */
+
+#define WM_NULL        0x0000
+#define WM_PAINT       0x000F
+#define WM_INPUT       0x00FF
+#define WM_KEYDOWN     0x0100
+#define WM_KEYUP       0x0101
+#define WM_CHAR        0x0102
+#define WM_SYSKEYDOWN  0x0104
+#define WM_SYSKEYUP    0x0105
+#define WM_TIMER       0x0113
+#define WM_MOUSEMOVE   0x0200
+#define WM_APP         0x8000
+
+#define HC_ACTION      0
+#define PM_REMOVE      0x0001
+
+typedef struct {
+    LONG x;
+    LONG y;
+} POINT;
+
+typedef struct {
+    HWND   hwnd;
+    UINT   message;
+    WPARAM wParam;
+    LPARAM lParam;
+    DWORD  time;
+    POINT  pt;
+} MSG;
+
+typedef struct {
+    DWORD     vkCode;
+    DWORD     scanCode;
+    DWORD     flags;
+    DWORD     time;
+    ULONG_PTR dwExtraInfo;
+} KBDLLHOOKSTRUCT;
+
+#define LLKHF_EXTENDED  0x01
+
+/* ===== Keyboard input ===== */
+
+#define INPUT_KEYBOARD        1
+#define KEYEVENTF_EXTENDEDKEY 0x0001
+#define KEYEVENTF_KEYUP       0x0002
+#define KEYEVENTF_UNICODE     0x0004
+#define MAPVK_VK_TO_VSC       0
+
+typedef struct {
+    WORD      wVk;
+    WORD      wScan;
+    DWORD     dwFlags;
+    DWORD     time;
+    ULONG_PTR dwExtraInfo;
+} KEYBDINPUT;
+
+typedef struct {
+    DWORD type;
+    union {
+        KEYBDINPUT ki;
+    };
+} INPUT;
+
+SHORT WINAPI GetKeyState(int vk);
+SHORT WINAPI GetAsyncKeyState(int vk);
+BOOL  WINAPI GetKeyboardState(BYTE *lpKeyState);
+BOOL  WINAPI SetKeyboardState(BYTE *lpKeyState);
+UINT  WINAPI SendInput(UINT cInputs, INPUT *pInputs, int cbSize);
+UINT  WINAPI MapVirtualKeyW(UINT uCode, UINT uMapType);
+#define MapVirtualKey MapVirtualKeyW
+
+LRESULT WINAPI CallNextHookEx(HHOOK hhk, int nCode, WPARAM wParam, LPARAM lParam);
+HWND    WINAPI GetForegroundWindow(void);
+DWORD   WINAPI GetWindowThreadProcessId(HWND hWnd, DWORD *lpdwProcessId);
+DWORD   WINAPI GetCurrentProcessId(void);
+DWORD   WINAPI GetModuleFileNameW(HMODULE hModule, WCHAR *lpFilename, DWORD nSize);
+BOOL    WINAPI PostMessageW(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam);
+BOOL    WINAPI IsWindow(HWND hWnd);
+
+DWORD   WINAPI GetCurrentThreadId(void);
+UINT    WINAPI RegisterWindowMessageW(const WCHAR *lpString);
+BOOL    WINAPI PostThreadMessageW(DWORD idThread, UINT Msg, WPARAM wParam, LPARAM lParam);
+
+/* ===== Memory, TLS, interlocked ===== */
+
+#define HEAP_ZERO_MEMORY    0x00000008
+#define TLS_OUT_OF_INDEXES  ((DWORD)0xFFFFFFFF)
+
+HANDLE WINAPI GetProcessHeap(void);
+void  *WINAPI HeapAlloc(HANDLE hHeap, DWORD dwFlags, size_t dwBytes);
+BOOL   WINAPI HeapFree(HANDLE hHeap, DWORD dwFlags, void *lpMem);
+
+DWORD  WINAPI TlsAlloc(void);
+void  *WINAPI TlsGetValue(DWORD dwTlsIndex);
+BOOL   WINAPI TlsSetValue(DWORD dwTlsIndex, void *lpTlsValue);
+
+#define InterlockedIncrement(p) __atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement(p) __atomic_sub_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedExchangeAdd(p, v) __atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedExchange(p, v) __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedCompareExchange(p, x, c) \
+    __sync_val_compare_and_swap((p), (c), (x))
+#define InterlockedCompareExchangePointer(p, x, c) \
+    __sync_val_compare_and_swap((p), (c), (x))
+#define MemoryBarrier() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#if defined(__x86_64__) || defined(__i386__)
+#define YieldProcessor() __builtin_ia32_pause()
+#else
+#define YieldProcessor() ((void)0)
+#endif
+
+/* ===== Registry ===== */
+
+#define HKEY_CURRENT_USER   ((HKEY)(ULONG_PTR)0x80000001)
+#define HKEY_LOCAL_MACHINE  ((HKEY)(ULONG_PTR)0x80000002)
+
+#define KEY_READ            0x20019
+#define KEY_WRITE           0x20006
+#define REG_BINARY          3
+#define REG_DWORD           4
+
+LONG WINAPI RegOpenKeyExW(HKEY hKey, LPCWSTR lpSubKey, DWORD ulOptions,
+                          DWORD samDesired, HKEY *phkResult);
+LONG WINAPI RegCreateKeyExW(HKEY hKey, LPCWSTR lpSubKey, DWORD Reserved,
+                            WCHAR *lpClass, DWORD dwOptions, DWORD samDesired,
+                            void *lpSecurityAttributes, HKEY *phkResult,
+                            DWORD *lpdwDisposition);
+LONG WINAPI RegQueryValueExW(HKEY hKey, LPCWSTR lpValueName, DWORD *lpReserved,
+                             DWORD *lpType, BYTE *lpData, DWORD *lpcbData);
+LONG WINAPI RegSetValueExW(HKEY hKey, LPCWSTR lpValueName, DWORD Reserved,
+                           DWORD dwType, const BYTE *lpData, DWORD cbData);
+LONG WINAPI RegCloseKey(HKEY hKey);
+
+#endif /* KOLEMAK_HOST_WINDOWS_H */
@@ -0,0 +1,385 @@
+/*
+ * key_pipeline.c - Drive the real key path the way Windows would
+ */
+
+#include "key_pipeline.h"
+#include "appmodes.h"
+#include "host_util.h"
+#include "llhook.h"
+#include "regwriter.h"
+#include "settings.h"
+#include "sharedprefs.h"
+#include "tsf_mock.h"
+#include "win32_shim.h"
+
+/* Exported by key_handler.c */
+extern const ITfKeyEventSinkVtbl g_keyEventSinkVtbl;
+
+static TextService g_ts;
+static PipelineOptions g_opts;
+static BOOL g_focused = TRUE;
+static UINT g_asyncLag = 0;
+static ULONG g_events = 0;
+static ULONG g_eaten = 0;
+static ULONG g_passed = 0;
+static BOOL g_uiScheduled = FALSE;
+
+/* ===== Minimal TIP IUnknown (key sink delegates here) ===== */
+
+static HRESULT STDMETHODCALLTYPE Tip_QueryInterface(
+    ITfTextInputProcessorEx *pThis, REFIID riid, void **ppvObj)
+{
+    (void)riid;
+    *ppvObj = pThis;
+    return S_OK;
+}
+
+static ULONG STDMETHODCALLTYPE Tip_AddRef(ITfTextInputProcessorEx *pThis)
+{
+    return InterlockedIncrement(&TS_FROM_TIP(pThis)->refCount);
+}
+
+static ULONG STDMETHODCALLTYPE Tip_Release(ITfTextInputProcessorEx *pThis)
+{
+    return InterlockedDecrement(&TS_FROM_TIP(pThis)->refCount);
+}
+
+static const ITfTextInputProcessorExVtbl g_hostTipVtbl = {
+    Tip_QueryInterface,
+    Tip_AddRef,
+    Tip_Release,
+};
+
+/* ===== Application default behaviour ===== */
+
+static void AppKeyDown(UINT vk, WCHAR unicode)
+{
+    BOOL shift = (GetKeyState(VK_SHIFT) & 0x8000) != 0;
+    BOOL caps  = (GetKeyState(VK_CAPITAL) & 0x0001) != 0;
+    WCHAR ch;
+
+    if ((GetKeyState(VK_CONTROL) & 0x8000) || (GetKeyState(VK_MENU) & 0x8000) ||
+        (GetKeyState(VK_LWIN) & 0x8000) || (GetKeyState(VK_RWIN) & 0x8000))
+        return;    /* shortcut: no text */
+
+    switch (vk) {
+    case VK_PACKET: MockTsf_AppInsert(unicode); return;
+    case VK_BACK:   MockTsf_AppBackspace(); return;
+    case VK_LEFT:   MockTsf_AppMoveCaret(-1); return;
+    case VK_RIGHT:  MockTsf_AppMoveCaret(1); return;
+    default: break;
+    }
+
+    ch = Host_UsChar(vk, shift, caps);
+    if (ch)
+        MockTsf_AppInsert(ch);
+}
+
+/* ===== Delivery ===== */
+
+static void Deliver(UINT vk, BOOL down, ULONG_PTR extraInfo, WCHAR unicode)
+{
+    ITfKeyEventSink *sink = (ITfKeyEventSink *)&g_ts.keyEventSink;
+    ITfContext *ctx = MockTsf_Context();
+    UINT scan = (vk == VK_PACKET) ? unicode : MapVirtualKey(vk, MAPVK_VK_TO_VSC);
+    BOOL wasDown = (GetKeyState((int)vk) & 0x8000) != 0;
+    LPARAM lParam = 1 | ((LPARAM)scan << 16) | (wasDown ? ((LPARAM)1 << 30) : 0);
+    BOOL eaten = FALSE;
+
+    /* 1. WH_KEYBOARD_LL (reports left/right modifier VKs) */
+    {
+        KBDLLHOOKSTRUCT kb;
+        memset(&kb, 0, sizeof(kb));
+        kb.vkCode = vk == VK_SHIFT ? VK_LSHIFT :
+                    vk == VK_CONTROL ? VK_LCONTROL :
+                    vk == VK_MENU ? VK_LMENU : vk;
+        kb.scanCode = scan;
+        kb.dwExtraInfo = extraInfo;
+        if (KolemakLowLevelKeyboardProc(HC_ACTION,
+                down ? WM_KEYDOWN : WM_KEYUP, (LPARAM)&kb))
+            return;
+    }
+
+    if (vk == 0xFF)
+        return;    /* no-op key injected to suppress the Start menu */
+    if (vk != VK_PACKET)
+        Shim_SetKeyState(vk, down);
+
+    /* Another window has focus: this thread sees nothing further */
+    if (!g_focused)
+        return;
+
+    if (!down)
+        lParam |= (LPARAM)3 << 30;
+
+    /* 2. WH_GETMESSAGE */
+    {
+        MSG msg;
+        BOOL sys = (GetKeyState(VK_MENU) & 0x8000) != 0;
+        memset(&msg, 0, sizeof(msg));
+        msg.message = down ? (sys ? WM_SYSKEYDOWN : WM_KEYDOWN)
+                           : (sys ? WM_SYSKEYUP : WM_KEYUP);
+        msg.wParam = vk;
+        msg.lParam = lParam;
+        KolemakGetMsgProc(HC_ACTION, PM_REMOVE, (LPARAM)&msg);
+        if (msg.message == WM_NULL)
+            return;
+        vk = (UINT)msg.wParam;
+        lParam = msg.lParam;
+    }
+
+    if (!down) {
+        sink->lpVtbl->OnTestKeyUp(sink, ctx, vk, lParam, &eaten);
+        if (eaten)
+            sink->lpVtbl->OnKeyUp(sink, ctx, vk, lParam, &eaten);
+        return;
+    }
+
+    /* 3. Preserved keys */
+    if (vk == VK_HANGUL) {
+        sink->lpVtbl->OnPreservedKey(sink, ctx,
+            &GUID_KolemakPreservedKey_Toggle, &eaten);
+        if (eaten) return;
+    }
+
+    /* 4. Key event sink */
+    sink->lpVtbl->OnTestKeyDown(sink, ctx, vk, lParam, &eaten);
+    if (eaten)
+        sink->lpVtbl->OnKeyDown(sink, ctx, vk, lParam, &eaten);
+
+    if (eaten) {
+        g_eaten++;
+    } else {
+        g_passed++;
+        AppKeyDown(vk, unicode);
+    }
+}
+
+static void Drain(BOOL runAsync)
+{
+    INPUT in;
+    MSG msg;
+
+    for (;;) {
+        if (runAsync)
+            MockTsf_RunAsync();
+
+        /* Posted messages come before input, as in GetMessage */
+        if (Shim_PopThreadMessage(&msg)) {
+            KolemakGetMsgProc(HC_ACTION, PM_REMOVE, (LPARAM)&msg);
+            continue;
+        }
+        if (!Shim_PopInput(&in))
+            break;
+        if (in.ki.dwFlags & KEYEVENTF_UNICODE)
+            Deliver(VK_PACKET, !(in.ki.dwFlags & KEYEVENTF_KEYUP),
+                    in.ki.dwExtraInfo, (WCHAR)in.ki.wScan);
+        else
+            Deliver(in.ki.wVk, !(in.ki.dwFlags & KEYEVENTF_KEYUP),
+                    in.ki.dwExtraInfo, 0);
+    }
+}
+
+/* ===== Deferred subsystems (as in text_service.c) ===== */
+
+enum {
+    PIPE_STAGE_SETTINGS,
+    PIPE_STAGE_HOOKS,
+    PIPE_STAGE_COUNT
+};
+
+static BOOL Stage_InitSettings(void *ctx)
+{
+    TextService *ts = (TextService *)ctx;
+
+    Settings_StartWriter(g_opts.regQuietMs);
+    if (!Settings_Load(ts))
+        Settings_Save(ts);
+
+    ts->koreanMode = g_opts.koreanMode;
+    ts->colemakMode = g_opts.colemakMode;
+    Settings_PublishColemakMode(ts->colemakMode);
+    return TRUE;
+}
+
+static void Stage_UninitSettings(void *ctx)
+{
+    (void)ctx;
+    Settings_StopWriter();
+}
+
+static BOOL Stage_InitHooks(void *ctx)
+{
+    TextService *ts = (TextService *)ctx;
+
+    KeyHandler_ResetLLHook();
+    LLHook_Attach(ts);
+    TlsSetValue(g_tlsIndex, ts);
+    return TRUE;
+}
+
+static void Stage_UninitHooks(void *ctx)
+{
+    LLHook_Detach((TextService *)ctx);
+    TlsSetValue(g_tlsIndex, NULL);
+}
+
+static const InitStage g_stages[PIPE_STAGE_COUNT] = {
+    { "settings", Stage_InitSettings, Stage_UninitSettings },
+    { "hooks",    Stage_InitHooks,    Stage_UninitHooks    },
+};
+
+void TextService_Ready(TextService *ts)
+{
+    if (initstage_pending(&ts->stages, INITSTAGE_ALL(&ts->stages)))
+        initstage_run(&ts->stages, INITSTAGE_ALL(&ts->stages), ts);
+}
+
+/* The UI timer of text_service.c fires once the thread is out of
+ * input: here when the script is done or focus moves away */
+void TextService_ScheduleUi(TextService *ts)
+{
+    (void)ts;
+    g_uiScheduled = TRUE;
+}
+
+static void RunUiTimer(void)
+{
+    if (g_uiScheduled) {
+        g_uiScheduled = FALSE;
+        KeyHandler_ApplyUi(&g_ts);
+    }
+}
+
+/* ===== Public API ===== */
+
+TextService *Pipeline_Init(const PipelineOptions *opts)
+{
+    TextService *ts = &g_ts;
+    unsigned long long t0;
+
+    Shim_ResetKeyState();
+    Shim_ResetRegistry();
+    Shim_SetModuleName(PIPELINE_DEFAULT_APP);
+    sharedprefs_reset();
+    appmodes_reset();
+    MockTsf_Init();
+    MockTsf_SetRefuseSync(opts->asyncOnly);
+
+    if (g_tlsIndex == TLS_OUT_OF_INDEXES)
+        g_tlsIndex = TlsAlloc();
+
+    /* Same defaults as TS_ActivateEx */
+    t0 = initstage_now_ns();
+    memset(ts, 0, sizeof(*ts));
+    ts->lpVtbl = &g_hostTipVtbl;
+    ts->keyEventSink.lpVtbl = &g_keyEventSinkVtbl;
+    ts->refCount = 1;
+    ts->threadMgr = MockTsf_ThreadMgr();
+    ts->clientId = 1;
+    hangul_ic_init(&ts->hangulCtx);
+    ts->koreanMode = FALSE;
+    ts->colemakMode = TRUE;
+    ts->capsLockAsBackspace = TRUE;
+    ts->capsLockOn = FALSE;
+    ts->semicolonSwap = TRUE;
+    ts->winKeyRemap = TRUE;
+    ts->hotkeyVk = VK_SPACE;
+    ts->hotkeyModifiers = KOLEMAK_MOD_WIN;
+    ts->threadMgrSinkCookie = TF_INVALID_COOKIE;
+    initstage_setup(&ts->stages, g_stages, PIPE_STAGE_COUNT);
+    KeyHandler_SyncModifiers(ts);
+    g_opts = *opts;
+    ts->stages.activateNs = initstage_now_ns() - t0;
+
+    /* The mock document has focus from the start */
+    TextService_Ready(ts);
+
+    g_focused = TRUE;
+    g_uiScheduled = FALSE;
+    g_asyncLag = opts->asyncLag;
+    g_events = g_eaten = g_passed = 0;
+    return ts;
+}
+
+void Pipeline_Shutdown(void)
+{
+    ContextCache_Invalidate(&g_ts);
+    if (g_ts.composition) {
+        g_ts.composition->lpVtbl->Release(g_ts.composition);
+        g_ts.composition = NULL;
+    }
+    initstage_undo(&g_ts.stages, &g_ts);
+}
+
+void Pipeline_Key(UINT vk, BOOL down)
+{
+    Deliver(vk, down, 0, 0);
+    g_events++;
+    Drain(g_asyncLag <= 1 || g_events % g_asyncLag == 0);
+}
+
+void Pipeline_Settle(void)
+{
+    Drain(TRUE);
+    RunUiTimer();
+}
+
+void Pipeline_Tap(UINT vk, UINT mods)
+{
+    if (mods & PIPE_MOD_WIN)   Pipeline_Key(VK_LWIN, TRUE);
+    if (mods & PIPE_MOD_CTRL)  Pipeline_Key(VK_CONTROL, TRUE);
+    if (mods & PIPE_MOD_ALT)   Pipeline_Key(VK_MENU, TRUE);
+    if (mods & PIPE_MOD_SHIFT) Pipeline_Key(VK_SHIFT, TRUE);
+
+    Pipeline_Key(vk, TRUE);
+    Pipeline_Key(vk, FALSE);
+
+    if (mods & PIPE_MOD_SHIFT) Pipeline_Key(VK_SHIFT, FALSE);
+    if (mods & PIPE_MOD_ALT)   Pipeline_Key(VK_MENU, FALSE);
+    if (mods & PIPE_MOD_CTRL)  Pipeline_Key(VK_CONTROL, FALSE);
+    if (mods & PIPE_MOD_WIN)   Pipeline_Key(VK_LWIN, FALSE);
+}
+
+void Pipeline_SetFocus(BOOL focused)
+{
+    ITfKeyEventSink *sink = (ITfKeyEventSink *)&g_ts.keyEventSink;
+
+    RunUiTimer();
+    g_focused = focused;
+    sink->lpVtbl->OnSetFocus(sink, focused);
+
+    /* As TMES_OnSetFocus does for a document getting focus */
+    if (focused && (g_ts.stages.done & (1u << PIPE_STAGE_SETTINGS)))
+        Settings_RestoreAppModes(&g_ts);
+
+    /* The foreground came back: the broker's WinEvent hook resyncs the
+     * LL hook's modifiers */
+    if (focused)
+        KeyHandler_SyncLLHookModifiers();
+
+    /* The writer gets to run while another window has focus */
+    if (!focused)
+        regwriter_flush(TRUE);
+}
+
+void Pipeline_SwitchApp(const char *image)
+{
+    Pipeline_SetFocus(FALSE);
+    Shim_SetModuleName(image);
+
+    /* A thread of another process, which starts in English */
+    g_ts.appKey = 0;
+    g_ts.koreanMode = FALSE;
+    Pipeline_SetFocus(TRUE);
+}
+
+ULONG Pipeline_EatenCount(void)
+{
+    return g_eaten;
+}
+
+ULONG Pipeline_PassedCount(void)
+{
+    return g_passed;
+}
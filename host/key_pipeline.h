@@ -0,0 +1,61 @@
+/*
+ * key_pipeline.h - Drive the real key path the way Windows would
+ *
+ * Each key event goes WH_KEYBOARD_LL -> key state -> WH_GETMESSAGE ->
+ * preserved keys -> OnTestKeyDown -> OnKeyDown, and is applied to the
+ * mock document when the IME does not eat it.  Events the IME sends
+ * with SendInput are fed back through the same path.
+ */
+
+#ifndef KEY_PIPELINE_H
+#define KEY_PIPELINE_H
+
+#include "kolemak.h"
+
+typedef struct {
+    BOOL koreanMode;
+    BOOL colemakMode;
+    BOOL asyncOnly;        /* refuse TF_ES_SYNC, as Win10 apps often do */
+    UINT asyncLag;         /* run async sessions only every N key events,
+                              as a busy app would (0 = after every event) */
+    DWORD regQuietMs;      /* registry writer quiet period (0 = store only
+                              on focus loss and shutdown) */
+} PipelineOptions;
+
+/* Pipeline modifier flags for Pipeline_Tap */
+#define PIPE_MOD_SHIFT  0x01
+#define PIPE_MOD_CTRL   0x02
+#define PIPE_MOD_ALT    0x04
+#define PIPE_MOD_WIN    0x08
+
+TextService *Pipeline_Init(const PipelineOptions *opts);
+void         Pipeline_Shutdown(void);
+
+/* One physical key transition, followed by async sessions and
+ * re-injected input until the queues are empty */
+void Pipeline_Key(UINT vk, BOOL down);
+
+/* Press and release vk with the given modifiers held */
+void Pipeline_Tap(UINT vk, UINT mods);
+
+/* Run everything still queued (async sessions, re-injected input) */
+void Pipeline_Settle(void);
+
+/* Focus moves to another window (FALSE) or back (TRUE).  While away,
+ * key events reach only the LL hook and the OS key state, so key-ups
+ * in that time are never seen by the thread's key path.  Losing focus
+ * waits for the registry writes it starts. */
+void Pipeline_SetFocus(BOOL focused);
+
+/* Focus moves to a thread of the application with this image path,
+ * which has the modes it starts with or those remembered for it
+ * (appmodes.h).  Pipeline_Init starts in PIPELINE_DEFAULT_APP. */
+#define PIPELINE_DEFAULT_APP "C:\\Program Files\\Host\\host.exe"
+
+void Pipeline_SwitchApp(const char *image);
+
+/* Events delivered to OnKeyDown / passed to the app so far */
+ULONG Pipeline_EatenCount(void);
+ULONG Pipeline_PassedCount(void);
+
+#endif /* KEY_PIPELINE_H */
@@ -0,0 +1,809 @@
+/*
+ * kolemak_bench.c - Microbenchmarks for the portable core
+ *
+ * Usage: kolemak-bench [--quick] [--filter TEXT] [--json FILE]
+ *                      [--baseline FILE] [--threshold PCT]
+ *
+ * Times hangul_ic_process / backspace / flush, the keymap lookups and
+ * the key dispatch table and the LL hook's decision (lldecide_key) over
+ * fixed, seeded inputs: a realistic Korean
+ * stream drawn from syllable frequencies, and adversarial streams
+ * (compound final consonants split by compound vowels, consonant-only
+ * runs).  The sharedprefs benchmarks read the settings snapshot from a
+ * private POSIX shm section, the last one while a second thread keeps
+ * publishing.  The tooltip labels (tiplabel.h) are drawn by a software
+ * stand-in for GDI and composed, and the per-application mode table
+ * (appmodes.h) is timed on focus lookups.  Correctness is checked by
+ * the tests (host/tests), not here.
+ *
+ * Each benchmark is calibrated to ~10 ms per sample and sampled
+ * repeatedly; the median ns/op and cycles/op are reported together
+ * with the median absolute deviation (MAD) as the noise estimate.
+ *
+ * --json writes the results; --baseline compares against a previous
+ * --json file and exits with 1 if any benchmark is slower by more than
+ * the threshold (default 5%) AND by more than 3x the combined noise.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "appmodes.h"
+#include "hangul.h"
+#include "host_util.h"
+#include "keydispatch.h"
+#include "keymap.h"
+#include "lldecide.h"
+#include "sharedprefs.h"
+#include "tiplabel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLES 1
+static unsigned long long ReadCycles(void) { return __rdtsc(); }
+#else
+#define HAVE_CYCLES 0
+static unsigned long long ReadCycles(void) { return 0; }
+#endif
+
+#define STREAM_LEN      4096    /* inputs per stream (power of two) */
+#define SAMPLE_NS       10000000ull
+#define MAX_SAMPLES     64
+
+/* Results are folded into this so the calls cannot be optimized away */
+static volatile unsigned g_sink;
+
+/* ===== Inputs ===== */
+
+/* Common syllables as Dubeolsik keys (uppercase = Shift), weighted by
+ * approximate frequency in running Korean text.  Typed back to back they
+ * also exercise final-consonant migration (e.g. 일 + 이 -> 이리). */
+typedef struct { const char *keys; int weight; } WeightedSyllable;
+
+static const WeightedSyllable g_syllables[] = {
+    { "dl",   40 }, { "ek",   36 }, { "sms",  26 }, { "dml",  24 }, /* 이 다 는 의 */
+    { "dp",   22 }, { "gk",   22 }, { "rh",   18 }, { "rk",   18 }, /* 에 하 고 가 */
+    { "dmf",  17 }, { "wl",   16 }, { "fh",   15 }, { "tj",   14 }, /* 을 지 로 서 */
+    { "rl",   14 }, { "tk",   13 }, { "gks",  13 }, { "fl",   12 }, /* 기 사 한 리 */
+    { "wk",   11 }, { "eh",   11 }, { "rnr",  10 }, { "wjd",  10 }, /* 자 도 국 정 */
+    { "tl",   10 }, { "dls",  10 }, { "eo",    9 }, { "dj",    9 }, /* 시 인 대 어 */
+    { "tn",    8 }, { "du",    8 }, { "dlT",   8 }, { "emf",   8 }, /* 수 여 있 들 */
+    { "sk",    7 }, { "go",    7 }, { "dlf",   7 }, { "rp",    6 }, /* 나 해 일 게 */
+    { "dk",    6 }, { "wjr",   6 }, { "qn",    6 }, { "tkd",   6 }, /* 아 적 부 상 */
+    { "dhk",   5 }, { "goT",   4 }, { "djqt",  3 }, { "dksg",  3 }, /* 와 했 없 않 */
+    { "aksg",  2 }, { "dlfr",  1 }, { "ekfr",  1 }, { "rkqt",  1 }, /* 많 읽 닭 값 */
+    { "Rhk",   2 }, { "dnjs",  2 }, { "ehl",   2 }, { "Tm",    1 }, /* 꽈 원 되 쓰 */
+};
+
+/* Every compound final consonant, each followed by a compound vowel so
+ * the final splits and the vowel combines: 갃 + ㅘ -> 각 + 솨, ... */
+static const char g_adversarialJong[] =
+    "rkrthk" "rkswhk" "rksghk" "rkfrhk" "rkfahk" "rkfqhk"
+    "rkfthk" "rkfxhk" "rkfvhk" "rkfghk" "rkqthk";
+
+/* Consonant-only and vowel-only runs: every key commits (no cho/jung
+ * combination), plus doubled consonants typed with Shift */
+static const char g_adversarialRuns[] = "rtrtekfrqtREQTWkhlnjpmlhkbl";
+
+static unsigned g_rand = 12345;
+
+static unsigned NextRand(void)
+{
+    g_rand = g_rand * 1103515245u + 12345u;
+    return (g_rand >> 16) & 0x7FFF;
+}
+
+static int AppendKeys(JamoMapping *out, int n, const char *keys)
+{
+    for (; *keys && n < STREAM_LEN; keys++) {
+        BOOL shift = (*keys >= 'A' && *keys <= 'Z');
+        UINT vk = shift ? (UINT)*keys : (UINT)(*keys - 32);
+        out[n++] = keymap_get_jamo(vk, shift, FALSE);
+    }
+    return n;
+}
+
+/* Realistic stream: weighted syllables, a word break (flush) after ~1/3 */
+static void BuildRealistic(JamoMapping *out)
+{
+    int total = 0, n = 0;
+    size_t i;
+
+    for (i = 0; i < sizeof(g_syllables) / sizeof(g_syllables[0]); i++)
+        total += g_syllables[i].weight;
+
+    while (n < STREAM_LEN) {
+        int pick = (int)(NextRand() % (unsigned)total);
+        for (i = 0; pick >= g_syllables[i].weight; i++)
+            pick -= g_syllables[i].weight;
+        n = AppendKeys(out, n, g_syllables[i].keys);
+        if (n < STREAM_LEN && NextRand() % 3 == 0) {
+            out[n].cho = -1;
+            out[n].jung = -1;
+            n++;
+        }
+    }
+}
+
+static void BuildRepeated(JamoMapping *out, const char *keys)
+{
+    int n = 0;
+    while (n < STREAM_LEN)
+        n = AppendKeys(out, n, keys);
+}
+
+/* Contexts captured after every input of a stream, for backspace/flush */
+static void CaptureStates(const JamoMapping *in, HangulContext *states)
+{
+    HangulContext hc;
+    int i;
+
+    hangul_ic_init(&hc);
+    for (i = 0; i < STREAM_LEN; i++) {
+        if (in[i].cho < 0 && in[i].jung < 0)
+            hangul_ic_flush(&hc);
+        else
+            hangul_ic_process(&hc, in[i].cho, in[i].jung);
+        states[i] = hc;
+    }
+}
+
+static JamoMapping g_realistic[STREAM_LEN];
+static JamoMapping g_jongChain[STREAM_LEN];
+static JamoMapping g_runs[STREAM_LEN];
+static HangulContext g_realisticStates[STREAM_LEN];
+static HangulContext g_jongStates[STREAM_LEN];
+static HangulKey g_keys[STREAM_LEN];
+static BYTE g_typingVks[STREAM_LEN];
+static BYTE g_typingShift[STREAM_LEN];
+
+/* Key stream for the keymap lookups: letters at English letter
+ * frequency, with spaces, punctuation and ~5% Shift */
+static void BuildTyping(void)
+{
+    static const char freq[] =
+        "eeeeeeeeeeeetttttttttaaaaaaaaooooooooiiiiiiinnnnnnnsssssshhhhhh"
+        "rrrrrrddddllllcccuuummwwffggyyppbbvk  ,.;'/-";
+    int i;
+
+    for (i = 0; i < STREAM_LEN; i++) {
+        char c = freq[NextRand() % (sizeof(freq) - 1)];
+        BYTE vk;
+        switch (c) {
+        case ' ':  vk = VK_SPACE; break;
+        case ',':  vk = VK_OEM_COMMA; break;
+        case '.':  vk = VK_OEM_PERIOD; break;
+        case ';':  vk = VK_OEM_1; break;
+        case '\'': vk = VK_OEM_7; break;
+        case '/':  vk = VK_OEM_2; break;
+        case '-':  vk = VK_OEM_MINUS; break;
+        default:   vk = (BYTE)(c - 32); break;
+        }
+        g_typingVks[i] = vk;
+        g_typingShift[i] = (NextRand() % 20) == 0;
+        g_keys[i].vk = vk;
+        g_keys[i].shift = g_typingShift[i];
+    }
+}
+
+/* ===== Benchmarks =====
+ *
+ * Each runs iters operations and returns a value folded into g_sink. */
+
+static unsigned RunProcess(const JamoMapping *in, long iters)
+{
+    HangulContext hc;
+    unsigned acc = 0;
+    long i;
+
+    hangul_ic_init(&hc);
+    for (i = 0; i < iters; i++) {
+        const JamoMapping *j = &in[i & (STREAM_LEN - 1)];
+        HangulResult r;
+        if (j->cho < 0 && j->jung < 0)
+            r = hangul_ic_flush(&hc);
+        else
+            r = hangul_ic_process(&hc, j->cho, j->jung);
+        acc += r.commit1 + r.compose;
+    }
+    return acc;
+}
+
+static unsigned BenchProcessRealistic(long iters) { return RunProcess(g_realistic, iters); }
+static unsigned BenchProcessJongChain(long iters) { return RunProcess(g_jongChain, iters); }
+static unsigned BenchProcessRuns(long iters)      { return RunProcess(g_runs, iters); }
+
+/* One backspace from a captured state (the state copy is included) */
+static unsigned RunBackspace(const HangulContext *states, long iters)
+{
+    unsigned acc = 0;
+    long i;
+
+    for (i = 0; i < iters; i++) {
+        HangulContext hc = states[i & (STREAM_LEN - 1)];
+        acc += hangul_ic_backspace(&hc).compose;
+    }
+    return acc;
+}
+
+static unsigned BenchBackspaceRealistic(long iters) { return RunBackspace(g_realisticStates, iters); }
+static unsigned BenchBackspaceJongChain(long iters) { return RunBackspace(g_jongStates, iters); }
+
+static unsigned BenchFlush(long iters)
+{
+    unsigned acc = 0;
+    long i;
+
+    for (i = 0; i < iters; i++) {
+        HangulContext hc = g_realisticStates[i & (STREAM_LEN - 1)];
+        acc += hangul_ic_flush(&hc).commit1;
+    }
+    return acc;
+}
+
+static unsigned BenchProcessKeys(long iters)
+{
+    static WCHAR out[STREAM_LEN * HANGUL_BATCH_MAX_COMMIT];
+    HangulContext hc;
+    unsigned acc = 0;
+    long done = 0;
+
+    hangul_ic_init(&hc);
+    while (done < iters) {
+        int count = (iters - done < STREAM_LEN) ? (int)(iters - done) : STREAM_LEN;
+        int outLen = 0;
+        WCHAR preedit;
+        hangul_ic_process_keys(&hc, g_keys, count, FALSE,
+                               out, (int)(sizeof(out) / sizeof(out[0])),
+                               &outLen, &preedit);
+        acc += (unsigned)outLen + preedit;
+        done += count;
+    }
+    return acc;
+}
+
+static unsigned BenchGetJamo(long iters)
+{
+    unsigned acc = 0;
+    long i;
+
+    for (i = 0; i < iters; i++) {
+        int k = (int)(i & (STREAM_LEN - 1));
+        JamoMapping j = keymap_get_jamo(g_typingVks[k], g_typingShift[k], (i & 1));
+        acc += (unsigned)(j.cho + j.jung);
+    }
+    return acc;
+}
+
+static unsigned BenchGetColemak(long iters)
+{
+    unsigned acc = 0;
+    long i;
+
+    for (i = 0; i < iters; i++) {
+        int k = (int)(i & (STREAM_LEN - 1));
+        WCHAR ch = 0;
+        if (keymap_get_colemak(g_typingVks[k], g_typingShift[k], &ch))
+            acc += ch;
+    }
+    return acc;
+}
+
+static unsigned BenchGetColemakVk(long iters)
+{
+    unsigned acc = 0;
+    long i;
+
+    for (i = 0; i < iters; i++)
+        acc += keymap_get_colemak_vk(g_typingVks[i & (STREAM_LEN - 1)]);
+    return acc;
+}
+
+static unsigned BenchGetQwertyVk(long iters)
+{
+    unsigned acc = 0;
+    long i;
+
+    for (i = 0; i < iters; i++)
+        acc += keymap_get_qwerty_vk(g_typingVks[i & (STREAM_LEN - 1)]);
+    return acc;
+}
+
+/* Korean Colemak with every option on: the IME's default settings */
+static KeyDispatch g_dispatch;
+
+static unsigned BenchDispatchLookup(long iters)
+{
+    unsigned acc = 0;
+    long i;
+
+    for (i = 0; i < iters; i++) {
+        int k = (int)(i & (STREAM_LEN - 1));
+        const KeyAction *ka = keydispatch_lookup(&g_dispatch, g_typingVks[k],
+                                                 (i & 1), FALSE);
+        acc += ka->action + ka->ch[g_typingShift[k]];
+    }
+    return acc;
+}
+
+/* ===== lldecide ===== */
+
+typedef struct { BYTE vk; BYTE up; } LLEvent;
+
+/* Typing (every key down and up, Win never held) and Win shortcuts
+ * (Win down, key down, key up, Win up) over the typing stream */
+static LLEvent g_llTyping[STREAM_LEN];
+static LLEvent g_llWinKeys[STREAM_LEN];
+
+/* IME active in the foreground, default settings */
+static const LLDecideInput g_llInput = {
+    TRUE, FALSE, TRUE, TRUE, VK_SPACE, TF_MOD_WIN
+};
+
+static void BuildLLEvents(void)
+{
+    int i;
+
+    for (i = 0; i < STREAM_LEN; i++) {
+        BYTE vk = g_typingVks[i / 2];
+
+        g_llTyping[i].vk = vk;
+        g_llTyping[i].up = (BYTE)(i & 1);
+
+        vk = g_typingVks[i / 4];
+        g_llWinKeys[i].vk = ((i & 3) == 0 || (i & 3) == 3) ? VK_LWIN : vk;
+        g_llWinKeys[i].up = (BYTE)((i & 3) >= 2);
+    }
+}
+
+static unsigned RunDecide(const LLEvent *events, long iters)
+{
+    LLDecideState st;
+    LLDecision d;
+    unsigned acc = 0;
+    long i;
+
+    lldecide_reset(&st, 0);
+    for (i = 0; i < iters; i++) {
+        const LLEvent *e = &events[i & (STREAM_LEN - 1)];
+        lldecide_key(&st, &g_llInput, e->vk, 0, FALSE, e->up, FALSE, &d);
+        acc += d.action + d.vk;
+    }
+    return acc;
+}
+
+static unsigned BenchDecideTyping(long iters)  { return RunDecide(g_llTyping, iters); }
+static unsigned BenchDecideWinKeys(long iters) { return RunDecide(g_llWinKeys, iters); }
+
+/* ===== tiplabel ===== */
+
+/* Largest label bitmap at the DPIs used here */
+#define TIP_MAX_PIXELS (512 * 128)
+
+static DWORD g_tipPixels[TIP_MAX_PIXELS];
+
+/* Render and compose one label per op, as the first show at a DPI */
+static unsigned BenchTipLabel(long iters)
+{
+    TipLabelLayout l;
+    unsigned acc = 0;
+    long i;
+
+    for (i = 0; i < iters; i++) {
+        Host_RasterizeLabel((UINT)i % TIPLABEL_COUNT, 96, g_tipPixels, &l);
+        tiplabel_compose(g_tipPixels, (size_t)l.width * (size_t)l.height);
+        acc += g_tipPixels[l.textY * l.width + l.textX + 1];
+    }
+    return acc;
+}
+
+/* ===== appmodes ===== */
+
+#define APP_NAMES 100
+
+static DWORD g_appKeys[APP_NAMES];
+
+static void BuildAppKeys(void)
+{
+    WCHAR name[32];
+    int i, k;
+
+    for (i = 0; i < APP_NAMES; i++) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "C:\\Apps\\app%d.exe", i);
+        for (k = 0; buf[k]; k++)
+            name[k] = (WCHAR)buf[k];
+        name[k] = 0;
+        g_appKeys[i] = appmodes_key(name);
+    }
+}
+
+/* Focus moving among 48 remembered applications */
+static unsigned BenchAppModesGet(long iters)
+{
+    unsigned acc = 0;
+    BYTE modes = 0;
+    long i;
+
+    for (i = 0; i < iters; i++) {
+        appmodes_get(g_appKeys[(i * 7) % 48], &modes);
+        acc += modes;
+    }
+    return acc;
+}
+
+/* ===== sharedprefs ===== */
+
+/* The writer stores one counter in every slot */
+static volatile int g_writerRunning;
+static pthread_t g_writer;
+static unsigned long g_writes;
+
+static void FillPrefs(SharedPrefs *p, DWORD value)
+{
+    int i;
+    for (i = 0; i < SHAREDPREFS_COUNT; i++)
+        p->v[i] = value;
+}
+
+static void *WriterThread(void *arg)
+{
+    SharedPrefs p;
+    DWORD n = 0;
+    int i;
+
+    (void)arg;
+    while (g_writerRunning) {
+        FillPrefs(&p, ++n);
+        sharedprefs_publish(&p, SHAREDPREFS_ALL);
+        g_writes++;
+        for (i = 0; i < 256; i++)
+            YieldProcessor();
+    }
+    return NULL;
+}
+
+static void StopWriter(void)
+{
+    if (g_writerRunning) {
+        g_writerRunning = 0;
+        pthread_join(g_writer, NULL);
+    }
+}
+
+/* Generation matches: the path every focus change takes */
+static unsigned BenchPrefsUnchanged(long iters)
+{
+    SharedPrefs p;
+    LONG generation = 0;
+    unsigned acc = 0;
+    long i;
+
+    sharedprefs_read(&p, &generation);
+    for (i = 0; i < iters; i++)
+        acc += (unsigned)sharedprefs_read(&p, &generation);
+    return acc;
+}
+
+static unsigned BenchPrefsCopy(long iters)
+{
+    SharedPrefs p;
+    unsigned acc = 0;
+    long i;
+
+    for (i = 0; i < iters; i++) {
+        LONG generation = 0;
+        if (sharedprefs_read(&p, &generation) == SHAREDPREFS_CHANGED)
+            acc += p.v[0] + p.v[SHAREDPREFS_COUNT - 1];
+    }
+    return acc;
+}
+
+/* Copies as they change while another thread publishes */
+static unsigned BenchPrefsContended(long iters)
+{
+    SharedPrefs p;
+    LONG generation = 0;
+    unsigned acc = 0;
+    long i;
+
+    if (!g_writerRunning) {
+        g_writerRunning = 1;
+        if (pthread_create(&g_writer, NULL, WriterThread, NULL) != 0)
+            g_writerRunning = 0;
+    }
+    for (i = 0; i < iters; i++) {
+        if (sharedprefs_read(&p, &generation) == SHAREDPREFS_CHANGED)
+            acc += p.v[0] + p.v[SHAREDPREFS_COUNT - 1];
+    }
+    return acc;
+}
+
+typedef struct {
+    const char *name;
+    unsigned (*run)(long iters);
+} Benchmark;
+
+static const Benchmark g_benchmarks[] = {
+    { "hangul_ic_process/realistic",     BenchProcessRealistic },
+    { "hangul_ic_process/jong_chain",    BenchProcessJongChain },
+    { "hangul_ic_process/commit_runs",   BenchProcessRuns },
+    { "hangul_ic_backspace/realistic",   BenchBackspaceRealistic },
+    { "hangul_ic_backspace/jong_chain",  BenchBackspaceJongChain },
+    { "hangul_ic_flush/realistic",       BenchFlush },
+    { "hangul_ic_process_keys/typing",   BenchProcessKeys },
+    { "keymap_get_jamo/typing",          BenchGetJamo },
+    { "keymap_get_colemak/typing",       BenchGetColemak },
+    { "keymap_get_colemak_vk/typing",    BenchGetColemakVk },
+    { "keymap_get_qwerty_vk/typing",     BenchGetQwertyVk },
+    { "keydispatch_lookup/typing",       BenchDispatchLookup },
+    { "lldecide_key/typing",             BenchDecideTyping },
+    { "lldecide_key/win_shortcuts",      BenchDecideWinKeys },
+    { "tiplabel_render/label",           BenchTipLabel },
+    { "appmodes_get/switching",          BenchAppModesGet },
+    { "sharedprefs_read/unchanged",      BenchPrefsUnchanged },
+    { "sharedprefs_read/copy",           BenchPrefsCopy },
+    { "sharedprefs_read/contended",      BenchPrefsContended },  /* keep last */
+};
+
+#define BENCH_COUNT ((int)(sizeof(g_benchmarks) / sizeof(g_benchmarks[0])))
+
+/* ===== Measurement ===== */
+
+typedef struct {
+    char   name[64];
+    double nsPerOp;       /* median over samples */
+    double nsMad;         /* median absolute deviation */
+    double cyclesPerOp;   /* median, 0 if unavailable */
+    long   opsPerSample;
+    int    samples;
+} BenchResult;
+
+static int CompareDouble(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double Median(double *v, int n)
+{
+    qsort(v, (size_t)n, sizeof(*v), CompareDouble);
+    return (n & 1) ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2.0;
+}
+
+static void Measure(const Benchmark *b, int samples, BenchResult *res)
+{
+    double ns[MAX_SAMPLES], cycles[MAX_SAMPLES], dev[MAX_SAMPLES];
+    long iters = 1024;
+    int i;
+
+    /* Warm up and calibrate: grow iters until a sample takes SAMPLE_NS */
+    for (;;) {
+        unsigned long long t0 = Host_NowNs();
+        g_sink += b->run(iters);
+        if (Host_NowNs() - t0 >= SAMPLE_NS / 4 || iters >= (1L << 30))
+            break;
+        iters *= 2;
+    }
+    iters *= 4;
+
+    for (i = 0; i < samples; i++) {
+        unsigned long long t0 = Host_NowNs();
+        unsigned long long c0 = ReadCycles();
+        g_sink += b->run(iters);
+        cycles[i] = (double)(ReadCycles() - c0) / (double)iters;
+        ns[i] = (double)(Host_NowNs() - t0) / (double)iters;
+    }
+
+    snprintf(res->name, sizeof(res->name), "%s", b->name);
+    res->nsPerOp = Median(ns, samples);
+    res->cyclesPerOp = HAVE_CYCLES ? Median(cycles, samples) : 0.0;
+    for (i = 0; i < samples; i++)
+        dev[i] = ns[i] > res->nsPerOp ? ns[i] - res->nsPerOp : res->nsPerOp - ns[i];
+    res->nsMad = Median(dev, samples);
+    res->opsPerSample = iters;
+    res->samples = samples;
+}
+
+/* ===== Results files ===== */
+
+static BOOL WriteJson(const char *path, const BenchResult *res, int count)
+{
+    FILE *f = fopen(path, "w");
+    int i;
+
+    if (!f)
+        return FALSE;
+    fprintf(f, "{\n  \"tool\": \"kolemak-bench\",\n  \"version\": 1,\n"
+               "  \"cycles\": \"%s\",\n  \"benchmarks\": [\n",
+            HAVE_CYCLES ? "tsc" : "none");
+    for (i = 0; i < count; i++) {
+        fprintf(f, "    {\"name\": \"%s\", \"ns_per_op\": %.4f, \"ns_mad\": %.4f, "
+                   "\"cycles_per_op\": %.3f, \"ops_per_sample\": %ld, \"samples\": %d}%s\n",
+                res[i].name, res[i].nsPerOp, res[i].nsMad, res[i].cyclesPerOp,
+                res[i].opsPerSample, res[i].samples, i + 1 < count ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    return fclose(f) == 0;
+}
+
+/* Reads a file written by WriteJson (one benchmark object per line) */
+static int ReadJson(const char *path, BenchResult *res, int cap)
+{
+    FILE *f = fopen(path, "r");
+    char line[512];
+    int count = 0;
+
+    if (!f)
+        return -1;
+    while (count < cap && fgets(line, sizeof(line), f)) {
+        const char *p = strstr(line, "\"name\": \"");
+        const char *q;
+        size_t len;
+
+        if (!p)
+            continue;
+        p += 9;
+        q = strchr(p, '"');
+        if (!q)
+            continue;
+        len = (size_t)(q - p) < sizeof(res->name) - 1 ? (size_t)(q - p) : sizeof(res->name) - 1;
+        memcpy(res[count].name, p, len);
+        res[count].name[len] = 0;
+        if ((p = strstr(q, "\"ns_per_op\": ")) == NULL ||
+            sscanf(p, "\"ns_per_op\": %lf", &res[count].nsPerOp) != 1)
+            continue;
+        if ((p = strstr(q, "\"ns_mad\": ")) == NULL ||
+            sscanf(p, "\"ns_mad\": %lf", &res[count].nsMad) != 1)
+            res[count].nsMad = 0.0;
+        count++;
+    }
+    fclose(f);
+    return count;
+}
+
+/* Slower by more than threshold AND more than 3x the combined MAD
+ * (MAD ~ 0.67 sigma, so this is ~2 sigma of either run's noise) */
+static int Compare(const BenchResult *cur, int count,
+                   const BenchResult *base, int baseCount, double threshold)
+{
+    int i, j, regressions = 0;
+
+    printf("\n%-34s %10s %10s %8s\n", "vs baseline", "base ns", "ns", "change");
+    for (i = 0; i < count; i++) {
+        const BenchResult *b = NULL;
+        double change, noise;
+        const char *verdict;
+
+        for (j = 0; j < baseCount; j++) {
+            if (strcmp(base[j].name, cur[i].name) == 0) {
+                b = &base[j];
+                break;
+            }
+        }
+        if (!b || b->nsPerOp <= 0.0) {
+            printf("%-34s %10s %10.2f %8s  new\n", cur[i].name, "-", cur[i].nsPerOp, "");
+            continue;
+        }
+
+        change = cur[i].nsPerOp - b->nsPerOp;
+        noise = 3.0 * (cur[i].nsMad + b->nsMad);
+        if (change > b->nsPerOp * threshold && change > noise) {
+            verdict = "SLOWER";
+            regressions++;
+        } else if (-change > b->nsPerOp * threshold && -change > noise) {
+            verdict = "faster";
+        } else {
+            verdict = "~";
+        }
+        printf("%-34s %10.2f %10.2f %+7.1f%%  %s\n", cur[i].name, b->nsPerOp,
+               cur[i].nsPerOp, 100.0 * change / b->nsPerOp, verdict);
+    }
+    return regressions;
+}
+
+/* ===== main ===== */
+
+static void Usage(void)
+{
+    fprintf(stderr,
+        "usage: kolemak-bench [--quick] [--filter TEXT] [--json FILE]\n"
+        "                     [--baseline FILE] [--threshold PCT]\n");
+}
+
+int main(int argc, char **argv)
+{
+    static BenchResult results[BENCH_COUNT], baseline[64];
+    const char *filter = NULL, *jsonPath = NULL, *basePath = NULL;
+    char shmName[64];
+    SharedPrefs prefs;
+    double threshold = 0.05;
+    int samples = 21, count = 0, i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--quick") == 0)
+            samples = 5;
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+            filter = argv[++i];
+        else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+            jsonPath = argv[++i];
+        else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+            basePath = argv[++i];
+        else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc)
+            threshold = strtod(argv[++i], NULL) / 100.0;
+        else {
+            Usage();
+            return 2;
+        }
+    }
+
+    BuildRealistic(g_realistic);
+    BuildRepeated(g_jongChain, g_adversarialJong);
+    BuildRepeated(g_runs, g_adversarialRuns);
+    CaptureStates(g_realistic, g_realisticStates);
+    CaptureStates(g_jongChain, g_jongStates);
+    BuildTyping();
+    BuildLLEvents();
+    keydispatch_build(&g_dispatch, KEYDISPATCH_KOREAN | KEYDISPATCH_COLEMAK |
+                                   KEYDISPATCH_SEMISWAP | KEYDISPATCH_CAPS_BACKSPACE);
+
+    snprintf(shmName, sizeof(shmName), "/kolemak-bench.%ld", (long)getpid());
+    setenv("KOLEMAK_SHM", shmName, 1);
+    FillPrefs(&prefs, 0);
+    if (!sharedprefs_init(&prefs))
+        fprintf(stderr, "kolemak-bench: no shared memory section\n");
+
+    BuildAppKeys();
+    appmodes_load(NULL, 0);
+    for (i = 0; i < 48; i++)
+        appmodes_put(g_appKeys[i], (BYTE)(i & 3));
+
+    printf("%-34s %10s %8s %10s\n", "benchmark", "ns/op", "+/-", "cycles/op");
+    for (i = 0; i < BENCH_COUNT; i++) {
+        if (filter && !strstr(g_benchmarks[i].name, filter))
+            continue;
+        Measure(&g_benchmarks[i], samples, &results[count]);
+        printf("%-34s %10.2f %8.2f %10.1f\n", results[count].name,
+               results[count].nsPerOp, results[count].nsMad,
+               results[count].cyclesPerOp);
+        fflush(stdout);
+        count++;
+    }
+
+    StopWriter();
+    sharedprefs_close();
+    sharedprefs_unlink();
+    appmodes_close();
+    appmodes_unlink();
+    if (g_writes) {
+        SharedPrefsStats st;
+        sharedprefs_stats(&st);
+        printf("sharedprefs: %lu writes  %ld read retries  %ld writer spins\n",
+               g_writes, (long)st.readRetries, (long)st.writeSpins);
+    }
+
+    if (jsonPath && !WriteJson(jsonPath, results, count)) {
+        fprintf(stderr, "kolemak-bench: cannot write %s\n", jsonPath);
+        return 1;
+    }
+
+    if (basePath) {
+        int baseCount = ReadJson(basePath, baseline,
+                                 (int)(sizeof(baseline) / sizeof(baseline[0])));
+        int regressions;
+
+        if (baseCount < 0) {
+            fprintf(stderr, "kolemak-bench: cannot read %s\n", basePath);
+            return 1;
+        }
+        regressions = Compare(results, count, baseline, baseCount, threshold);
+        if (regressions) {
+            printf("%d benchmark(s) regressed beyond %.1f%% and noise\n",
+                   regressions, threshold * 100.0);
+            return 1;
+        }
+    }
+    return 0;
+}
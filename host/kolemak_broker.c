@@ -0,0 +1,237 @@
+/*
+ * kolemak_broker.c - Broker election and handoff across processes
+ *
+ * Usage: kolemak-broker [-p PROCS] [-r ROUNDS]
+ *
+ * Forks PROCS stand-ins for processes hosting the IME.  Each joins the
+ * elections for both session roles through broker.c, the LL hook
+ * (llhook.c) and the tray icon (tray.c), with roles that record its pid
+ * in a shared scoreboard per role.  The owner of one role, taking turns,
+ * is then removed ROUNDS times, alternating a clean exit (broker_stop)
+ * with SIGKILL (a crash that abandons the mutexes), and a fresh stand-in
+ * replaces it.  Each time exactly one of the others must take over every
+ * role it held.  Prints the handoff latency in ns per role and exits
+ * with 1 if a handoff timed out or two processes ever owned a role at
+ * once.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "broker.h"
+#include "host_util.h"
+#include "shmsection.h"
+
+#define BROKER_MAX_PROCS    64
+#define BROKER_MAX_ROUNDS   10000
+#define BROKER_TIMEOUT_NS   2000000000ULL
+
+/* The role names llhook.c and tray.c use, in a private section
+ * (KOLEMAK_SHM) */
+static const char *const g_roleNames[] = { "LLHookMutex", "TrayMutex" };
+
+#define BROKER_ROLES ((int)(sizeof(g_roleNames) / sizeof(g_roleNames[0])))
+
+typedef struct {
+    volatile LONG owner;           /* pid of the current owner, 0 = none */
+    volatile LONG removed;         /* pid the driver is taking away */
+    volatile LONG elections;
+    volatile LONG takeovers;       /* elections after the owner was killed */
+    volatile LONG overlaps;        /* elections while another owner lived */
+    volatile unsigned long long electedAt;
+} Scoreboard;
+
+static Scoreboard *g_boards;    /* one per role */
+static volatile sig_atomic_t g_stop;
+
+/* ===== Stand-in process ===== */
+
+static BOOL Elect(void *ctx)
+{
+    Scoreboard *b = (Scoreboard *)ctx;
+    LONG prev;
+
+    /* Stamped first: the driver reads it once owner changes */
+    b->electedAt = Host_NowNs();
+    prev = InterlockedExchange(&b->owner, (LONG)getpid());
+
+    if (prev != 0 && prev != b->removed)
+        InterlockedIncrement(&b->overlaps);
+    if (prev != 0)
+        InterlockedIncrement(&b->takeovers);
+    InterlockedIncrement(&b->elections);
+    return TRUE;
+}
+
+static void Resign(void *ctx)
+{
+    Scoreboard *b = (Scoreboard *)ctx;
+    InterlockedCompareExchange(&b->owner, 0, (LONG)getpid());
+}
+
+static void OnTerm(int sig)
+{
+    (void)sig;
+    g_stop = 1;
+}
+
+static void StandIn(void)
+{
+    BrokerRole roles[BROKER_ROLES];
+    Broker *brokers[BROKER_ROLES];
+    int i;
+
+    signal(SIGTERM, OnTerm);
+    for (i = 0; i < BROKER_ROLES; i++) {
+        roles[i].name = g_roleNames[i];
+        roles[i].elect = Elect;
+        roles[i].resign = Resign;
+        roles[i].ctx = &g_boards[i];
+        brokers[i] = broker_start(&roles[i]);
+        if (!brokers[i])
+            _exit(2);
+    }
+    while (!g_stop)
+        usleep(1000);
+    for (i = 0; i < BROKER_ROLES; i++)
+        broker_stop(brokers[i]);
+    _exit(0);
+}
+
+static pid_t Spawn(void)
+{
+    pid_t pid = fork();
+
+    if (pid == 0)
+        StandIn();
+    return pid;
+}
+
+/* ===== Driver ===== */
+
+static BOOL WaitForOwner(const Scoreboard *b, LONG notPid,
+                         unsigned long long since)
+{
+    while (b->owner == 0 || b->owner == notPid) {
+        if (Host_NowNs() - since > BROKER_TIMEOUT_NS)
+            return FALSE;
+        usleep(100);
+    }
+    return TRUE;
+}
+
+static void Usage(void)
+{
+    fprintf(stderr, "usage: kolemak-broker [-p PROCS] [-r ROUNDS]\n");
+}
+
+int main(int argc, char **argv)
+{
+    static unsigned long long samples[BROKER_ROLES][BROKER_MAX_ROUNDS];
+    static pid_t procs[BROKER_MAX_PROCS];
+    size_t count[BROKER_ROLES] = {0};
+    char shmName[64];
+    long nprocs = 8, rounds = 200, r;
+    int i, k, failed = 0;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+            nprocs = strtol(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+            rounds = strtol(argv[++i], NULL, 10);
+        else {
+            Usage();
+            return 2;
+        }
+    }
+    if (nprocs < 2 || nprocs > BROKER_MAX_PROCS ||
+        rounds < 1 || rounds > BROKER_MAX_ROUNDS) {
+        Usage();
+        return 2;
+    }
+
+    snprintf(shmName, sizeof(shmName), "/kolemak-broker.%ld", (long)getpid());
+    setenv("KOLEMAK_SHM", shmName, 1);
+
+    g_boards = (Scoreboard *)mmap(NULL, BROKER_ROLES * sizeof(Scoreboard),
+                                  PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (g_boards == MAP_FAILED) {
+        perror("kolemak-broker: mmap");
+        return 2;
+    }
+    memset((void *)g_boards, 0, BROKER_ROLES * sizeof(Scoreboard));
+
+    for (i = 0; i < nprocs; i++)
+        procs[i] = Spawn();
+
+    for (k = 0; k < BROKER_ROLES; k++) {
+        if (!WaitForOwner(&g_boards[k], 0, Host_NowNs())) {
+            fprintf(stderr, "kolemak-broker: nobody was elected for %s\n",
+                    g_roleNames[k]);
+            failed = 1;
+            rounds = 0;
+        }
+    }
+
+    for (r = 0; r < rounds; r++) {
+        int role = (int)(r % BROKER_ROLES);
+        LONG owner = g_boards[role].owner;
+        BOOL crash = ((r / BROKER_ROLES) & 1) != 0;
+        unsigned long long start;
+
+        for (k = 0; k < BROKER_ROLES; k++)
+            g_boards[k].removed = owner;
+        start = Host_NowNs();
+        kill((pid_t)owner, crash ? SIGKILL : SIGTERM);
+
+        /* Every role the process held moves on, not only this one */
+        for (k = 0; k < BROKER_ROLES && !failed; k++) {
+            BOOL held = (k == role);
+
+            if (!WaitForOwner(&g_boards[k], owner, start)) {
+                fprintf(stderr, "kolemak-broker: round %ld: no %s takeover "
+                        "after %s\n", r, g_roleNames[k],
+                        crash ? "SIGKILL" : "a clean exit");
+                failed = 1;
+            } else if (held) {
+                samples[k][count[k]++] = g_boards[k].electedAt - start;
+            }
+        }
+        if (failed)
+            break;
+
+        /* Replace the removed process to keep the pool size */
+        waitpid((pid_t)owner, NULL, 0);
+        for (i = 0; i < nprocs; i++) {
+            if (procs[i] == (pid_t)owner)
+                procs[i] = Spawn();
+        }
+    }
+
+    for (i = 0; i < nprocs; i++)
+        kill(procs[i], SIGTERM);
+    for (i = 0; i < nprocs; i++)
+        waitpid(procs[i], NULL, 0);
+
+    for (k = 0; k < BROKER_ROLES; k++) {
+        const Scoreboard *b = &g_boards[k];
+        char label[64];
+
+        shmsection_unlink(g_roleNames[k]);
+        printf("%s: %ld processes  %ld handoffs  %ld elections  "
+               "%ld takeovers  %ld overlaps\n",
+               g_roleNames[k], nprocs, (long)count[k], (long)b->elections,
+               (long)b->takeovers, (long)b->overlaps);
+        snprintf(label, sizeof(label), "%s handoff ns", g_roleNames[k]);
+        Host_PrintLatency(label, samples[k], count[k]);
+
+        if (b->overlaps || b->owner != 0)
+            failed = 1;
+    }
+    return failed;
+}
@@ -0,0 +1,399 @@
+/*
+ * kolemak_host.c - Run the IME key path headlessly on a non-Windows host
+ *
+ * Usage: kolemak-host [--korean] [--qwerty] [--async] [--lag N] [-n N]
+ *                     [--reg-quiet MS] [--reglog] [--record FILE]
+ *                     [--msgs N] SCRIPT
+ *
+ * SCRIPT is typed as physical QWERTY keys: lowercase letters, digits
+ * and punctuation as-is, uppercase letters with Shift, and {NAME} for
+ * other keys.  NAME may carry CTRL+, ALT+, SHIFT+ and WIN+ prefixes,
+ * e.g. {BS} {ENTER} {ESC} {LEFT} {HANGUL} {F13} {CTRL+c} {WIN+SPACE}.
+ * {+NAME} and {-NAME} press or release a single key, and {BLUR} /
+ * {FOCUS} move focus away and back, so held modifiers and key-ups
+ * missed while unfocused can be scripted: {+CTRL}{BLUR}{-CTRL}{FOCUS}a.
+ * {APP:NAME} moves focus to a thread of the application NAME (an image
+ * path), which gets the modes remembered for it (appmodes.h):
+ * {APP:talk.exe}{HANGUL}dkssud {APP:code.exe}hi{APP:talk.exe}dkssud.
+ * With no SCRIPT, lines are read from stdin.
+ *
+ * --lag N lets async edit sessions run only every N key events, as in
+ * an app too busy to grant them promptly.
+ *
+ * Registry writes are queued to the settings writer thread, which
+ * stores them on {BLUR}, at exit, or after --reg-quiet MS without new
+ * writes.  --reglog lists the values it stored, in order.
+ *
+ * Prints the resulting document as UTF-8, then per-keystroke timing
+ * (covering hooks, key sink, edit sessions and re-injected input) and
+ * the cost of activation and of each subsystem brought up after it.
+ * --record writes the key sink's events as a keytrace (keytrace.h)
+ * for kolemak-replay.  At exit it lists the IME objects allocated
+ * (arena.h) and fails if an edit session was never released.
+ *
+ * --msgs N then passes N million non-keyboard messages (mouse moves,
+ * paints, timers, raw input) through the WH_GETMESSAGE hook, as every
+ * message an app dequeues would, and prints the time per million.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "appmodes.h"
+#include "host_util.h"
+#include "key_pipeline.h"
+#include "keytrace.h"
+#include "regwriter.h"
+#include "tsf_mock.h"
+#include "win32_shim.h"
+
+#define MAX_SAMPLES (1 << 20)
+
+static TextService *g_ts;
+static unsigned long long *g_samples;
+static size_t g_sampleCount = 0;
+
+static void TimedTap(UINT vk, UINT mods)
+{
+    unsigned long long t0 = Host_NowNs();
+    Pipeline_Tap(vk, mods);
+    if (g_sampleCount < MAX_SAMPLES)
+        g_samples[g_sampleCount++] = Host_NowNs() - t0;
+}
+
+/* ===== Script parsing ===== */
+
+typedef struct { const char *name; UINT vk; } NamedKey;
+
+static const NamedKey g_namedKeys[] = {
+    { "BS", VK_BACK }, { "TAB", VK_TAB }, { "ENTER", VK_RETURN },
+    { "ESC", VK_ESCAPE }, { "SPACE", VK_SPACE }, { "LEFT", VK_LEFT },
+    { "RIGHT", VK_RIGHT }, { "UP", VK_UP }, { "DOWN", VK_DOWN },
+    { "HOME", VK_HOME }, { "END", VK_END }, { "DEL", VK_DELETE },
+    { "HANGUL", VK_HANGUL }, { "CAPS", VK_CAPITAL }, { "F13", VK_F13 },
+    { "SHIFT", VK_SHIFT }, { "CTRL", VK_CONTROL }, { "ALT", VK_MENU },
+};
+
+static const char g_punct[]        = ";=,-./`[\\]'";
+static const char g_punctShifted[] = ":+<_>?~{|}\"";
+static const BYTE g_punctVk[] = {
+    VK_OEM_1, VK_OEM_PLUS, VK_OEM_COMMA, VK_OEM_MINUS, VK_OEM_PERIOD,
+    VK_OEM_2, VK_OEM_3, VK_OEM_4, VK_OEM_5, VK_OEM_6, VK_OEM_7,
+};
+static const char g_digitShifted[] = ")!@#$%^&*(";
+
+/* Map one ASCII character to a VK and Shift state; FALSE if unknown */
+static BOOL CharToKey(char c, UINT *vk, UINT *mods)
+{
+    const char *p;
+
+    if (c >= 'a' && c <= 'z') { *vk = (UINT)(c - 32); return TRUE; }
+    if (c >= 'A' && c <= 'Z') { *vk = (UINT)c; *mods |= PIPE_MOD_SHIFT; return TRUE; }
+    if (c >= '0' && c <= '9') { *vk = (UINT)c; return TRUE; }
+    if (c == ' ')             { *vk = VK_SPACE; return TRUE; }
+    if (c == '\n')            { *vk = VK_RETURN; return TRUE; }
+    if ((p = strchr(g_punct, c)) != NULL && c) {
+        *vk = g_punctVk[p - g_punct];
+        return TRUE;
+    }
+    if ((p = strchr(g_punctShifted, c)) != NULL && c) {
+        *vk = g_punctVk[p - g_punctShifted];
+        *mods |= PIPE_MOD_SHIFT;
+        return TRUE;
+    }
+    if ((p = strchr(g_digitShifted, c)) != NULL && c) {
+        *vk = (UINT)('0' + (p - g_digitShifted));
+        *mods |= PIPE_MOD_SHIFT;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/* Parse "{MOD+...+NAME}" starting after '{'; returns chars consumed */
+static int ParseNamedKey(const char *s, UINT *vk, UINT *mods)
+{
+    static const struct { const char *prefix; UINT mod; } prefixes[] = {
+        { "CTRL+", PIPE_MOD_CTRL }, { "ALT+", PIPE_MOD_ALT },
+        { "SHIFT+", PIPE_MOD_SHIFT }, { "WIN+", PIPE_MOD_WIN },
+    };
+    const char *end = strchr(s, '}');
+    const char *p = s;
+    size_t i, len;
+
+    if (!end)
+        return -1;
+
+    for (i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); i++) {
+        size_t n = strlen(prefixes[i].prefix);
+        if ((size_t)(end - p) > n && strncmp(p, prefixes[i].prefix, n) == 0) {
+            *mods |= prefixes[i].mod;
+            p += n;
+            i = (size_t)-1;     /* prefixes may come in any order */
+        }
+    }
+
+    len = (size_t)(end - p);
+    if (len == 1 && CharToKey(*p, vk, mods))
+        return (int)(end - s) + 1;
+    for (i = 0; i < sizeof(g_namedKeys) / sizeof(g_namedKeys[0]); i++) {
+        if (strlen(g_namedKeys[i].name) == len &&
+            strncmp(g_namedKeys[i].name, p, len) == 0) {
+            *vk = g_namedKeys[i].vk;
+            return (int)(end - s) + 1;
+        }
+    }
+    return -1;
+}
+
+static BOOL RunScript(const char *script)
+{
+    const char *s = script;
+
+    while (*s) {
+        UINT vk = 0, mods = 0;
+
+        if (strncmp(s, "{BLUR}", 6) == 0 || strncmp(s, "{FOCUS}", 7) == 0) {
+            Pipeline_SetFocus(s[1] == 'F');
+            s += s[1] == 'F' ? 7 : 6;
+            continue;
+        }
+        if (strncmp(s, "{APP:", 5) == 0) {
+            char image[MAX_PATH];
+            const char *end = strchr(s + 5, '}');
+            size_t len = end ? (size_t)(end - (s + 5)) : 0;
+
+            if (len == 0 || len >= sizeof(image)) {
+                fprintf(stderr, "kolemak-host: bad app at \"%.16s\"\n", s);
+                return FALSE;
+            }
+            memcpy(image, s + 5, len);
+            image[len] = 0;
+            Pipeline_SwitchApp(image);
+            s = end + 1;
+            continue;
+        }
+        if (s[0] == '{' && (s[1] == '+' || s[1] == '-')) {
+            int n = ParseNamedKey(s + 2, &vk, &mods);
+            if (n < 0 || mods) {
+                fprintf(stderr, "kolemak-host: bad key at \"%.16s\"\n", s);
+                return FALSE;
+            }
+            Pipeline_Key(vk, s[1] == '+');
+            s += 2 + n;
+            continue;
+        }
+        if (*s == '{') {
+            int n = ParseNamedKey(s + 1, &vk, &mods);
+            if (n < 0) {
+                fprintf(stderr, "kolemak-host: bad key at \"%.16s\"\n", s);
+                return FALSE;
+            }
+            s += 1 + n;
+        } else if (CharToKey(*s, &vk, &mods)) {
+            s++;
+        } else {
+            fprintf(stderr, "kolemak-host: unsupported character 0x%02x\n",
+                    (unsigned char)*s);
+            return FALSE;
+        }
+        TimedTap(vk, mods);
+    }
+    return TRUE;
+}
+
+/* ===== Output ===== */
+
+static void PrintStats(void)
+{
+    ULONG syncSessions, asyncSessions;
+    AppModesStats apps;
+    char line[256];
+
+    MockTsf_Counters(&syncSessions, &asyncSessions);
+    fprintf(stderr, "keystrokes: %zu  eaten: %lu  passed: %lu\n",
+            g_sampleCount, (unsigned long)Pipeline_EatenCount(),
+            (unsigned long)Pipeline_PassedCount());
+    fprintf(stderr, "edit sessions: sync %lu  async %lu  SendInput events: %lu\n",
+            (unsigned long)syncSessions, (unsigned long)asyncSessions,
+            (unsigned long)Shim_TotalInputs());
+    fprintf(stderr, "edit session pool: hits %lu  misses %lu  app calls: %lu\n",
+            (unsigned long)g_ts->esPool.hits, (unsigned long)g_ts->esPool.misses,
+            (unsigned long)MockTsf_AppCalls());
+    fprintf(stderr, "registry calls: %lu\n",
+            (unsigned long)Shim_RegistryCalls());
+    fprintf(stderr, "ui updates: posted %lu  applied %lu\n",
+            (unsigned long)g_ts->uiBus.posted,
+            (unsigned long)g_ts->uiBus.applied);
+    appmodes_stats(&apps);
+    fprintf(stderr, "app modes: %ld apps  hits %ld  misses %ld  "
+            "evictions %ld\n", (long)apps.count, (long)apps.hits,
+            (long)apps.misses, (long)apps.evictions);
+    Host_PrintLatency("ns/keystroke", g_samples, g_sampleCount);
+
+    initstage_format(&g_ts->stages, line, sizeof(line));
+    fprintf(stderr, "activation: %s\n", line);
+}
+
+/* After shutdown: what the IME allocated, and whether any edit
+ * session is still alive */
+static BOOL PrintMemory(void)
+{
+    ArenaStats st;
+    UINT i;
+
+    for (i = 0; i <= ARENA_TYPES; i++) {
+        arena_stats(i, &st);
+        if (i < ARENA_TYPES && !st.allocs)
+            continue;
+        fprintf(stderr, "ime memory: %-13s live %ld (peak %ld)  bytes %ld "
+                "(peak %ld)  allocs %ld\n", arena_type_name(i),
+                (long)st.live, (long)st.peakLive, (long)st.bytes,
+                (long)st.peakBytes, (long)st.allocs);
+    }
+
+    arena_stats(ARENA_EDIT_SESSION, &st);
+    if (st.live) {
+        fprintf(stderr, "kolemak-host: %ld edit session(s) never released\n",
+                (long)st.live);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* Messages a busy app dequeues between keystrokes */
+static void RunMessages(long millions)
+{
+    static const UINT kinds[] = { WM_MOUSEMOVE, WM_PAINT, WM_TIMER, WM_INPUT };
+    unsigned long long *samples;
+    MSG msgs[64];
+    long m;
+    int i, k;
+
+    samples = (unsigned long long *)malloc((size_t)millions * sizeof(*samples));
+    if (!samples)
+        return;
+
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < 64; i++) {
+        msgs[i].hwnd = (HWND)(ULONG_PTR)0x1000;
+        msgs[i].message = kinds[i % 4];
+        msgs[i].lParam = (LPARAM)i;
+    }
+
+    for (m = 0; m < millions; m++) {
+        unsigned long long t0 = Host_NowNs();
+        for (i = 0; i < 1000000 / 64; i++) {
+            for (k = 0; k < 64; k++)
+                KolemakGetMsgProc(HC_ACTION, PM_REMOVE, (LPARAM)&msgs[k]);
+        }
+        samples[m] = Host_NowNs() - t0;
+    }
+    Host_PrintLatency("ns/million messages", samples, (size_t)millions);
+    free(samples);
+}
+
+static void PrintRegistryLog(void)
+{
+    const ShimRegWrite *log;
+    UINT count = Shim_RegistryLog(&log), i;
+    RegWriterStats st;
+    const WCHAR *c;
+
+    regwriter_stats(&st);
+    fprintf(stderr, "registry writer: puts %lu  coalesced %lu  batches %lu  stored %lu\n",
+            (unsigned long)st.puts, (unsigned long)st.coalesced,
+            (unsigned long)st.batches, (unsigned long)st.stored);
+    fprintf(stderr, "registry writes:");
+    for (i = 0; i < count; i++) {
+        fputc(' ', stderr);
+        for (c = log[i].name; *c; c++)
+            fputc((char)*c, stderr);
+        fprintf(stderr, "=%lu", (unsigned long)log[i].value);
+    }
+    fputc('\n', stderr);
+}
+
+/* ===== main ===== */
+
+static void Usage(void)
+{
+    fprintf(stderr,
+        "usage: kolemak-host [--korean] [--qwerty] [--async] [--lag N] [-n N]\n"
+        "                    [--reg-quiet MS] [--reglog] [--record FILE]\n"
+        "                    [--msgs N] [SCRIPT]\n");
+}
+
+int main(int argc, char **argv)
+{
+    PipelineOptions opts = { FALSE, TRUE, FALSE, 0, 0 };
+    const char *script = NULL;
+    const char *record = NULL;
+    long repeat = 1, msgs = 0, r;
+    int i, textLen;
+    const WCHAR *text;
+    BOOL ok = TRUE, regLog = FALSE;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--korean") == 0)
+            opts.koreanMode = TRUE;
+        else if (strcmp(argv[i], "--qwerty") == 0)
+            opts.colemakMode = FALSE;
+        else if (strcmp(argv[i], "--async") == 0)
+            opts.asyncOnly = TRUE;
+        else if (strcmp(argv[i], "--lag") == 0 && i + 1 < argc)
+            opts.asyncLag = (UINT)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--reg-quiet") == 0 && i + 1 < argc)
+            opts.regQuietMs = (DWORD)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--reglog") == 0)
+            regLog = TRUE;
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            repeat = strtol(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+            record = argv[++i];
+        else if (strcmp(argv[i], "--msgs") == 0 && i + 1 < argc)
+            msgs = strtol(argv[++i], NULL, 10);
+        else if (argv[i][0] == '-') {
+            Usage();
+            return 2;
+        } else
+            script = argv[i];
+    }
+
+    g_samples = (unsigned long long *)malloc(MAX_SAMPLES * sizeof(*g_samples));
+    if (!g_samples)
+        return 1;
+
+    g_ts = Pipeline_Init(&opts);
+    if (record && !keytrace_open(record)) {
+        fprintf(stderr, "kolemak-host: cannot write %s\n", record);
+        return 1;
+    }
+
+    if (script) {
+        for (r = 0; r < repeat && ok; r++) {
+            if (r > 0)
+                MockTsf_Clear();
+            ok = RunScript(script);
+        }
+    } else {
+        char line[4096];
+        while (ok && fgets(line, sizeof(line), stdin))
+            ok = RunScript(line);
+    }
+
+    Pipeline_Settle();
+    text = MockTsf_Text(&textLen);
+    Host_PrintUtf8(text, textLen);
+    PrintStats();
+    if (msgs > 0)
+        RunMessages(msgs);
+
+    Pipeline_Shutdown();
+    if (!PrintMemory())
+        ok = FALSE;
+    if (regLog)
+        PrintRegistryLog();
+    keytrace_close();
+    free(g_samples);
+    return ok ? 0 : 1;
+}
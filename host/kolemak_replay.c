@@ -0,0 +1,305 @@
+/*
+ * kolemak_replay.c - Replay a keystroke trace through the portable core
+ *
+ * Usage: kolemak-replay [--pace] [--dump] [-n N] TRACE
+ *
+ * Feeds every key-down that entered OnTestKeyDown through
+ * keymap_get_jamo / keymap_get_colemak / hangul_ic_process the way
+ * key_handler.c does, and prints the resulting text followed by
+ * per-event timing.  By default events run back to back; --pace waits
+ * out the recorded gaps so latency can be observed at typing speed.
+ * -n repeats the whole trace for throughput runs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hangul.h"
+#include "host_util.h"
+#include "keymap.h"
+#include "keytrace.h"
+
+#define REPLAY_TEXT_MAX 65536
+
+typedef struct {
+    HangulContext hc;
+    WCHAR text[REPLAY_TEXT_MAX];
+    int   len;
+    WCHAR preedit;
+} ReplayDoc;
+
+static void DocAppend(ReplayDoc *d, WCHAR ch)
+{
+    if (ch && d->len < REPLAY_TEXT_MAX)
+        d->text[d->len++] = ch;
+}
+
+static void DocApply(ReplayDoc *d, HangulResult r)
+{
+    switch (r.type) {
+    case HANGUL_RESULT_COMPOSING:
+        d->preedit = r.compose;
+        break;
+    case HANGUL_RESULT_COMMIT:
+    case HANGUL_RESULT_COMMIT_FLUSH:
+        DocAppend(d, r.commit1);
+        DocAppend(d, r.commit2);
+        d->preedit = r.compose;
+        break;
+    case HANGUL_RESULT_PASS:
+        break;
+    }
+}
+
+static void DocFlush(ReplayDoc *d)
+{
+    if (d->hc.state != HANGUL_STATE_EMPTY)
+        DocApply(d, hangul_ic_flush(&d->hc));
+    d->preedit = 0;
+}
+
+static void DocBackspace(ReplayDoc *d)
+{
+    if (d->hc.state != HANGUL_STATE_EMPTY) {
+        HangulResult r = hangul_ic_backspace(&d->hc);
+        /* COMMIT_FLUSH here cancels the composition (ES_CANCEL_COMPOSITION) */
+        d->preedit = (r.type == HANGUL_RESULT_COMPOSING) ? r.compose : 0;
+    } else if (d->len > 0) {
+        d->len--;
+    }
+}
+
+/* One key-down, following KES_OnKeyDown's decisions */
+static void ReplayKey(ReplayDoc *d, const KeyTraceEvent *ev)
+{
+    UINT vk = ev->vk;
+    BOOL shift   = (ev->mods & KEYTRACE_MOD_SHIFT) != 0;
+    BOOL caps    = (ev->mods & KEYTRACE_MOD_CAPS) != 0;
+    BOOL korean  = (ev->modes & KEYTRACE_MODE_KOREAN) != 0;
+    BOOL colemak = (ev->modes & KEYTRACE_MODE_COLEMAK) != 0;
+    BOOL swap    = (ev->modes & KEYTRACE_MODE_SEMISWAP) != 0;
+    WCHAR ch;
+
+    /* Ctrl/Alt/Win shortcuts only flush */
+    if (ev->mods & (KEYTRACE_MOD_CTRL | KEYTRACE_MOD_ALT | KEYTRACE_MOD_WIN)) {
+        DocFlush(d);
+        return;
+    }
+
+    /* CapsLock as Backspace (Shift+CapsLock only toggles caps).  Outside
+     * a composition it re-injects VK_BACK, which the trace records. */
+    if (vk == VK_F13 || vk == VK_CAPITAL) {
+        if (!shift && d->hc.state != HANGUL_STATE_EMPTY)
+            DocBackspace(d);
+        return;
+    }
+    if (vk == VK_BACK) {
+        DocBackspace(d);
+        return;
+    }
+    if (vk == VK_SHIFT || vk == VK_LSHIFT || vk == VK_RSHIFT ||
+        vk == VK_CONTROL || vk == VK_MENU)
+        return;
+
+    if (korean) {
+        JamoMapping jamo = keymap_get_jamo(vk, shift, colemak && swap);
+        if (jamo.cho >= 0 || jamo.jung >= 0) {
+            DocApply(d, hangul_ic_process(&d->hc, jamo.cho, jamo.jung));
+            return;
+        }
+        if (d->hc.state != HANGUL_STATE_EMPTY &&
+            !(colemak && vk >= 'A' && vk <= 'Z')) {
+            DocFlush(d);
+
+            /* Space, digits and punctuation are written along with the
+             * flushed syllable (KEY_ACTION_FLUSH_INSERT) */
+            if (vk != VK_OEM_1 && keymap_get_us_symbol(vk, shift, &ch)) {
+                DocAppend(d, ch);
+                return;
+            }
+
+            /* Other keys are re-injected, and the re-injected key is in
+             * the trace as its own event; ';' passes through as typed */
+            if (vk != VK_OEM_1)
+                return;
+        }
+        if (!colemak || !(vk >= 'A' && vk <= 'Z')) {
+            DocAppend(d, Host_UsChar(vk, shift, caps));
+            return;
+        }
+    }
+
+    if (colemak) {
+        BOOL s = shift;
+        if (caps && ((vk >= 'A' && vk <= 'Z') || vk == VK_OEM_1))
+            s = !s;
+        DocFlush(d);
+        if (keymap_get_colemak(vk, s, &ch)) {
+            DocAppend(d, ch);
+            return;
+        }
+    }
+    DocAppend(d, Host_UsChar(vk, shift, caps));
+}
+
+/* ===== Trace loading ===== */
+
+static BYTE *LoadFile(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    BYTE *data = NULL;
+    size_t cap = 0, n;
+
+    if (!f)
+        return NULL;
+    *len = 0;
+    for (;;) {
+        if (*len == cap) {
+            BYTE *grown;
+            cap = cap ? cap * 2 : 65536;
+            grown = (BYTE *)realloc(data, cap);
+            if (!grown) { free(data); fclose(f); return NULL; }
+            data = grown;
+        }
+        n = fread(data + *len, 1, cap - *len, f);
+        if (n == 0)
+            break;
+        *len += n;
+    }
+    fclose(f);
+    return data;
+}
+
+static const char *VkName(BYTE vk, char *buf)
+{
+    if ((vk >= 'A' && vk <= 'Z') || (vk >= '0' && vk <= '9'))
+        snprintf(buf, 8, "%c", vk);
+    else
+        snprintf(buf, 8, "0x%02X", vk);
+    return buf;
+}
+
+static void SleepUntilNs(unsigned long long deadline)
+{
+    unsigned long long now = Host_NowNs();
+    if (deadline > now) {
+        struct timespec t;
+        t.tv_sec = (time_t)((deadline - now) / 1000000000ull);
+        t.tv_nsec = (long)((deadline - now) % 1000000000ull);
+        nanosleep(&t, NULL);
+    }
+}
+
+/* ===== main ===== */
+
+static void Usage(void)
+{
+    fprintf(stderr, "usage: kolemak-replay [--pace] [--dump] [-n N] TRACE\n");
+}
+
+int main(int argc, char **argv)
+{
+    static ReplayDoc doc;
+    const char *path = NULL;
+    BOOL pace = FALSE, dump = FALSE;
+    long repeat = 1, r;
+    BYTE *data;
+    size_t len, events = 0, replayed = 0;
+    unsigned long long *samples;
+    unsigned long long t0, elapsed;
+    KeyTraceReader reader;
+    KeyTraceEvent ev;
+    int i, rc;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--pace") == 0)
+            pace = TRUE;
+        else if (strcmp(argv[i], "--dump") == 0)
+            dump = TRUE;
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            repeat = strtol(argv[++i], NULL, 10);
+        else if (argv[i][0] == '-') {
+            Usage();
+            return 2;
+        } else
+            path = argv[i];
+    }
+    if (!path || repeat < 1) {
+        Usage();
+        return 2;
+    }
+
+    data = LoadFile(path, &len);
+    if (!data || !keytrace_reader_init(&reader, data, len)) {
+        fprintf(stderr, "kolemak-replay: %s is not a keystroke trace\n", path);
+        free(data);
+        return 1;
+    }
+
+    /* Count events and validate once, dumping if requested */
+    while ((rc = keytrace_next(&reader, &ev)) > 0) {
+        if (dump) {
+            char name[8];
+            printf("%10llu us  %-4s %s%s mods=%02x modes=%x%s\n",
+                   ev.timeUs, VkName(ev.vk, name),
+                   (ev.flags & KEYTRACE_KEYUP) ? "up  " : "down",
+                   (ev.flags & KEYTRACE_TEST) ? " test" : "     ",
+                   ev.mods, ev.modes,
+                   (ev.flags & KEYTRACE_REPEAT) ? " repeat" : "");
+        }
+        events++;
+    }
+    if (rc < 0)
+        fprintf(stderr, "kolemak-replay: trace truncated after %zu events\n", events);
+
+    samples = (unsigned long long *)malloc((events ? events : 1) * (size_t)repeat *
+                                           sizeof(*samples));
+    if (!samples) {
+        free(data);
+        return 1;
+    }
+
+    t0 = Host_NowNs();
+    for (r = 0; r < repeat; r++) {
+        unsigned long long start = Host_NowNs();
+
+        hangul_ic_init(&doc.hc);
+        doc.len = 0;
+        doc.preedit = 0;
+        keytrace_reader_init(&reader, data, len);
+
+        while (keytrace_next(&reader, &ev) > 0) {
+            unsigned long long t;
+
+            /* Only OnTestKeyDown sees every key; skip IME-injected VK_PACKET */
+            if (!(ev.flags & KEYTRACE_TEST) || (ev.flags & KEYTRACE_KEYUP) ||
+                ev.vk == VK_PACKET)
+                continue;
+            if (pace)
+                SleepUntilNs(start + ev.timeUs * 1000ull);
+
+            t = Host_NowNs();
+            ReplayKey(&doc, &ev);
+            samples[replayed++] = Host_NowNs() - t;
+        }
+    }
+    elapsed = Host_NowNs() - t0;
+
+    if (doc.preedit)
+        DocAppend(&doc, doc.preedit);
+    Host_PrintUtf8(doc.text, doc.len);
+
+    fprintf(stderr, "trace: %zu bytes  %zu events  (%.2f bytes/event)\n",
+            len, events, events ? (double)len / (double)events : 0.0);
+    fprintf(stderr, "replayed: %zu key-downs in %.3f ms", replayed,
+            (double)elapsed / 1e6);
+    if (!pace && elapsed > 0)
+        fprintf(stderr, "  (%.0f keys/s)", (double)replayed * 1e9 / (double)elapsed);
+    fputc('\n', stderr);
+    Host_PrintLatency("ns/event", samples, replayed);
+
+    free(samples);
+    free(data);
+    return rc < 0 ? 1 : 0;
+}
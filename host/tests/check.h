@@ -0,0 +1,26 @@
+/*
+ * check.h - Assertions for the host tests
+ *
+ * Each test is one program: CHECK reports a failed condition and keeps
+ * going, CHECK_EXIT ends main with 1 if any failed.
+ */
+
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+
+static int g_checkFailures;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", \
+                    __FILE__, __LINE__, #cond); \
+            g_checkFailures++; \
+        } \
+    } while (0)
+
+#define CHECK_EXIT() return g_checkFailures ? 1 : 0
+
+#endif /* CHECK_H */
@@ -0,0 +1,31 @@
+# Record a script with kolemak-host and replay the trace with
+# kolemak-replay: both must end with the same text.
+#
+# cmake -DHOST=... -DREPLAY=... -DTRACE=... -DFLAGS="--korean" -DSCRIPT=... -P
+
+function(last_line output var)
+    string(REGEX REPLACE "\n+$" "" output "${output}")
+    string(REGEX REPLACE "^.*\n" "" output "${output}")
+    set(${var} "${output}" PARENT_SCOPE)
+endfunction()
+
+separate_arguments(FLAGS UNIX_COMMAND "${FLAGS}")
+file(REMOVE "${TRACE}")
+execute_process(COMMAND "${HOST}" --record "${TRACE}" ${FLAGS} "${SCRIPT}"
+                INPUT_FILE /dev/null OUTPUT_VARIABLE hostOut RESULT_VARIABLE hostRc)
+if(NOT hostRc EQUAL 0)
+    message(FATAL_ERROR "kolemak-host failed (${hostRc})")
+endif()
+execute_process(COMMAND "${REPLAY}" "${TRACE}"
+                INPUT_FILE /dev/null OUTPUT_VARIABLE replayOut RESULT_VARIABLE replayRc)
+file(REMOVE "${TRACE}")
+if(NOT replayRc EQUAL 0)
+    message(FATAL_ERROR "kolemak-replay failed (${replayRc})")
+endif()
+
+last_line("${hostOut}" typed)
+last_line("${replayOut}" replayed)
+if(NOT typed STREQUAL replayed)
+    message(FATAL_ERROR "typed '${typed}' but replayed '${replayed}'")
+endif()
+message(STATUS "${typed}")
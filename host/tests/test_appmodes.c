@@ -0,0 +1,242 @@
+/*
+ * test_appmodes.c - Input modes remembered per application (appmodes.h)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "appmodes.h"
+#include "check.h"
+#include "shmsection.h"
+
+#define APP_NAMES 100
+
+/* appmodes.c's section, mapped raw to leave the lock held */
+typedef struct {
+    volatile LONG lock;
+    volatile LONG loaded;
+    BYTE  head, tail, count, reserved;
+    BYTE  entries[APPMODES_SLOTS][8];
+    BYTE  index[APPMODES_SLOTS * 2];
+} AppModesSection;
+
+static DWORD g_keys[APP_NAMES];
+
+static void BuildKeys(void)
+{
+    WCHAR name[32];
+    int i, k;
+
+    for (i = 0; i < APP_NAMES; i++) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "C:\\Apps\\app%d.exe", i);
+        for (k = 0; buf[k]; k++)
+            name[k] = (WCHAR)buf[k];
+        name[k] = 0;
+        g_keys[i] = appmodes_key(name);
+    }
+}
+
+/* Keys fold case and ignore the directory */
+static void TestKeys(void)
+{
+    int i, k;
+
+    CHECK(appmodes_key(L"C:\\Program Files\\Talk\\Talk.EXE") ==
+          appmodes_key(L"talk.exe"));
+    CHECK(appmodes_key(L"talk.exe") != appmodes_key(L"code.exe"));
+    CHECK(appmodes_key(L"C:\\dir\\") == 0);
+    CHECK(appmodes_key(NULL) == 0);
+
+    for (i = 0; i < APP_NAMES; i++) {
+        for (k = 0; k < i; k++)
+            CHECK(g_keys[i] != g_keys[k]);
+    }
+}
+
+/* Nothing is remembered before the snapshot is loaded; a put first
+ * survives the load */
+static void TestLoad(void)
+{
+    BYTE modes = 0;
+
+    appmodes_reset();
+    CHECK(!appmodes_loaded());
+    CHECK(appmodes_put(g_keys[0], APPMODE_KOREAN));
+    CHECK(!appmodes_get(g_keys[0], &modes));
+    CHECK(appmodes_load(NULL, 0));
+    CHECK(appmodes_loaded());
+    CHECK(!appmodes_load(NULL, 0));
+    CHECK(appmodes_get(g_keys[0], &modes) && modes == APPMODE_KOREAN);
+
+    /* Same modes again does not change the snapshot */
+    CHECK(!appmodes_put(g_keys[0], APPMODE_KOREAN));
+    CHECK(appmodes_put(g_keys[0], APPMODE_COLEMAK));
+}
+
+/* A full table drops the least recently used, and a lookup counts as
+ * a use */
+static void TestEviction(void)
+{
+    BYTE modes;
+    int i;
+
+    appmodes_reset();
+    appmodes_load(NULL, 0);
+    for (i = 0; i < APPMODES_SLOTS; i++)
+        appmodes_put(g_keys[i], (BYTE)(i & 3));
+    CHECK(appmodes_get(g_keys[0], &modes));
+    appmodes_put(g_keys[APPMODES_SLOTS], 1);
+    CHECK(appmodes_get(g_keys[0], &modes));
+    CHECK(!appmodes_get(g_keys[1], &modes));
+
+    appmodes_reset();
+    appmodes_load(NULL, 0);
+    for (i = 0; i < APP_NAMES; i++)
+        appmodes_put(g_keys[i], (BYTE)(i & 3));
+    for (i = 0; i < APP_NAMES; i++) {
+        BOOL kept = appmodes_get(g_keys[i], &modes);
+
+        CHECK(kept == (i >= APP_NAMES - APPMODES_SLOTS));
+        if (kept)
+            CHECK(modes == (BYTE)(i & 3));
+    }
+}
+
+/* A snapshot loads back to the same table, in the same order */
+static void TestSnapshot(void)
+{
+    static BYTE snap[APPMODES_SNAPSHOT_MAX], again[APPMODES_SNAPSHOT_MAX];
+    DWORD size, size2;
+    BYTE modes;
+    int i;
+
+    size = appmodes_save(snap, sizeof(snap));
+    CHECK(size == APPMODES_SNAPSHOT_MAX);
+    appmodes_reset();
+    CHECK(appmodes_load(snap, size));
+    size2 = appmodes_save(again, sizeof(again));
+    CHECK(size2 == size && memcmp(snap, again, size) == 0);
+
+    for (i = APP_NAMES - APPMODES_SLOTS; i < APP_NAMES; i++)
+        CHECK(appmodes_get(g_keys[i], &modes) && modes == (BYTE)(i & 3));
+
+    /* A malformed snapshot starts empty */
+    snap[2]++;
+    appmodes_reset();
+    CHECK(appmodes_load(snap, size));
+    CHECK(!appmodes_get(g_keys[APP_NAMES - 1], &modes));
+    CHECK(appmodes_save(again, sizeof(again)) == 4);
+}
+
+/* Entries put before the load stay in front of the snapshot's; the
+ * snapshot's least recently used are the ones that do not fit */
+static void TestLoadOrder(void)
+{
+    static BYTE snap[APPMODES_SNAPSHOT_MAX], again[APPMODES_SNAPSHOT_MAX];
+    DWORD size;
+    BYTE modes;
+    int i;
+
+    appmodes_reset();
+    appmodes_load(NULL, 0);
+    appmodes_put(g_keys[2], 2);
+    appmodes_put(g_keys[1], 1);
+    size = appmodes_save(snap, sizeof(snap));
+    CHECK(size == 4 + 2 * 5);
+
+    appmodes_reset();
+    appmodes_put(g_keys[0], 3);
+    CHECK(appmodes_load(snap, size));
+    CHECK(appmodes_save(again, sizeof(again)) == 4 + 3 * 5);
+    CHECK(memcmp(again + 4, &g_keys[0], 4) == 0 && again[8] == 3);
+    CHECK(memcmp(again + 9, snap + 4, 10) == 0);
+
+    appmodes_reset();
+    appmodes_load(NULL, 0);
+    for (i = APPMODES_SLOTS; i > 0; i--)
+        appmodes_put(g_keys[i], 1);
+    size = appmodes_save(snap, sizeof(snap));
+    appmodes_reset();
+    appmodes_put(g_keys[0], 2);
+    CHECK(appmodes_load(snap, size));
+    CHECK(appmodes_get(g_keys[0], &modes) && modes == 2);
+    CHECK(appmodes_get(g_keys[1], &modes));
+    CHECK(!appmodes_get(g_keys[APPMODES_SLOTS], &modes));
+}
+
+/* A pid that no longer runs */
+static pid_t DeadPid(void)
+{
+    pid_t pid = fork();
+
+    if (pid == 0)
+        _exit(0);
+    waitpid(pid, NULL, 0);
+    return pid;
+}
+
+/* A lock left by a process that died is taken over and the table read
+ * again from the snapshot; a live owner is waited on, then skipped */
+static void TestDeadOwner(AppModesSection *t)
+{
+    static BYTE snap[APPMODES_SNAPSHOT_MAX], again[APPMODES_SNAPSHOT_MAX];
+    AppModesStats before, after;
+    DWORD size;
+    BYTE modes;
+
+    appmodes_reset();
+    appmodes_load(NULL, 0);
+    appmodes_put(g_keys[1], 1);
+    size = appmodes_save(snap, sizeof(snap));
+    appmodes_stats(&before);
+
+    t->lock = (LONG)DeadPid();
+    CHECK(appmodes_put(g_keys[0], 2));
+    CHECK(t->lock == 0);
+    CHECK(!appmodes_loaded());
+    CHECK(appmodes_save(again, sizeof(again)) == 0);
+
+    CHECK(appmodes_load(snap, size));
+    CHECK(appmodes_get(g_keys[0], &modes) && modes == 2);
+    CHECK(appmodes_get(g_keys[1], &modes) && modes == 1);
+
+    t->lock = (LONG)getpid();
+    CHECK(!appmodes_get(g_keys[0], &modes));
+    t->lock = 0;
+    CHECK(appmodes_get(g_keys[0], &modes));
+
+    appmodes_stats(&after);
+    CHECK(after.recoveries - before.recoveries == 1);
+    CHECK(after.lockFailures - before.lockFailures == 1);
+}
+
+int main(void)
+{
+    char shmName[64];
+    AppModesSection *t;
+    HANDLE handle;
+
+    snprintf(shmName, sizeof(shmName), "/kolemak-test.%ld", (long)getpid());
+    setenv("KOLEMAK_SHM", shmName, 1);
+
+    BuildKeys();
+    TestKeys();
+    TestLoad();
+    TestEviction();
+    TestSnapshot();
+    TestLoadOrder();
+
+    t = (AppModesSection *)shmsection_map("AppModes.v1",
+                                          sizeof(AppModesSection), &handle);
+    CHECK(t != NULL);
+    if (t) {
+        TestDeadOwner(t);
+        shmsection_unmap(t, sizeof(AppModesSection), handle);
+    }
+
+    appmodes_close();
+    appmodes_unlink();
+    CHECK_EXIT();
+}
@@ -0,0 +1,96 @@
+/*
+ * test_arena.c - Per-type accounting of the IME's objects (arena.h)
+ */
+
+#include <string.h>
+#include "arena.h"
+#include "check.h"
+
+/* Live and peak follow allocations and frees, per type */
+static void TestAccounting(void)
+{
+    ArenaStats st;
+    BYTE *a, *b;
+    void *c;
+
+    a = (BYTE *)arena_alloc(ARENA_TEXT_SERVICE, 100);
+    b = (BYTE *)arena_alloc(ARENA_TEXT_SERVICE, 50);
+    c = arena_alloc(ARENA_LANGBAR_BUTTON, 30);
+    CHECK(a && b && c);
+    CHECK(a[0] == 0 && a[99] == 0);
+    CHECK(((size_t)a & 15) == ((size_t)b & 15));
+
+    arena_stats(ARENA_TEXT_SERVICE, &st);
+    CHECK(st.live == 2 && st.bytes == 150);
+    CHECK(st.peakLive == 2 && st.peakBytes == 150);
+    CHECK(st.allocs == 2);
+
+    arena_free(a);
+    arena_stats(ARENA_TEXT_SERVICE, &st);
+    CHECK(st.live == 1 && st.bytes == 50);
+    CHECK(st.peakLive == 2 && st.peakBytes == 150);
+
+    /* A smaller allocation does not move the peak */
+    a = (BYTE *)arena_alloc(ARENA_TEXT_SERVICE, 10);
+    arena_stats(ARENA_TEXT_SERVICE, &st);
+    CHECK(st.live == 2 && st.bytes == 60);
+    CHECK(st.peakLive == 2 && st.peakBytes == 150);
+    CHECK(st.allocs == 3);
+
+    arena_stats(ARENA_LANGBAR_BUTTON, &st);
+    CHECK(st.live == 1 && st.bytes == 30 && st.peakBytes == 30);
+
+    arena_free(a);
+    arena_free(b);
+    arena_free(c);
+    arena_free(NULL);
+    arena_stats(ARENA_TEXT_SERVICE, &st);
+    CHECK(st.live == 0 && st.bytes == 0);
+    arena_stats(ARENA_LANGBAR_BUTTON, &st);
+    CHECK(st.live == 0 && st.bytes == 0);
+}
+
+/* Held objects are live without bytes of their own */
+static void TestHold(void)
+{
+    ArenaStats st;
+
+    arena_hold(ARENA_EDIT_SESSION);
+    arena_hold(ARENA_EDIT_SESSION);
+    arena_hold(ARENA_TYPES);
+    arena_stats(ARENA_EDIT_SESSION, &st);
+    CHECK(st.live == 2 && st.bytes == 0 && st.peakBytes == 0);
+    arena_unhold(ARENA_EDIT_SESSION);
+    arena_unhold(ARENA_EDIT_SESSION);
+    arena_stats(ARENA_EDIT_SESSION, &st);
+    CHECK(st.live == 0 && st.peakLive == 2 && st.allocs == 2);
+}
+
+/* ARENA_TYPES sums every type; an unknown type allocates nothing */
+static void TestTotal(void)
+{
+    ArenaStats st;
+    void *p;
+
+    CHECK(arena_alloc(ARENA_TYPES, 8) == NULL);
+    p = arena_alloc(ARENA_SCANCODE_MAP, 20);
+    arena_stats(ARENA_TYPES, &st);
+    CHECK(st.live == 1 && st.bytes == 20);
+    CHECK(st.peakLive == 2 + 2 + 1 + 1);
+    CHECK(st.peakBytes == 150 + 30 + 20);
+    CHECK(st.allocs == 3 + 1 + 2 + 1);
+    arena_free(p);
+
+    CHECK(strcmp(arena_type_name(ARENA_EDIT_SESSION), "EditSession") == 0);
+    CHECK(strcmp(arena_type_name(ARENA_TYPES), "total") == 0);
+}
+
+int main(void)
+{
+    arena_open();
+    TestAccounting();
+    TestHold();
+    TestTotal();
+    arena_close();
+    CHECK_EXIT();
+}
@@ -0,0 +1,211 @@
+/*
+ * test_broker.c - Election and handoff of session roles (broker.h)
+ *
+ * Brokers for one role in the same process compete like brokers in
+ * different processes; a forked child stands in for a process that
+ * crashes while it owns the role.
+ */
+
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "broker.h"
+#include "check.h"
+#include "host_util.h"
+#include "shmsection.h"
+
+#define WAIT_NS 2000000000ULL
+
+/* Who serves a role; shared with forked children */
+typedef struct {
+    volatile LONG serving;      /* brokers between elect and resign */
+    volatile LONG elected;
+    volatile LONG resigned;
+    volatile LONG refuse;       /* elect fails this many more times */
+    volatile LONG overlaps;     /* elected while another served */
+} Board;
+
+static Board *g_boards;
+
+static BOOL Elect(void *ctx)
+{
+    Board *b = (Board *)ctx;
+
+    if (b->refuse > 0) {
+        InterlockedDecrement(&b->refuse);
+        return FALSE;
+    }
+    if (InterlockedIncrement(&b->serving) != 1)
+        InterlockedIncrement(&b->overlaps);
+    InterlockedIncrement(&b->elected);
+    return TRUE;
+}
+
+static void Resign(void *ctx)
+{
+    Board *b = (Board *)ctx;
+
+    InterlockedDecrement(&b->serving);
+    InterlockedIncrement(&b->resigned);
+}
+
+/* The names llhook.c and tray.c use */
+static BrokerRole g_hook = { "LLHookMutex", Elect, Resign, NULL };
+static BrokerRole g_tray = { "TrayMutex", Elect, Resign, NULL };
+
+/* Until one of the brokers owns the role; that one, or NULL */
+static Broker *WaitOwner(Broker *const *brokers, int count)
+{
+    unsigned long long start = Host_NowNs();
+    int i;
+
+    do {
+        for (i = 0; i < count; i++) {
+            if (brokers[i] && broker_is_owner(brokers[i]))
+                return brokers[i];
+        }
+        usleep(200);
+    } while (Host_NowNs() - start < WAIT_NS);
+    return NULL;
+}
+
+static BOOL WaitElected(const Board *b, LONG elected)
+{
+    unsigned long long start = Host_NowNs();
+
+    while (b->elected < elected) {
+        if (Host_NowNs() - start > WAIT_NS)
+            return FALSE;
+        usleep(200);
+    }
+    return TRUE;
+}
+
+/* One of three owns the role; stopping the owner hands it to exactly
+ * one of the others */
+static void TestHandoff(void)
+{
+    Board *b = &g_boards[0];
+    Broker *brokers[3], *owner, *next;
+    BrokerStats st;
+    int i, n;
+
+    for (i = 0; i < 3; i++) {
+        brokers[i] = broker_start(&g_hook);
+        CHECK(brokers[i] != NULL);
+    }
+
+    for (n = 0; n < 3; n++) {
+        owner = WaitOwner(brokers, 3);
+        CHECK(owner != NULL);
+        CHECK(b->serving == 1 && b->elected == n + 1);
+        broker_stats(owner, &st);
+        CHECK(st.elections == 1 && st.takeovers == 0);
+
+        for (i = 0; i < 3; i++) {
+            if (brokers[i] == owner)
+                brokers[i] = NULL;
+        }
+        broker_stop(owner);
+        CHECK(b->resigned == n + 1);
+        if (n < 2) {
+            next = WaitOwner(brokers, 3);
+            CHECK(next != NULL && next != owner);
+        }
+    }
+    CHECK(b->serving == 0 && b->overlaps == 0);
+
+    broker_stop(NULL);
+    broker_stats(NULL, &st);
+    CHECK(st.elections == 0);
+}
+
+/* A broker whose elect fails passes the role on and stops competing */
+static void TestRefuse(void)
+{
+    Board *b = &g_boards[1];
+    Broker *brokers[2];
+
+    b->refuse = 1;
+    brokers[0] = broker_start(&g_hook);
+    brokers[1] = broker_start(&g_hook);
+    CHECK(WaitOwner(brokers, 2) != NULL);
+    CHECK(b->refuse == 0 && b->elected == 1 && b->serving == 1);
+    CHECK(broker_is_owner(brokers[0]) != broker_is_owner(brokers[1]));
+    broker_stop(brokers[0]);
+    broker_stop(brokers[1]);
+    CHECK(b->serving == 0);
+}
+
+/* The LL hook and the tray icon are elected independently: a process
+ * can hold one while another holds the other, and a crash of a process
+ * holding both hands each on */
+static void TestCrash(void)
+{
+    Board *hook = &g_boards[2], *tray = &g_boards[3];
+    Broker *waiting[2];
+    BrokerStats st;
+    pid_t child;
+
+    child = fork();
+    if (child == 0) {
+        broker_start(&g_hook);
+        broker_start(&g_tray);
+        for (;;)
+            pause();
+    }
+    CHECK(WaitElected(hook, 1) && WaitElected(tray, 1));
+
+    waiting[0] = broker_start(&g_hook);
+    waiting[1] = broker_start(&g_tray);
+    usleep(20000);
+    CHECK(!broker_is_owner(waiting[0]) && !broker_is_owner(waiting[1]));
+
+    /* Killed while serving: resign never runs, the mutexes are
+     * abandoned.  Its turn is over as of the kill. */
+    hook->serving = 0;
+    tray->serving = 0;
+    kill(child, SIGKILL);
+    waitpid(child, NULL, 0);
+
+    CHECK(WaitElected(hook, 2) && WaitElected(tray, 2));
+    CHECK(broker_is_owner(waiting[0]) && broker_is_owner(waiting[1]));
+    broker_stats(waiting[0], &st);
+    CHECK(st.elections == 1 && st.takeovers == 1);
+    broker_stats(waiting[1], &st);
+    CHECK(st.elections == 1 && st.takeovers == 1);
+
+    /* Gave up one role only */
+    broker_stop(waiting[1]);
+    CHECK(broker_is_owner(waiting[0]));
+    broker_stop(waiting[0]);
+    CHECK(hook->overlaps == 0 && tray->overlaps == 0);
+}
+
+int main(void)
+{
+    char shmName[64];
+
+    snprintf(shmName, sizeof(shmName), "/kolemak-test.%ld", (long)getpid());
+    setenv("KOLEMAK_SHM", shmName, 1);
+
+    g_boards = (Board *)mmap(NULL, 4 * sizeof(Board),
+                             PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (g_boards == MAP_FAILED)
+        return 2;
+
+    g_hook.ctx = &g_boards[0];
+    TestHandoff();
+    g_hook.ctx = &g_boards[1];
+    TestRefuse();
+    g_hook.ctx = &g_boards[2];
+    g_tray.ctx = &g_boards[3];
+    TestCrash();
+
+    shmsection_unlink(g_hook.name);
+    shmsection_unlink(g_tray.name);
+    CHECK_EXIT();
+}
@@ -0,0 +1,111 @@
+/*
+ * test_hangul.c - The transition table against the reference engine
+ *
+ * hangul.c builds its table from the reference engine, assuming the
+ * carried cho/jung never change a transition.  This runs both engines
+ * from every reachable composition (every node, with every value of the
+ * indices it carries) on every input and compares what they return and
+ * the composition they leave.  The engine is included, not linked, to
+ * reach the reference functions.
+ */
+
+#include "check.h"
+#include "hangul.c"
+
+/* The first few differences in full, then a count */
+#define REPORT_MAX 10
+
+static unsigned long g_steps;
+
+static BOOL SameResult(HangulResult a, HangulResult b)
+{
+    return a.type == b.type && a.commit1 == b.commit1 &&
+           a.commit2 == b.commit2 && a.compose == b.compose;
+}
+
+static BOOL SameContext(const HangulContext *a, const HangulContext *b)
+{
+    return a->state == b->state && a->cho == b->cho &&
+           a->jung == b->jung && a->jong == b->jong;
+}
+
+/* Every input (19 consonants, 21 vowels, backspace) from ctx */
+static void CompareFrom(const HangulContext *ctx)
+{
+    int input;
+
+    for (input = 0; input < DFA_INPUTS; input++) {
+        HangulContext dfa = *ctx, ref = *ctx;
+        HangulResult rd, rr;
+
+        if (input == DFA_INPUT_BS) {
+            if (ctx->state == HANGUL_STATE_EMPTY)
+                continue;
+            rd = hangul_ic_backspace(&dfa);
+            rr = ref_ic_backspace(&ref);
+        } else if (input < 19) {
+            rd = hangul_ic_process(&dfa, input, -1);
+            rr = ref_ic_process(&ref, input, -1);
+        } else {
+            rd = hangul_ic_process(&dfa, -1, input - 19);
+            rr = ref_ic_process(&ref, -1, input - 19);
+        }
+        g_steps++;
+
+        if (SameResult(rd, rr) && SameContext(&dfa, &ref))
+            continue;
+        if (g_checkFailures < REPORT_MAX)
+            fprintf(stderr,
+                    "state %d cho %d jung %d jong %d, input %d:\n"
+                    "  table     %d %04X %04X %04X -> %d %d %d %d\n"
+                    "  reference %d %04X %04X %04X -> %d %d %d %d\n",
+                    ctx->state, ctx->cho, ctx->jung, ctx->jong, input,
+                    rd.type, rd.commit1, rd.commit2, rd.compose,
+                    dfa.state, dfa.cho, dfa.jung, dfa.jong,
+                    rr.type, rr.commit1, rr.commit2, rr.compose,
+                    ref.state, ref.cho, ref.jung, ref.jong);
+        CHECK(SameResult(rd, rr));
+        CHECK(SameContext(&dfa, &ref));
+    }
+}
+
+int main(void)
+{
+    HangulContext ctx;
+    int node, cho, jung, nodes = 0;
+
+    for (node = 0; node < DFA_NODES; node++) {
+        if (!dfa_node_context(node, 0, &ctx))
+            continue;
+        nodes++;
+        CHECK(dfa_node(&ctx) == node);
+
+        switch (ctx.state) {
+        case HANGUL_STATE_JUNGSEONG:
+            for (cho = 0; cho < 19; cho++) {
+                ctx.cho = cho;
+                CompareFrom(&ctx);
+            }
+            break;
+        case HANGUL_STATE_JONGSEONG:
+            for (cho = 0; cho < 19; cho++) {
+                for (jung = 0; jung < 21; jung++) {
+                    ctx.cho = cho;
+                    ctx.jung = jung;
+                    CompareFrom(&ctx);
+                }
+            }
+            break;
+        default:
+            /* EMPTY and CHOSEONG carry nothing */
+            CompareFrom(&ctx);
+            break;
+        }
+    }
+
+    /* EMPTY, 19 consonants, 11 composite consonants, 21 vowels and 27
+     * final consonants */
+    CHECK(nodes == 79);
+    printf("%d nodes, %lu transitions\n", nodes, g_steps);
+    CHECK_EXIT();
+}
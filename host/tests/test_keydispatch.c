@@ -0,0 +1,255 @@
+/*
+ * test_keydispatch.c - Dispatch tables against the original key ladder
+ *
+ * The tables (keydispatch.h) stand in for the if-chains the key event
+ * sink ran on every key, ShouldEatKey and KES_OnKeyDown.  Those chains
+ * are kept below as they were, with the edit sessions and SendInput
+ * calls replaced by the action they amount to, and compared with the
+ * tables for every VK, mode set, composition state, modifier state,
+ * Shift and CapsLock.
+ */
+
+#include "check.h"
+#include "keydispatch.h"
+#include "keymap.h"
+
+/* The first few differences in full, then a count */
+#define REPORT_MAX 10
+
+typedef struct {
+    BOOL koreanMode;
+    BOOL colemakMode;
+    BOOL semicolonSwap;
+    BOOL capsLockAsBackspace;
+    BOOL capsLockOn;
+    BOOL composing;
+    BOOL modHeld;           /* Ctrl, Alt or Win */
+} LadderState;
+
+/* What the original OnKeyDown did with a key */
+typedef struct {
+    KeyActionType action;
+    JamoMapping   jamo;     /* KEY_ACTION_JAMO */
+    WCHAR         ch;       /* KEY_ACTION_CHAR / KEY_ACTION_FLUSH_CHAR */
+} LadderResult;
+
+/* ===== The original ladder ===== */
+
+static BOOL LadderShouldEat(const LadderState *ts, UINT vk)
+{
+    if (vk == VK_F13)
+        return TRUE;
+    if (ts->capsLockAsBackspace && vk == VK_CAPITAL)
+        return TRUE;
+    if (ts->modHeld) {
+        if (ts->koreanMode && ts->composing)
+            return TRUE;
+        return FALSE;
+    }
+    if (!ts->colemakMode && !ts->koreanMode)
+        return FALSE;
+    if (vk >= 'A' && vk <= 'Z')
+        return TRUE;
+    if (vk == VK_OEM_1) {
+        if (ts->colemakMode && !ts->koreanMode)
+            return TRUE;
+        if (ts->koreanMode && ts->colemakMode && ts->semicolonSwap)
+            return TRUE;
+    }
+    if (vk == VK_BACK && ts->composing)
+        return TRUE;
+    if (ts->composing) {
+        if (vk == VK_SHIFT || vk == VK_LSHIFT || vk == VK_RSHIFT)
+            return TRUE;
+    }
+    if (ts->composing) {
+        if (vk == VK_RETURN || vk == VK_ESCAPE)
+            return TRUE;
+    }
+    if (ts->composing) {
+        if (vk == VK_LEFT || vk == VK_RIGHT || vk == VK_UP || vk == VK_DOWN ||
+            vk == VK_HOME || vk == VK_END || vk == VK_DELETE || vk == VK_TAB)
+            return TRUE;
+    }
+    if (ts->composing &&
+        vk != VK_CONTROL && vk != VK_LCONTROL && vk != VK_RCONTROL &&
+        vk != VK_MENU && vk != VK_LMENU && vk != VK_RMENU &&
+        vk != VK_LWIN && vk != VK_RWIN)
+        return TRUE;
+    return FALSE;
+}
+
+/* HandleEnglishKey: TRUE if it sent a character */
+static BOOL LadderEnglishKey(const LadderState *ts, UINT vk, BOOL shift,
+                             WCHAR *ch)
+{
+    if (ts->capsLockOn && ((vk >= 'A' && vk <= 'Z') || vk == VK_OEM_1))
+        shift = !shift;
+    return keymap_get_colemak(vk, shift, ch);
+}
+
+static LadderResult LadderKeyDown(const LadderState *ts, UINT vk, BOOL shift)
+{
+    LadderResult r;
+
+    r.action = KEY_ACTION_PASS;
+    r.jamo.cho = r.jamo.jung = -1;
+    r.ch = 0;
+
+    if (vk == VK_F13 || (ts->capsLockAsBackspace && vk == VK_CAPITAL)) {
+        r.action = KEY_ACTION_CAPSLOCK;
+        return r;
+    }
+    if (vk == VK_SHIFT || vk == VK_LSHIFT || vk == VK_RSHIFT) {
+        r.action = ts->composing ? KEY_ACTION_SWALLOW : KEY_ACTION_PASS;
+        return r;
+    }
+    if (vk == VK_BACK && ts->composing) {
+        r.action = KEY_ACTION_BACKSPACE;
+        return r;
+    }
+    if (vk == VK_RETURN && ts->composing) {
+        r.action = KEY_ACTION_ENTER;
+        return r;
+    }
+    if (vk == VK_ESCAPE && ts->composing) {
+        r.action = KEY_ACTION_FLUSH;
+        return r;
+    }
+    if ((vk == VK_LEFT || vk == VK_RIGHT || vk == VK_UP || vk == VK_DOWN ||
+         vk == VK_HOME || vk == VK_END || vk == VK_DELETE || vk == VK_TAB) &&
+        ts->composing) {
+        r.action = KEY_ACTION_FLUSH_REINJECT;
+        return r;
+    }
+    if (ts->koreanMode && ts->composing &&
+        !(vk >= 'A' && vk <= 'Z') &&
+        vk != VK_OEM_1 &&
+        vk != VK_BACK &&
+        vk != VK_SHIFT && vk != VK_LSHIFT && vk != VK_RSHIFT &&
+        vk != VK_CONTROL && vk != VK_LCONTROL && vk != VK_RCONTROL &&
+        vk != VK_MENU && vk != VK_LMENU && vk != VK_RMENU &&
+        vk != VK_LWIN && vk != VK_RWIN) {
+        r.action = KEY_ACTION_FLUSH_REINJECT;
+        return r;
+    }
+    if (ts->modHeld) {
+        r.action = (ts->koreanMode && ts->composing) ? KEY_ACTION_FLUSH_PASS
+                                                     : KEY_ACTION_PASS;
+        return r;
+    }
+
+    if (ts->koreanMode) {
+        /* HandleKoreanKey */
+        r.jamo = keymap_get_jamo(vk, shift,
+                                 ts->colemakMode && ts->semicolonSwap);
+        if (r.jamo.cho >= 0 || r.jamo.jung >= 0) {
+            r.action = KEY_ACTION_JAMO;
+            return r;
+        }
+        if (ts->colemakMode && vk >= 'A' && vk <= 'Z' &&
+            LadderEnglishKey(ts, vk, shift, &r.ch)) {
+            r.action = ts->composing ? KEY_ACTION_FLUSH_CHAR : KEY_ACTION_CHAR;
+            return r;
+        }
+        r.action = ts->composing ? KEY_ACTION_FLUSH_PASS : KEY_ACTION_PASS;
+        return r;
+    }
+    if (ts->colemakMode && LadderEnglishKey(ts, vk, shift, &r.ch))
+        r.action = KEY_ACTION_CHAR;
+    return r;
+}
+
+/* ===== Comparison ===== */
+
+static BYTE Modes(const LadderState *ts)
+{
+    BYTE modes = 0;
+
+    if (ts->koreanMode)          modes |= KEYDISPATCH_KOREAN;
+    if (ts->colemakMode)         modes |= KEYDISPATCH_COLEMAK;
+    if (ts->semicolonSwap)       modes |= KEYDISPATCH_SEMISWAP;
+    if (ts->capsLockAsBackspace) modes |= KEYDISPATCH_CAPS_BACKSPACE;
+    return modes;
+}
+
+static void Report(const LadderState *ts, UINT vk, BOOL shift,
+                   const KeyAction *ka, const LadderResult *r)
+{
+    if (g_checkFailures >= REPORT_MAX)
+        return;
+    fprintf(stderr, "modes %02X composing %d mod %d caps %d vk %02X shift %d: "
+            "table %d/%02X ladder %d\n", Modes(ts), ts->composing,
+            ts->modHeld, ts->capsLockOn, vk, shift, ka->action, ka->flags,
+            r->action);
+}
+
+static void CompareKey(const KeyDispatch *kd, const LadderState *ts,
+                       UINT vk, BOOL shift)
+{
+    const KeyAction *ka = keydispatch_lookup(kd, vk, ts->composing,
+                                             ts->modHeld);
+    LadderResult r = LadderKeyDown(ts, vk, shift);
+    KeyActionType action = (KeyActionType)ka->action;
+    BOOL eat = (ka->flags & KEY_FLAG_EAT) != 0;
+    BOOL same = eat == LadderShouldEat(ts, vk);
+    int s = shift;
+    WCHAR ch;
+
+    /* Keys that only type a character are now written along with the
+     * flushed syllable instead of re-injected: the same text */
+    if (action == KEY_ACTION_FLUSH_INSERT) {
+        action = KEY_ACTION_FLUSH_REINJECT;
+        same = same && keymap_get_us_symbol(vk, shift, &ch) &&
+               ka->ch[s] == ch;
+    }
+    same = same && action == r.action;
+
+    if (same && action == KEY_ACTION_JAMO)
+        same = ka->cho[s] == r.jamo.cho && ka->jung[s] == r.jamo.jung;
+    if (same && (action == KEY_ACTION_CHAR ||
+                 action == KEY_ACTION_FLUSH_CHAR)) {
+        if (ts->capsLockOn && (ka->flags & KEY_FLAG_CAPS))
+            s = !s;
+        same = ka->ch[s] == r.ch;
+    }
+
+    if (!same)
+        Report(ts, vk, shift, ka, &r);
+    CHECK(same);
+}
+
+int main(void)
+{
+    KeyDispatch kd;
+    LadderState ts;
+    int modes, t, caps, shift;
+    UINT vk;
+    unsigned long keys = 0;
+
+    for (modes = 0; modes < 16; modes++) {
+        keydispatch_build(&kd, (BYTE)modes);
+        ts.koreanMode = (modes & KEYDISPATCH_KOREAN) != 0;
+        ts.colemakMode = (modes & KEYDISPATCH_COLEMAK) != 0;
+        ts.semicolonSwap = (modes & KEYDISPATCH_SEMISWAP) != 0;
+        ts.capsLockAsBackspace = (modes & KEYDISPATCH_CAPS_BACKSPACE) != 0;
+
+        for (t = 0; t < KEYDISPATCH_TABLES; t++) {
+            ts.composing = (t & 1) != 0;
+            ts.modHeld = (t & 2) != 0;
+
+            for (caps = 0; caps < 2; caps++) {
+                ts.capsLockOn = caps;
+                for (vk = 0; vk < 256; vk++) {
+                    for (shift = 0; shift < 2; shift++) {
+                        CompareKey(&kd, &ts, vk, shift);
+                        keys++;
+                    }
+                }
+            }
+        }
+    }
+
+    printf("%lu keys\n", keys);
+    CHECK_EXIT();
+}
@@ -0,0 +1,159 @@
+/*
+ * test_lldecide.c - The LL hook's decision for each key (lldecide.h)
+ */
+
+#include "check.h"
+#include "keymap.h"
+#include "lldecide.h"
+
+/* IME active in the foreground, default settings */
+static const LLDecideInput g_active = {
+    TRUE, FALSE, TRUE, TRUE, VK_SPACE, TF_MOD_WIN
+};
+
+static BYTE Key(LLDecideState *st, const LLDecideInput *in, UINT vk,
+                BOOL up, LLDecision *d)
+{
+    lldecide_key(st, in, vk, 0, FALSE, up, FALSE, d);
+    return d->action;
+}
+
+/* Win+E is remapped to its Colemak key, and the injected key is
+ * released by E's key-up even after Win went up first */
+static void TestRemap(void)
+{
+    LLDecideState st;
+    LLDecision d;
+    UINT to = keymap_get_colemak_vk('E');
+
+    CHECK(to != 'E');
+    lldecide_reset(&st, 0);
+    CHECK(Key(&st, &g_active, VK_LWIN, FALSE, &d) == LLDECIDE_PASS);
+    CHECK(Key(&st, &g_active, 'E', FALSE, &d) == LLDECIDE_REMAP);
+    CHECK(d.vk == to);
+    CHECK(Key(&st, &g_active, VK_LWIN, TRUE, &d) == LLDECIDE_PASS);
+    CHECK(Key(&st, &g_active, 'E', TRUE, &d) == LLDECIDE_RELEASE);
+    CHECK(d.vk == to);
+    CHECK(Key(&st, &g_active, 'E', TRUE, &d) == LLDECIDE_PASS);
+
+    /* A key Colemak leaves in place, and typing without Win */
+    Key(&st, &g_active, VK_RWIN, FALSE, &d);
+    CHECK(Key(&st, &g_active, 'A', FALSE, &d) == LLDECIDE_PASS);
+    CHECK(Key(&st, &g_active, 'A', TRUE, &d) == LLDECIDE_PASS);
+    Key(&st, &g_active, VK_RWIN, TRUE, &d);
+    CHECK(Key(&st, &g_active, 'E', FALSE, &d) == LLDECIDE_PASS);
+    CHECK(Key(&st, &g_active, 'E', TRUE, &d) == LLDECIDE_PASS);
+}
+
+/* Win+Space toggles once per press, however long it auto-repeats */
+static void TestToggle(void)
+{
+    LLDecideState st;
+    LLDecision d;
+
+    lldecide_reset(&st, MODSTATE_LWIN);
+    CHECK(Key(&st, &g_active, VK_SPACE, FALSE, &d) == LLDECIDE_TOGGLE);
+    CHECK(!d.colemakMode);
+    CHECK(Key(&st, &g_active, VK_SPACE, FALSE, &d) != LLDECIDE_TOGGLE);
+    CHECK(Key(&st, &g_active, VK_SPACE, TRUE, &d) == LLDECIDE_PASS);
+    CHECK(Key(&st, &g_active, VK_SPACE, FALSE, &d) == LLDECIDE_TOGGLE);
+    Key(&st, &g_active, VK_SPACE, TRUE, &d);
+
+    /* Other modifiers held: not the hotkey */
+    Key(&st, &g_active, VK_LSHIFT, FALSE, &d);
+    CHECK(Key(&st, &g_active, VK_SPACE, FALSE, &d) == LLDECIDE_PASS);
+}
+
+/* Nothing is eaten where the IME is not active, or in QWERTY mode
+ * unless it is the toggle */
+static void TestInactive(void)
+{
+    LLDecideInput in = g_active;
+    LLDecideState st;
+    LLDecision d;
+
+    in.imeActive = FALSE;
+    lldecide_reset(&st, MODSTATE_LWIN);
+    CHECK(Key(&st, &in, 'E', FALSE, &d) == LLDECIDE_PASS);
+    CHECK(Key(&st, &in, VK_SPACE, FALSE, &d) == LLDECIDE_PASS);
+    CHECK(Key(&st, &in, 'E', TRUE, &d) == LLDECIDE_PASS);
+
+    in = g_active;
+    in.colemakMode = FALSE;
+    lldecide_reset(&st, MODSTATE_LWIN);
+    CHECK(Key(&st, &in, 'E', FALSE, &d) == LLDECIDE_PASS);
+    CHECK(Key(&st, &in, VK_SPACE, FALSE, &d) == LLDECIDE_TOGGLE);
+    CHECK(d.colemakMode);
+
+    in = g_active;
+    in.winKeyRemap = FALSE;
+    lldecide_reset(&st, MODSTATE_LWIN);
+    CHECK(Key(&st, &in, 'E', FALSE, &d) == LLDECIDE_PASS);
+}
+
+/* The capturing dialog gets every Win+key with its modifiers, even
+ * where the IME is not active */
+static void TestCapture(void)
+{
+    LLDecideInput in = g_active;
+    LLDecideState st;
+    LLDecision d;
+
+    in.capturing = TRUE;
+    in.imeActive = FALSE;
+    lldecide_reset(&st, MODSTATE_LWIN | MODSTATE_RCTRL);
+    CHECK(Key(&st, &in, 'K', FALSE, &d) == LLDECIDE_CAPTURE);
+    CHECK(d.vk == 'K');
+    CHECK(d.mods == (TF_MOD_WIN | TF_MOD_CONTROL));
+    CHECK(Key(&st, &in, 'K', TRUE, &d) == LLDECIDE_PASS);
+}
+
+/* Injected events only move the modifiers */
+static void TestInjected(void)
+{
+    LLDecideState st;
+    LLDecision d;
+
+    lldecide_reset(&st, 0);
+    lldecide_key(&st, &g_active, VK_LWIN, 0, FALSE, FALSE, TRUE, &d);
+    CHECK(d.action == LLDECIDE_PASS);
+    lldecide_key(&st, &g_active, 'E', 0, FALSE, FALSE, TRUE, &d);
+    CHECK(d.action == LLDECIDE_PASS);
+    CHECK(st.mods.down == MODSTATE_LWIN);
+    CHECK(Key(&st, &g_active, 'E', FALSE, &d) == LLDECIDE_REMAP);
+}
+
+/* Win released on the secure desktop (Win+L): the hook never sees the
+ * key-up, and until the modifiers are resynced from the OS every letter
+ * would be taken for a Win shortcut.  A resync keeps the release of a
+ * key remapped before. */
+static void TestMissedWinUp(void)
+{
+    LLDecideState st;
+    LLDecision d;
+    UINT to = keymap_get_colemak_vk('E');
+
+    lldecide_reset(&st, 0);
+    Key(&st, &g_active, VK_LWIN, FALSE, &d);
+    CHECK(Key(&st, &g_active, 'L', FALSE, &d) != LLDECIDE_TOGGLE);
+    Key(&st, &g_active, 'L', TRUE, &d);
+    CHECK(Key(&st, &g_active, 'E', FALSE, &d) == LLDECIDE_REMAP);
+
+    /* Back on the desktop: Win is up, E still down */
+    modstate_reset(&st.mods, 0);
+    CHECK(Key(&st, &g_active, 'E', TRUE, &d) == LLDECIDE_RELEASE);
+    CHECK(d.vk == to);
+    CHECK(Key(&st, &g_active, 'R', FALSE, &d) == LLDECIDE_PASS);
+    CHECK(Key(&st, &g_active, 'R', TRUE, &d) == LLDECIDE_PASS);
+}
+
+int main(void)
+{
+    TestRemap();
+    TestToggle();
+    TestInactive();
+    TestCapture();
+    TestInjected();
+    TestMissedWinUp();
+    CHECK_EXIT();
+}
@@ -0,0 +1,117 @@
+/*
+ * test_modstate.c - Modifier tracking from key events (modstate.h)
+ */
+
+#include "check.h"
+#include "keydispatch.h"
+#include "modstate.h"
+
+#define SCAN_LSHIFT 0x2A
+#define SCAN_RSHIFT 0x36
+
+/* Sided keys, as WH_KEYBOARD_LL reports them */
+static void TestSided(void)
+{
+    ModState ms;
+
+    modstate_reset(&ms, 0);
+    CHECK(modstate_key(&ms, VK_LSHIFT, SCAN_LSHIFT, FALSE, FALSE));
+    CHECK(modstate_key(&ms, VK_RSHIFT, SCAN_RSHIFT, FALSE, FALSE));
+    CHECK(ms.down == MODSTATE_SHIFT);
+
+    /* One Shift released while the other is held keeps Shift down */
+    modstate_key(&ms, VK_LSHIFT, SCAN_LSHIFT, FALSE, TRUE);
+    CHECK(ms.down == MODSTATE_RSHIFT);
+    CHECK(ms.down & MODSTATE_SHIFT);
+
+    modstate_key(&ms, VK_LWIN, 0, TRUE, FALSE);
+    modstate_key(&ms, VK_RMENU, 0, TRUE, FALSE);
+    CHECK(ms.down == (MODSTATE_RSHIFT | MODSTATE_LWIN | MODSTATE_RALT));
+    modstate_key(&ms, VK_RSHIFT, SCAN_RSHIFT, FALSE, TRUE);
+    modstate_key(&ms, VK_LWIN, 0, TRUE, TRUE);
+    modstate_key(&ms, VK_RMENU, 0, TRUE, TRUE);
+    CHECK(ms.down == 0);
+}
+
+/* Generic keys, as key messages report them: the side comes from the
+ * scan code (Shift) or the extended flag (Ctrl, Alt) */
+static void TestGeneric(void)
+{
+    ModState ms;
+
+    modstate_reset(&ms, 0);
+    modstate_key(&ms, VK_SHIFT, SCAN_RSHIFT, FALSE, FALSE);
+    CHECK(ms.down == MODSTATE_RSHIFT);
+    modstate_key(&ms, VK_SHIFT, SCAN_LSHIFT, FALSE, FALSE);
+    CHECK(ms.down == MODSTATE_SHIFT);
+
+    modstate_key(&ms, VK_CONTROL, 0x1D, TRUE, FALSE);
+    modstate_key(&ms, VK_MENU, 0x38, FALSE, FALSE);
+    CHECK(ms.down == (MODSTATE_SHIFT | MODSTATE_RCTRL | MODSTATE_LALT));
+
+    /* lParam: scan code in bits 16-23, extended in bit 24 */
+    modstate_message(&ms, VK_CONTROL, (LPARAM)((1 << 24) | (0x1D << 16)),
+                     TRUE);
+    CHECK(!(ms.down & MODSTATE_CTRL));
+    modstate_message(&ms, VK_SHIFT, (LPARAM)(SCAN_RSHIFT << 16), TRUE);
+    CHECK(ms.down == (MODSTATE_LSHIFT | MODSTATE_LALT));
+}
+
+static void TestOtherKeys(void)
+{
+    ModState ms;
+
+    modstate_reset(&ms, MODSTATE_LCTRL | MODSTATE_RWIN);
+    CHECK(ms.down == (MODSTATE_LCTRL | MODSTATE_RWIN));
+    CHECK(!modstate_key(&ms, 'A', 0x1E, FALSE, FALSE));
+    CHECK(!modstate_key(&ms, VK_SPACE, 0x39, FALSE, TRUE));
+    CHECK(ms.down == (MODSTATE_LCTRL | MODSTATE_RWIN));
+
+    /* A key-up never seen down changes nothing else */
+    modstate_key(&ms, VK_LMENU, 0x38, FALSE, TRUE);
+    CHECK(ms.down == (MODSTATE_LCTRL | MODSTATE_RWIN));
+}
+
+/* Ctrl released while another window had focus: the key-up never
+ * arrives, so the tracker still holds Ctrl and would pass the next key
+ * as a shortcut until the owner resyncs from the OS on focus
+ * (KeyHandler_SyncModifiers) */
+static void TestMissedKeyUp(void)
+{
+    KeyDispatch kd;
+    ModState ms;
+    const KeyAction *ka;
+
+    keydispatch_build(&kd, KEYDISPATCH_KOREAN | KEYDISPATCH_COLEMAK);
+    modstate_reset(&ms, 0);
+    modstate_key(&ms, VK_LCONTROL, 0x1D, FALSE, FALSE);
+    CHECK(ms.down == MODSTATE_LCTRL);
+
+    ka = keydispatch_lookup(&kd, 'D', FALSE,
+                            ms.down & (MODSTATE_CTRL | MODSTATE_ALT | MODSTATE_WIN));
+    CHECK(ka->action == KEY_ACTION_PASS);
+    CHECK(!(ka->flags & KEY_FLAG_EAT));
+
+    /* Focus returns with Ctrl up in the OS */
+    modstate_reset(&ms, 0);
+    ka = keydispatch_lookup(&kd, 'D', FALSE,
+                            ms.down & (MODSTATE_CTRL | MODSTATE_ALT | MODSTATE_WIN));
+    CHECK(ka->action == KEY_ACTION_JAMO);
+    CHECK(ka->flags & KEY_FLAG_EAT);
+
+    /* A modifier still held in the OS survives the resync */
+    modstate_reset(&ms, MODSTATE_RSHIFT);
+    ka = keydispatch_lookup(&kd, 'D', FALSE,
+                            ms.down & (MODSTATE_CTRL | MODSTATE_ALT | MODSTATE_WIN));
+    CHECK(ka->action == KEY_ACTION_JAMO);
+    CHECK(ms.down & MODSTATE_SHIFT);
+}
+
+int main(void)
+{
+    TestSided();
+    TestGeneric();
+    TestOtherKeys();
+    TestMissedKeyUp();
+    CHECK_EXIT();
+}
@@ -0,0 +1,148 @@
+/*
+ * test_regwriter.c - Coalescing and order of queued registry values
+ * (regwriter.h)
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+#include "check.h"
+#include "regwriter.h"
+
+#define MAX_STORED 64
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static RegWriterCmd g_stored[MAX_STORED];
+static UINT g_count;
+static UINT g_batches;
+static pthread_t g_storeThread;
+
+static void Store(const RegWriterCmd *cmds, UINT count)
+{
+    UINT i;
+
+    pthread_mutex_lock(&g_lock);
+    for (i = 0; i < count && g_count < MAX_STORED; i++)
+        g_stored[g_count++] = cmds[i];
+    g_batches++;
+    g_storeThread = pthread_self();
+    pthread_mutex_unlock(&g_lock);
+}
+
+static void Forget(void)
+{
+    pthread_mutex_lock(&g_lock);
+    g_count = 0;
+    g_batches = 0;
+    pthread_mutex_unlock(&g_lock);
+}
+
+static UINT Batches(void)
+{
+    UINT n;
+
+    pthread_mutex_lock(&g_lock);
+    n = g_batches;
+    pthread_mutex_unlock(&g_lock);
+    return n;
+}
+
+/* Only the latest value of a slot is stored, and slots in the order
+ * they were first queued, in one batch on the worker */
+static void TestCoalesce(void)
+{
+    RegWriterStats before, after;
+
+    Forget();
+    CHECK(regwriter_start(Store, 0));
+    regwriter_stats(&before);
+    regwriter_put(3, 1);
+    regwriter_put(1, 2);
+    regwriter_put(3, 5);
+    regwriter_put(7, 9);
+    regwriter_put(1, 4);
+    CHECK(Batches() == 0);
+    regwriter_flush(TRUE);
+    regwriter_stats(&after);
+
+    CHECK(g_batches == 1);
+    CHECK(g_count == 3);
+    CHECK(g_stored[0].slot == 3 && g_stored[0].value == 5);
+    CHECK(g_stored[1].slot == 1 && g_stored[1].value == 4);
+    CHECK(g_stored[2].slot == 7 && g_stored[2].value == 9);
+    CHECK(!pthread_equal(g_storeThread, pthread_self()));
+    CHECK(after.puts - before.puts == 5);
+    CHECK(after.coalesced - before.coalesced == 2);
+    CHECK(after.batches - before.batches == 1);
+    CHECK(after.stored - before.stored == 3);
+
+    /* A slot stored is queued afresh, at the end */
+    Forget();
+    regwriter_put(7, 1);
+    regwriter_put(3, 6);
+    regwriter_flush(TRUE);
+    CHECK(g_count == 2);
+    CHECK(g_stored[0].slot == 7 && g_stored[1].slot == 3);
+
+    /* Out of range slots are dropped */
+    Forget();
+    regwriter_put(REGWRITER_MAX_SLOTS, 1);
+    regwriter_flush(TRUE);
+    CHECK(g_count == 0);
+    regwriter_stop();
+}
+
+/* Stopping stores what is pending; afterwards puts store at once on
+ * the caller's thread */
+static void TestStop(void)
+{
+    Forget();
+    CHECK(regwriter_start(Store, 0));
+    regwriter_put(2, 8);
+    regwriter_stop();
+    CHECK(g_count == 1 && g_stored[0].slot == 2 && g_stored[0].value == 8);
+
+    Forget();
+    regwriter_put(4, 1);
+    CHECK(g_count == 1 && g_stored[0].slot == 4);
+    CHECK(pthread_equal(g_storeThread, pthread_self()));
+}
+
+/* Refcounted: an inner stop flushes but keeps the worker */
+static void TestRefs(void)
+{
+    Forget();
+    CHECK(regwriter_start(Store, 0));
+    CHECK(regwriter_start(Store, 0));
+    regwriter_put(5, 1);
+    regwriter_stop();
+    CHECK(g_count == 1);
+    regwriter_put(5, 2);
+    CHECK(g_count == 1);
+    regwriter_stop();
+    CHECK(g_count == 2 && g_stored[1].value == 2);
+}
+
+/* With a quiet period the queue is stored once puts stop */
+static void TestQuiet(void)
+{
+    int i;
+
+    Forget();
+    CHECK(regwriter_start(Store, 20));
+    regwriter_put(6, 1);
+    regwriter_put(6, 2);
+    for (i = 0; i < 200 && Batches() == 0; i++)
+        usleep(5000);
+    CHECK(Batches() == 1);
+    CHECK(g_count == 1 && g_stored[0].value == 2);
+    regwriter_stop();
+}
+
+int main(void)
+{
+    TestCoalesce();
+    TestStop();
+    TestRefs();
+    TestQuiet();
+    CHECK_EXIT();
+}
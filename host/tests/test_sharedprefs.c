@@ -0,0 +1,206 @@
+/*
+ * test_sharedprefs.c - The session's settings seqlock (sharedprefs.h)
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "check.h"
+#include "host_util.h"
+#include "sharedprefs.h"
+#include "shmsection.h"
+
+#define PREFS_STR_(x) #x
+#define PREFS_STR(x)  PREFS_STR_(x)
+#define PREFS_TAG     "Prefs.v" PREFS_STR(SHAREDPREFS_LAYOUT)
+
+/* sharedprefs.c's section, mapped raw to leave a store unfinished */
+typedef struct {
+    volatile LONG  seq;
+    volatile LONG  writer;
+    volatile DWORD layout;
+    volatile DWORD v[SHAREDPREFS_COUNT];
+} PrefsBlock;
+
+#define READ_NS     1000000000ULL   /* reading under the writer */
+#define STALL_NS    50000000ULL     /* a read waiting on a live writer */
+
+static void Fill(SharedPrefs *p, DWORD value)
+{
+    int i;
+    for (i = 0; i < SHAREDPREFS_COUNT; i++)
+        p->v[i] = value;
+}
+
+static BOOL Torn(const SharedPrefs *p)
+{
+    int i;
+    for (i = 1; i < SHAREDPREFS_COUNT; i++) {
+        if (p->v[i] != p->v[0])
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/* ===== Torn reads ===== */
+
+static volatile int g_writing;
+
+/* Stores one counter in every slot, so a consistent copy has all
+ * slots equal */
+static void *Writer(void *arg)
+{
+    SharedPrefs p;
+    DWORD n = 0;
+
+    (void)arg;
+    while (g_writing) {
+        Fill(&p, ++n);
+        sharedprefs_publish(&p, SHAREDPREFS_ALL);
+    }
+    return NULL;
+}
+
+static void TestTornReads(void)
+{
+    pthread_t writer;
+    SharedPrefs p;
+    LONG generation = 0;
+    unsigned long copies = 0, torn = 0;
+    unsigned long long start;
+    DWORD last = 0;
+    BOOL backwards = FALSE;
+
+    g_writing = 1;
+    CHECK(pthread_create(&writer, NULL, Writer, NULL) == 0);
+    start = Host_NowNs();
+    while (Host_NowNs() - start < READ_NS) {
+        if (sharedprefs_read(&p, &generation) != SHAREDPREFS_CHANGED)
+            continue;
+        copies++;
+        if (Torn(&p))
+            torn++;
+        if (p.v[0] < last)
+            backwards = TRUE;
+        last = p.v[0];
+    }
+    g_writing = 0;
+    pthread_join(writer, NULL);
+
+    CHECK(copies > 0);
+    CHECK(torn == 0);
+    CHECK(!backwards);
+}
+
+/* ===== Unfinished stores ===== */
+
+/* A pid that no longer runs */
+static pid_t DeadPid(void)
+{
+    pid_t pid = fork();
+
+    if (pid == 0)
+        _exit(0);
+    waitpid(pid, NULL, 0);
+    return pid;
+}
+
+/* Leave the block as a writer holder stopped in the middle of a store */
+static LONG Interrupt(PrefsBlock *b, LONG holder)
+{
+    LONG seq = b->seq;
+
+    b->writer = holder;
+    b->seq = seq + 1;
+    b->v[0] = 77;
+    return seq;
+}
+
+/* A writer that died is taken over by the next reader or writer */
+static void TestDeadWriter(PrefsBlock *b)
+{
+    SharedPrefsStats before, after;
+    SharedPrefs p;
+    LONG generation = 0, seq;
+
+    sharedprefs_stats(&before);
+    seq = Interrupt(b, (LONG)DeadPid());
+    CHECK(sharedprefs_read(&p, &generation) == SHAREDPREFS_CHANGED);
+    CHECK(generation != seq && !(generation & 1));
+    CHECK(p.v[0] == 77);
+    CHECK(b->writer == 0);
+
+    Fill(&p, 5);
+    CHECK(sharedprefs_publish(&p, SHAREDPREFS_ALL));
+    CHECK(sharedprefs_read(&p, &generation) == SHAREDPREFS_CHANGED);
+    CHECK(!Torn(&p) && p.v[0] == 5);
+
+    /* ... and by a writer, without a reader first */
+    Interrupt(b, (LONG)DeadPid());
+    Fill(&p, 6);
+    CHECK(sharedprefs_publish(&p, SHAREDPREFS_ALL));
+    CHECK(sharedprefs_read(&p, &generation) == SHAREDPREFS_CHANGED);
+    CHECK(p.v[0] == 6);
+
+    /* ... also by one that must not wait */
+    Interrupt(b, (LONG)DeadPid());
+    Fill(&p, 7);
+    CHECK(sharedprefs_try_publish(&p, SHAREDPREFS_ALL));
+    CHECK(sharedprefs_read(&p, &generation) == SHAREDPREFS_CHANGED);
+    CHECK(p.v[0] == 7);
+
+    sharedprefs_stats(&after);
+    CHECK(after.recoveries - before.recoveries == 3);
+}
+
+/* A live writer that takes long sends readers back to the registry,
+ * and only once per store; a writer that must not wait gives up as
+ * quickly */
+static void TestLiveWriter(PrefsBlock *b)
+{
+    SharedPrefs p;
+    LONG generation = 0, seq;
+    unsigned long long start;
+
+    seq = Interrupt(b, (LONG)getpid());
+    start = Host_NowNs();
+    CHECK(sharedprefs_read(&p, &generation) == SHAREDPREFS_UNAVAILABLE);
+    CHECK(sharedprefs_read(&p, &generation) == SHAREDPREFS_UNAVAILABLE);
+    Fill(&p, 8);
+    CHECK(!sharedprefs_try_publish(&p, SHAREDPREFS_ALL));
+    CHECK(Host_NowNs() - start < STALL_NS);
+
+    /* The writer finishes */
+    b->seq = seq + 2;
+    b->writer = 0;
+    CHECK(sharedprefs_read(&p, &generation) == SHAREDPREFS_CHANGED);
+    CHECK(generation == seq + 2);
+}
+
+int main(void)
+{
+    char shmName[64];
+    PrefsBlock *b;
+    HANDLE handle;
+    SharedPrefs p;
+
+    snprintf(shmName, sizeof(shmName), "/kolemak-test.%ld", (long)getpid());
+    setenv("KOLEMAK_SHM", shmName, 1);
+
+    Fill(&p, 0);
+    CHECK(sharedprefs_init(&p));
+    b = (PrefsBlock *)shmsection_map(PREFS_TAG, sizeof(PrefsBlock), &handle);
+    CHECK(b != NULL);
+    if (b) {
+        CHECK(b->layout == SHAREDPREFS_LAYOUT && b->writer == 0);
+        TestTornReads();
+        TestDeadWriter(b);
+        TestLiveWriter(b);
+        shmsection_unmap(b, sizeof(PrefsBlock), handle);
+    }
+
+    sharedprefs_close();
+    sharedprefs_unlink();
+    CHECK_EXIT();
+}
@@ -0,0 +1,72 @@
+/*
+ * test_tiplabel.c - Tooltip label layout and pixels (tiplabel.h)
+ */
+
+#include "check.h"
+#include "host_util.h"
+#include "tiplabel.h"
+
+/* Largest label bitmap at the DPIs used here */
+#define TIP_MAX_PIXELS (512 * 128)
+
+static DWORD g_pixels[TIP_MAX_PIXELS];
+
+/* The 96 DPI layout is the popup's old one, and padding scales */
+static void TestLayout(void)
+{
+    TipLabelLayout l;
+
+    CHECK(tiplabel_font_height(96) == -13);
+    tiplabel_layout(50, 17, 96, &l);
+    CHECK(l.x == 20 && l.y == 20);
+    CHECK(l.width == 70 && l.height == 27);
+    CHECK(l.textX == 10 && l.textY == 5);
+
+    tiplabel_layout(100, 34, 192, &l);
+    CHECK(l.width == 140 && l.height == 54);
+    CHECK(l.textX == 20);
+}
+
+/* Composed pixels are premultiplied gray at the popup's opacity: the
+ * background where nothing is drawn, the foreground where the text
+ * fully covers */
+static void TestPixels(void)
+{
+    static const UINT dpis[] = { 96, 120, 144, 192 };
+    TipLabelLayout l;
+    UINT d, label;
+
+    for (d = 0; d < sizeof(dpis) / sizeof(dpis[0]); d++) {
+        for (label = 0; label < TIPLABEL_COUNT; label++) {
+            size_t i, n, bad = 0;
+            BOOL full = FALSE;
+
+            Host_RasterizeLabel(label, dpis[d], g_pixels, &l);
+            n = (size_t)l.width * (size_t)l.height;
+            CHECK(n <= TIP_MAX_PIXELS);
+            tiplabel_compose(g_pixels, n);
+
+            for (i = 0; i < n; i++) {
+                DWORD p = g_pixels[i];
+                DWORD a = p >> 24, c = p & 0xFF;
+
+                if (a != TIPLABEL_OPACITY || c > a ||
+                    ((p >> 8) & 0xFF) != c || ((p >> 16) & 0xFF) != c)
+                    bad++;
+                if (c == TIPLABEL_OPACITY)
+                    full = TRUE;
+            }
+            CHECK(bad == 0);
+            CHECK(full);
+            CHECK((g_pixels[0] & 0xFF) ==
+                  (TIPLABEL_BACKGROUND * TIPLABEL_OPACITY + 127) / 255);
+        }
+    }
+}
+
+int main(void)
+{
+    TestLayout();
+    TestPixels();
+    CHECK_EXIT();
+}
@@ -0,0 +1,60 @@
+/*
+ * test_uibus.c - Coalesced UI updates from the key path (uibus.h)
+ */
+
+#include <string.h>
+#include "check.h"
+#include "uibus.h"
+
+#define BIT(t) (1u << (t))
+
+/* A burst of posts is one flush, with the last value per target */
+static void TestCoalesce(void)
+{
+    UiBus bus;
+    LONG value[UIBUS_TARGETS];
+
+    memset(&bus, 0, sizeof(bus));
+    CHECK(uibus_post(&bus, UIBUS_TOOLTIP, 1));
+    CHECK(!uibus_post(&bus, UIBUS_TOOLTIP, 0));
+    CHECK(!uibus_post(&bus, UIBUS_LANGBAR, 0));
+    CHECK(!uibus_post(&bus, UIBUS_TOOLTIP, 1));
+    CHECK(!uibus_post(&bus, UIBUS_KEYBOARD_OPEN, 1));
+    CHECK(!uibus_post(&bus, UIBUS_KEYBOARD_OPEN, 0));
+
+    CHECK(uibus_take(&bus, value) ==
+          (BIT(UIBUS_KEYBOARD_OPEN) | BIT(UIBUS_TOOLTIP) | BIT(UIBUS_LANGBAR)));
+    CHECK(value[UIBUS_TOOLTIP] == 1);
+    CHECK(value[UIBUS_KEYBOARD_OPEN] == 0);
+    CHECK(bus.posted == 6 && bus.applied == 3);
+
+    /* Nothing pending: the next post schedules again */
+    CHECK(uibus_take(&bus, value) == 0);
+    CHECK(bus.applied == 3);
+    CHECK(uibus_post(&bus, UIBUS_LANGBAR, 0));
+    CHECK(uibus_take(&bus, value) == BIT(UIBUS_LANGBAR));
+    CHECK(bus.posted == 7 && bus.applied == 4);
+}
+
+static void TestClear(void)
+{
+    UiBus bus;
+    LONG value[UIBUS_TARGETS];
+
+    memset(&bus, 0, sizeof(bus));
+    CHECK(!uibus_post(&bus, UIBUS_TARGETS, 1));
+    CHECK(bus.dirty == 0 && bus.posted == 0);
+
+    uibus_post(&bus, UIBUS_TOOLTIP, 1);
+    uibus_clear(&bus);
+    CHECK(uibus_take(&bus, value) == 0);
+    CHECK(bus.applied == 0);
+    CHECK(uibus_post(&bus, UIBUS_TOOLTIP, 0));
+}
+
+int main(void)
+{
+    TestCoalesce();
+    TestClear();
+    CHECK_EXIT();
+}
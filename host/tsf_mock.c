@@ -0,0 +1,649 @@
+/*
+ * tsf_mock.c - In-memory TSF document for the host build
+ *
+ * Implements just enough of ITfThreadMgr, ITfDocumentMgr, ITfContext,
+ * ITfInsertAtSelection, ITfContextComposition, ITfComposition and
+ * ITfRange for edit_session.c to run against a plain text buffer.
+ * All objects except ranges and compositions are static singletons.
+ */
+
+#include <stdlib.h>
+#include "tsf_mock.h"
+
+/* Interface identity is all that matters on the host; values are arbitrary */
+const IID IID_IUnknown =
+    { 0x00000000, 0x0000, 0x0000, { 0xc0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46 } };
+const IID IID_ITfEditSession =
+    { 0xaa80e803, 0x2021, 0x11d2, { 0x93, 0xe0, 0x00, 0x60, 0xb0, 0x67, 0xb8, 0x6e } };
+const IID IID_ITfInsertAtSelection =
+    { 0x55ce16ba, 0x3014, 0x41c1, { 0x9c, 0xeb, 0xfa, 0xde, 0x14, 0x46, 0xac, 0x6c } };
+const IID IID_ITfContextComposition =
+    { 0xd40c8aae, 0xac92, 0x4fc7, { 0x9a, 0x11, 0x0e, 0xe0, 0xe2, 0x3a, 0xa3, 0x9b } };
+const IID IID_ITfKeystrokeMgr =
+    { 0xaa80e7f0, 0x2021, 0x11d2, { 0x93, 0xe0, 0x00, 0x60, 0xb0, 0x67, 0xb8, 0x6e } };
+
+/* ===== Document ===== */
+
+typedef struct MockRange MockRange;
+
+struct MockRange {
+    const ITfRangeVtbl *lpVtbl;
+    LONG refCount;
+    int  start;
+    int  end;
+    MockRange *next;            /* live range list (anchor tracking) */
+};
+
+typedef struct {
+    WCHAR text[MOCK_DOC_CAPACITY];
+    int   len;
+    int   selStart;
+    int   selEnd;
+    BOOL  interim;
+    MockRange *ranges;
+    BOOL  composing;
+    BOOL  refuseSync;
+    ULONG syncSessions;
+    ULONG asyncSessions;
+    ULONG appCalls;             /* IME -> app calls other than AddRef/Release */
+} MockDoc;
+
+static MockDoc g_doc;
+
+#define ASYNC_QUEUE_SIZE 64
+
+static ITfEditSession *g_asyncQueue[ASYNC_QUEUE_SIZE];
+static int g_asyncCount = 0;
+
+/* Map a position across replacement of [s, e) by n characters.
+ * Range starts have backward gravity and range ends forward gravity,
+ * so text inserted at a composition's edge ends up inside it. */
+static int AdjustPos(int p, int s, int e, int n, BOOL forward)
+{
+    if (p > e || (p == e && (s < e || forward)))
+        return p + n - (e - s);
+    if (p > s)
+        return (p < s + n) ? p : s + n;
+    return p;
+}
+
+static void DocReplace(int s, int e, const WCHAR *text, int n)
+{
+    MockRange *r;
+
+    if (s < 0) s = 0;
+    if (e > g_doc.len) e = g_doc.len;
+    if (e < s) e = s;
+    if (g_doc.len - (e - s) + n > MOCK_DOC_CAPACITY)
+        return;
+
+    memmove(&g_doc.text[s + n], &g_doc.text[e],
+            (size_t)(g_doc.len - e) * sizeof(WCHAR));
+    if (n > 0)
+        memcpy(&g_doc.text[s], text, (size_t)n * sizeof(WCHAR));
+    g_doc.len += n - (e - s);
+
+    for (r = g_doc.ranges; r; r = r->next) {
+        r->start = AdjustPos(r->start, s, e, n, FALSE);
+        r->end = AdjustPos(r->end, s, e, n, TRUE);
+    }
+    g_doc.selStart = AdjustPos(g_doc.selStart, s, e, n, TRUE);
+    g_doc.selEnd = AdjustPos(g_doc.selEnd, s, e, n, TRUE);
+}
+
+/* ===== ITfRange ===== */
+
+static const ITfRangeVtbl g_rangeVtbl;
+
+static MockRange *Range_New(int start, int end)
+{
+    MockRange *r = (MockRange *)calloc(1, sizeof(MockRange));
+    if (!r) return NULL;
+    r->lpVtbl = &g_rangeVtbl;
+    r->refCount = 1;
+    r->start = start;
+    r->end = end;
+    r->next = g_doc.ranges;
+    g_doc.ranges = r;
+    return r;
+}
+
+static HRESULT STDMETHODCALLTYPE Range_QueryInterface(
+    ITfRange *pThis, REFIID riid, void **ppvObj)
+{
+    (void)pThis; (void)riid;
+    *ppvObj = NULL;
+    return E_NOINTERFACE;
+}
+
+static ULONG STDMETHODCALLTYPE Range_AddRef(ITfRange *pThis)
+{
+    return ++((MockRange *)pThis)->refCount;
+}
+
+static ULONG STDMETHODCALLTYPE Range_Release(ITfRange *pThis)
+{
+    MockRange *r = (MockRange *)pThis;
+    MockRange **pp;
+    LONG c = --r->refCount;
+
+    if (c == 0) {
+        for (pp = &g_doc.ranges; *pp; pp = &(*pp)->next) {
+            if (*pp == r) { *pp = r->next; break; }
+        }
+        free(r);
+    }
+    return c;
+}
+
+static HRESULT STDMETHODCALLTYPE Range_SetText(
+    ITfRange *pThis, TfEditCookie ec, DWORD dwFlags,
+    const WCHAR *pchText, LONG cch)
+{
+    MockRange *r = (MockRange *)pThis;
+    int s = r->start;
+
+    (void)ec; (void)dwFlags;
+    g_doc.appCalls++;
+    DocReplace(r->start, r->end, pchText, cch);
+    r->start = s;
+    r->end = s + cch;
+    return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE Range_Collapse(
+    ITfRange *pThis, TfEditCookie ec, TfAnchor aPos)
+{
+    MockRange *r = (MockRange *)pThis;
+
+    (void)ec;
+    g_doc.appCalls++;
+    if (aPos == TF_ANCHOR_START)
+        r->end = r->start;
+    else
+        r->start = r->end;
+    return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE Range_GetContext(
+    ITfRange *pThis, ITfContext **ppContext)
+{
+    (void)pThis;
+    g_doc.appCalls++;
+    *ppContext = MockTsf_Context();
+    (*ppContext)->lpVtbl->AddRef(*ppContext);
+    return S_OK;
+}
+
+static const ITfRangeVtbl g_rangeVtbl = {
+    Range_QueryInterface,
+    Range_AddRef,
+    Range_Release,
+    Range_SetText,
+    Range_Collapse,
+    Range_GetContext,
+};
+
+/* ===== ITfComposition ===== */
+
+typedef struct {
+    const ITfCompositionVtbl *lpVtbl;
+    LONG refCount;
+    MockRange *range;
+} MockComposition;
+
+static HRESULT STDMETHODCALLTYPE Comp_QueryInterface(
+    ITfComposition *pThis, REFIID riid, void **ppvObj)
+{
+    (void)pThis; (void)riid;
+    *ppvObj = NULL;
+    return E_NOINTERFACE;
+}
+
+static ULONG STDMETHODCALLTYPE Comp_AddRef(ITfComposition *pThis)
+{
+    return ++((MockComposition *)pThis)->refCount;
+}
+
+static ULONG STDMETHODCALLTYPE Comp_Release(ITfComposition *pThis)
+{
+    MockComposition *c = (MockComposition *)pThis;
+    LONG n = --c->refCount;
+
+    if (n == 0) {
+        if (c->range)
+            Range_Release((ITfRange *)c->range);
+        free(c);
+    }
+    return n;
+}
+
+/* Returns a clone, as TSF does: callers may collapse it freely */
+static HRESULT STDMETHODCALLTYPE Comp_GetRange(
+    ITfComposition *pThis, ITfRange **ppRange)
+{
+    MockComposition *c = (MockComposition *)pThis;
+    MockRange *r;
+
+    g_doc.appCalls++;
+
+    if (!c->range)
+        return E_FAIL;
+    r = Range_New(c->range->start, c->range->end);
+    if (!r)
+        return E_OUTOFMEMORY;
+    *ppRange = (ITfRange *)r;
+    return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE Comp_EndComposition(
+    ITfComposition *pThis, TfEditCookie ecWrite)
+{
+    MockComposition *c = (MockComposition *)pThis;
+
+    (void)ecWrite;
+    g_doc.appCalls++;
+    if (c->range) {
+        Range_Release((ITfRange *)c->range);
+        c->range = NULL;
+    }
+    g_doc.composing = FALSE;
+    g_doc.interim = FALSE;
+    return S_OK;
+}
+
+static const ITfCompositionVtbl g_compositionVtbl = {
+    Comp_QueryInterface,
+    Comp_AddRef,
+    Comp_Release,
+    Comp_GetRange,
+    Comp_EndComposition,
+};
+
+/* ===== ITfContext and its sub-interfaces ===== */
+
+typedef struct {
+    const ITfContextVtbl *lpVtbl;
+    struct { const ITfInsertAtSelectionVtbl   *lpVtbl; } insertAtSelection;
+    struct { const ITfContextCompositionVtbl  *lpVtbl; } contextComposition;
+} MockContext;
+
+static MockContext g_context;
+
+static HRESULT STDMETHODCALLTYPE Ctx_QueryInterface(
+    ITfContext *pThis, REFIID riid, void **ppvObj)
+{
+    (void)pThis;
+    g_doc.appCalls++;
+    if (IsEqualIID(riid, &IID_IUnknown))
+        *ppvObj = &g_context;
+    else if (IsEqualIID(riid, &IID_ITfInsertAtSelection))
+        *ppvObj = &g_context.insertAtSelection;
+    else if (IsEqualIID(riid, &IID_ITfContextComposition))
+        *ppvObj = &g_context.contextComposition;
+    else {
+        *ppvObj = NULL;
+        return E_NOINTERFACE;
+    }
+    return S_OK;
+}
+
+static ULONG STDMETHODCALLTYPE Ctx_AddRef(ITfContext *pThis)
+{
+    (void)pThis;
+    return 2;
+}
+
+static ULONG STDMETHODCALLTYPE Ctx_Release(ITfContext *pThis)
+{
+    (void)pThis;
+    return 1;
+}
+
+static HRESULT STDMETHODCALLTYPE Ctx_RequestEditSession(
+    ITfContext *pThis, TfClientId tid, ITfEditSession *pes,
+    DWORD dwFlags, HRESULT *phrSession)
+{
+    (void)pThis; (void)tid;
+    g_doc.appCalls++;
+
+    if (dwFlags & TF_ES_SYNC) {
+        if (g_doc.refuseSync)
+            return TF_E_SYNCHRONOUS;
+        g_doc.syncSessions++;
+        *phrSession = pes->lpVtbl->DoEditSession(pes, 1);
+        return S_OK;
+    }
+
+    if (g_asyncCount == ASYNC_QUEUE_SIZE)
+        return E_FAIL;
+    pes->lpVtbl->AddRef(pes);
+    g_asyncQueue[g_asyncCount++] = pes;
+    *phrSession = TF_S_ASYNC;
+    return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE Ctx_SetSelection(
+    ITfContext *pThis, TfEditCookie ec, ULONG ulCount,
+    const TF_SELECTION *pSelection)
+{
+    MockRange *r;
+
+    (void)pThis; (void)ec;
+    g_doc.appCalls++;
+    if (ulCount < 1)
+        return E_INVALIDARG;
+    r = (MockRange *)pSelection[0].range;
+    g_doc.selStart = r->start;
+    g_doc.selEnd = r->end;
+    g_doc.interim = pSelection[0].style.fInterimChar;
+    return S_OK;
+}
+
+/* A full TSF document: writable and not a CUAS (IMM32) emulation */
+static HRESULT STDMETHODCALLTYPE Ctx_GetStatus(ITfContext *pThis, TF_STATUS *pdcs)
+{
+    (void)pThis;
+    g_doc.appCalls++;
+    pdcs->dwDynamicFlags = 0;
+    pdcs->dwStaticFlags = 0;
+    return S_OK;
+}
+
+static const ITfContextVtbl g_contextVtbl = {
+    Ctx_QueryInterface,
+    Ctx_AddRef,
+    Ctx_Release,
+    Ctx_RequestEditSession,
+    Ctx_SetSelection,
+    Ctx_GetStatus,
+};
+
+static HRESULT STDMETHODCALLTYPE IAS_QueryInterface(
+    ITfInsertAtSelection *pThis, REFIID riid, void **ppvObj)
+{
+    (void)pThis;
+    return Ctx_QueryInterface((ITfContext *)&g_context, riid, ppvObj);
+}
+
+static ULONG STDMETHODCALLTYPE IAS_AddRef(ITfInsertAtSelection *pThis)
+{
+    (void)pThis;
+    return 2;
+}
+
+static ULONG STDMETHODCALLTYPE IAS_Release(ITfInsertAtSelection *pThis)
+{
+    (void)pThis;
+    return 1;
+}
+
+static HRESULT STDMETHODCALLTYPE IAS_InsertTextAtSelection(
+    ITfInsertAtSelection *pThis, TfEditCookie ec, DWORD dwFlags,
+    const WCHAR *pchText, LONG cch, ITfRange **ppRange)
+{
+    int s = g_doc.selStart;
+    MockRange *r;
+
+    (void)pThis; (void)ec;
+    g_doc.appCalls++;
+
+    if (!(dwFlags & TF_IAS_QUERYONLY)) {
+        DocReplace(g_doc.selStart, g_doc.selEnd, pchText, cch);
+        g_doc.selStart = g_doc.selEnd = s + cch;
+        g_doc.interim = FALSE;
+        r = Range_New(s, s + cch);
+    } else {
+        r = Range_New(g_doc.selStart, g_doc.selEnd);
+    }
+
+    if (!r)
+        return E_OUTOFMEMORY;
+    if (ppRange)
+        *ppRange = (ITfRange *)r;
+    else
+        Range_Release((ITfRange *)r);
+    return S_OK;
+}
+
+static const ITfInsertAtSelectionVtbl g_insertAtSelectionVtbl = {
+    IAS_QueryInterface,
+    IAS_AddRef,
+    IAS_Release,
+    IAS_InsertTextAtSelection,
+};
+
+static HRESULT STDMETHODCALLTYPE CC_QueryInterface(
+    ITfContextComposition *pThis, REFIID riid, void **ppvObj)
+{
+    (void)pThis;
+    return Ctx_QueryInterface((ITfContext *)&g_context, riid, ppvObj);
+}
+
+static ULONG STDMETHODCALLTYPE CC_AddRef(ITfContextComposition *pThis)
+{
+    (void)pThis;
+    return 2;
+}
+
+static ULONG STDMETHODCALLTYPE CC_Release(ITfContextComposition *pThis)
+{
+    (void)pThis;
+    return 1;
+}
+
+static HRESULT STDMETHODCALLTYPE CC_StartComposition(
+    ITfContextComposition *pThis, TfEditCookie ecWrite,
+    ITfRange *pCompositionRange, ITfCompositionSink *pSink,
+    ITfComposition **ppComposition)
+{
+    MockRange *src = (MockRange *)pCompositionRange;
+    MockComposition *c;
+
+    (void)pThis; (void)ecWrite; (void)pSink;
+    g_doc.appCalls++;
+
+    c = (MockComposition *)calloc(1, sizeof(MockComposition));
+    if (!c)
+        return E_OUTOFMEMORY;
+    c->lpVtbl = &g_compositionVtbl;
+    c->refCount = 1;
+    c->range = Range_New(src->start, src->end);
+    if (!c->range) {
+        free(c);
+        return E_OUTOFMEMORY;
+    }
+    g_doc.composing = TRUE;
+    *ppComposition = (ITfComposition *)c;
+    return S_OK;
+}
+
+static const ITfContextCompositionVtbl g_contextCompositionVtbl = {
+    CC_QueryInterface,
+    CC_AddRef,
+    CC_Release,
+    CC_StartComposition,
+};
+
+/* ===== ITfDocumentMgr / ITfThreadMgr ===== */
+
+static ITfDocumentMgr g_docMgr;
+static ITfThreadMgr   g_threadMgr;
+
+static HRESULT STDMETHODCALLTYPE DM_QueryInterface(
+    ITfDocumentMgr *pThis, REFIID riid, void **ppvObj)
+{
+    if (IsEqualIID(riid, &IID_IUnknown)) {
+        *ppvObj = pThis;
+        return S_OK;
+    }
+    *ppvObj = NULL;
+    return E_NOINTERFACE;
+}
+
+static ULONG STDMETHODCALLTYPE DM_AddRef(ITfDocumentMgr *pThis)
+{
+    (void)pThis;
+    return 2;
+}
+
+static ULONG STDMETHODCALLTYPE DM_Release(ITfDocumentMgr *pThis)
+{
+    (void)pThis;
+    return 1;
+}
+
+static HRESULT STDMETHODCALLTYPE DM_GetTop(ITfDocumentMgr *pThis, ITfContext **ppic)
+{
+    (void)pThis;
+    *ppic = (ITfContext *)&g_context;
+    return S_OK;
+}
+
+static const ITfDocumentMgrVtbl g_docMgrVtbl = {
+    DM_QueryInterface,
+    DM_AddRef,
+    DM_Release,
+    DM_GetTop,
+};
+
+static HRESULT STDMETHODCALLTYPE TM_QueryInterface(
+    ITfThreadMgr *pThis, REFIID riid, void **ppvObj)
+{
+    if (IsEqualIID(riid, &IID_IUnknown)) {
+        *ppvObj = pThis;
+        return S_OK;
+    }
+    *ppvObj = NULL;
+    return E_NOINTERFACE;
+}
+
+static ULONG STDMETHODCALLTYPE TM_AddRef(ITfThreadMgr *pThis)
+{
+    (void)pThis;
+    return 2;
+}
+
+static ULONG STDMETHODCALLTYPE TM_Release(ITfThreadMgr *pThis)
+{
+    (void)pThis;
+    return 1;
+}
+
+static HRESULT STDMETHODCALLTYPE TM_GetFocus(
+    ITfThreadMgr *pThis, ITfDocumentMgr **ppdimFocus)
+{
+    (void)pThis;
+    *ppdimFocus = &g_docMgr;
+    return S_OK;
+}
+
+static const ITfThreadMgrVtbl g_threadMgrVtbl = {
+    TM_QueryInterface,
+    TM_AddRef,
+    TM_Release,
+    TM_GetFocus,
+};
+
+/* ===== Public API ===== */
+
+void MockTsf_Init(void)
+{
+    g_context.lpVtbl = &g_contextVtbl;
+    g_context.insertAtSelection.lpVtbl = &g_insertAtSelectionVtbl;
+    g_context.contextComposition.lpVtbl = &g_contextCompositionVtbl;
+    g_docMgr.lpVtbl = &g_docMgrVtbl;
+    g_threadMgr.lpVtbl = &g_threadMgrVtbl;
+    MockTsf_Clear();
+}
+
+void MockTsf_Clear(void)
+{
+    g_doc.len = 0;
+    g_doc.selStart = g_doc.selEnd = 0;
+    g_doc.interim = FALSE;
+}
+
+ITfThreadMgr *MockTsf_ThreadMgr(void)
+{
+    return &g_threadMgr;
+}
+
+ITfContext *MockTsf_Context(void)
+{
+    return (ITfContext *)&g_context;
+}
+
+void MockTsf_SetRefuseSync(BOOL refuse)
+{
+    g_doc.refuseSync = refuse;
+}
+
+int MockTsf_RunAsync(void)
+{
+    int ran = 0;
+
+    /* Sessions may queue further sessions; keep draining in order */
+    while (g_asyncCount > 0) {
+        ITfEditSession *pes = g_asyncQueue[0];
+        g_asyncCount--;
+        memmove(&g_asyncQueue[0], &g_asyncQueue[1],
+                (size_t)g_asyncCount * sizeof(g_asyncQueue[0]));
+        g_doc.asyncSessions++;
+        pes->lpVtbl->DoEditSession(pes, 1);
+        pes->lpVtbl->Release(pes);
+        ran++;
+    }
+    return ran;
+}
+
+const WCHAR *MockTsf_Text(int *len)
+{
+    if (len)
+        *len = g_doc.len;
+    return g_doc.text;
+}
+
+int MockTsf_Caret(void)
+{
+    return g_doc.selEnd;
+}
+
+BOOL MockTsf_Composing(void)
+{
+    return g_doc.composing;
+}
+
+void MockTsf_Counters(ULONG *syncSessions, ULONG *asyncSessions)
+{
+    if (syncSessions) *syncSessions = g_doc.syncSessions;
+    if (asyncSessions) *asyncSessions = g_doc.asyncSessions;
+}
+
+ULONG MockTsf_AppCalls(void)
+{
+    return g_doc.appCalls;
+}
+
+void MockTsf_AppInsert(WCHAR ch)
+{
+    int s = g_doc.selStart;
+    DocReplace(g_doc.selStart, g_doc.selEnd, &ch, 1);
+    g_doc.selStart = g_doc.selEnd = s + 1;
+}
+
+void MockTsf_AppBackspace(void)
+{
+    if (g_doc.selStart != g_doc.selEnd)
+        DocReplace(g_doc.selStart, g_doc.selEnd, NULL, 0);
+    else if (g_doc.selStart > 0)
+        DocReplace(g_doc.selStart - 1, g_doc.selStart, NULL, 0);
+}
+
+void MockTsf_AppMoveCaret(int delta)
+{
+    int p = g_doc.selEnd + delta;
+    if (p < 0) p = 0;
+    if (p > g_doc.len) p = g_doc.len;
+    g_doc.selStart = g_doc.selEnd = p;
+}
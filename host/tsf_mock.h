@@ -0,0 +1,41 @@
+/*
+ * tsf_mock.h - In-memory TSF document for the host build
+ *
+ * One thread manager -> document manager -> context chain backed by
+ * a flat UTF-16 buffer.  Sync edit sessions run immediately; async
+ * ones are queued until MockTsf_RunAsync so that Win10-style ordering
+ * problems can be reproduced.
+ */
+
+#ifndef TSF_MOCK_H
+#define TSF_MOCK_H
+
+#include <msctf.h>
+
+#define MOCK_DOC_CAPACITY 4096
+
+void          MockTsf_Init(void);
+void          MockTsf_Clear(void);
+
+ITfThreadMgr *MockTsf_ThreadMgr(void);
+ITfContext   *MockTsf_Context(void);
+
+/* When TRUE, TF_ES_SYNC requests fail with TF_E_SYNCHRONOUS */
+void          MockTsf_SetRefuseSync(BOOL refuse);
+
+/* Run queued async sessions; returns the number run */
+int           MockTsf_RunAsync(void);
+
+/* Document inspection */
+const WCHAR  *MockTsf_Text(int *len);
+int           MockTsf_Caret(void);
+BOOL          MockTsf_Composing(void);
+void          MockTsf_Counters(ULONG *syncSessions, ULONG *asyncSessions);
+ULONG         MockTsf_AppCalls(void);    /* IME calls into the app */
+
+/* Edits performed by the "application" for keys the IME passed through */
+void          MockTsf_AppInsert(WCHAR ch);
+void          MockTsf_AppBackspace(void);
+void          MockTsf_AppMoveCaret(int delta);
+
+#endif /* TSF_MOCK_H */
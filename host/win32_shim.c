@@ -0,0 +1,570 @@
+/*
+ * win32_shim.c - Win32 stand-in for the host build
+ *
+ * Keyboard state, a captured SendInput queue, MapVirtualKey, TLS,
+ * heap and an in-memory registry: enough for the key path to run
+ * unmodified outside Windows.  Only the registry is thread-safe (the
+ * settings writer stores from its own thread).
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "win32_shim.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+/* ===== Keyboard state ===== */
+
+static BYTE g_keyState[256];
+
+static void UpdateGenericModifier(UINT generic, UINT left, UINT right)
+{
+    BYTE down = (g_keyState[left] | g_keyState[right]) & 0x80;
+    g_keyState[generic] = (BYTE)((g_keyState[generic] & 0x01) | down);
+}
+
+void Shim_SetKeyState(UINT vk, BOOL down)
+{
+    if (vk >= 256)
+        return;
+
+    if (down) {
+        if (!(g_keyState[vk] & 0x80))
+            g_keyState[vk] ^= 0x01;
+        g_keyState[vk] |= 0x80;
+    } else {
+        g_keyState[vk] &= (BYTE)~0x80;
+    }
+
+    /* Generic modifiers also reported as left-hand keys */
+    if (vk == VK_SHIFT)   g_keyState[VK_LSHIFT]   = (BYTE)(g_keyState[VK_LSHIFT] & 0x01) | (g_keyState[vk] & 0x80);
+    if (vk == VK_CONTROL) g_keyState[VK_LCONTROL] = (BYTE)(g_keyState[VK_LCONTROL] & 0x01) | (g_keyState[vk] & 0x80);
+    if (vk == VK_MENU)    g_keyState[VK_LMENU]    = (BYTE)(g_keyState[VK_LMENU] & 0x01) | (g_keyState[vk] & 0x80);
+
+    UpdateGenericModifier(VK_SHIFT, VK_LSHIFT, VK_RSHIFT);
+    UpdateGenericModifier(VK_CONTROL, VK_LCONTROL, VK_RCONTROL);
+    UpdateGenericModifier(VK_MENU, VK_LMENU, VK_RMENU);
+}
+
+void Shim_ResetKeyState(void)
+{
+    memset(g_keyState, 0, sizeof(g_keyState));
+}
+
+SHORT WINAPI GetKeyState(int vk)
+{
+    BYTE s;
+    if (vk < 0 || vk >= 256)
+        return 0;
+    s = g_keyState[vk];
+    return (SHORT)(((s & 0x80) ? 0x8000 : 0) | (s & 0x01));
+}
+
+SHORT WINAPI GetAsyncKeyState(int vk)
+{
+    return (SHORT)(GetKeyState(vk) & 0x8000);
+}
+
+BOOL WINAPI GetKeyboardState(BYTE *lpKeyState)
+{
+    memcpy(lpKeyState, g_keyState, sizeof(g_keyState));
+    return TRUE;
+}
+
+BOOL WINAPI SetKeyboardState(BYTE *lpKeyState)
+{
+    memcpy(g_keyState, lpKeyState, sizeof(g_keyState));
+    return TRUE;
+}
+
+/* ===== SendInput capture ===== */
+
+#define INPUT_QUEUE_SIZE 256
+
+static INPUT g_inputQueue[INPUT_QUEUE_SIZE];
+static UINT  g_inputHead = 0;
+static UINT  g_inputCount = 0;
+static ULONG g_inputTotal = 0;
+
+UINT WINAPI SendInput(UINT cInputs, INPUT *pInputs, int cbSize)
+{
+    UINT i;
+
+    (void)cbSize;
+    for (i = 0; i < cInputs; i++) {
+        if (g_inputCount == INPUT_QUEUE_SIZE)
+            break;
+        g_inputQueue[(g_inputHead + g_inputCount) % INPUT_QUEUE_SIZE] = pInputs[i];
+        g_inputCount++;
+        g_inputTotal++;
+    }
+    return i;
+}
+
+UINT Shim_PendingInputs(void)
+{
+    return g_inputCount;
+}
+
+BOOL Shim_PopInput(INPUT *out)
+{
+    if (g_inputCount == 0)
+        return FALSE;
+    *out = g_inputQueue[g_inputHead];
+    g_inputHead = (g_inputHead + 1) % INPUT_QUEUE_SIZE;
+    g_inputCount--;
+    return TRUE;
+}
+
+ULONG Shim_TotalInputs(void)
+{
+    return g_inputTotal;
+}
+
+/* ===== MapVirtualKey (set 1 scan codes, US layout) ===== */
+
+typedef struct { BYTE vk; BYTE scan; } ScanEntry;
+
+static const ScanEntry g_scanCodes[] = {
+    { VK_BACK, 0x0E }, { VK_TAB, 0x0F }, { VK_RETURN, 0x1C },
+    { VK_SHIFT, 0x2A }, { VK_CONTROL, 0x1D }, { VK_MENU, 0x38 },
+    { VK_CAPITAL, 0x3A }, { VK_ESCAPE, 0x01 }, { VK_SPACE, 0x39 },
+    { VK_END, 0x4F }, { VK_HOME, 0x47 }, { VK_LEFT, 0x4B },
+    { VK_UP, 0x48 }, { VK_RIGHT, 0x4D }, { VK_DOWN, 0x50 },
+    { VK_DELETE, 0x53 }, { VK_LWIN, 0x5B }, { VK_RWIN, 0x5C },
+    { VK_F13, 0x64 }, { VK_LSHIFT, 0x2A }, { VK_RSHIFT, 0x36 },
+    { VK_LCONTROL, 0x1D }, { VK_RCONTROL, 0x1D }, { VK_LMENU, 0x38 },
+    { VK_RMENU, 0x38 }, { VK_OEM_1, 0x27 }, { VK_OEM_PLUS, 0x0D },
+    { VK_OEM_COMMA, 0x33 }, { VK_OEM_MINUS, 0x0C }, { VK_OEM_PERIOD, 0x34 },
+    { VK_OEM_2, 0x35 }, { VK_OEM_3, 0x29 }, { VK_OEM_4, 0x1A },
+    { VK_OEM_5, 0x2B }, { VK_OEM_6, 0x1B }, { VK_OEM_7, 0x28 },
+    { '0', 0x0B }, { '1', 0x02 }, { '2', 0x03 }, { '3', 0x04 },
+    { '4', 0x05 }, { '5', 0x06 }, { '6', 0x07 }, { '7', 0x08 },
+    { '8', 0x09 }, { '9', 0x0A },
+    { 'A', 0x1E }, { 'B', 0x30 }, { 'C', 0x2E }, { 'D', 0x20 },
+    { 'E', 0x12 }, { 'F', 0x21 }, { 'G', 0x22 }, { 'H', 0x23 },
+    { 'I', 0x17 }, { 'J', 0x24 }, { 'K', 0x25 }, { 'L', 0x26 },
+    { 'M', 0x32 }, { 'N', 0x31 }, { 'O', 0x18 }, { 'P', 0x19 },
+    { 'Q', 0x10 }, { 'R', 0x13 }, { 'S', 0x1F }, { 'T', 0x14 },
+    { 'U', 0x16 }, { 'V', 0x2F }, { 'W', 0x11 }, { 'X', 0x2D },
+    { 'Y', 0x15 }, { 'Z', 0x2C },
+};
+
+UINT WINAPI MapVirtualKeyW(UINT uCode, UINT uMapType)
+{
+    size_t i;
+
+    if (uMapType != MAPVK_VK_TO_VSC)
+        return 0;
+    for (i = 0; i < ARRAY_SIZE(g_scanCodes); i++) {
+        if (g_scanCodes[i].vk == uCode)
+            return g_scanCodes[i].scan;
+    }
+    return 0;
+}
+
+/* ===== Hooks and windows ===== */
+
+static DWORD g_foregroundPid = 1;
+
+void Shim_SetForegroundPid(DWORD pid)
+{
+    g_foregroundPid = pid;
+}
+
+LRESULT WINAPI CallNextHookEx(HHOOK hhk, int nCode, WPARAM wParam, LPARAM lParam)
+{
+    (void)hhk; (void)nCode; (void)wParam; (void)lParam;
+    return 0;
+}
+
+HWND WINAPI GetForegroundWindow(void)
+{
+    return (HWND)(ULONG_PTR)0x1000;
+}
+
+DWORD WINAPI GetWindowThreadProcessId(HWND hWnd, DWORD *lpdwProcessId)
+{
+    (void)hWnd;
+    if (lpdwProcessId)
+        *lpdwProcessId = g_foregroundPid;
+    return 1;
+}
+
+DWORD WINAPI GetCurrentProcessId(void)
+{
+    return 1;
+}
+
+static char g_moduleName[MAX_PATH] = "host.exe";
+
+void Shim_SetModuleName(const char *name)
+{
+    snprintf(g_moduleName, sizeof(g_moduleName), "%s", name);
+}
+
+/* The process image: the name set above, widened */
+DWORD WINAPI GetModuleFileNameW(HMODULE hModule, WCHAR *lpFilename, DWORD nSize)
+{
+    DWORD i;
+
+    (void)hModule;
+    if (nSize == 0)
+        return 0;
+    for (i = 0; g_moduleName[i] && i < nSize - 1; i++)
+        lpFilename[i] = (WCHAR)(unsigned char)g_moduleName[i];
+    lpFilename[i] = 0;
+    return i;
+}
+
+BOOL WINAPI PostMessageW(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam)
+{
+    (void)hWnd; (void)Msg; (void)wParam; (void)lParam;
+    return TRUE;
+}
+
+BOOL WINAPI IsWindow(HWND hWnd)
+{
+    return hWnd != NULL;
+}
+
+DWORD WINAPI GetCurrentThreadId(void)
+{
+    return 1;
+}
+
+/* ===== Thread messages ===== */
+
+#define THREAD_MSG_QUEUE_SIZE 64
+
+static MSG  g_threadMsgs[THREAD_MSG_QUEUE_SIZE];
+static UINT g_threadMsgHead = 0;
+static UINT g_threadMsgCount = 0;
+
+UINT WINAPI RegisterWindowMessageW(const WCHAR *lpString)
+{
+    (void)lpString;
+    return 0xC000;
+}
+
+BOOL WINAPI PostThreadMessageW(DWORD idThread, UINT Msg, WPARAM wParam, LPARAM lParam)
+{
+    MSG *msg;
+
+    if (idThread != GetCurrentThreadId() ||
+        g_threadMsgCount == THREAD_MSG_QUEUE_SIZE)
+        return FALSE;
+    msg = &g_threadMsgs[(g_threadMsgHead + g_threadMsgCount) % THREAD_MSG_QUEUE_SIZE];
+    memset(msg, 0, sizeof(*msg));
+    msg->message = Msg;
+    msg->wParam = wParam;
+    msg->lParam = lParam;
+    g_threadMsgCount++;
+    return TRUE;
+}
+
+BOOL Shim_PopThreadMessage(MSG *out)
+{
+    if (g_threadMsgCount == 0)
+        return FALSE;
+    *out = g_threadMsgs[g_threadMsgHead];
+    g_threadMsgHead = (g_threadMsgHead + 1) % THREAD_MSG_QUEUE_SIZE;
+    g_threadMsgCount--;
+    return TRUE;
+}
+
+/* ===== Heap and TLS ===== */
+
+HANDLE WINAPI GetProcessHeap(void)
+{
+    return (HANDLE)(ULONG_PTR)0x2000;
+}
+
+void *WINAPI HeapAlloc(HANDLE hHeap, DWORD dwFlags, size_t dwBytes)
+{
+    (void)hHeap;
+    return (dwFlags & HEAP_ZERO_MEMORY) ? calloc(1, dwBytes) : malloc(dwBytes);
+}
+
+BOOL WINAPI HeapFree(HANDLE hHeap, DWORD dwFlags, void *lpMem)
+{
+    (void)hHeap; (void)dwFlags;
+    free(lpMem);
+    return TRUE;
+}
+
+#define TLS_SLOTS 8
+
+static _Thread_local void *g_tlsSlots[TLS_SLOTS];
+static DWORD g_tlsNext = 0;
+
+DWORD WINAPI TlsAlloc(void)
+{
+    if (g_tlsNext >= TLS_SLOTS)
+        return TLS_OUT_OF_INDEXES;
+    return g_tlsNext++;
+}
+
+void *WINAPI TlsGetValue(DWORD dwTlsIndex)
+{
+    return dwTlsIndex < TLS_SLOTS ? g_tlsSlots[dwTlsIndex] : NULL;
+}
+
+BOOL WINAPI TlsSetValue(DWORD dwTlsIndex, void *lpTlsValue)
+{
+    if (dwTlsIndex >= TLS_SLOTS)
+        return FALSE;
+    g_tlsSlots[dwTlsIndex] = lpTlsValue;
+    return TRUE;
+}
+
+/* ===== In-memory registry ===== */
+
+#define REG_MAX_KEYS    16
+#define REG_MAX_VALUES  64
+#define REG_MAX_NAME    128
+#define REG_MAX_DATA    512
+
+typedef struct {
+    BOOL  used;
+    HKEY  root;
+    WCHAR path[REG_MAX_NAME];
+} RegKey;
+
+typedef struct {
+    BOOL  used;
+    int   key;
+    WCHAR name[REG_MAX_NAME];
+    DWORD type;
+    DWORD size;
+    BYTE  data[REG_MAX_DATA];
+} RegValue;
+
+static RegKey   g_regKeys[REG_MAX_KEYS];
+static RegValue g_regValues[REG_MAX_VALUES];
+static pthread_mutex_t g_regLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* DWORD values written, in order */
+#define REG_MAX_LOG     256
+
+static ShimRegWrite g_regLog[REG_MAX_LOG];
+static UINT g_regLogCount = 0;
+
+static BOOL WStrEq(const WCHAR *a, const WCHAR *b)
+{
+    while (*a && *a == *b) { a++; b++; }
+    return *a == *b;
+}
+
+static void WStrCopy(WCHAR *dst, const WCHAR *src, int cap)
+{
+    int i;
+    for (i = 0; i < cap - 1 && src[i]; i++)
+        dst[i] = src[i];
+    dst[i] = 0;
+}
+
+static int FindKey(HKEY root, const WCHAR *path)
+{
+    int i;
+    for (i = 0; i < REG_MAX_KEYS; i++) {
+        if (g_regKeys[i].used && g_regKeys[i].root == root &&
+            WStrEq(g_regKeys[i].path, path))
+            return i;
+    }
+    return -1;
+}
+
+/* HKEY handles are key index + 1 (0 would be NULL) */
+#define KEY_TO_HKEY(i)  ((HKEY)(ULONG_PTR)((i) + 1))
+#define HKEY_TO_KEY(h)  ((int)(ULONG_PTR)(h) - 1)
+
+static ULONG g_regCalls = 0;
+
+void Shim_ResetRegistry(void)
+{
+    pthread_mutex_lock(&g_regLock);
+    memset(g_regKeys, 0, sizeof(g_regKeys));
+    memset(g_regValues, 0, sizeof(g_regValues));
+    g_regCalls = 0;
+    g_regLogCount = 0;
+    pthread_mutex_unlock(&g_regLock);
+}
+
+ULONG Shim_RegistryCalls(void)
+{
+    ULONG calls;
+
+    pthread_mutex_lock(&g_regLock);
+    calls = g_regCalls;
+    pthread_mutex_unlock(&g_regLock);
+    return calls;
+}
+
+UINT Shim_RegistryLog(const ShimRegWrite **log)
+{
+    *log = g_regLog;
+    return g_regLogCount;
+}
+
+static LONG RegOpenKeyLocked(HKEY hKey, LPCWSTR lpSubKey, DWORD ulOptions,
+                             DWORD samDesired, HKEY *phkResult)
+{
+    int k = FindKey(hKey, lpSubKey);
+
+    (void)ulOptions; (void)samDesired;
+    g_regCalls++;
+    if (k < 0)
+        return ERROR_FILE_NOT_FOUND;
+    *phkResult = KEY_TO_HKEY(k);
+    return ERROR_SUCCESS;
+}
+
+static LONG RegCreateKeyLocked(HKEY hKey, LPCWSTR lpSubKey, DWORD Reserved,
+                               WCHAR *lpClass, DWORD dwOptions, DWORD samDesired,
+                               void *lpSecurityAttributes, HKEY *phkResult,
+                               DWORD *lpdwDisposition)
+{
+    int k = FindKey(hKey, lpSubKey);
+
+    (void)Reserved; (void)lpClass; (void)dwOptions; (void)samDesired;
+    (void)lpSecurityAttributes; (void)lpdwDisposition;
+    g_regCalls++;
+
+    if (k < 0) {
+        for (k = 0; k < REG_MAX_KEYS && g_regKeys[k].used; k++)
+            ;
+        if (k == REG_MAX_KEYS)
+            return E_OUTOFMEMORY;
+        g_regKeys[k].used = TRUE;
+        g_regKeys[k].root = hKey;
+        WStrCopy(g_regKeys[k].path, lpSubKey, REG_MAX_NAME);
+    }
+    *phkResult = KEY_TO_HKEY(k);
+    return ERROR_SUCCESS;
+}
+
+static RegValue *FindValue(int key, const WCHAR *name)
+{
+    int i;
+    for (i = 0; i < REG_MAX_VALUES; i++) {
+        if (g_regValues[i].used && g_regValues[i].key == key &&
+            WStrEq(g_regValues[i].name, name))
+            return &g_regValues[i];
+    }
+    return NULL;
+}
+
+static LONG RegQueryValueLocked(HKEY hKey, LPCWSTR lpValueName, DWORD *lpReserved,
+                                DWORD *lpType, BYTE *lpData, DWORD *lpcbData)
+{
+    RegValue *v = FindValue(HKEY_TO_KEY(hKey), lpValueName);
+
+    (void)lpReserved;
+    g_regCalls++;
+    if (!v)
+        return ERROR_FILE_NOT_FOUND;
+    if (lpType)
+        *lpType = v->type;
+    if (lpData) {
+        if (!lpcbData || *lpcbData < v->size)
+            return E_INVALIDARG;
+        memcpy(lpData, v->data, v->size);
+    }
+    if (lpcbData)
+        *lpcbData = v->size;
+    return ERROR_SUCCESS;
+}
+
+static LONG RegSetValueLocked(HKEY hKey, LPCWSTR lpValueName, DWORD Reserved,
+                              DWORD dwType, const BYTE *lpData, DWORD cbData)
+{
+    int key = HKEY_TO_KEY(hKey);
+    RegValue *v = FindValue(key, lpValueName);
+    int i;
+
+    (void)Reserved;
+    g_regCalls++;
+    if (cbData > REG_MAX_DATA)
+        return E_INVALIDARG;
+
+    if (!v) {
+        for (i = 0; i < REG_MAX_VALUES && g_regValues[i].used; i++)
+            ;
+        if (i == REG_MAX_VALUES)
+            return E_OUTOFMEMORY;
+        v = &g_regValues[i];
+        v->used = TRUE;
+        v->key = key;
+        WStrCopy(v->name, lpValueName, REG_MAX_NAME);
+    }
+    v->type = dwType;
+    v->size = cbData;
+    memcpy(v->data, lpData, cbData);
+
+    if (dwType == REG_DWORD && cbData == sizeof(DWORD) &&
+        g_regLogCount < REG_MAX_LOG) {
+        ShimRegWrite *w = &g_regLog[g_regLogCount++];
+        WStrCopy(w->name, lpValueName, SHIM_REG_MAX_NAME);
+        memcpy(&w->value, lpData, sizeof(DWORD));
+    }
+    return ERROR_SUCCESS;
+}
+
+/* ===== Registry API (serialized) ===== */
+
+LONG WINAPI RegOpenKeyExW(HKEY hKey, LPCWSTR lpSubKey, DWORD ulOptions,
+                          DWORD samDesired, HKEY *phkResult)
+{
+    LONG ret;
+
+    pthread_mutex_lock(&g_regLock);
+    ret = RegOpenKeyLocked(hKey, lpSubKey, ulOptions, samDesired, phkResult);
+    pthread_mutex_unlock(&g_regLock);
+    return ret;
+}
+
+LONG WINAPI RegCreateKeyExW(HKEY hKey, LPCWSTR lpSubKey, DWORD Reserved,
+                            WCHAR *lpClass, DWORD dwOptions, DWORD samDesired,
+                            void *lpSecurityAttributes, HKEY *phkResult,
+                            DWORD *lpdwDisposition)
+{
+    LONG ret;
+
+    pthread_mutex_lock(&g_regLock);
+    ret = RegCreateKeyLocked(hKey, lpSubKey, Reserved, lpClass, dwOptions,
+                             samDesired, lpSecurityAttributes, phkResult,
+                             lpdwDisposition);
+    pthread_mutex_unlock(&g_regLock);
+    return ret;
+}
+
+LONG WINAPI RegQueryValueExW(HKEY hKey, LPCWSTR lpValueName, DWORD *lpReserved,
+                             DWORD *lpType, BYTE *lpData, DWORD *lpcbData)
+{
+    LONG ret;
+
+    pthread_mutex_lock(&g_regLock);
+    ret = RegQueryValueLocked(hKey, lpValueName, lpReserved, lpType,
+                              lpData, lpcbData);
+    pthread_mutex_unlock(&g_regLock);
+    return ret;
+}
+
+LONG WINAPI RegSetValueExW(HKEY hKey, LPCWSTR lpValueName, DWORD Reserved,
+                           DWORD dwType, const BYTE *lpData, DWORD cbData)
+{
+    LONG ret;
+
+    pthread_mutex_lock(&g_regLock);
+    ret = RegSetValueLocked(hKey, lpValueName, Reserved, dwType, lpData, cbData);
+    pthread_mutex_unlock(&g_regLock);
+    return ret;
+}
+
+LONG WINAPI RegCloseKey(HKEY hKey)
+{
+    (void)hKey;
+    return ERROR_SUCCESS;
+}
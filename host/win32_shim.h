@@ -0,0 +1,51 @@
+/*
+ * win32_shim.h - Controls for the host Win32 stand-in
+ *
+ * Lets the host driver set keyboard state, collect SendInput events
+ * and inspect the in-memory registry behind host/include/windows.h.
+ */
+
+#ifndef WIN32_SHIM_H
+#define WIN32_SHIM_H
+
+#include <windows.h>
+
+/* Record a physical key transition in the keyboard state.
+ * Left/right modifiers also update the generic VK_SHIFT/CONTROL/MENU,
+ * and a key-down flips the toggle bit (CapsLock etc.). */
+void Shim_SetKeyState(UINT vk, BOOL down);
+
+/* Clear all key state */
+void Shim_ResetKeyState(void);
+
+/* SendInput queue (FIFO).  Shim_PopInput returns FALSE when empty. */
+UINT Shim_PendingInputs(void);
+BOOL Shim_PopInput(INPUT *out);
+ULONG Shim_TotalInputs(void);
+
+/* PostThreadMessageW queue of the (single) host thread, FIFO */
+BOOL Shim_PopThreadMessage(MSG *out);
+
+/* Drop every registry key and value */
+void Shim_ResetRegistry(void);
+
+/* Registry opens, creates, queries and sets since the last reset */
+ULONG Shim_RegistryCalls(void);
+
+/* DWORD values written since the last reset, in order */
+#define SHIM_REG_MAX_NAME 32
+
+typedef struct {
+    WCHAR name[SHIM_REG_MAX_NAME];
+    DWORD value;
+} ShimRegWrite;
+
+UINT Shim_RegistryLog(const ShimRegWrite **log);
+
+/* Process id reported for the foreground window */
+void Shim_SetForegroundPid(DWORD pid);
+
+/* Image path reported by GetModuleFileNameW (ASCII) */
+void Shim_SetModuleName(const char *name);
+
+#endif /* WIN32_SHIM_H */
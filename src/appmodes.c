@@ -0,0 +1,455 @@
+/*
+ * appmodes.c - Input modes remembered per application
+ *
+ * The table is portable; the section comes from shmsection.h.
+ */
+
+#include "appmodes.h"
+#include "shmsection.h"
+
+#include <string.h>
+
+#define APPMODES_TAG        "AppModes.v1"
+
+/* Index: twice the slots, so probes stay short at a full table */
+#define APPMODES_INDEX      (APPMODES_SLOTS * 2)
+#define APPMODES_INDEX_MASK (APPMODES_INDEX - 1)
+#define APPMODES_NONE       0xFF
+
+/* The lock is given up after this many attempts, so an owner that is
+ * preempted costs the focus path a miss, not a wait.  Every
+ * APPMODES_STALL_SPINS the owner is checked for having died. */
+#define APPMODES_SPIN_LIMIT (1 << 16)
+#define APPMODES_STALL_SPINS (1 << 10)
+
+#define APPMODES_MAGIC0     'K'
+#define APPMODES_MAGIC1     'A'
+#define APPMODES_VERSION    1
+#define APPMODES_RECORD     5
+
+typedef struct {
+    DWORD key;
+    BYTE  modes;
+    BYTE  prev;         /* LRU neighbours, APPMODES_NONE at the ends */
+    BYTE  next;
+    BYTE  reserved;
+} AppModesEntry;
+
+typedef struct {
+    volatile LONG lock;         /* pid of the owner, 0 = free */
+    volatile LONG loaded;
+    BYTE  head;         /* most recently used */
+    BYTE  tail;         /* least recently used */
+    BYTE  count;
+    BYTE  reserved;
+    AppModesEntry entries[APPMODES_SLOTS];
+    BYTE  index[APPMODES_INDEX];    /* entry + 1, 0 = empty */
+} AppModesTable;
+
+static AppModesTable *volatile s_table;
+static AppModesTable s_localTable;
+static HANDLE s_mapping;
+static volatile LONG s_hits;
+static volatile LONG s_misses;
+static volatile LONG s_evictions;
+static volatile LONG s_lockFailures;
+static volatile LONG s_recoveries;
+
+/* ===== Keys ===== */
+
+DWORD appmodes_key(const WCHAR *imagePath)
+{
+    const WCHAR *name = imagePath, *p;
+    DWORD h = 2166136261u;
+
+    if (!imagePath)
+        return 0;
+    for (p = imagePath; *p; p++) {
+        if (*p == L'\\' || *p == L'/' || *p == L':')
+            name = p + 1;
+    }
+    if (!*name)
+        return 0;
+
+    for (p = name; *p; p++) {
+        WCHAR c = *p;
+        if (c >= L'A' && c <= L'Z')
+            c = (WCHAR)(c - L'A' + L'a');
+        h = (h ^ (BYTE)c) * 16777619u;
+        h = (h ^ (BYTE)(c >> 8)) * 16777619u;
+    }
+    return h ? h : 1;
+}
+
+/* ===== Section mapping ===== */
+
+static AppModesTable *get_table(void)
+{
+    AppModesTable *table;
+    HANDLE handle = NULL;
+
+    if (s_table)
+        return s_table;
+
+    /* A new section is zero-filled: empty and not yet loaded */
+    table = (AppModesTable *)shmsection_map(APPMODES_TAG,
+                                            sizeof(AppModesTable), &handle);
+    if (!table)
+        table = &s_localTable;
+
+    /* Two threads may race here; the loser drops its view */
+    if (InterlockedCompareExchangePointer((void *volatile *)&s_table,
+                                          table, NULL) != NULL) {
+        if (table != &s_localTable)
+            shmsection_unmap(table, sizeof(AppModesTable), handle);
+    } else if (table != &s_localTable) {
+        s_mapping = handle;
+    }
+    return s_table;
+}
+
+void appmodes_close(void)
+{
+    AppModesTable *table = s_table;
+
+    s_table = NULL;
+    if (table && table != &s_localTable)
+        shmsection_unmap(table, sizeof(AppModesTable), s_mapping);
+    s_mapping = NULL;
+}
+
+void appmodes_unlink(void)
+{
+    shmsection_unlink(APPMODES_TAG);
+}
+
+/* ===== Index ===== */
+
+static UINT home_of(DWORD key)
+{
+    return (UINT)((key * 2654435761u) >> 24) & APPMODES_INDEX_MASK;
+}
+
+/* Index position of key, or -1 */
+static int find(const AppModesTable *t, DWORD key)
+{
+    UINT i = home_of(key);
+
+    while (t->index[i]) {
+        if (t->entries[t->index[i] - 1].key == key)
+            return (int)i;
+        i = (i + 1) & APPMODES_INDEX_MASK;
+    }
+    return -1;
+}
+
+static void index_insert(AppModesTable *t, UINT slot)
+{
+    UINT i = home_of(t->entries[slot].key);
+
+    while (t->index[i])
+        i = (i + 1) & APPMODES_INDEX_MASK;
+    t->index[i] = (BYTE)(slot + 1);
+}
+
+/* Remove without tombstones: later entries of the probe run move back
+ * into the hole unless that would put them before their home */
+static void index_remove(AppModesTable *t, UINT pos)
+{
+    UINT hole = pos, i = pos;
+
+    for (;;) {
+        UINT home;
+
+        i = (i + 1) & APPMODES_INDEX_MASK;
+        if (!t->index[i])
+            break;
+        home = home_of(t->entries[t->index[i] - 1].key);
+        if (((i - home) & APPMODES_INDEX_MASK) >=
+            ((i - hole) & APPMODES_INDEX_MASK)) {
+            t->index[hole] = t->index[i];
+            hole = i;
+        }
+    }
+    t->index[hole] = 0;
+}
+
+/* ===== LRU order ===== */
+
+static void unlink_entry(AppModesTable *t, UINT slot)
+{
+    AppModesEntry *e = &t->entries[slot];
+
+    if (e->prev != APPMODES_NONE)
+        t->entries[e->prev].next = e->next;
+    else
+        t->head = e->next;
+    if (e->next != APPMODES_NONE)
+        t->entries[e->next].prev = e->prev;
+    else
+        t->tail = e->prev;
+}
+
+static void push_front(AppModesTable *t, UINT slot)
+{
+    AppModesEntry *e = &t->entries[slot];
+
+    e->prev = APPMODES_NONE;
+    e->next = t->head;
+    if (t->head != APPMODES_NONE)
+        t->entries[t->head].prev = (BYTE)slot;
+    else
+        t->tail = (BYTE)slot;
+    t->head = (BYTE)slot;
+}
+
+static void push_back(AppModesTable *t, UINT slot)
+{
+    AppModesEntry *e = &t->entries[slot];
+
+    e->prev = t->tail;
+    e->next = APPMODES_NONE;
+    if (t->tail != APPMODES_NONE)
+        t->entries[t->tail].next = (BYTE)slot;
+    else
+        t->head = (BYTE)slot;
+    t->tail = (BYTE)slot;
+}
+
+static void touch(AppModesTable *t, UINT slot)
+{
+    if (t->head != slot) {
+        unlink_entry(t, slot);
+        push_front(t, slot);
+    }
+}
+
+static void clear(AppModesTable *t)
+{
+    memset(t->entries, 0, sizeof(t->entries));
+    memset(t->index, 0, sizeof(t->index));
+    t->head = APPMODES_NONE;
+    t->tail = APPMODES_NONE;
+    t->count = 0;
+}
+
+/* ===== Lock ===== */
+
+/* The process owning the lock died: take it over.  Whatever it was
+ * changing may be half done, so the table starts over, to be loaded
+ * again from the last snapshot. */
+static BOOL take_over(AppModesTable *t, LONG holder, LONG self)
+{
+    if (holder == 0 || shmsection_process_alive((DWORD)holder) ||
+        InterlockedCompareExchange(&t->lock, self, holder) != holder)
+        return FALSE;
+
+    clear(t);
+    t->loaded = 0;
+    InterlockedIncrement(&s_recoveries);
+    return TRUE;
+}
+
+static BOOL lock(AppModesTable *t)
+{
+    LONG self = (LONG)shmsection_process_id();
+    UINT spins;
+
+    for (spins = 0; spins < APPMODES_SPIN_LIMIT; spins++) {
+        LONG owner = t->lock;
+
+        if (owner == 0 && InterlockedCompareExchange(&t->lock, self, 0) == 0)
+            return TRUE;
+        if ((spins & (APPMODES_STALL_SPINS - 1)) ==
+                APPMODES_STALL_SPINS - 1 && take_over(t, owner, self))
+            return TRUE;
+        YieldProcessor();
+    }
+    InterlockedIncrement(&s_lockFailures);
+    return FALSE;
+}
+
+static void unlock(AppModesTable *t)
+{
+    MemoryBarrier();
+    t->lock = 0;
+}
+
+/* ===== Entries ===== */
+
+/* With the table locked */
+static BOOL put_locked(AppModesTable *t, DWORD key, BYTE modes)
+{
+    int pos = find(t, key);
+    UINT slot;
+
+    if (pos >= 0) {
+        AppModesEntry *e = &t->entries[t->index[pos] - 1];
+        BOOL changed = (e->modes != modes);
+
+        e->modes = modes;
+        touch(t, t->index[pos] - 1);
+        return changed;
+    }
+
+    if (t->count < APPMODES_SLOTS) {
+        slot = t->count++;
+    } else {
+        slot = t->tail;
+        index_remove(t, (UINT)find(t, t->entries[slot].key));
+        unlink_entry(t, slot);
+        InterlockedIncrement(&s_evictions);
+    }
+    t->entries[slot].key = key;
+    t->entries[slot].modes = modes;
+    index_insert(t, slot);
+    push_front(t, slot);
+    return TRUE;
+}
+
+/* ===== Public API ===== */
+
+BOOL appmodes_loaded(void)
+{
+    AppModesTable *t = get_table();
+    return t->loaded != 0;
+}
+
+BOOL appmodes_load(const BYTE *data, DWORD size)
+{
+    AppModesTable *t = get_table();
+    UINT count, i;
+
+    if (t->loaded || !lock(t))
+        return FALSE;
+    if (t->loaded) {
+        unlock(t);
+        return FALSE;
+    }
+
+    if (t->count == 0)
+        clear(t);
+    if (data && size >= 4 &&
+        data[0] == APPMODES_MAGIC0 && data[1] == APPMODES_MAGIC1 &&
+        data[2] == APPMODES_VERSION && data[3] <= APPMODES_SLOTS &&
+        size == 4 + (DWORD)data[3] * APPMODES_RECORD) {
+        count = data[3];
+
+        /* Most recently used first.  Entries put before the load are
+         * newer than the snapshot's, so these go behind them, and what
+         * does not fit is the snapshot's least recently used. */
+        for (i = 0; i < count && t->count < APPMODES_SLOTS; i++) {
+            const BYTE *r = data + 4 + i * APPMODES_RECORD;
+            DWORD key = (DWORD)r[0] | ((DWORD)r[1] << 8) |
+                        ((DWORD)r[2] << 16) | ((DWORD)r[3] << 24);
+            UINT slot;
+
+            if (!key || find(t, key) >= 0)
+                continue;
+            slot = t->count++;
+            t->entries[slot].key = key;
+            t->entries[slot].modes = r[4] & (APPMODE_KOREAN | APPMODE_COLEMAK);
+            index_insert(t, slot);
+            push_back(t, slot);
+        }
+    }
+    t->loaded = 1;
+    unlock(t);
+    return TRUE;
+}
+
+BOOL appmodes_get(DWORD key, BYTE *modes)
+{
+    AppModesTable *t = get_table();
+    int pos;
+
+    if (!key || !t->loaded || !lock(t))
+        return FALSE;
+
+    pos = find(t, key);
+    if (pos >= 0) {
+        *modes = t->entries[t->index[pos] - 1].modes;
+        touch(t, t->index[pos] - 1);
+    }
+    unlock(t);
+
+    InterlockedIncrement(pos >= 0 ? &s_hits : &s_misses);
+    return pos >= 0;
+}
+
+BOOL appmodes_put(DWORD key, BYTE modes)
+{
+    AppModesTable *t = get_table();
+    BOOL changed;
+
+    if (!key || !lock(t))
+        return FALSE;
+
+    /* A table never loaded or put to is still all zeroes: set up its
+     * links first */
+    if (!t->loaded && t->count == 0)
+        clear(t);
+    changed = put_locked(t, key, modes);
+    unlock(t);
+    return changed;
+}
+
+DWORD appmodes_save(BYTE *buf, DWORD size)
+{
+    AppModesTable *t = get_table();
+    BYTE *r = buf + 4;
+    UINT slot, count = 0;
+
+    if (size < APPMODES_SNAPSHOT_MAX || !lock(t))
+        return 0;
+
+    /* Until it is loaded, the table would overwrite the snapshot with
+     * the few entries put since */
+    if (!t->loaded) {
+        unlock(t);
+        return 0;
+    }
+
+    for (slot = t->count ? t->head : APPMODES_NONE;
+         slot != APPMODES_NONE && count < APPMODES_SLOTS;
+         slot = t->entries[slot].next) {
+        const AppModesEntry *e = &t->entries[slot];
+        r[0] = (BYTE)e->key;
+        r[1] = (BYTE)(e->key >> 8);
+        r[2] = (BYTE)(e->key >> 16);
+        r[3] = (BYTE)(e->key >> 24);
+        r[4] = e->modes;
+        r += APPMODES_RECORD;
+        count++;
+    }
+    unlock(t);
+
+    buf[0] = APPMODES_MAGIC0;
+    buf[1] = APPMODES_MAGIC1;
+    buf[2] = APPMODES_VERSION;
+    buf[3] = (BYTE)count;
+    return 4 + count * APPMODES_RECORD;
+}
+
+void appmodes_reset(void)
+{
+    AppModesTable *t = get_table();
+
+    if (!lock(t))
+        return;
+    clear(t);
+    t->loaded = 0;
+    unlock(t);
+}
+
+void appmodes_stats(AppModesStats *stats)
+{
+    AppModesTable *t = get_table();
+
+    stats->count = t->count;
+    stats->hits = s_hits;
+    stats->misses = s_misses;
+    stats->evictions = s_evictions;
+    stats->lockFailures = s_lockFailures;
+    stats->recoveries = s_recoveries;
+}
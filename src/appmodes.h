@@ -0,0 +1,79 @@
+/*
+ * appmodes.h - Input modes remembered per application
+ *
+ * Korean/English is per thread and starts in English, Colemak/QWERTY
+ * is one value for the session, so someone going back and forth between
+ * a Korean messenger and an English IDE retoggles on every switch.  The
+ * modes last used in each application are kept in a table shared by
+ * the session (shmsection.h; private to the process if that fails):
+ * APPMODES_SLOTS entries in LRU order, found through an open-addressed
+ * hash index, so the lookup on focus and the update on a toggle are
+ * O(1) and the least recently used application is dropped when full.
+ *
+ * An application is the hash of its image name (appmodes_key).  The
+ * table is persisted as one compact snapshot (appmodes_save), not a
+ * registry value per application.
+ */
+
+#ifndef APPMODES_H
+#define APPMODES_H
+
+#include <windows.h>
+
+#define APPMODES_SLOTS      64
+
+/* Mode bits */
+#define APPMODE_KOREAN      0x01
+#define APPMODE_COLEMAK     0x02
+
+/* Snapshot: 4-byte header, then 5 bytes (key LE, modes) per entry,
+ * most recently used first */
+#define APPMODES_SNAPSHOT_MAX   (4 + APPMODES_SLOTS * 5)
+
+/* Key of the application at imagePath: FNV-1a of its file name, ASCII
+ * case folded.  0 = no name (not remembered). */
+DWORD appmodes_key(const WCHAR *imagePath);
+
+/* Drop this process's view of the section (DLL unload) */
+void appmodes_close(void);
+
+/* Remove the section's name, e.g. a private one set up through
+ * KOLEMAK_SHM (shmsection.h) */
+void appmodes_unlink(void);
+
+/* Whether the table was populated from a snapshot yet; the caller then
+ * reads the snapshot and passes it to appmodes_load */
+BOOL appmodes_loaded(void);
+
+/* Populate the table from a snapshot (NULL or malformed = start empty),
+ * behind any entries put before.  Does nothing if another process got
+ * there first. */
+BOOL appmodes_load(const BYTE *data, DWORD size);
+
+/* Modes of key, making it the most recently used; FALSE if unknown */
+BOOL appmodes_get(DWORD key, BYTE *modes);
+
+/* Remember modes for key, dropping the least recently used entry if
+ * the table is full.  TRUE if that changed what a snapshot holds. */
+BOOL appmodes_put(DWORD key, BYTE modes);
+
+/* Write a snapshot into buf (at least APPMODES_SNAPSHOT_MAX bytes);
+ * returns its size, 0 on failure or while the table is not loaded */
+DWORD appmodes_save(BYTE *buf, DWORD size);
+
+/* Forget every entry, as if the section were new (host runs) */
+void appmodes_reset(void);
+
+/* Seen by this process */
+typedef struct {
+    LONG count;         /* entries in the table now */
+    LONG hits;
+    LONG misses;
+    LONG evictions;
+    LONG lockFailures;  /* table skipped: another writer held it too long */
+    LONG recoveries;    /* lock taken over from a process that died */
+} AppModesStats;
+
+void appmodes_stats(AppModesStats *stats);
+
+#endif /* APPMODES_H */
@@ -0,0 +1,161 @@
+/*
+ * arena.c - Private allocator for the IME's objects
+ */
+
+#include "arena.h"
+
+#include <string.h>
+
+/* Ahead of every block; 16 bytes keep the block as aligned as the heap
+ * returned it */
+typedef struct {
+    UINT type;
+    UINT size;
+    UINT reserved[2];
+} ArenaHeader;
+
+static ArenaStats s_stats[ARENA_TYPES];
+
+static const char *const s_names[ARENA_TYPES] = {
+    "TextService",
+    "EditSession",
+    "LangBarButton",
+    "ScancodeMap",
+};
+
+/* ===== Heap ===== */
+
+#ifdef _WIN32
+
+static HANDLE s_heap;
+
+void arena_open(void)
+{
+    if (!s_heap)
+        s_heap = HeapCreate(0, 0, 0);
+}
+
+void arena_close(void)
+{
+    if (s_heap) {
+        HeapDestroy(s_heap);
+        s_heap = NULL;
+    }
+}
+
+/* The process heap if the private one could not be created */
+static HANDLE Heap(void)
+{
+    return s_heap ? s_heap : GetProcessHeap();
+}
+
+#else
+
+void arena_open(void) {}
+void arena_close(void) {}
+
+static HANDLE Heap(void)
+{
+    return GetProcessHeap();
+}
+
+#endif
+
+/* ===== Accounting ===== */
+
+static void RaiseTo(volatile LONG *peak, LONG now)
+{
+    LONG seen = *peak;
+
+    while (now > seen) {
+        LONG prev = InterlockedCompareExchange(peak, now, seen);
+        if (prev == seen)
+            break;
+        seen = prev;
+    }
+}
+
+static void Count(UINT type, LONG bytes)
+{
+    ArenaStats *s = &s_stats[type];
+
+    InterlockedIncrement(&s->allocs);
+    RaiseTo(&s->peakLive, InterlockedIncrement(&s->live));
+    if (bytes)
+        RaiseTo(&s->peakBytes,
+                InterlockedExchangeAdd(&s->bytes, bytes) + bytes);
+}
+
+static void Uncount(UINT type, LONG bytes)
+{
+    InterlockedDecrement(&s_stats[type].live);
+    if (bytes)
+        InterlockedExchangeAdd(&s_stats[type].bytes, -bytes);
+}
+
+/* ===== Public API ===== */
+
+void *arena_alloc(UINT type, size_t size)
+{
+    ArenaHeader *h;
+
+    if (type >= ARENA_TYPES || size > 0x7FFFFFF0u - sizeof(ArenaHeader))
+        return NULL;
+
+    h = (ArenaHeader *)HeapAlloc(Heap(), HEAP_ZERO_MEMORY,
+                                 sizeof(ArenaHeader) + size);
+    if (!h)
+        return NULL;
+    h->type = type;
+    h->size = (UINT)size;
+    Count(type, (LONG)size);
+    return h + 1;
+}
+
+void arena_free(void *p)
+{
+    ArenaHeader *h;
+
+    if (!p)
+        return;
+    h = (ArenaHeader *)p - 1;
+    Uncount(h->type, (LONG)h->size);
+    HeapFree(Heap(), 0, h);
+}
+
+void arena_hold(UINT type)
+{
+    if (type < ARENA_TYPES)
+        Count(type, 0);
+}
+
+void arena_unhold(UINT type)
+{
+    if (type < ARENA_TYPES)
+        Uncount(type, 0);
+}
+
+const char *arena_type_name(UINT type)
+{
+    return type < ARENA_TYPES ? s_names[type] : "total";
+}
+
+void arena_stats(UINT type, ArenaStats *out)
+{
+    UINT i;
+
+    if (type < ARENA_TYPES) {
+        *out = s_stats[type];
+        return;
+    }
+
+    /* The sum of peaks bounds the peak of the sum */
+    memset(out, 0, sizeof(*out));
+    for (i = 0; i < ARENA_TYPES; i++) {
+        out->live += s_stats[i].live;
+        out->bytes += s_stats[i].bytes;
+        out->peakLive += s_stats[i].peakLive;
+        out->peakBytes += s_stats[i].peakBytes;
+        out->allocs += s_stats[i].allocs;
+    }
+}
@@ -0,0 +1,58 @@
+/*
+ * arena.h - Private allocator for the IME's objects
+ *
+ * kolemak.dll lives in every GUI process, so its allocations come from
+ * a heap of its own (HeapCreate) rather than the host application's,
+ * and each is counted against its object type: live objects, live
+ * bytes, peak bytes.  The totals are cheap to read, so the IME's
+ * footprint in a process can be shown (the tray's About box) and
+ * checked for leaks (kolemak-host reports them at exit).
+ *
+ * Objects carved from a pool inside another allocation (edit sessions,
+ * edit_session.c) are counted with arena_hold/arena_unhold: live, but
+ * no bytes of their own.
+ *
+ * Elsewhere (host build) the blocks come from the process heap.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <windows.h>
+
+/* Object types */
+enum {
+    ARENA_TEXT_SERVICE,
+    ARENA_EDIT_SESSION,
+    ARENA_LANGBAR_BUTTON,
+    ARENA_SCANCODE_MAP,
+    ARENA_TYPES
+};
+
+typedef struct {
+    LONG live;        /* objects */
+    LONG bytes;       /* allocated for the live ones */
+    LONG peakLive;
+    LONG peakBytes;
+    LONG allocs;      /* ever, including holds */
+} ArenaStats;
+
+/* Create / destroy the private heap (DllMain) */
+void arena_open(void);
+void arena_close(void);
+
+/* Zeroed; NULL when out of memory */
+void *arena_alloc(UINT type, size_t size);
+void  arena_free(void *p);
+
+/* Count an object not allocated here */
+void arena_hold(UINT type);
+void arena_unhold(UINT type);
+
+const char *arena_type_name(UINT type);
+
+/* One type, or all of them summed (type = ARENA_TYPES) */
+void arena_stats(UINT type, ArenaStats *out);
+
+#endif /* ARENA_H */
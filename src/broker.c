@@ -0,0 +1,337 @@
+/*
+ * broker.c - Session-wide election of one process for a role
+ *
+ * The thread body is portable; the mutex and the wait are a named Win32
+ * mutex and the thread's message queue on Windows, and a robust pthread
+ * mutex in shared memory elsewhere (host build).
+ */
+
+#include "broker.h"
+#include "shmsection.h"
+
+#include <stddef.h>
+#include <string.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#endif
+
+/* The election lock, held by the owner's broker thread */
+typedef enum {
+    ELECT_OWNER,       /* acquired */
+    ELECT_TAKEOVER,    /* acquired from an owner that died */
+    ELECT_STOP,        /* broker_stop was called while waiting */
+    ELECT_FAILED,
+} ElectResult;
+
+static void run(Broker *b);
+
+/* ===== Platform ===== */
+
+#ifdef _WIN32
+
+#define BROKER_MAX_NAME 64
+
+struct Broker {
+    volatile LONG inUse;
+    const BrokerRole *role;
+    HANDLE thread;
+    DWORD  threadId;
+    HANDLE ready;
+    HANDLE mutex;
+    volatile LONG owner;
+    volatile LONG stopping;
+    BrokerStats stats;
+};
+
+/* Posted messages wake the wait, so WM_QUIT ends it */
+static ElectResult elect_wait(Broker *b)
+{
+    for (;;) {
+        DWORD r = MsgWaitForMultipleObjects(1, &b->mutex, FALSE, INFINITE,
+                                            QS_POSTMESSAGE);
+        MSG msg;
+
+        if (r == WAIT_OBJECT_0)
+            return ELECT_OWNER;
+        if (r == WAIT_ABANDONED_0)
+            return ELECT_TAKEOVER;
+        if (r != WAIT_OBJECT_0 + 1)
+            return ELECT_FAILED;
+        while (PeekMessageW(&msg, NULL, 0, 0, PM_REMOVE)) {
+            if (msg.message == WM_QUIT)
+                return ELECT_STOP;
+        }
+    }
+}
+
+static void elect_release(Broker *b)
+{
+    ReleaseMutex(b->mutex);
+}
+
+/* Until broker_stop posts WM_QUIT; hooks run from inside GetMessage */
+static void serve(Broker *b)
+{
+    MSG msg;
+
+    (void)b;
+    while (GetMessageW(&msg, NULL, 0, 0) > 0)
+        DispatchMessageW(&msg);
+}
+
+static DWORD WINAPI broker_entry(void *arg)
+{
+    Broker *b = (Broker *)arg;
+    MSG msg;
+
+    /* Create the message queue before broker_start returns */
+    PeekMessageW(&msg, NULL, WM_USER, WM_USER, PM_NOREMOVE);
+    SetEvent(b->ready);
+    run(b);
+    return 0;
+}
+
+static BOOL platform_start(Broker *b)
+{
+    WCHAR name[BROKER_MAX_NAME];
+    const WCHAR prefix[] = L"Kolemak";
+    size_t n = 0, i;
+
+    for (i = 0; prefix[i]; i++)
+        name[n++] = prefix[i];
+    for (i = 0; b->role->name[i] && n < BROKER_MAX_NAME - 1; i++)
+        name[n++] = (WCHAR)(BYTE)b->role->name[i];
+    name[n] = 0;
+
+    /* Not owned on creation: ownership is taken by the wait.  Open to
+     * the session user at every integrity level, like the sections. */
+    b->mutex = CreateMutexW(shmsection_security(), FALSE, name);
+    if (!b->mutex)
+        return FALSE;
+    b->ready = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (!b->ready) {
+        CloseHandle(b->mutex);
+        return FALSE;
+    }
+
+    b->thread = CreateThread(NULL, 0, broker_entry, b, 0, &b->threadId);
+    if (b->thread)
+        WaitForSingleObject(b->ready, INFINITE);
+    CloseHandle(b->ready);
+    if (!b->thread) {
+        CloseHandle(b->mutex);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void platform_stop(Broker *b)
+{
+    PostThreadMessageW(b->threadId, WM_QUIT, 0, 0);
+    WaitForSingleObject(b->thread, INFINITE);
+    CloseHandle(b->thread);
+    CloseHandle(b->mutex);
+}
+
+#else
+
+/* How often a waiter looks for broker_stop */
+#define BROKER_POLL_MS 20
+
+typedef struct {
+    volatile LONG   state;     /* 0 = new, 1 = initializing, 2 = ready */
+    pthread_mutex_t mutex;
+} BrokerSection;
+
+struct Broker {
+    volatile LONG inUse;
+    const BrokerRole *role;
+    pthread_t thread;
+    BrokerSection *section;
+    HANDLE mapping;
+    pthread_mutex_t lock;      /* guards stopping for the cond */
+    pthread_cond_t  cond;
+    volatile LONG owner;
+    volatile LONG stopping;
+    BrokerStats stats;
+};
+
+static void section_init(BrokerSection *s)
+{
+    pthread_mutexattr_t attr;
+
+    if (InterlockedCompareExchange(&s->state, 1, 0) == 0) {
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&s->mutex, &attr);
+        pthread_mutexattr_destroy(&attr);
+        InterlockedExchange(&s->state, 2);
+        return;
+    }
+    while (s->state != 2)
+        sched_yield();
+}
+
+static void deadline(struct timespec *ts, long ms)
+{
+    clock_gettime(CLOCK_REALTIME, ts);
+    ts->tv_nsec += ms * 1000000L;
+    while (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+static ElectResult elect_wait(Broker *b)
+{
+    struct timespec until;
+
+    for (;;) {
+        int r;
+
+        if (b->stopping)
+            return ELECT_STOP;
+        deadline(&until, BROKER_POLL_MS);
+        r = pthread_mutex_timedlock(&b->section->mutex, &until);
+        if (r == 0)
+            return ELECT_OWNER;
+        if (r == EOWNERDEAD) {
+            pthread_mutex_consistent(&b->section->mutex);
+            return ELECT_TAKEOVER;
+        }
+        if (r != ETIMEDOUT)
+            return ELECT_FAILED;
+    }
+}
+
+static void elect_release(Broker *b)
+{
+    pthread_mutex_unlock(&b->section->mutex);
+}
+
+static void serve(Broker *b)
+{
+    pthread_mutex_lock(&b->lock);
+    while (!b->stopping)
+        pthread_cond_wait(&b->cond, &b->lock);
+    pthread_mutex_unlock(&b->lock);
+}
+
+static void *broker_entry(void *arg)
+{
+    run((Broker *)arg);
+    return NULL;
+}
+
+static BOOL platform_start(Broker *b)
+{
+    b->section = (BrokerSection *)shmsection_map(b->role->name,
+                                                 sizeof(BrokerSection),
+                                                 &b->mapping);
+    if (!b->section)
+        return FALSE;
+    section_init(b->section);
+    pthread_mutex_init(&b->lock, NULL);
+    pthread_cond_init(&b->cond, NULL);
+    if (pthread_create(&b->thread, NULL, broker_entry, b) != 0) {
+        pthread_cond_destroy(&b->cond);
+        pthread_mutex_destroy(&b->lock);
+        shmsection_unmap(b->section, sizeof(BrokerSection), b->mapping);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void platform_stop(Broker *b)
+{
+    pthread_mutex_lock(&b->lock);
+    InterlockedExchange(&b->stopping, 1);
+    pthread_cond_broadcast(&b->cond);
+    pthread_mutex_unlock(&b->lock);
+
+    pthread_join(b->thread, NULL);
+    pthread_cond_destroy(&b->cond);
+    pthread_mutex_destroy(&b->lock);
+    shmsection_unmap(b->section, sizeof(BrokerSection), b->mapping);
+}
+
+#endif
+
+/* ===== Broker thread ===== */
+
+static void run(Broker *b)
+{
+    const BrokerRole *role = b->role;
+    ElectResult r = elect_wait(b);
+
+    if (r != ELECT_OWNER && r != ELECT_TAKEOVER)
+        return;
+
+    InterlockedIncrement(&b->stats.elections);
+    if (r == ELECT_TAKEOVER)
+        InterlockedIncrement(&b->stats.takeovers);
+
+    /* A process that cannot serve gives the role to the next waiter */
+    if (role->elect(role->ctx)) {
+        InterlockedExchange(&b->owner, 1);
+        serve(b);
+        InterlockedExchange(&b->owner, 0);
+        role->resign(role->ctx);
+    }
+    elect_release(b);
+}
+
+/* ===== Public API ===== */
+
+static Broker s_brokers[BROKER_MAX_ROLES];
+
+Broker *broker_start(const BrokerRole *role)
+{
+    Broker *b = NULL;
+    int i;
+
+    for (i = 0; i < BROKER_MAX_ROLES; i++) {
+        if (InterlockedCompareExchange(&s_brokers[i].inUse, 1, 0) == 0) {
+            b = &s_brokers[i];
+            break;
+        }
+    }
+    if (!b)
+        return NULL;
+
+    memset((void *)&b->role, 0, sizeof(*b) - offsetof(Broker, role));
+    b->role = role;
+    if (!platform_start(b)) {
+        InterlockedExchange(&b->inUse, 0);
+        return NULL;
+    }
+    return b;
+}
+
+void broker_stop(Broker *b)
+{
+    if (!b)
+        return;
+    InterlockedExchange(&b->stopping, 1);
+    platform_stop(b);
+    InterlockedExchange(&b->inUse, 0);
+}
+
+BOOL broker_is_owner(const Broker *b)
+{
+    return b && b->owner;
+}
+
+void broker_stats(const Broker *b, BrokerStats *stats)
+{
+    if (b) {
+        *stats = b->stats;
+    } else {
+        stats->elections = 0;
+        stats->takeovers = 0;
+    }
+}
@@ -0,0 +1,56 @@
+/*
+ * broker.h - Session-wide election of one process for a role
+ *
+ * Some work must be done once per desktop session however many
+ * processes load the IME; the WH_KEYBOARD_LL hook (llhook.h) and the
+ * tray icon (tray.c) are two.  Each process that can do the work starts
+ * a broker thread, and the threads compete for a named mutex.
+ * The winner calls role->elect on its broker thread and, if that
+ * succeeds, serves until stopped.  The others sleep in the wait for the
+ * mutex and cost nothing until it is their turn.  When the owner stops,
+ * or its process dies and the mutex is abandoned, one waiter wakes and
+ * takes over.
+ *
+ * On Windows the owner serves by pumping its thread's messages, so a
+ * hook installed in elect runs there.  Elsewhere (host build) the mutex
+ * is a robust process-shared pthread mutex in shared memory
+ * (shmsection.h), which is handed on the same way when its owner dies;
+ * kolemak-broker exercises election and handoff across processes.
+ */
+
+#ifndef BROKER_H
+#define BROKER_H
+
+#include <windows.h>
+
+typedef struct {
+    const char *name;              /* mutex / section tag, ASCII */
+    BOOL (*elect)(void *ctx);      /* now the owner; FALSE = cannot serve,
+                                      pass the role on and stop competing */
+    void (*resign)(void *ctx);     /* stop serving (only after elect
+                                      succeeded) */
+    void *ctx;
+} BrokerRole;
+
+typedef struct Broker Broker;
+
+/* Roles a process can compete for at once */
+#define BROKER_MAX_ROLES 4
+
+/* Start competing for the role; NULL if no thread could be started.
+ * The role and ctx must outlive the broker. */
+Broker *broker_start(const BrokerRole *role);
+
+/* Resign if owner (another process takes over) and join the thread */
+void    broker_stop(Broker *b);
+
+BOOL    broker_is_owner(const Broker *b);
+
+typedef struct {
+    LONG elections;    /* times this process became owner */
+    LONG takeovers;    /* ... from an owner that died */
+} BrokerStats;
+
+void    broker_stats(const Broker *b, BrokerStats *stats);
+
+#endif /* BROKER_H */
@@ -3,7 +3,9 @@
  */
 
 #include "kolemak.h"
+#include "appmodes.h"
 #include "resource.h"
+#include "sharedprefs.h"
 #include <shlwapi.h>
 
 /* ===== Class Factory ===== */
@@ -77,9 +79,15 @@ BOOL WINAPI DllMain(HINSTANCE hInstDll, DWORD dwReason, LPVOID lpReserved)
     case DLL_PROCESS_ATTACH:
         g_hInst = hInstDll;
         g_tlsIndex = TlsAlloc();
+        arena_open();
+        KolemakTooltip_Init(hInstDll);
         DisableThreadLibraryCalls(hInstDll);
         break;
     case DLL_PROCESS_DETACH:
+        KolemakTooltip_Uninit();
+        sharedprefs_close();
+        appmodes_close();
+        arena_close();
         if (g_tlsIndex != TLS_OUT_OF_INDEXES) {
             TlsFree(g_tlsIndex);
             g_tlsIndex = TLS_OUT_OF_INDEXES;
@@ -143,13 +151,13 @@ static void ScancodeMap_Install(void)
                          NULL, &existSize) == ERROR_SUCCESS &&
         type == REG_BINARY && existSize >= SCMAP_HEADER_SIZE + SCMAP_ENTRY_SIZE)
     {
-        existing = (BYTE *)HeapAlloc(GetProcessHeap(), 0, existSize);
+        existing = (BYTE *)arena_alloc(ARENA_SCANCODE_MAP, existSize);
         if (!existing) { RegCloseKey(hKey); return; }
 
         if (RegQueryValueExW(hKey, L"Scancode Map", NULL, NULL,
                              existing, &existSize) != ERROR_SUCCESS)
         {
-            HeapFree(GetProcessHeap(), 0, existing);
+            arena_free(existing);
             existing = NULL;
             existSize = 0;
         }
@@ -177,8 +185,7 @@ static void ScancodeMap_Install(void)
             /* Add CapsLock → F13 entry: rebuild with one more entry */
             newCount = count + 1;
             newSize = SCMAP_HEADER_SIZE + newCount * SCMAP_ENTRY_SIZE;
-            newMap = (BYTE *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY,
-                                       newSize);
+            newMap = (BYTE *)arena_alloc(ARENA_SCANCODE_MAP, newSize);
             if (newMap) {
                 /* Copy header */
                 memcpy(newMap, existing, 8);
@@ -194,13 +201,13 @@ static void ScancodeMap_Install(void)
                     entry[0] = SCANCODE_F13;
                     entry[1] = SCANCODE_CAPSLOCK;
                 }
-                /* Null terminator is already zero from HEAP_ZERO_MEMORY */
+                /* Null terminator is already zero from arena_alloc */
                 RegSetValueExW(hKey, L"Scancode Map", 0, REG_BINARY,
                                newMap, newSize);
-                HeapFree(GetProcessHeap(), 0, newMap);
+                arena_free(newMap);
             }
         }
-        HeapFree(GetProcessHeap(), 0, existing);
+        arena_free(existing);
     } else {
         /* No existing Scancode Map: create fresh */
         BYTE map[SCMAP_HEADER_SIZE + 2 * SCMAP_ENTRY_SIZE];
@@ -241,13 +248,13 @@ static void ScancodeMap_Uninstall(void)
         return;
     }
 
-    existing = (BYTE *)HeapAlloc(GetProcessHeap(), 0, existSize);
+    existing = (BYTE *)arena_alloc(ARENA_SCANCODE_MAP, existSize);
     if (!existing) { RegCloseKey(hKey); return; }
 
     if (RegQueryValueExW(hKey, L"Scancode Map", NULL, NULL,
                          existing, &existSize) != ERROR_SUCCESS)
     {
-        HeapFree(GetProcessHeap(), 0, existing);
+        arena_free(existing);
         RegCloseKey(hKey);
         return;
     }
@@ -269,7 +276,7 @@ static void ScancodeMap_Uninstall(void)
     } else {
         /* Rebuild without CapsLock entry */
         newSize = SCMAP_HEADER_SIZE + newCount * SCMAP_ENTRY_SIZE;
-        newMap = (BYTE *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, newSize);
+        newMap = (BYTE *)arena_alloc(ARENA_SCANCODE_MAP, newSize);
         if (newMap) {
             memcpy(newMap, existing, 8);
             *(DWORD *)(newMap + 8) = newCount;
@@ -288,11 +295,11 @@ static void ScancodeMap_Uninstall(void)
             }
             RegSetValueExW(hKey, L"Scancode Map", 0, REG_BINARY,
                            newMap, newSize);
-            HeapFree(GetProcessHeap(), 0, newMap);
+            arena_free(newMap);
         }
     }
 
-    HeapFree(GetProcessHeap(), 0, existing);
+    arena_free(existing);
     RegCloseKey(hKey);
 }
 
@@ -29,53 +29,201 @@ static ULONG STDMETHODCALLTYPE ES_AddRef(ITfEditSession *pThis)
     return InterlockedIncrement(&es->refCount);
 }
 
+/* ===== Session pool ===== */
+
+static EditSession *AllocSession(TextService *ts)
+{
+    EditSessionPool *pool = &ts->esPool;
+    EditSession *es;
+
+    if (pool->freeList) {
+        es = pool->freeList;
+        pool->freeList = es->nextFree;
+    } else if (pool->carved < EDIT_SESSION_POOL_SIZE) {
+        es = &pool->slots[pool->carved++];
+    } else {
+        pool->misses++;
+        return (EditSession *)arena_alloc(ARENA_EDIT_SESSION,
+                                          sizeof(EditSession));
+    }
+
+    pool->hits++;
+    arena_hold(ARENA_EDIT_SESSION);
+    ZeroMemory(es, sizeof(*es));
+    return es;
+}
+
+static void FreeSession(TextService *ts, EditSession *es)
+{
+    EditSessionPool *pool = &ts->esPool;
+
+    if (es >= pool->slots && es < pool->slots + EDIT_SESSION_POOL_SIZE) {
+        es->nextFree = pool->freeList;
+        pool->freeList = es;
+        arena_unhold(ARENA_EDIT_SESSION);
+    } else {
+        arena_free(es);
+    }
+}
+
 static ULONG STDMETHODCALLTYPE ES_Release(ITfEditSession *pThis)
 {
     EditSession *es = (EditSession *)pThis;
     LONG c = InterlockedDecrement(&es->refCount);
     if (c == 0) {
+        TextService *ts = es->ts;
+
+        /* Dropped by TSF without running */
+        if (ts->pendingSession == es)
+            ts->pendingSession = NULL;
         if (es->context)
             es->context->lpVtbl->Release(es->context);
-        HeapFree(GetProcessHeap(), 0, es);
+        FreeSession(ts, es);
+
+        /* The pool lives in the TextService: keep it alive until every
+         * session it handed out has come back */
+        ts->lpVtbl->Release((ITfTextInputProcessorEx *)ts);
     }
     return c;
 }
 
+/* ===== Context cache =====
+ *
+ * Interfaces of the context being edited are queried once and kept
+ * until focus moves or the context is popped, and the composition's
+ * range is fetched once per composition instead of once per helper.
+ */
+
+void ContextCache_DropCompositionRange(TextService *ts)
+{
+    ContextCache *cc = &ts->ctxCache;
+
+    if (cc->compositionRange) {
+        cc->compositionRange->lpVtbl->Release(cc->compositionRange);
+        cc->compositionRange = NULL;
+    }
+}
+
+void ContextCache_Invalidate(TextService *ts)
+{
+    ContextCache *cc = &ts->ctxCache;
+
+    ContextCache_DropCompositionRange(ts);
+    if (cc->insertAtSelection)
+        cc->insertAtSelection->lpVtbl->Release(cc->insertAtSelection);
+    if (cc->contextComposition)
+        cc->contextComposition->lpVtbl->Release(cc->contextComposition);
+    if (cc->context)
+        cc->context->lpVtbl->Release(cc->context);
+    ZeroMemory(cc, sizeof(*cc));
+}
+
+/* Cache for ctx, emptied first if it holds another context */
+static ContextCache *GetContextCache(TextService *ts, ITfContext *ctx)
+{
+    ContextCache *cc = &ts->ctxCache;
+
+    if (cc->context != ctx) {
+        ContextCache_Invalidate(ts);
+        cc->context = ctx;
+        ctx->lpVtbl->AddRef(ctx);
+    }
+    return cc;
+}
+
+DWORD ContextCache_Caps(TextService *ts, ITfContext *ctx)
+{
+    return GetContextCache(ts, ctx)->caps;
+}
+
+void ContextCache_AddCaps(TextService *ts, ITfContext *ctx, DWORD caps)
+{
+    GetContextCache(ts, ctx)->caps |= caps;
+}
+
+/* Whether typed characters can be written into ctx by edit session.
+ * Read-only documents and CUAS contexts (IMM32 apps, where inserted text
+ * arrives as an IME result rather than WM_CHAR) are typed via SendInput,
+ * as are contexts that refuse sync sessions, since async insertion would
+ * reorder text against keys the app handles itself. */
+BOOL ContextCache_CanInsertText(TextService *ts, ITfContext *ctx)
+{
+    ContextCache *cc = GetContextCache(ts, ctx);
+
+    if (!(cc->caps & CTXCAP_STATUS_KNOWN)) {
+        TF_STATUS status;
+
+        cc->caps |= CTXCAP_STATUS_KNOWN;
+        if (FAILED(ctx->lpVtbl->GetStatus(ctx, &status)) ||
+            (status.dwDynamicFlags & TS_SD_READONLY) ||
+            (status.dwStaticFlags & TS_SS_TRANSITORY))
+            cc->caps |= CTXCAP_NO_INSERT;
+    }
+    return !(cc->caps & (CTXCAP_NO_INSERT | CTXCAP_SYNC_REFUSED));
+}
+
+static ITfInsertAtSelection *GetInsertAtSelection(TextService *ts, ITfContext *ctx)
+{
+    ContextCache *cc = GetContextCache(ts, ctx);
+
+    if (!cc->insertAtSelection)
+        ctx->lpVtbl->QueryInterface(ctx, &IID_ITfInsertAtSelection,
+                                    (void **)&cc->insertAtSelection);
+    return cc->insertAtSelection;
+}
+
+static ITfContextComposition *GetContextComposition(TextService *ts, ITfContext *ctx)
+{
+    ContextCache *cc = GetContextCache(ts, ctx);
+
+    if (!cc->contextComposition)
+        ctx->lpVtbl->QueryInterface(ctx, &IID_ITfContextComposition,
+                                    (void **)&cc->contextComposition);
+    return cc->contextComposition;
+}
+
+/* Range covering the active composition (owned by the cache) */
+static ITfRange *GetCompositionRange(TextService *ts)
+{
+    ContextCache *cc = &ts->ctxCache;
+
+    if (!ts->composition) return NULL;
+
+    if (!cc->compositionRange &&
+        FAILED(ts->composition->lpVtbl->GetRange(ts->composition,
+                                                  &cc->compositionRange)))
+        cc->compositionRange = NULL;
+    return cc->compositionRange;
+}
+
 /* ===== Composition helpers ===== */
 
 static HRESULT StartComposition(TextService *ts, ITfContext *ctx, TfEditCookie ec)
 {
-    ITfInsertAtSelection *pInsert = NULL;
-    ITfContextComposition *pCtxComp = NULL;
+    ITfInsertAtSelection *pInsert = GetInsertAtSelection(ts, ctx);
+    ITfContextComposition *pCtxComp = GetContextComposition(ts, ctx);
     ITfRange *pRange = NULL;
     ITfComposition *pComp = NULL;
     HRESULT hr;
 
-    hr = ctx->lpVtbl->QueryInterface(ctx, &IID_ITfInsertAtSelection,
-                                      (void **)&pInsert);
-    if (FAILED(hr)) return hr;
+    if (!pInsert || !pCtxComp) return E_NOINTERFACE;
 
     /* Get an empty range at the current selection */
     hr = pInsert->lpVtbl->InsertTextAtSelection(
         pInsert, ec, TF_IAS_QUERYONLY, NULL, 0, &pRange);
-    pInsert->lpVtbl->Release(pInsert);
     if (FAILED(hr)) return hr;
 
-    hr = ctx->lpVtbl->QueryInterface(ctx, &IID_ITfContextComposition,
-                                      (void **)&pCtxComp);
-    if (FAILED(hr)) { pRange->lpVtbl->Release(pRange); return hr; }
-
     hr = pCtxComp->lpVtbl->StartComposition(
         pCtxComp, ec, pRange,
         (ITfCompositionSink *)&ts->compositionSink,
         &pComp);
-    pCtxComp->lpVtbl->Release(pCtxComp);
     pRange->lpVtbl->Release(pRange);
 
     if (SUCCEEDED(hr) && pComp) {
         if (ts->composition)
             ts->composition->lpVtbl->Release(ts->composition);
         ts->composition = pComp;
+        ContextCache_DropCompositionRange(ts);
     }
     return hr;
 }
@@ -83,18 +231,11 @@ static HRESULT StartComposition(TextService *ts, ITfContext *ctx, TfEditCookie e
 static HRESULT SetCompositionText(TextService *ts, TfEditCookie ec,
                                    const WCHAR *text, int len)
 {
-    ITfRange *pRange = NULL;
-    HRESULT hr;
+    ITfRange *pRange = GetCompositionRange(ts);
 
-    if (!ts->composition) return E_FAIL;
+    if (!pRange) return E_FAIL;
 
-    hr = ts->composition->lpVtbl->GetRange(ts->composition, &pRange);
-    if (FAILED(hr)) return hr;
-
-    hr = pRange->lpVtbl->SetText(pRange, ec, 0, text, len);
-
-    pRange->lpVtbl->Release(pRange);
-    return hr;
+    return pRange->lpVtbl->SetText(pRange, ec, 0, text, len);
 }
 
 /* Set selection to cover the composition text with a block cursor (fInterimChar).
@@ -102,18 +243,19 @@ static HRESULT SetCompositionText(TextService *ts, TfEditCookie ec,
 static void SetInterimSelection(TextService *ts, ITfContext *ctx,
                                  TfEditCookie ec)
 {
-    ITfRange *pRange = NULL;
+    ITfRange *pRange;
+    TF_SELECTION sel;
 
-    if (!ts->composition) return;
+    if (GetContextCache(ts, ctx)->caps & CTXCAP_NO_INTERIM) return;
 
-    if (SUCCEEDED(ts->composition->lpVtbl->GetRange(ts->composition, &pRange))) {
-        TF_SELECTION sel;
-        sel.range = pRange;
-        sel.style.ase = TF_AE_NONE;
-        sel.style.fInterimChar = TRUE;
-        ctx->lpVtbl->SetSelection(ctx, ec, 1, &sel);
-        pRange->lpVtbl->Release(pRange);
-    }
+    pRange = GetCompositionRange(ts);
+    if (!pRange) return;
+
+    sel.range = pRange;
+    sel.style.ase = TF_AE_NONE;
+    sel.style.fInterimChar = TRUE;
+    if (FAILED(ctx->lpVtbl->SetSelection(ctx, ec, 1, &sel)))
+        ContextCache_AddCaps(ts, ctx, CTXCAP_NO_INTERIM);
 }
 
 /* Move selection to end of composition range.
@@ -122,19 +264,19 @@ static void SetInterimSelection(TextService *ts, ITfContext *ctx,
 static void SetSelectionToCompositionEnd(TextService *ts, ITfContext *ctx,
                                           TfEditCookie ec)
 {
-    ITfRange *pRange = NULL;
+    ITfRange *pRange = GetCompositionRange(ts);
+    TF_SELECTION sel;
 
-    if (!ts->composition) return;
+    if (!pRange) return;
 
-    if (SUCCEEDED(ts->composition->lpVtbl->GetRange(ts->composition, &pRange))) {
-        TF_SELECTION sel;
-        pRange->lpVtbl->Collapse(pRange, ec, TF_ANCHOR_END);
-        sel.range = pRange;
-        sel.style.ase = TF_AE_NONE;
-        sel.style.fInterimChar = FALSE;
-        ctx->lpVtbl->SetSelection(ctx, ec, 1, &sel);
-        pRange->lpVtbl->Release(pRange);
-    }
+    pRange->lpVtbl->Collapse(pRange, ec, TF_ANCHOR_END);
+    sel.range = pRange;
+    sel.style.ase = TF_AE_NONE;
+    sel.style.fInterimChar = FALSE;
+    ctx->lpVtbl->SetSelection(ctx, ec, 1, &sel);
+
+    /* Collapsed: no longer covers the composition */
+    ContextCache_DropCompositionRange(ts);
 }
 
 static HRESULT EndComposition(TextService *ts, TfEditCookie ec)
@@ -143,6 +285,7 @@ static HRESULT EndComposition(TextService *ts, TfEditCookie ec)
 
     if (!ts->composition) return S_OK;
 
+    ContextCache_DropCompositionRange(ts);
     hr = ts->composition->lpVtbl->EndComposition(ts->composition, ec);
     ts->composition->lpVtbl->Release(ts->composition);
     ts->composition = NULL;
@@ -150,20 +293,17 @@ static HRESULT EndComposition(TextService *ts, TfEditCookie ec)
     return hr;
 }
 
-static HRESULT InsertText(ITfContext *ctx, TfEditCookie ec,
+static HRESULT InsertText(TextService *ts, ITfContext *ctx, TfEditCookie ec,
                            const WCHAR *text, int len)
 {
-    ITfInsertAtSelection *pInsert = NULL;
+    ITfInsertAtSelection *pInsert = GetInsertAtSelection(ts, ctx);
     ITfRange *pRange = NULL;
     HRESULT hr;
 
-    hr = ctx->lpVtbl->QueryInterface(ctx, &IID_ITfInsertAtSelection,
-                                      (void **)&pInsert);
-    if (FAILED(hr)) return hr;
+    if (!pInsert) return E_NOINTERFACE;
 
     hr = pInsert->lpVtbl->InsertTextAtSelection(
         pInsert, ec, 0, text, len, &pRange);
-    pInsert->lpVtbl->Release(pInsert);
 
     if (pRange)
         pRange->lpVtbl->Release(pRange);
@@ -186,6 +326,98 @@ static void ReinjectKey(UINT vk)
     SendInput(2, inputs, sizeof(INPUT));
 }
 
+/* Apply one Hangul result to the document */
+static HRESULT HandleResult(TextService *ts, ITfContext *ctx, TfEditCookie ec,
+                            const HangulResult *r)
+{
+    HRESULT hr = S_OK;
+
+    switch (r->type) {
+
+    case HANGUL_RESULT_COMPOSING:
+        /* Update composition display */
+        if (!ts->composition) {
+            hr = StartComposition(ts, ctx, ec);
+            if (FAILED(hr)) break;
+        }
+        if (r->compose) {
+            hr = SetCompositionText(ts, ec, &r->compose, 1);
+            /* Show block cursor over the composing character */
+            if (SUCCEEDED(hr))
+                SetInterimSelection(ts, ctx, ec);
+        }
+        break;
+
+    case HANGUL_RESULT_COMMIT:
+    {
+        /* Commit character(s), then update composition with new compose */
+        WCHAR commitBuf[3];
+        int commitLen = 0;
+
+        if (r->commit1) commitBuf[commitLen++] = r->commit1;
+        if (r->commit2) commitBuf[commitLen++] = r->commit2;
+
+        if (ts->composition) {
+            /* Set the committed text on the current composition range */
+            if (commitLen > 0)
+                SetCompositionText(ts, ec, commitBuf, commitLen);
+            /* Move selection to after committed text before ending */
+            SetSelectionToCompositionEnd(ts, ctx, ec);
+            EndComposition(ts, ec);
+        } else if (commitLen > 0) {
+            InsertText(ts, ctx, ec, commitBuf, commitLen);
+        }
+
+        /* Start new composition for the compose character */
+        if (r->compose) {
+            hr = StartComposition(ts, ctx, ec);
+            if (SUCCEEDED(hr)) {
+                SetCompositionText(ts, ec, &r->compose, 1);
+                SetInterimSelection(ts, ctx, ec);
+            }
+        }
+        break;
+    }
+
+    case HANGUL_RESULT_COMMIT_FLUSH:
+    {
+        WCHAR commitBuf[3];
+        int commitLen = 0;
+
+        if (r->commit1) commitBuf[commitLen++] = r->commit1;
+        if (r->commit2) commitBuf[commitLen++] = r->commit2;
+
+        if (ts->composition) {
+            if (commitLen > 0)
+                SetCompositionText(ts, ec, commitBuf, commitLen);
+            /* Move selection to after committed text before ending */
+            SetSelectionToCompositionEnd(ts, ctx, ec);
+            EndComposition(ts, ec);
+        } else if (commitLen > 0) {
+            /* No active composition (e.g. standalone vowel).
+             * Start+end a composition to ensure correct cursor positioning,
+             * preventing async race where the next key is inserted before us. */
+            StartComposition(ts, ctx, ec);
+            if (ts->composition) {
+                SetCompositionText(ts, ec, commitBuf, commitLen);
+                SetSelectionToCompositionEnd(ts, ctx, ec);
+                EndComposition(ts, ec);
+            } else {
+                InsertText(ts, ctx, ec, commitBuf, commitLen);
+            }
+        }
+        /* No new composition (flush = done) */
+        break;
+    }
+
+    case HANGUL_RESULT_PASS:
+        /* Nothing to do */
+        break;
+    }
+
+    return hr;
+}
+
 static HRESULT STDMETHODCALLTYPE ES_DoEditSession(
     ITfEditSession *pThis, TfEditCookie ec)
 {
@@ -197,13 +429,13 @@ static HRESULT STDMETHODCALLTYPE ES_DoEditSession(
 
     case ES_INSERT_CHAR:
     {
-        /* English mode: insert a single character */
-        WCHAR ch = es->data.ch;
+        /* English mode: insert the typed character(s) */
         if (ts->composition) {
             EndComposition(ts, ec);
         }
-        if (ch)
-            hr = InsertText(es->context, ec, &ch, 1);
+        if (es->data.insert.len > 0)
+            hr = InsertText(ts, es->context, ec, es->data.insert.text,
+                            (int)es->data.insert.len);
         break;
     }
 
@@ -219,90 +451,14 @@ static HRESULT STDMETHODCALLTYPE ES_DoEditSession(
 
     case ES_HANDLE_RESULT:
     {
-        HangulResult *r = &es->data.hangulResult;
-
-        switch (r->type) {
-
-        case HANGUL_RESULT_COMPOSING:
-            /* Update composition display */
-            if (!ts->composition) {
-                hr = StartComposition(ts, es->context, ec);
-                if (FAILED(hr)) break;
-            }
-            if (r->compose) {
-                hr = SetCompositionText(ts, ec, &r->compose, 1);
-                /* Show block cursor over the composing character */
-                if (SUCCEEDED(hr))
-                    SetInterimSelection(ts, es->context, ec);
-            }
-            break;
-
-        case HANGUL_RESULT_COMMIT:
-        {
-            /* Commit character(s), then update composition with new compose */
-            WCHAR commitBuf[3];
-            int commitLen = 0;
-
-            if (r->commit1) commitBuf[commitLen++] = r->commit1;
-            if (r->commit2) commitBuf[commitLen++] = r->commit2;
-
-            if (ts->composition) {
-                /* Set the committed text on the current composition range */
-                if (commitLen > 0)
-                    SetCompositionText(ts, ec, commitBuf, commitLen);
-                /* Move selection to after committed text before ending */
-                SetSelectionToCompositionEnd(ts, es->context, ec);
-                EndComposition(ts, ec);
-            } else if (commitLen > 0) {
-                InsertText(es->context, ec, commitBuf, commitLen);
-            }
-
-            /* Start new composition for the compose character */
-            if (r->compose) {
-                hr = StartComposition(ts, es->context, ec);
-                if (SUCCEEDED(hr)) {
-                    SetCompositionText(ts, ec, &r->compose, 1);
-                    SetInterimSelection(ts, es->context, ec);
-                }
-            }
-            break;
-        }
+        UINT i;
 
-        case HANGUL_RESULT_COMMIT_FLUSH:
-        {
-            WCHAR commitBuf[3];
-            int commitLen = 0;
+        /* Running now: nothing more can be appended */
+        if (ts->pendingSession == es)
+            ts->pendingSession = NULL;
 
-            if (r->commit1) commitBuf[commitLen++] = r->commit1;
-            if (r->commit2) commitBuf[commitLen++] = r->commit2;
-
-            if (ts->composition) {
-                if (commitLen > 0)
-                    SetCompositionText(ts, ec, commitBuf, commitLen);
-                /* Move selection to after committed text before ending */
-                SetSelectionToCompositionEnd(ts, es->context, ec);
-                EndComposition(ts, ec);
-            } else if (commitLen > 0) {
-                /* No active composition (e.g. standalone vowel).
-                 * Start+end a composition to ensure correct cursor positioning,
-                 * preventing async race where the next key is inserted before us. */
-                StartComposition(ts, es->context, ec);
-                if (ts->composition) {
-                    SetCompositionText(ts, ec, commitBuf, commitLen);
-                    SetSelectionToCompositionEnd(ts, es->context, ec);
-                    EndComposition(ts, ec);
-                } else {
-                    InsertText(es->context, ec, commitBuf, commitLen);
-                }
-            }
-            /* No new composition (flush = done) */
-            break;
-        }
-
-        case HANGUL_RESULT_PASS:
-            /* Nothing to do */
-            break;
-        }
+        for (i = 0; i < es->data.results.count; i++)
+            hr = HandleResult(ts, es->context, ec, &es->data.results.items[i]);
         break;
     }
     }
@@ -330,13 +486,13 @@ HRESULT EditSession_Create(TextService *ts, ITfContext *ctx,
 {
     EditSession *es;
 
-    es = (EditSession *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY,
-                                   sizeof(EditSession));
+    es = AllocSession(ts);
     if (!es) return E_OUTOFMEMORY;
 
     es->lpVtbl = &g_editSessionVtbl;
     es->refCount = 1;
     es->ts = ts;
+    ts->lpVtbl->AddRef((ITfTextInputProcessorEx *)ts);
     es->context = ctx;
     ctx->lpVtbl->AddRef(ctx);
     es->type = type;
@@ -344,3 +500,36 @@ HRESULT EditSession_Create(TextService *ts, ITfContext *ctx,
     *ppSession = es;
     return S_OK;
 }
+
+BOOL EditSession_AddResult(EditSession *es, const HangulResult *result)
+{
+    HangulResult *last;
+
+    if (es->reinjectVk != 0)
+        return FALSE;
+    if (result->type == HANGUL_RESULT_PASS)
+        return TRUE;
+
+    if (es->data.results.count > 0) {
+        last = &es->data.results.items[es->data.results.count - 1];
+
+        /* Every result rewrites the composition text, so a composition
+         * update that is still queued never needs to be shown */
+        if (last->type == HANGUL_RESULT_COMPOSING) {
+            *last = *result;
+            return TRUE;
+        }
+
+        /* A commit that opens a composition can carry its update too */
+        if (last->type == HANGUL_RESULT_COMMIT && last->compose &&
+            result->type == HANGUL_RESULT_COMPOSING && result->compose) {
+            last->compose = result->compose;
+            return TRUE;
+        }
+    }
+
+    if (es->data.results.count == EDIT_SESSION_MAX_RESULTS)
+        return FALSE;
+    es->data.results.items[es->data.results.count++] = *result;
+    return TRUE;
+}
@@ -4,6 +4,10 @@
 
 #include "hangul.h"
 
+#if !defined(HANGUL_REFERENCE_ENGINE) && !defined(_WIN32)
+#include <pthread.h>
+#endif
+
 /* ===== Index tables ===== */
 
 /* Choseong(19): ㄱㄲㄴㄷㄸㄹㅁㅂㅃㅅㅆㅇㅈㅉㅊㅋㅌㅍㅎ */
@@ -275,7 +279,13 @@ HangulResult hangul_ic_flush(HangulContext *ctx)
     return make_result(HANGUL_RESULT_COMMIT_FLUSH, ch, 0, 0);
 }
 
-HangulResult hangul_ic_process(HangulContext *ctx, int cho_index, int jung_index)
+/* ===== Reference engine =====
+ *
+ * The original switch-based state machine.  It is the behavioral spec for
+ * the transition table below (which is generated from it) and can be
+ * selected at build time with HANGUL_REFERENCE_ENGINE. */
+
+static HangulResult ref_ic_process(HangulContext *ctx, int cho_index, int jung_index)
 {
     int is_consonant = (cho_index >= 0);
     int is_vowel = (jung_index >= 0);
@@ -302,7 +312,12 @@ HangulResult hangul_ic_process(HangulContext *ctx, int cho_index, int jung_index
                 /* 복합 자음 분해: 첫째 커밋, 둘째가 새 초성 */
                 int remain_jong, new_cho;
                 WCHAR committed;
-                try_decompose_jong(ctx->jong, &remain_jong, &new_cho);
+                if (!try_decompose_jong(ctx->jong, &remain_jong, &new_cho)) {
+                    /* Not a compound (never built that way): it all
+                     * becomes the new choseong */
+                    remain_jong = 0;
+                    new_cho = g_jong_to_cho[ctx->jong];
+                }
                 committed = g_compat_jong[remain_jong];
                 ctx->cho = new_cho;
                 ctx->jung = jung_index;
@@ -421,7 +436,7 @@ HangulResult hangul_ic_process(HangulContext *ctx, int cho_index, int jung_index
     return make_result(HANGUL_RESULT_PASS, 0, 0, 0);
 }
 
-HangulResult hangul_ic_backspace(HangulContext *ctx)
+static HangulResult ref_ic_backspace(HangulContext *ctx)
 {
     int first, second;
 
@@ -462,3 +477,369 @@ HangulResult hangul_ic_backspace(HangulContext *ctx)
         return make_result(HANGUL_RESULT_PASS, 0, 0, 0);
     }
 }
+
+#ifndef HANGUL_REFERENCE_ENGINE
+
+/* ===== Table-driven engine =====
+ *
+ * Every reachable composition state is numbered as a DFA node:
+ *
+ *   0        EMPTY
+ *   1..19    CHOSEONG, single consonant (by cho)
+ *   20..47   CHOSEONG, composite consonant (by jong)
+ *   48..68   JUNGSEONG (by jung)
+ *   69..96   JONGSEONG (by jong)
+ *
+ * The cho (and, in JONGSEONG, the jung) of a syllable under construction
+ * never influences the next transition, so it is "carried" through the
+ * table instead of being part of the node.  g_dfa[node][input] holds the
+ * next state, the new indices and the emitted characters for each of the
+ * 19 consonant + 21 vowel inputs, plus one column for backspace.
+ *
+ * The table is generated once from the reference engine above, so both
+ * engines agree by construction. */
+
+#define DFA_NODES          97
+#define DFA_INPUT_BS       40   /* Column 40: backspace */
+#define DFA_INPUTS         41
+
+#define DFA_BASE_CHO        1
+#define DFA_BASE_CHO_COMP  20
+#define DFA_BASE_JUNG      48
+#define DFA_BASE_JONG      69
+
+/* DfaEntry.flags */
+#define DFA_KEEP_CHO       0x01  /* new cho = current cho */
+#define DFA_KEEP_JUNG      0x02  /* new jung = current jung */
+#define DFA_COMMIT_SYL     0x04  /* commit1 += syllable base of current cho/jung */
+#define DFA_COMPOSE_SYL    0x08  /* compose = syllable of the new cho/jung/jong */
+#define DFA_COMPOSE_CHO    0x10  /* compose = compatibility jamo of the new cho */
+
+typedef struct {
+    BYTE        state;    /* Next HangulState */
+    BYTE        type;     /* HangulResultType */
+    signed char cho;      /* New cho (unless DFA_KEEP_CHO) */
+    signed char jung;     /* New jung (unless DFA_KEEP_JUNG) */
+    BYTE        jong;     /* New jong */
+    BYTE        flags;
+    WCHAR       commit1;  /* Fixed char, or jong offset with DFA_COMMIT_SYL */
+    WCHAR       commit2;
+    WCHAR       compose;  /* Fixed char unless DFA_COMPOSE_SYL */
+} DfaEntry;
+
+static DfaEntry g_dfa[DFA_NODES][DFA_INPUTS];
+
+/* Syllable code point for (cho, jung) with no jongseong */
+#define SYL_BASE(cho, jung) (0xAC00 + ((cho) * 21 + (jung)) * 28)
+
+static int dfa_node(const HangulContext *ctx)
+{
+    switch (ctx->state) {
+    case HANGUL_STATE_CHOSEONG:
+        return ctx->jong > 0 ? DFA_BASE_CHO_COMP + ctx->jong
+                             : DFA_BASE_CHO + ctx->cho;
+    case HANGUL_STATE_JUNGSEONG:
+        return DFA_BASE_JUNG + ctx->jung;
+    case HANGUL_STATE_JONGSEONG:
+        return DFA_BASE_JONG + ctx->jong;
+    default:
+        return 0;
+    }
+}
+
+/* Build a representative context for a node.  carry selects one of two
+ * distinct values for the carried indices.  Returns 0 for unreachable
+ * nodes (e.g. CHOSEONG with a non-composite jong). */
+static int dfa_node_context(int node, int carry, HangulContext *ctx)
+{
+    int remain, first_cho;
+
+    hangul_ic_init(ctx);
+    if (node == 0)
+        return 1;
+
+    if (node < DFA_BASE_CHO_COMP) {
+        ctx->state = HANGUL_STATE_CHOSEONG;
+        ctx->cho = node - DFA_BASE_CHO;
+        return 1;
+    }
+    if (node < DFA_BASE_JUNG) {
+        ctx->jong = node - DFA_BASE_CHO_COMP;
+        if (!try_decompose_jong(ctx->jong, &remain, &first_cho))
+            return 0;
+        ctx->state = HANGUL_STATE_CHOSEONG;
+        ctx->cho = g_jong_to_cho[remain];
+        return 1;
+    }
+    if (node < DFA_BASE_JONG) {
+        ctx->state = HANGUL_STATE_JUNGSEONG;
+        ctx->cho = carry ? 1 : 0;
+        ctx->jung = node - DFA_BASE_JUNG;
+        return 1;
+    }
+    ctx->jong = node - DFA_BASE_JONG;
+    if (ctx->jong == 0)
+        return 0;
+    ctx->state = HANGUL_STATE_JONGSEONG;
+    ctx->cho = carry ? 1 : 0;
+    ctx->jung = carry ? 2 : 0;
+    return 1;
+}
+
+/* Run the reference engine from both carry variants of a node and record
+ * which outputs follow the carried indices and which are constant. */
+static void dfa_build_entry(int node, int input, DfaEntry *e)
+{
+    HangulContext a, b;
+    HangulResult ra, rb;
+    int old_cho_a, old_jung_a;
+
+    e->state = HANGUL_STATE_EMPTY;
+    e->type = HANGUL_RESULT_PASS;
+    e->cho = -1;
+    e->jung = -1;
+    e->jong = 0;
+    e->flags = 0;
+    e->commit1 = e->commit2 = e->compose = 0;
+
+    if (!dfa_node_context(node, 0, &a) || !dfa_node_context(node, 1, &b))
+        return;
+    if (a.state == HANGUL_STATE_EMPTY && input == DFA_INPUT_BS)
+        return;
+
+    old_cho_a = a.cho;
+    old_jung_a = a.jung;
+
+    if (input == DFA_INPUT_BS) {
+        ra = ref_ic_backspace(&a);
+        rb = ref_ic_backspace(&b);
+    } else if (input < 19) {
+        ra = ref_ic_process(&a, input, -1);
+        rb = ref_ic_process(&b, input, -1);
+    } else {
+        ra = ref_ic_process(&a, -1, input - 19);
+        rb = ref_ic_process(&b, -1, input - 19);
+    }
+
+    e->state = (BYTE)a.state;
+    e->type = (BYTE)ra.type;
+    e->jong = (BYTE)a.jong;
+
+    if (a.cho != b.cho)
+        e->flags |= DFA_KEEP_CHO;
+    else
+        e->cho = (signed char)a.cho;
+
+    if (a.jung != b.jung)
+        e->flags |= DFA_KEEP_JUNG;
+    else
+        e->jung = (signed char)a.jung;
+
+    if (ra.commit1 != rb.commit1) {
+        e->flags |= DFA_COMMIT_SYL;
+        e->commit1 = (WCHAR)(ra.commit1 - SYL_BASE(old_cho_a, old_jung_a));
+    } else {
+        e->commit1 = ra.commit1;
+    }
+    e->commit2 = ra.commit2;
+
+    if (a.state == HANGUL_STATE_JUNGSEONG || a.state == HANGUL_STATE_JONGSEONG)
+        e->flags |= DFA_COMPOSE_SYL;
+    else if (ra.compose != rb.compose)
+        e->flags |= DFA_COMPOSE_CHO;  /* e.g. backspace JUNGSEONG -> CHOSEONG */
+    else
+        e->compose = ra.compose;
+}
+
+static void dfa_fill(void)
+{
+    int node, input;
+
+    for (node = 0; node < DFA_NODES; node++)
+        for (input = 0; input < DFA_INPUTS; input++)
+            dfa_build_entry(node, input, &g_dfa[node][input]);
+}
+
+/* dfa_build_entry clears an entry before filling it in, so the table
+ * is built exactly once; the once-guard also orders the writes before
+ * any thread that returns from dfa_build reads them */
+#ifdef _WIN32
+
+static INIT_ONCE g_dfa_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK dfa_build_once(PINIT_ONCE once, PVOID param, PVOID *ctx)
+{
+    (void)once; (void)param; (void)ctx;
+    dfa_fill();
+    return TRUE;
+}
+
+static void dfa_build(void)
+{
+    InitOnceExecuteOnce(&g_dfa_once, dfa_build_once, NULL, NULL);
+}
+
+#else
+
+static pthread_once_t g_dfa_once = PTHREAD_ONCE_INIT;
+
+static void dfa_build(void)
+{
+    pthread_once(&g_dfa_once, dfa_fill);
+}
+
+#endif
+
+static HangulResult dfa_step(HangulContext *ctx, int input)
+{
+    const DfaEntry *e = &g_dfa[dfa_node(ctx)][input];
+    int old_cho = ctx->cho;
+    int old_jung = ctx->jung;
+    HangulResult r;
+
+    ctx->state = (HangulState)e->state;
+    ctx->cho = (e->flags & DFA_KEEP_CHO) ? old_cho : e->cho;
+    ctx->jung = (e->flags & DFA_KEEP_JUNG) ? old_jung : e->jung;
+    ctx->jong = e->jong;
+
+    r.type = (HangulResultType)e->type;
+    r.commit1 = (e->flags & DFA_COMMIT_SYL)
+        ? (WCHAR)(e->commit1 + SYL_BASE(old_cho, old_jung)) : e->commit1;
+    r.commit2 = e->commit2;
+    if (e->flags & DFA_COMPOSE_SYL)
+        r.compose = (WCHAR)(SYL_BASE(ctx->cho, ctx->jung) + ctx->jong);
+    else if (e->flags & DFA_COMPOSE_CHO)
+        r.compose = g_compat_cho[ctx->cho];
+    else
+        r.compose = e->compose;
+    return r;
+}
+
+/* ===== Public entry points ===== */
+
+HangulResult hangul_ic_process(HangulContext *ctx, int cho_index, int jung_index)
+{
+    int input;
+
+    if (cho_index >= 0 && cho_index < 19)
+        input = cho_index;
+    else if (jung_index >= 0 && jung_index < 21)
+        input = 19 + jung_index;
+    else
+        return make_result(HANGUL_RESULT_PASS, 0, 0, 0);
+
+    dfa_build();
+    return dfa_step(ctx, input);
+}
+
+HangulResult hangul_ic_backspace(HangulContext *ctx)
+{
+    dfa_build();
+    return dfa_step(ctx, DFA_INPUT_BS);
+}
+
+#else /* HANGUL_REFERENCE_ENGINE */
+
+HangulResult hangul_ic_process(HangulContext *ctx, int cho_index, int jung_index)
+{
+    return ref_ic_process(ctx, cho_index, jung_index);
+}
+
+HangulResult hangul_ic_backspace(HangulContext *ctx)
+{
+    return ref_ic_backspace(ctx);
+}
+
+#endif /* HANGUL_REFERENCE_ENGINE */
+
+/* ===== Batch API ===== */
+
+#ifndef HANGUL_REFERENCE_ENGINE
+#define batch_prepare()                 dfa_build()
+#define batch_backspace(ctx)            dfa_step((ctx), DFA_INPUT_BS)
+#else
+#define batch_prepare()                 ((void)0)
+#define batch_backspace(ctx)            ref_ic_backspace(ctx)
+#endif
+
+/* Feed one jamo input, appending any committed text at out[*len] */
+static void batch_step(HangulContext *ctx, int cho, int jung,
+                       WCHAR *out, int *len)
+{
+    HangulResult r;
+
+    if (cho == HANGUL_JAMO_BACKSPACE) {
+        if (ctx->state != HANGUL_STATE_EMPTY)
+            batch_backspace(ctx);
+        else if (*len > 0)
+            (*len)--;
+        return;
+    }
+
+    if (cho >= 0 && cho < 19) {
+#ifndef HANGUL_REFERENCE_ENGINE
+        r = dfa_step(ctx, cho);
+#else
+        r = ref_ic_process(ctx, cho, -1);
+#endif
+    } else if (jung >= 0 && jung < 21) {
+#ifndef HANGUL_REFERENCE_ENGINE
+        r = dfa_step(ctx, 19 + jung);
+#else
+        r = ref_ic_process(ctx, -1, jung);
+#endif
+    } else {
+        r = hangul_ic_flush(ctx);
+    }
+
+    if (r.commit1) out[(*len)++] = r.commit1;
+    if (r.commit2) out[(*len)++] = r.commit2;
+}
+
+int hangul_ic_process_batch(HangulContext *ctx,
+                            const JamoMapping *jamo, int count,
+                            WCHAR *out, int outCap, int *outLen,
+                            WCHAR *preedit)
+{
+    int len = *outLen;
+    int i;
+
+    batch_prepare();
+
+    for (i = 0; i < count && outCap - len >= HANGUL_BATCH_MAX_COMMIT; i++)
+        batch_step(ctx, jamo[i].cho, jamo[i].jung, out, &len);
+
+    *outLen = len;
+    *preedit = compose_display(ctx);
+    return i;
+}
+
+int hangul_ic_process_keys(HangulContext *ctx,
+                           const HangulKey *keys, int count,
+                           BOOL semicolonSwap,
+                           WCHAR *out, int outCap, int *outLen,
+                           WCHAR *preedit)
+{
+    int len = *outLen;
+    int i;
+
+    batch_prepare();
+
+    for (i = 0; i < count && outCap - len >= HANGUL_BATCH_MAX_COMMIT; i++) {
+        UINT vk = keys[i].vk;
+
+        if (vk == VK_BACK) {
+            batch_step(ctx, HANGUL_JAMO_BACKSPACE, -1, out, &len);
+        } else if (vk == VK_SPACE) {
+            batch_step(ctx, -1, -1, out, &len);
+            out[len++] = L' ';
+        } else {
+            JamoMapping jamo = keymap_get_jamo(vk, keys[i].shift, semicolonSwap);
+            batch_step(ctx, jamo.cho, jamo.jung, out, &len);
+        }
+    }
+
+    *outLen = len;
+    *preedit = compose_display(ctx);
+    return i;
+}
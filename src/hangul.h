@@ -3,12 +3,16 @@
  *
  * Implements the state machine for combining jamo into syllables.
  * Unicode Hangul syllable = 0xAC00 + (cho*21 + jung)*28 + jong
+ *
+ * Keys are processed through a precomputed transition table; define
+ * HANGUL_REFERENCE_ENGINE to use the original switch-based engine.
  */
 
 #ifndef HANGUL_H
 #define HANGUL_H
 
 #include <windows.h>
+#include "keymap.h"
 
 /* Composition state */
 typedef enum {
@@ -55,6 +59,46 @@ HangulResult hangul_ic_backspace(HangulContext *ctx);
 /* Flush: commit whatever is currently composing */
 HangulResult hangul_ic_flush(HangulContext *ctx);
 
+/* ===== Batch API =====
+ *
+ * Runs a whole input sequence through the engine in one call, writing
+ * committed text to a caller-provided buffer instead of returning one
+ * HangulResult per key.  Intended for bulk conversion, replays and
+ * benchmarks; no edit sessions are involved.
+ *
+ * Each call consumes inputs until they are exhausted or the output buffer
+ * has room for fewer than HANGUL_BATCH_MAX_COMMIT characters, and returns
+ * the number of inputs consumed.  *outLen is advanced by the number of
+ * characters written; *preedit receives the composing character left in
+ * ctx (0 if none).  Call again with the remaining input to continue. */
+
+#define HANGUL_BATCH_MAX_COMMIT  2   /* Max chars committed per input */
+
+/* Jamo input: cho/jung as for hangul_ic_process.
+ * cho == HANGUL_JAMO_BACKSPACE is a backspace: it edits the composition,
+ * or deletes the last committed character when nothing is composing.
+ * Any other input with cho < 0 and jung < 0 flushes the composition. */
+#define HANGUL_JAMO_BACKSPACE    (-2)
+
+int hangul_ic_process_batch(HangulContext *ctx,
+                            const JamoMapping *jamo, int count,
+                            WCHAR *out, int outCap, int *outLen,
+                            WCHAR *preedit);
+
+/* Key input: a virtual key plus Shift state, mapped with keymap_get_jamo.
+ * VK_BACK is a backspace, VK_SPACE flushes and commits a space, and any
+ * other non-jamo key flushes the composition. */
+typedef struct {
+    BYTE vk;
+    BYTE shift;
+} HangulKey;
+
+int hangul_ic_process_keys(HangulContext *ctx,
+                           const HangulKey *keys, int count,
+                           BOOL semicolonSwap,
+                           WCHAR *out, int outCap, int *outLen,
+                           WCHAR *preedit);
+
 /* Compose a syllable from indices */
 WCHAR hangul_syllable(int cho, int jung, int jong);
 
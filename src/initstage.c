@@ -0,0 +1,87 @@
+/*
+ * initstage.c - Subsystems brought up on first use
+ */
+
+#include "initstage.h"
+
+#include <stdio.h>
+#include <string.h>
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+void initstage_setup(InitStages *s, const InitStage *stages, UINT count)
+{
+    memset(s, 0, sizeof(*s));
+    s->stages = stages;
+    s->count = count < INITSTAGE_MAX ? count : INITSTAGE_MAX;
+}
+
+void initstage_run(InitStages *s, UINT mask, void *ctx)
+{
+    UINT i;
+
+    for (i = 0; i < s->count; i++) {
+        UINT bit = 1u << i;
+        unsigned long long t0;
+
+        if (!(mask & bit) || (s->tried & bit))
+            continue;
+        s->tried |= bit;
+
+        t0 = initstage_now_ns();
+        if (s->stages[i].init(ctx))
+            s->done |= bit;
+        s->ns[i] = initstage_now_ns() - t0;
+    }
+}
+
+void initstage_undo(InitStages *s, void *ctx)
+{
+    UINT i = s->count;
+
+    while (i-- > 0) {
+        if (s->done & (1u << i))
+            s->stages[i].uninit(ctx);
+    }
+    s->tried = 0;
+    s->done = 0;
+}
+
+unsigned long long initstage_now_ns(void)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (!freq.QuadPart)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (unsigned long long)(now.QuadPart / freq.QuadPart) * 1000000000ull +
+           (unsigned long long)(now.QuadPart % freq.QuadPart) * 1000000000ull /
+           (unsigned long long)freq.QuadPart;
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (unsigned long long)t.tv_sec * 1000000000ull +
+           (unsigned long long)t.tv_nsec;
+#endif
+}
+
+void initstage_format(const InitStages *s, char *buf, size_t size)
+{
+    size_t len;
+    UINT i;
+
+    if (size == 0)
+        return;
+    snprintf(buf, size, "activate %.1fus", (double)s->activateNs / 1000.0);
+    for (i = 0; i < s->count; i++) {
+        len = strlen(buf);
+        if (s->tried & (1u << i))
+            snprintf(buf + len, size - len, "  %s %.1fus%s", s->stages[i].name,
+                     (double)s->ns[i] / 1000.0,
+                     (s->done & (1u << i)) ? "" : " (failed)");
+        else
+            snprintf(buf + len, size - len, "  %s -", s->stages[i].name);
+    }
+}
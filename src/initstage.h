@@ -0,0 +1,58 @@
+/*
+ * initstage.h - Subsystems brought up on first use
+ *
+ * A TextService is activated for every thread that may take input, and
+ * many of those (background threads, dialogs closed unused) never get a
+ * keystroke.  Its subsystems are listed as stages; activation does only
+ * what it cannot do without, and initstage_run brings up the rest when
+ * the thread first has focus.  Every stage is timed, so the cost of
+ * activation and of each subsystem can be reported (kolemak-host, or
+ * the debugger output in KOLEMAK_KEY_TRACE builds).
+ */
+
+#ifndef INITSTAGE_H
+#define INITSTAGE_H
+
+#include <windows.h>
+
+#define INITSTAGE_MAX 8
+
+typedef struct {
+    const char *name;
+    BOOL (*init)(void *ctx);       /* FALSE = unavailable: not retried,
+                                      not undone */
+    void (*uninit)(void *ctx);
+} InitStage;
+
+typedef struct {
+    const InitStage *stages;
+    UINT  count;
+    UINT  tried;                   /* Bit per stage run (or running) */
+    UINT  done;                    /* Bit per stage that succeeded */
+    unsigned long long activateNs; /* Activation itself, set by the owner */
+    unsigned long long ns[INITSTAGE_MAX];
+} InitStages;
+
+/* All stages of a set */
+#define INITSTAGE_ALL(s)    ((1u << (s)->count) - 1)
+
+/* Whether any stage in mask has yet to run: the one check on hot paths */
+#define initstage_pending(s, mask)  (((s)->tried & (mask)) != (mask))
+
+void initstage_setup(InitStages *s, const InitStage *stages, UINT count);
+
+/* Run the stages in mask that have not run yet, in table order.  A
+ * stage is marked before it runs, so one that causes a nested call
+ * (a focus event while registering) is not entered twice. */
+void initstage_run(InitStages *s, UINT mask, void *ctx);
+
+/* Undo the stages that succeeded, in reverse order, and start over */
+void initstage_undo(InitStages *s, void *ctx);
+
+/* Monotonic clock for the timings */
+unsigned long long initstage_now_ns(void);
+
+/* "activate 1.2us  settings 35.0us  hooks -" into buf ('-' = not run) */
+void initstage_format(const InitStages *s, char *buf, size_t size);
+
+#endif /* INITSTAGE_H */
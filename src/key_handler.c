@@ -7,39 +7,137 @@
 
 #include "kolemak.h"
 #include "settings.h"
+#include "llhook.h"
+
+#ifdef KOLEMAK_KEY_TRACE
+#include "keytrace.h"
+
+/* Record a key event entering the sink (see keytrace.h) */
+static void TraceKeyEvent(TextService *ts, UINT vk, LPARAM lParam, BYTE flags)
+{
+    BYTE held = ts->modState.down;
+    BYTE mods = 0;
+    BYTE modes = 0;
+
+    if (held & MODSTATE_SHIFT)            mods |= KEYTRACE_MOD_SHIFT;
+    if (held & MODSTATE_CTRL)             mods |= KEYTRACE_MOD_CTRL;
+    if (held & MODSTATE_ALT)              mods |= KEYTRACE_MOD_ALT;
+    if (held & MODSTATE_WIN)              mods |= KEYTRACE_MOD_WIN;
+    if (ts->capsLockOn)                   mods |= KEYTRACE_MOD_CAPS;
+    if (!(flags & KEYTRACE_KEYUP) && ((lParam >> 30) & 1))
+        flags |= KEYTRACE_REPEAT;         /* bit 30: previous key state */
+
+    if (ts->koreanMode)    modes |= KEYTRACE_MODE_KOREAN;
+    if (ts->colemakMode)   modes |= KEYTRACE_MODE_COLEMAK;
+    if (ts->semicolonSwap) modes |= KEYTRACE_MODE_SEMISWAP;
+
+    keytrace_record((BYTE)vk, mods, flags, modes);
+}
+
+#define TRACE_KEY(ts, vk, lParam, flags) TraceKeyEvent((ts), (vk), (lParam), (flags))
+#else
+#define TRACE_KEY(ts, vk, lParam, flags) ((void)0)
+#endif
 
 /* Helper: request an edit session */
 static HRESULT RequestEditSession(TextService *ts, ITfContext *ctx,
                                    EditSessionType type, EditSession *es)
 {
-    HRESULT hr;
+    HRESULT hr = TF_E_SYNCHRONOUS;
     HRESULT hrSession;
+    BOOL queued = ts->pendingSession && ts->pendingSession->context == ctx;
 
-    (void)type;
+    /* Whatever is requested now must run after the queued session,
+     * so nothing more may be appended to it */
+    ts->pendingSession = NULL;
 
-    hr = ctx->lpVtbl->RequestEditSession(
-        ctx, ts->clientId,
-        (ITfEditSession *)es,
-        TF_ES_SYNC | TF_ES_READWRITE,
-        &hrSession);
+    /* Contexts that refused sync once are not asked again */
+    if (!queued && !(ContextCache_Caps(ts, ctx) & CTXCAP_SYNC_REFUSED)) {
+        hr = ctx->lpVtbl->RequestEditSession(
+            ctx, ts->clientId,
+            (ITfEditSession *)es,
+            TF_ES_SYNC | TF_ES_READWRITE,
+            &hrSession);
+        if (hr == TF_E_SYNCHRONOUS)
+            ContextCache_AddCaps(ts, ctx, CTXCAP_SYNC_REFUSED);
+    }
 
-    /* If sync not granted, fall back to async */
+    /* If sync not granted (or would overtake the queue), go async */
     if (hr == TF_E_SYNCHRONOUS) {
         hr = ctx->lpVtbl->RequestEditSession(
             ctx, ts->clientId,
             (ITfEditSession *)es,
             TF_ES_ASYNC | TF_ES_READWRITE,
             &hrSession);
+        if (SUCCEEDED(hr) && hrSession == TF_S_ASYNC &&
+            type == ES_HANDLE_RESULT && es->reinjectVk == 0)
+            ts->pendingSession = es;
     }
 
     return SUCCEEDED(hr) ? hrSession : hr;
 }
 
+/* Helper: apply a Hangul result, appending it to the session already
+ * queued for ctx when there is one */
+static HRESULT QueueHangulResult(TextService *ts, ITfContext *ctx,
+                                 const HangulResult *result, UINT reinjectVk)
+{
+    EditSession *es = ts->pendingSession;
+    HRESULT hr;
+
+    if (es && es->context == ctx && EditSession_AddResult(es, result)) {
+        es->reinjectVk = reinjectVk;
+        if (reinjectVk != 0)
+            ts->pendingSession = NULL;
+        return S_OK;
+    }
+
+    hr = EditSession_Create(ts, ctx, ES_HANDLE_RESULT, &es);
+    if (FAILED(hr)) return hr;
+
+    EditSession_AddResult(es, result);
+    es->reinjectVk = reinjectVk;  /* Re-inject after edit session completes */
+    RequestEditSession(ts, ctx, ES_HANDLE_RESULT, es);
+    es->lpVtbl->Release((ITfEditSession *)es);
+    return S_OK;
+}
+
+/* ===== Modifier state =====
+ *
+ * ts->modState follows the key messages this thread receives (the view
+ * GetKeyState gives), read once per event.  Key-ups released while
+ * another window had focus are never seen, so it is resynced from the
+ * OS when focus returns.  The LL hook sees every key of the session and
+ * keeps its own tracker (see below). */
+
+static const struct { BYTE vk; BYTE bit; } s_modifierKeys[] = {
+    { VK_LSHIFT,   MODSTATE_LSHIFT }, { VK_RSHIFT,   MODSTATE_RSHIFT },
+    { VK_LCONTROL, MODSTATE_LCTRL  }, { VK_RCONTROL, MODSTATE_RCTRL  },
+    { VK_LMENU,    MODSTATE_LALT   }, { VK_RMENU,    MODSTATE_RALT   },
+    { VK_LWIN,     MODSTATE_LWIN   }, { VK_RWIN,     MODSTATE_RWIN   },
+};
+
+static BYTE ReadModifiers(SHORT (WINAPI *getState)(int))
+{
+    BYTE down = 0;
+    int i;
+
+    for (i = 0; i < (int)(sizeof(s_modifierKeys) / sizeof(s_modifierKeys[0])); i++) {
+        if (getState(s_modifierKeys[i].vk) & 0x8000)
+            down |= s_modifierKeys[i].bit;
+    }
+    return down;
+}
+
+void KeyHandler_SyncModifiers(TextService *ts)
+{
+    modstate_reset(&ts->modState, ReadModifiers(GetKeyState));
+}
+
 /* Sync internal CapsLock state to OS thread-local state and registry */
 static void SyncCapsLockState(TextService *ts)
 {
     BYTE ks[256];
-    HKEY hKey;
 
     /* 1. OS thread-local state (for QWERTY passthrough mode) */
     GetKeyboardState(ks);
@@ -49,20 +147,40 @@ static void SyncCapsLockState(TextService *ts)
         ks[VK_CAPITAL] &= ~1;
     SetKeyboardState(ks);
 
-    /* 2. Registry (for cross-process sync) */
-    if (RegOpenKeyExW(HKEY_CURRENT_USER, KOLEMAK_REG_KEY,
-                      0, KEY_WRITE, &hKey) == ERROR_SUCCESS)
-    {
-        DWORD val = ts->capsLockOn ? 1 : 0;
-        RegSetValueExW(hKey, KOLEMAK_REG_CAPSLOCK_STATE, 0, REG_DWORD,
-                       (const BYTE *)&val, sizeof(DWORD));
-        RegCloseKey(hKey);
-    }
+    /* 2. Other processes (registry written lazily) */
+    Settings_PublishCapsLockState(ts);
+}
+
+/* ===== UI updates =====
+ *
+ * Mode changes only post the new state; KeyHandler_ApplyUi carries it
+ * out once per burst (TextService_ScheduleUi).
+ */
+
+static void PostUi(TextService *ts, UINT target, LONG value)
+{
+    if (uibus_post(&ts->uiBus, target, value))
+        TextService_ScheduleUi(ts);
+}
+
+void KeyHandler_ApplyUi(TextService *ts)
+{
+    LONG value[UIBUS_TARGETS];
+    UINT dirty = uibus_take(&ts->uiBus, value);
+
+    if (dirty & (1u << UIBUS_KEYBOARD_OPEN))
+        TextService_SetKeyboardOpen(ts, value[UIBUS_KEYBOARD_OPEN] != 0);
+    if (dirty & (1u << UIBUS_TOOLTIP))
+        KolemakTooltip_Show(value[UIBUS_TOOLTIP] ? TIPLABEL_COLEMAK
+                                                 : TIPLABEL_QWERTY);
+    if ((dirty & (1u << UIBUS_LANGBAR)) && ts->langBarButton)
+        LangBarButton_UpdateState(ts->langBarButton);
 }
 
 /* ===== Toggle helper (shared by LL hook and WH_GETMESSAGE hook) ===== */
 
-static void FlushAndToggleColemak(TextService *ts)
+/* Switch ts to a Colemak mode the caller has already published */
+static void FlushAndSetColemak(TextService *ts, BOOL mode)
 {
     if (ts->hangulCtx.state != HANGUL_STATE_EMPTY) {
         HangulResult result = hangul_ic_flush(&ts->hangulCtx);
@@ -73,39 +191,27 @@ static void FlushAndToggleColemak(TextService *ts)
             ITfContext *ctx = NULL;
             if (SUCCEEDED(docMgr->lpVtbl->GetTop(
                     docMgr, &ctx)) && ctx) {
-                EditSession *es = NULL;
-                HRESULT hr = EditSession_Create(ts, ctx,
-                    ES_HANDLE_RESULT, &es);
-                if (SUCCEEDED(hr)) {
-                    es->data.hangulResult = result;
-                    RequestEditSession(ts, ctx,
-                        ES_HANDLE_RESULT, es);
-                    es->lpVtbl->Release((ITfEditSession *)es);
-                }
+                QueueHangulResult(ts, ctx, &result, 0);
                 ctx->lpVtbl->Release(ctx);
             }
             docMgr->lpVtbl->Release(docMgr);
         }
     }
-    ts->colemakMode = !ts->colemakMode;
-
-    /* Sync to registry for cross-process consistency.
-     * Other processes pick this up via Settings_ReloadPrefs
-     * when they receive focus. */
-    {
-        HKEY hKey;
-        if (RegOpenKeyExW(HKEY_CURRENT_USER, KOLEMAK_REG_KEY,
-                          0, KEY_WRITE, &hKey) == ERROR_SUCCESS) {
-            DWORD val = ts->colemakMode ? 1 : 0;
-            RegSetValueExW(hKey, KOLEMAK_REG_COLEMAK_MODE, 0, REG_DWORD,
-                           (const BYTE *)&val, sizeof(DWORD));
-            RegCloseKey(hKey);
-        }
-    }
+    ts->colemakMode = mode;
+    LLHook_Publish(ts);
+    Settings_RememberAppModes(ts);
 
-    KolemakTooltip_Show(ts->colemakMode ? L"Colemak" : L"QWERTY");
-    if (ts->langBarButton)
-        LangBarButton_UpdateState(ts->langBarButton);
+    PostUi(ts, UIBUS_TOOLTIP, ts->colemakMode);
+    PostUi(ts, UIBUS_LANGBAR, 0);
+}
+
+static void FlushAndToggleColemak(TextService *ts)
+{
+    FlushAndSetColemak(ts, !ts->colemakMode);
+
+    /* Share with other processes; they pick this up via
+     * Settings_ReloadPrefs when they receive focus. */
+    Settings_PublishColemakMode(ts->colemakMode);
 }
 
 /* ===== WH_KEYBOARD_LL hook for Win+key Colemak remapping =====
@@ -117,177 +223,98 @@ static void FlushAndToggleColemak(TextService *ts)
  * WH_GETMESSAGE cannot intercept Win+key because the shell processes
  * them before messages reach the app queue.
  *
- * Only acts when the foreground window belongs to the current process,
- * preventing multiple LL hooks from conflicting across processes. */
+ * Runs only in the session's broker process (llhook.h), on a thread of
+ * its own: it acts for whichever process has the foreground window, if
+ * the IME is active there, with the settings from sharedprefs, and
+ * posts the toggle to the foreground thread.  The decision is
+ * lldecide_key's, on input kept current outside the key path; the
+ * state below belongs to that thread alone, so it needs no locking. */
+
+static LLDecideState s_ll;
 
-static BYTE s_llRemappedKeys[256];
-static BOOL s_toggleKeyDown = FALSE;
+void KeyHandler_ResetLLHook(void)
+{
+    lldecide_reset(&s_ll, ReadModifiers(GetAsyncKeyState));
+}
+
+/* Key-ups on the secure desktop (Win+L, Ctrl+Alt+Del, the lock screen)
+ * never reach the hook, and a Win left held would remap every letter
+ * typed after it.  Only the modifiers are replaced: remapped keys still
+ * down keep their pending release. */
+void KeyHandler_SyncLLHookModifiers(void)
+{
+    modstate_reset(&s_ll.mods, ReadModifiers(GetAsyncKeyState));
+}
 
-static BOOL IsModifierOnlyVk(UINT vk)
+static void InjectLLKey(UINT vk, BOOL up)
 {
-    return vk == VK_LWIN || vk == VK_RWIN ||
-           vk == VK_CONTROL || vk == VK_LCONTROL || vk == VK_RCONTROL ||
-           vk == VK_SHIFT || vk == VK_LSHIFT || vk == VK_RSHIFT ||
-           vk == VK_MENU || vk == VK_LMENU || vk == VK_RMENU;
+    INPUT input = {0};
+
+    input.type = INPUT_KEYBOARD;
+    input.ki.wVk = (WORD)vk;
+    input.ki.wScan = (WORD)MapVirtualKey(vk, MAPVK_VK_TO_VSC);
+    input.ki.dwFlags = up ? KEYEVENTF_KEYUP : 0;
+    input.ki.dwExtraInfo = KOLEMAK_LL_INJECTED;
+    SendInput(1, &input, sizeof(INPUT));
 }
 
 LRESULT CALLBACK KolemakLowLevelKeyboardProc(int nCode, WPARAM wParam,
                                               LPARAM lParam)
 {
     KBDLLHOOKSTRUCT *kb;
-    UINT vk;
+    LLHookClient *client;
+    LLDecideInput in;
+    LLDecision d;
+    HWND capture;
+    BOOL published;
 
     if (nCode != HC_ACTION)
         return CallNextHookEx(NULL, nCode, wParam, lParam);
 
     kb = (KBDLLHOOKSTRUCT *)lParam;
-
-    /* Skip events we injected ourselves */
-    if (kb->dwExtraInfo == KOLEMAK_LL_INJECTED)
-        return CallNextHookEx(NULL, nCode, wParam, lParam);
-
-    vk = kb->vkCode;
-
-    if (wParam == WM_KEYDOWN || wParam == WM_SYSKEYDOWN) {
-        BOOL winHeld =
-            (GetAsyncKeyState(VK_LWIN) & 0x8000) != 0 ||
-            (GetAsyncKeyState(VK_RWIN) & 0x8000) != 0;
-
-        if (winHeld && !IsModifierOnlyVk(vk)) {
-            /* Forward Win+key to settings dialog when capturing hotkey */
-            if (g_captureHwnd && IsWindow(g_captureHwnd)) {
-                UINT mod = KOLEMAK_MOD_WIN;
-                if (GetAsyncKeyState(VK_CONTROL) & 0x8000)
-                    mod |= TF_MOD_CONTROL;
-                if (GetAsyncKeyState(VK_SHIFT) & 0x8000)
-                    mod |= TF_MOD_SHIFT;
-                if (GetAsyncKeyState(VK_MENU) & 0x8000)
-                    mod |= TF_MOD_ALT;
-                PostMessageW(g_captureHwnd, WM_APP,
-                             (WPARAM)vk, (LPARAM)mod);
-                return 1;
-            }
-
-            /* Only act when foreground window is in this process */
-            {
-                HWND fg = GetForegroundWindow();
-                DWORD fgPid = 0;
-                GetWindowThreadProcessId(fg, &fgPid);
-                if (fgPid != GetCurrentProcessId())
-                    return CallNextHookEx(NULL, nCode, wParam, lParam);
-            }
-
-            {
-                TextService *ts =
-                    (TextService *)TlsGetValue(g_tlsIndex);
-                if (ts) {
-                    /* Refresh colemakMode from registry.
-                     * The LL hook runs per-process but colemakMode may
-                     * have been toggled in a different process.  Reading
-                     * the registry here (only on Win+key, not every
-                     * keystroke) ensures the latest state is used. */
-                    {
-                        HKEY hKey;
-                        DWORD val, type, size = sizeof(DWORD);
-                        if (RegOpenKeyExW(HKEY_CURRENT_USER,
-                                          KOLEMAK_REG_KEY,
-                                          0, KEY_READ, &hKey)
-                            == ERROR_SUCCESS)
-                        {
-                            if (RegQueryValueExW(
-                                    hKey, KOLEMAK_REG_COLEMAK_MODE,
-                                    NULL, &type, (BYTE *)&val,
-                                    &size) == ERROR_SUCCESS
-                                && type == REG_DWORD)
-                            {
-                                ts->colemakMode = (val != 0);
-                            }
-                            RegCloseKey(hKey);
-                        }
-                    }
-
-                    /* Win-modifier toggle hotkey (e.g. Win+Space) */
-                    if (!s_toggleKeyDown &&
-                        (ts->hotkeyModifiers & KOLEMAK_MOD_WIN))
-                    {
-                        UINT mods = KOLEMAK_MOD_WIN;
-                        if (GetAsyncKeyState(VK_CONTROL) & 0x8000)
-                            mods |= TF_MOD_CONTROL;
-                        if (GetAsyncKeyState(VK_SHIFT) & 0x8000)
-                            mods |= TF_MOD_SHIFT;
-                        if (GetAsyncKeyState(VK_MENU) & 0x8000)
-                            mods |= TF_MOD_ALT;
-
-                        if (vk == ts->hotkeyVk &&
-                            mods == ts->hotkeyModifiers)
-                        {
-                            s_toggleKeyDown = TRUE;
-                            FlushAndToggleColemak(ts);
-
-                            /* Inject no-op key to prevent Start menu.
-                             * Blocking Win+Space causes Windows to
-                             * treat Win release as standalone press;
-                             * a dummy keypress clears that state. */
-                            {
-                                INPUT noop[2] = {{0}, {0}};
-                                noop[0].type = INPUT_KEYBOARD;
-                                noop[0].ki.wVk = 0xFF;
-                                noop[0].ki.dwExtraInfo =
-                                    KOLEMAK_LL_INJECTED;
-                                noop[1].type = INPUT_KEYBOARD;
-                                noop[1].ki.wVk = 0xFF;
-                                noop[1].ki.dwFlags = KEYEVENTF_KEYUP;
-                                noop[1].ki.dwExtraInfo =
-                                    KOLEMAK_LL_INJECTED;
-                                SendInput(2, noop, sizeof(INPUT));
-                            }
-                            return 1;
-                        }
-                    }
-
-                    /* Win+alpha Colemak remap */
-                    if (ts->colemakMode && ts->winKeyRemap) {
-                        UINT remapped = keymap_get_colemak_vk(vk);
-                        if (remapped != vk && vk < 256) {
-                            INPUT input = {0};
-                            s_llRemappedKeys[vk] = (BYTE)remapped;
-                            input.type = INPUT_KEYBOARD;
-                            input.ki.wVk = (WORD)remapped;
-                            input.ki.wScan = (WORD)MapVirtualKey(
-                                remapped, MAPVK_VK_TO_VSC);
-                            input.ki.dwExtraInfo =
-                                KOLEMAK_LL_INJECTED;
-                            SendInput(1, &input, sizeof(INPUT));
-                            return 1;
-                        }
-                    }
-                }
-            }
-        }
-    }
-    else if (wParam == WM_KEYUP || wParam == WM_SYSKEYUP) {
-        /* Reset toggle key tracking */
+    client = LLHook_GetInput(&in, &capture);
+    lldecide_key(&s_ll, &in, kb->vkCode, kb->scanCode,
+                 (kb->flags & LLKHF_EXTENDED) != 0,
+                 wParam == WM_KEYUP || wParam == WM_SYSKEYUP,
+                 kb->dwExtraInfo == KOLEMAK_LL_INJECTED, &d);
+
+    switch (d.action) {
+    case LLDECIDE_CAPTURE:
+        PostMessageW(capture, WM_APP, (WPARAM)d.vk, (LPARAM)d.mods);
+        return 1;
+
+    case LLDECIDE_TOGGLE:
+        /* Publish here so the next Win+key sees the new mode even
+         * while the foreground app is still busy; the app applies it
+         * when it gets the message.  The hook does not wait out another
+         * writer: if one holds the settings, the app publishes. */
+        published = Settings_TryPublishColemakMode(d.colemakMode);
+        PostThreadMessageW((DWORD)client->threadId, LLHook_Message(),
+                           d.colemakMode ? LLHOOK_CMD_COLEMAK
+                                         : LLHOOK_CMD_QWERTY,
+                           !published);
+
+        /* Inject no-op key to prevent Start menu.
+         * Blocking Win+Space causes Windows to
+         * treat Win release as standalone press;
+         * a dummy keypress clears that state. */
         {
-            TextService *ts =
-                (TextService *)TlsGetValue(g_tlsIndex);
-            if (ts && vk == ts->hotkeyVk)
-                s_toggleKeyDown = FALSE;
+            INPUT noop[2] = {{0}, {0}};
+            noop[0].type = INPUT_KEYBOARD;
+            noop[0].ki.wVk = 0xFF;
+            noop[0].ki.dwExtraInfo = KOLEMAK_LL_INJECTED;
+            noop[1].type = INPUT_KEYBOARD;
+            noop[1].ki.wVk = 0xFF;
+            noop[1].ki.dwFlags = KEYEVENTF_KEYUP;
+            noop[1].ki.dwExtraInfo = KOLEMAK_LL_INJECTED;
+            SendInput(2, noop, sizeof(INPUT));
         }
+        return 1;
 
-        /* Release tracked remap regardless of current Win state */
-        if (vk < 256 && s_llRemappedKeys[vk]) {
-            UINT remapped = s_llRemappedKeys[vk];
-            INPUT input = {0};
-            s_llRemappedKeys[vk] = 0;
-            input.type = INPUT_KEYBOARD;
-            input.ki.wVk = (WORD)remapped;
-            input.ki.wScan =
-                (WORD)MapVirtualKey(remapped, MAPVK_VK_TO_VSC);
-            input.ki.dwFlags = KEYEVENTF_KEYUP;
-            input.ki.dwExtraInfo = KOLEMAK_LL_INJECTED;
-            SendInput(1, &input, sizeof(INPUT));
-            return 1;
-        }
+    case LLDECIDE_REMAP:
+    case LLDECIDE_RELEASE:
+        InjectLLKey(d.vk, d.action == LLDECIDE_RELEASE);
+        return 1;
     }
 
     return CallNextHookEx(NULL, nCode, wParam, lParam);
@@ -298,211 +325,304 @@ LRESULT CALLBACK KolemakLowLevelKeyboardProc(int nCode, WPARAM wParam,
  * Remaps VK codes in WM_KEYDOWN/WM_SYSKEYDOWN messages BEFORE TSF's
  * keystroke manager processes them.  This ensures Colemak shortcuts
  * work correctly in Korean mode, where TSF may skip OnTestKeyDown
- * for Ctrl+letter combinations.
+ * for Ctrl+letter combinations.  The key sink cannot do this: it only
+ * decides whether to eat a key, and the app still reads the original VK
+ * from its own message.
  *
  * Win+key remapping is handled by WH_KEYBOARD_LL instead (see above),
  * because Win+key shell shortcuts are consumed before reaching the
- * app queue. */
-LRESULT CALLBACK KolemakGetMsgProc(int code, WPARAM wParam, LPARAM lParam)
+ * app queue.
+ *
+ * The hook also sees every other message the thread dequeues: mouse
+ * moves, paints, timers, raw input.  Those leave after one range check
+ * on the message number (key messages are WM_KEYDOWN..WM_SYSKEYUP,
+ * LLHook_Message() and KolemakTray_Message() are registered ones,
+ * 0xC000 and up); host builds time it with kolemak-host --msgs. */
+
+#define GETMSG_KEY_RANGE(m) ((UINT)(m) - WM_KEYDOWN <= WM_SYSKEYUP - WM_KEYDOWN)
+#define GETMSG_REGISTERED   0xC000
+
+/* Toggle hotkey seen by the session's LL hook */
+static void OnLLHookMessage(MSG *msg)
 {
-    if (code == HC_ACTION && wParam == PM_REMOVE) {
-        MSG *msg = (MSG *)lParam;
-        if (msg->message == WM_KEYDOWN || msg->message == WM_SYSKEYDOWN) {
-            TextService *ts = (TextService *)TlsGetValue(g_tlsIndex);
-            if (ts) {
-                BOOL ctrl = (GetKeyState(VK_CONTROL) & 0x8000) != 0;
-                BOOL alt  = (GetKeyState(VK_MENU) & 0x8000) != 0;
-                BOOL win  = ((GetKeyState(VK_LWIN) & 0x8000) |
-                             (GetKeyState(VK_RWIN) & 0x8000)) != 0;
-                if (ctrl || alt || win) {
-                    UINT vk = (UINT)msg->wParam;
-                    UINT mods = 0;
-                    UINT remapped;
-                    BOOL isRepeat = (msg->lParam >> 30) & 1;
-
-                    if (ctrl) mods |= TF_MOD_CONTROL;
-                    if (alt)  mods |= TF_MOD_ALT;
-                    if (GetKeyState(VK_SHIFT) & 0x8000) mods |= TF_MOD_SHIFT;
-
-                    /* Handle Colemak toggle hotkey (physical key basis).
-                     * Win-modifier hotkeys are handled by the LL hook;
-                     * this path handles Ctrl/Alt/Shift-only hotkeys. */
-                    if (!isRepeat &&
-                        vk == ts->hotkeyVk &&
-                        mods == ts->hotkeyModifiers) {
-                        FlushAndToggleColemak(ts);
-                        msg->message = WM_NULL;
-                        return CallNextHookEx(NULL, code, wParam, lParam);
-                    }
+    TextService *ts = (TextService *)TlsGetValue(g_tlsIndex);
+    BOOL colemak = (msg->wParam == LLHOOK_CMD_COLEMAK);
+
+    /* The hook gave up on a busy writer */
+    if (msg->lParam)
+        Settings_PublishColemakMode(colemak);
+    if (ts)
+        FlushAndSetColemak(ts, colemak);
+    msg->message = WM_NULL;
+}
 
-                    /* Remap modifier+alpha for Colemak shortcuts.
-                     * Skip when Win is held — WH_KEYBOARD_LL handles
-                     * Win+key to avoid double-remapping. */
-                    if (ts->colemakMode && !win) {
-                        remapped = keymap_get_colemak_vk(vk);
-                        if (remapped != vk) {
-                            UINT newScan = MapVirtualKey(remapped,
-                                                         MAPVK_VK_TO_VSC);
-                            msg->wParam = remapped;
-                            msg->lParam = (msg->lParam & ~(0xFFu << 16))
-                                        | ((LPARAM)newScan << 16);
-                        }
-                    }
-                }
+/* This process was elected to show the tray icon (tray.c) */
+static void OnTrayMessage(MSG *msg)
+{
+    TextService *ts = (TextService *)TlsGetValue(g_tlsIndex);
+
+    if (ts)
+        KolemakTray_EnsureIcon(ts);
+    msg->message = WM_NULL;
+}
+
+static void OnKeyMessage(MSG *msg)
+{
+    BOOL up = (msg->message == WM_KEYUP || msg->message == WM_SYSKEYUP);
+    TextService *ts;
+    BYTE held;
+    BOOL ctrl, alt, win;
+
+    if (!up && msg->message != WM_KEYDOWN && msg->message != WM_SYSKEYDOWN)
+        return;    /* WM_CHAR and the like */
+
+    ts = (TextService *)TlsGetValue(g_tlsIndex);
+    if (!ts)
+        return;
+
+    modstate_message(&ts->modState, (UINT)msg->wParam, msg->lParam, up);
+    held = ts->modState.down;
+    ctrl = (held & MODSTATE_CTRL) != 0;
+    alt  = (held & MODSTATE_ALT) != 0;
+    win  = (held & MODSTATE_WIN) != 0;
+
+    if (!up && (ctrl || alt || win)) {
+        UINT vk = (UINT)msg->wParam;
+        UINT mods = 0;
+        UINT remapped;
+        BOOL isRepeat = (msg->lParam >> 30) & 1;
+
+        if (ctrl) mods |= TF_MOD_CONTROL;
+        if (alt)  mods |= TF_MOD_ALT;
+        if (held & MODSTATE_SHIFT) mods |= TF_MOD_SHIFT;
+
+        /* Handle Colemak toggle hotkey (physical key basis).
+         * Win-modifier hotkeys are handled by the LL hook;
+         * this path handles Ctrl/Alt/Shift-only hotkeys. */
+        if (!isRepeat &&
+            vk == ts->hotkeyVk &&
+            mods == ts->hotkeyModifiers) {
+            FlushAndToggleColemak(ts);
+            msg->message = WM_NULL;
+            return;
+        }
+
+        /* Remap modifier+alpha for Colemak shortcuts.
+         * Skip when Win is held — WH_KEYBOARD_LL handles
+         * Win+key to avoid double-remapping. */
+        if (ts->colemakMode && !win) {
+            remapped = keymap_get_colemak_vk(vk);
+            if (remapped != vk) {
+                UINT newScan = MapVirtualKey(remapped, MAPVK_VK_TO_VSC);
+                msg->wParam = remapped;
+                msg->lParam = (msg->lParam & ~(0xFFu << 16))
+                            | ((LPARAM)newScan << 16);
             }
         }
     }
-    return CallNextHookEx(NULL, code, wParam, lParam);
 }
 
-/* Check if a key should be eaten */
-static BOOL ShouldEatKey(TextService *ts, UINT vk, BOOL shift)
-{
-    /* Remapped CapsLock (F13): always eat regardless of mode */
-    if (vk == VK_F13)
-        return TRUE;
-
-    /* CapsLock → Backspace: eat CapsLock when enabled (pre-reboot compat) */
-    if (ts->capsLockAsBackspace && vk == VK_CAPITAL)
-        return TRUE;
-
-    /* When a modifier (Ctrl/Alt/Win) is held, VK remapping is already
-     * handled by the WH_GETMESSAGE hook (KolemakGetMsgProc).
-     * Only eat the key if Korean composition needs flushing. */
-    {
-        BOOL ctrl = (GetKeyState(VK_CONTROL) & 0x8000) != 0;
-        BOOL alt  = (GetKeyState(VK_MENU) & 0x8000) != 0;
-        BOOL win  = ((GetKeyState(VK_LWIN) & 0x8000) |
-                     (GetKeyState(VK_RWIN) & 0x8000)) != 0;
-        if (ctrl || alt || win) {
-            if (ts->koreanMode && ts->hangulCtx.state != HANGUL_STATE_EMPTY)
-                return TRUE;   /* Eat to flush composition in OnKeyDown */
-            return FALSE;
+LRESULT CALLBACK KolemakGetMsgProc(int code, WPARAM wParam, LPARAM lParam)
+{
+    MSG *msg = (MSG *)lParam;
+
+    if (code == HC_ACTION && wParam == PM_REMOVE) {
+        if (GETMSG_KEY_RANGE(msg->message))
+            OnKeyMessage(msg);
+        else if (msg->message >= GETMSG_REGISTERED && msg->hwnd == NULL) {
+            if (msg->message == LLHook_Message())
+                OnLLHookMessage(msg);
+            else if (msg->message == KolemakTray_Message())
+                OnTrayMessage(msg);
         }
     }
+    return CallNextHookEx(NULL, code, wParam, lParam);
+}
 
-    /* QWERTY mode with no Korean: pass everything through */
-    if (!ts->colemakMode && !ts->koreanMode)
-        return FALSE;
+static BYTE CurrentDispatchModes(TextService *ts)
+{
+    BYTE modes = 0;
 
-    /* Always eat letter keys (for Colemak remap or Korean input) */
-    if (vk >= 'A' && vk <= 'Z')
-        return TRUE;
-
-    /* Eat semicolon key: in English Colemak mode (maps ; -> O),
-     * or in Korean Colemak mode with semicolonSwap (maps ; -> ㅔ) */
-    if (vk == VK_OEM_1) {
-        if (ts->colemakMode && !ts->koreanMode)
-            return TRUE;
-        if (ts->koreanMode && ts->colemakMode && ts->semicolonSwap)
-            return TRUE;
-    }
+    if (ts->koreanMode)          modes |= KEYDISPATCH_KOREAN;
+    if (ts->colemakMode)         modes |= KEYDISPATCH_COLEMAK;
+    if (ts->semicolonSwap)       modes |= KEYDISPATCH_SEMISWAP;
+    if (ts->capsLockAsBackspace) modes |= KEYDISPATCH_CAPS_BACKSPACE;
+    return modes;
+}
 
-    /* Eat backspace during active composition */
-    if (vk == VK_BACK && ts->hangulCtx.state != HANGUL_STATE_EMPTY)
-        return TRUE;
+/* Classify a key through the dispatch table for the current settings,
+ * rebuilding the table first if a setting changed since the last key.
+ * The modifier snapshot and the result are recorded in *d. */
+static void DecideKey(TextService *ts, UINT vk, LPARAM lParam, KeyDecision *d)
+{
+    BYTE modes = CurrentDispatchModes(ts);
+    BYTE held;
+
+    if (keydispatch_stale(&ts->keyDispatch, modes))
+        keydispatch_build(&ts->keyDispatch, modes);
+
+    /* The key itself counts: a Ctrl key-down sees Ctrl held */
+    modstate_message(&ts->modState, vk, lParam, FALSE);
+    held = ts->modState.down;
+
+    d->vk = vk;
+    d->lParam = lParam;
+    d->modes = modes;
+    d->composing = (ts->hangulCtx.state != HANGUL_STATE_EMPTY);
+    d->shift = (held & MODSTATE_SHIFT) != 0;
+    d->action = keydispatch_lookup(&ts->keyDispatch, vk, d->composing,
+                                   held & (MODSTATE_CTRL | MODSTATE_ALT | MODSTATE_WIN));
+}
 
-    /* Eat modifier keys during active composition to prevent
-     * the browser/app from terminating composition on Shift press */
-    if (ts->hangulCtx.state != HANGUL_STATE_EMPTY) {
-        if (vk == VK_SHIFT || vk == VK_LSHIFT || vk == VK_RSHIFT)
-            return TRUE;
-    }
+/* Take the decision OnTestKeyDown made for this key, if it still holds:
+ * same key and lParam, same settings and composition state.  The record
+ * is consumed either way. */
+static BOOL TakeKeyDecision(TextService *ts, UINT vk, LPARAM lParam, KeyDecision *d)
+{
+    BOOL valid = ts->keyDecisionValid;
+
+    ts->keyDecisionValid = FALSE;
+    if (!valid ||
+        ts->keyDecision.vk != vk ||
+        ts->keyDecision.lParam != lParam ||
+        ts->keyDecision.modes != CurrentDispatchModes(ts) ||
+        ts->keyDecision.composing != (ts->hangulCtx.state != HANGUL_STATE_EMPTY))
+        return FALSE;
 
-    /* Eat Enter/Escape to flush composition */
-    if (ts->hangulCtx.state != HANGUL_STATE_EMPTY) {
-        if (vk == VK_RETURN || vk == VK_ESCAPE)
-            return TRUE;
-    }
+    *d = ts->keyDecision;
+    return TRUE;
+}
 
-    /* Eat navigation keys to flush composition */
-    if (ts->hangulCtx.state != HANGUL_STATE_EMPTY) {
-        if (vk == VK_LEFT || vk == VK_RIGHT || vk == VK_UP || vk == VK_DOWN ||
-            vk == VK_HOME || vk == VK_END || vk == VK_DELETE || vk == VK_TAB)
-            return TRUE;
-    }
+/* Flush the composition (if any), optionally re-injecting vk afterwards */
+static void FlushComposition(TextService *ts, ITfContext *ctx, UINT reinjectVk)
+{
+    HangulResult result;
 
-    /* Eat all remaining keys during composition (space, numbers,
-     * punctuation etc.) to ensure proper flush before key delivery.
-     * Without this, async edit sessions on Win10 cause misordering.
-     * Exclude Ctrl/Alt/Win so modifier shortcuts (Ctrl+A etc.) work. */
-    if (ts->hangulCtx.state != HANGUL_STATE_EMPTY &&
-        vk != VK_CONTROL && vk != VK_LCONTROL && vk != VK_RCONTROL &&
-        vk != VK_MENU && vk != VK_LMENU && vk != VK_RMENU &&
-        vk != VK_LWIN && vk != VK_RWIN)
-        return TRUE;
+    if (ts->hangulCtx.state == HANGUL_STATE_EMPTY)
+        return;
 
-    (void)shift;
-    return FALSE;
+    result = hangul_ic_flush(&ts->hangulCtx);
+    QueueHangulResult(ts, ctx, &result, reinjectVk);
 }
 
-/* Process a key in Korean mode */
-static HRESULT HandleKoreanKey(TextService *ts, ITfContext *ctx,
-                                UINT vk, BOOL shift)
+/* Flush the composition and commit ch right after it */
+static void FlushAndInsert(TextService *ts, ITfContext *ctx, WCHAR ch)
 {
-    JamoMapping jamo;
     HangulResult result;
-    EditSession *es = NULL;
-    HRESULT hr;
 
-    jamo = keymap_get_jamo(vk, shift, ts->colemakMode && ts->semicolonSwap);
+    if (ts->hangulCtx.state == HANGUL_STATE_EMPTY)
+        return;
 
-    if (jamo.cho < 0 && jamo.jung < 0) {
-        /* Not a jamo key. If composing, flush first then pass through. */
-        if (ts->hangulCtx.state != HANGUL_STATE_EMPTY) {
-            result = hangul_ic_flush(&ts->hangulCtx);
-            hr = EditSession_Create(ts, ctx, ES_HANDLE_RESULT, &es);
-            if (SUCCEEDED(hr)) {
-                es->data.hangulResult = result;
-                RequestEditSession(ts, ctx, ES_HANDLE_RESULT, es);
-                es->lpVtbl->Release((ITfEditSession *)es);
-            }
+    result = hangul_ic_flush(&ts->hangulCtx);
+    result.commit2 = ch;
+    QueueHangulResult(ts, ctx, &result, 0);
+}
+
+/* Backspace within the composition */
+static void HandleCompositionBackspace(TextService *ts, ITfContext *ctx)
+{
+    HangulResult result = hangul_ic_backspace(&ts->hangulCtx);
+    EditSession *es = NULL;
+
+    if (result.type == HANGUL_RESULT_COMPOSING) {
+        QueueHangulResult(ts, ctx, &result, 0);
+    } else if (result.type == HANGUL_RESULT_COMMIT_FLUSH) {
+        /* Backspace removed last jamo: cancel composition */
+        if (SUCCEEDED(EditSession_Create(ts, ctx, ES_CANCEL_COMPOSITION, &es))) {
+            RequestEditSession(ts, ctx, ES_CANCEL_COMPOSITION, es);
+            es->lpVtbl->Release((ITfEditSession *)es);
         }
-        return S_FALSE; /* Let the key pass through */
     }
+}
+
+/* Process a jamo key in Korean mode */
+static HRESULT HandleKoreanKey(TextService *ts, ITfContext *ctx,
+                                const KeyAction *ka, BOOL shift)
+{
+    HangulResult result;
 
-    result = hangul_ic_process(&ts->hangulCtx, jamo.cho, jamo.jung);
+    result = hangul_ic_process(&ts->hangulCtx, ka->cho[shift], ka->jung[shift]);
 
     if (result.type == HANGUL_RESULT_PASS)
         return S_FALSE;
 
-    hr = EditSession_Create(ts, ctx, ES_HANDLE_RESULT, &es);
-    if (FAILED(hr)) return hr;
+    return QueueHangulResult(ts, ctx, &result, 0);
+}
 
-    es->data.hangulResult = result;
-    RequestEditSession(ts, ctx, ES_HANDLE_RESULT, es);
+/* Character a KEY_ACTION_CHAR / FLUSH_CHAR entry types */
+static WCHAR EnglishChar(TextService *ts, const KeyAction *ka, BOOL shift)
+{
+    /* CapsLock inverts case for letter keys and ; (Colemak O) */
+    if (ts->capsLockOn && (ka->flags & KEY_FLAG_CAPS))
+        shift = !shift;
+    return ka->ch[shift];
+}
+
+/* Write count copies of ch with a sync edit session; FALSE if the
+ * context would not run one */
+static BOOL InsertEnglishChars(TextService *ts, ITfContext *ctx,
+                               WCHAR ch, UINT count)
+{
+    EditSession *es = NULL;
+    HRESULT hr, hrSession = E_FAIL;
+    UINT i;
+
+    if (FAILED(EditSession_Create(ts, ctx, ES_INSERT_CHAR, &es)))
+        return FALSE;
+
+    for (i = 0; i < count; i++)
+        es->data.insert.text[i] = ch;
+    es->data.insert.len = count;
+
+    hr = ctx->lpVtbl->RequestEditSession(
+        ctx, ts->clientId,
+        (ITfEditSession *)es,
+        TF_ES_SYNC | TF_ES_READWRITE,
+        &hrSession);
+    if (hr == TF_E_SYNCHRONOUS)
+        ContextCache_AddCaps(ts, ctx, CTXCAP_SYNC_REFUSED);
     es->lpVtbl->Release((ITfEditSession *)es);
 
-    return S_OK;
+    return SUCCEEDED(hr) && SUCCEEDED(hrSession);
 }
 
-/* Process a key in English mode - uses SendInput for correct ordering */
+/* Process a key in English mode: write the Colemak character into the
+ * document when the context allows it, else type it with SendInput */
 static HRESULT HandleEnglishKey(TextService *ts, ITfContext *ctx,
-                                 UINT vk, BOOL shift)
+                                const KeyAction *ka, BOOL shift, LPARAM lParam)
 {
-    WCHAR ch;
-    INPUT inputs[2] = {0};
+    WCHAR ch = EnglishChar(ts, ka, shift);
+    INPUT inputs[2 * EDIT_SESSION_MAX_CHARS];
+    UINT count = LOWORD(lParam), i;
 
-    (void)ctx;
+    if (!ch)
+        return S_FALSE; /* Not a key we remap */
 
-    /* CapsLock inverts case for letter keys.
-     * Include VK_OEM_1 (;) since Colemak maps it to O. */
-    if (ts->capsLockOn && ((vk >= 'A' && vk <= 'Z') || vk == VK_OEM_1))
-        shift = !shift;
+    /* Auto-repeat the app fell behind on arrives as one message with a
+     * repeat count: type all of it at once */
+    if (count == 0)
+        count = 1;
+    if (count > EDIT_SESSION_MAX_CHARS)
+        count = EDIT_SESSION_MAX_CHARS;
 
-    if (!keymap_get_colemak(vk, shift, &ch))
-        return S_FALSE; /* Not a key we remap */
+    if (!(ts->pendingSession && ts->pendingSession->context == ctx) &&
+        ContextCache_CanInsertText(ts, ctx) &&
+        InsertEnglishChars(ts, ctx, ch, count))
+        return S_OK;
 
-    /* Send Unicode character directly via SendInput.
-     * This arrives as VK_PACKET which ShouldEatKey doesn't eat,
+    /* Send Unicode characters via SendInput.
+     * These arrive as VK_PACKET which the dispatch table passes,
      * so no recursion. Ordering is guaranteed by SendInput. */
-    inputs[0].type = INPUT_KEYBOARD;
-    inputs[0].ki.wScan = ch;
-    inputs[0].ki.dwFlags = KEYEVENTF_UNICODE;
-    inputs[1].type = INPUT_KEYBOARD;
-    inputs[1].ki.wScan = ch;
-    inputs[1].ki.dwFlags = KEYEVENTF_UNICODE | KEYEVENTF_KEYUP;
-    SendInput(2, inputs, sizeof(INPUT));
+    ZeroMemory(inputs, sizeof(inputs));
+    for (i = 0; i < count; i++) {
+        inputs[2 * i].type = INPUT_KEYBOARD;
+        inputs[2 * i].ki.wScan = ch;
+        inputs[2 * i].ki.dwFlags = KEYEVENTF_UNICODE;
+        inputs[2 * i + 1].type = INPUT_KEYBOARD;
+        inputs[2 * i + 1].ki.wScan = ch;
+        inputs[2 * i + 1].ki.dwFlags = KEYEVENTF_UNICODE | KEYEVENTF_KEYUP;
+    }
+    SendInput(2 * count, inputs, sizeof(INPUT));
 
     return S_OK;
 }
@@ -534,9 +654,17 @@ static ULONG STDMETHODCALLTYPE KES_Release(ITfKeyEventSink *pThis)
 static HRESULT STDMETHODCALLTYPE KES_OnSetFocus(
     ITfKeyEventSink *pThis, BOOL fForeground)
 {
+    TextService *ts = TS_FROM_KEY_EVENT_SINK(pThis);
+
+    ts->keyDecisionValid = FALSE;
     if (fForeground) {
-        TextService *ts = TS_FROM_KEY_EVENT_SINK(pThis);
+        TextService_Ready(ts);
+
+        /* Modifier key-ups may have gone to another window meanwhile */
+        KeyHandler_SyncModifiers(ts);
         Settings_ReloadPrefs(ts);
+    } else {
+        Settings_Flush();
     }
     return S_OK;
 }
@@ -546,11 +674,20 @@ static HRESULT STDMETHODCALLTYPE KES_OnTestKeyDown(
     WPARAM wParam, LPARAM lParam, BOOL *pfEaten)
 {
     TextService *ts = TS_FROM_KEY_EVENT_SINK(pThis);
-    BOOL shift = (GetKeyState(VK_SHIFT) & 0x8000) != 0;
 
     (void)pic; (void)lParam;
 
-    *pfEaten = ShouldEatKey(ts, (UINT)wParam, shift);
+    TRACE_KEY(ts, (UINT)wParam, lParam, KEYTRACE_TEST);
+
+    /* A key before any focus event still finds the settings loaded */
+    if (initstage_pending(&ts->stages, INITSTAGE_ALL(&ts->stages)))
+        TextService_Ready(ts);
+
+    /* Recorded for KES_OnKeyDown, which TSF calls next for eaten keys */
+    DecideKey(ts, (UINT)wParam, lParam, &ts->keyDecision);
+    ts->keyDecisionValid = TRUE;
+
+    *pfEaten = (ts->keyDecision.action->flags & KEY_FLAG_EAT) != 0;
     return S_OK;
 }
 
@@ -558,7 +695,13 @@ static HRESULT STDMETHODCALLTYPE KES_OnTestKeyUp(
     ITfKeyEventSink *pThis, ITfContext *pic,
     WPARAM wParam, LPARAM lParam, BOOL *pfEaten)
 {
-    (void)pThis; (void)pic; (void)wParam; (void)lParam;
+    TextService *ts = TS_FROM_KEY_EVENT_SINK(pThis);
+
+    (void)pic;
+
+    modstate_message(&ts->modState, (UINT)wParam, lParam, TRUE);
+
+    TRACE_KEY(ts, (UINT)wParam, lParam, KEYTRACE_TEST | KEYTRACE_KEYUP);
 
     *pfEaten = FALSE;
     return S_OK;
@@ -570,15 +713,24 @@ static HRESULT STDMETHODCALLTYPE KES_OnKeyDown(
 {
     TextService *ts = TS_FROM_KEY_EVENT_SINK(pThis);
     UINT vk = (UINT)wParam;
-    BOOL shift = (GetKeyState(VK_SHIFT) & 0x8000) != 0;
+    KeyDecision decision;
+    const KeyAction *ka;
+    BOOL shift;
     HRESULT hr;
 
-    (void)lParam;
     *pfEaten = FALSE;
 
-    /* CapsLock handling: VK_F13 (remapped via Scancode Map) or
-     * VK_CAPITAL (pre-reboot / no scancode map fallback) */
-    if (vk == VK_F13 || (ts->capsLockAsBackspace && vk == VK_CAPITAL)) {
+    TRACE_KEY(ts, vk, lParam, 0);
+
+    /* Reuse OnTestKeyDown's decision; recompute only if it no longer
+     * matches (e.g. KeyDown called directly by the keystroke manager) */
+    if (!TakeKeyDecision(ts, vk, lParam, &decision))
+        DecideKey(ts, vk, lParam, &decision);
+    ka = decision.action;
+    shift = decision.shift;
+
+    switch (ka->action) {
+    case KEY_ACTION_CAPSLOCK:
         /* VK_CAPITAL (pre-reboot): OS already toggled CapsLock, undo it */
         if (vk == VK_CAPITAL) {
             BYTE ks[256];
@@ -587,276 +739,178 @@ static HRESULT STDMETHODCALLTYPE KES_OnKeyDown(
             SetKeyboardState(ks);
         }
 
-        if (ts->capsLockAsBackspace) {
-            if (shift) {
-                /* Shift+CapsLock: actual CapsLock toggle */
-                ts->capsLockOn = !ts->capsLockOn;
-                SyncCapsLockState(ts);
+        if (ts->capsLockAsBackspace && !shift) {
+            /* Backspace */
+            if (ts->hangulCtx.state != HANGUL_STATE_EMPTY) {
+                HandleCompositionBackspace(ts, pic);
             } else {
-                /* Backspace */
-                if (ts->hangulCtx.state != HANGUL_STATE_EMPTY) {
-                    HangulResult result = hangul_ic_backspace(&ts->hangulCtx);
-                    EditSession *es = NULL;
-
-                    if (result.type == HANGUL_RESULT_COMPOSING) {
-                        hr = EditSession_Create(ts, pic, ES_HANDLE_RESULT, &es);
-                        if (SUCCEEDED(hr)) {
-                            es->data.hangulResult = result;
-                            RequestEditSession(ts, pic, ES_HANDLE_RESULT, es);
-                            es->lpVtbl->Release((ITfEditSession *)es);
-                        }
-                    } else if (result.type == HANGUL_RESULT_COMMIT_FLUSH) {
-                        hr = EditSession_Create(ts, pic, ES_CANCEL_COMPOSITION, &es);
-                        if (SUCCEEDED(hr)) {
-                            RequestEditSession(ts, pic, ES_CANCEL_COMPOSITION, es);
-                            es->lpVtbl->Release((ITfEditSession *)es);
-                        }
-                    }
-                } else {
-                    INPUT bkInputs[2];
-                    memset(bkInputs, 0, sizeof(bkInputs));
-                    bkInputs[0].type = INPUT_KEYBOARD;
-                    bkInputs[0].ki.wVk = VK_BACK;
-                    bkInputs[0].ki.wScan =
-                        (WORD)MapVirtualKey(VK_BACK, MAPVK_VK_TO_VSC);
-                    bkInputs[1].type = INPUT_KEYBOARD;
-                    bkInputs[1].ki.wVk = VK_BACK;
-                    bkInputs[1].ki.wScan =
-                        (WORD)MapVirtualKey(VK_BACK, MAPVK_VK_TO_VSC);
-                    bkInputs[1].ki.dwFlags = KEYEVENTF_KEYUP;
-                    SendInput(2, bkInputs, sizeof(INPUT));
-                }
+                INPUT bkInputs[2];
+                memset(bkInputs, 0, sizeof(bkInputs));
+                bkInputs[0].type = INPUT_KEYBOARD;
+                bkInputs[0].ki.wVk = VK_BACK;
+                bkInputs[0].ki.wScan =
+                    (WORD)MapVirtualKey(VK_BACK, MAPVK_VK_TO_VSC);
+                bkInputs[1].type = INPUT_KEYBOARD;
+                bkInputs[1].ki.wVk = VK_BACK;
+                bkInputs[1].ki.wScan =
+                    (WORD)MapVirtualKey(VK_BACK, MAPVK_VK_TO_VSC);
+                bkInputs[1].ki.dwFlags = KEYEVENTF_KEYUP;
+                SendInput(2, bkInputs, sizeof(INPUT));
             }
         } else {
-            /* capsLockAsBackspace=FALSE: CapsLock toggle */
+            /* Shift+CapsLock, or capsLockAsBackspace=FALSE: CapsLock toggle */
             ts->capsLockOn = !ts->capsLockOn;
             SyncCapsLockState(ts);
         }
         *pfEaten = TRUE;
         return S_OK;
-    }
 
-    /* Shift keys eaten during composition: swallow silently.
-     * This prevents the browser from terminating composition on Shift press. */
-    if (vk == VK_SHIFT || vk == VK_LSHIFT || vk == VK_RSHIFT) {
-        *pfEaten = (ts->hangulCtx.state != HANGUL_STATE_EMPTY);
+    case KEY_ACTION_SWALLOW:
+        /* Shift keys eaten during composition: swallow silently.
+         * This prevents the browser from terminating composition on Shift press. */
+        *pfEaten = TRUE;
         return S_OK;
-    }
-
-    /* Handle backspace during composition */
-    if (vk == VK_BACK && ts->hangulCtx.state != HANGUL_STATE_EMPTY) {
-        HangulResult result = hangul_ic_backspace(&ts->hangulCtx);
-        EditSession *es = NULL;
-
-        if (result.type == HANGUL_RESULT_COMPOSING) {
-            hr = EditSession_Create(ts, pic, ES_HANDLE_RESULT, &es);
-            if (SUCCEEDED(hr)) {
-                es->data.hangulResult = result;
-                RequestEditSession(ts, pic, ES_HANDLE_RESULT, es);
-                es->lpVtbl->Release((ITfEditSession *)es);
-            }
-        } else if (result.type == HANGUL_RESULT_COMMIT_FLUSH) {
-            /* Backspace removed last jamo: cancel composition */
-            hr = EditSession_Create(ts, pic, ES_CANCEL_COMPOSITION, &es);
-            if (SUCCEEDED(hr)) {
-                RequestEditSession(ts, pic, ES_CANCEL_COMPOSITION, es);
-                es->lpVtbl->Release((ITfEditSession *)es);
-            }
-        }
 
+    case KEY_ACTION_BACKSPACE:
+        HandleCompositionBackspace(ts, pic);
         *pfEaten = TRUE;
         return S_OK;
-    }
 
-    /* Handle Enter: flush composition, end it, re-inject key.
-     *
-     * Two re-inject mechanisms are used simultaneously:
-     *
-     * 1) Immediate SendInput — delivers Enter during the current TSF
-     *    key processing cycle.  Browsers and KakaoTalk process this
-     *    for form submission / message send.
-     *
-     * 2) Async edit session with reinjectVk — delivers Enter from a
-     *    callback that runs outside TSF's keystroke manager.  Games
-     *    ignore the immediate SendInput but process this deferred one.
-     *
-     * Apps that handle the immediate Enter (browsers, KakaoTalk) will
-     * see a second Enter from the async callback, but it arrives after
-     * the action (page navigated / message sent), hitting an empty
-     * input field — harmless. */
-    if (vk == VK_RETURN && ts->hangulCtx.state != HANGUL_STATE_EMPTY)
-    {
-        HangulResult result = hangul_ic_flush(&ts->hangulCtx);
-        EditSession *es = NULL;
-
-        hr = EditSession_Create(ts, pic, ES_HANDLE_RESULT, &es);
-        if (SUCCEEDED(hr)) {
-            HRESULT hrSession;
-            es->data.hangulResult = result;
-
-            hr = pic->lpVtbl->RequestEditSession(
-                pic, ts->clientId,
-                (ITfEditSession *)es,
-                TF_ES_SYNC | TF_ES_READWRITE,
-                &hrSession);
-
-            if (hr == TF_E_SYNCHRONOUS) {
-                /* Sync not available: async handles EndComposition + reinject */
-                es->reinjectVk = VK_RETURN;
-                pic->lpVtbl->RequestEditSession(
-                    pic, ts->clientId,
-                    (ITfEditSession *)es,
-                    TF_ES_ASYNC | TF_ES_READWRITE,
-                    &hrSession);
-                es->lpVtbl->Release((ITfEditSession *)es);
+    case KEY_ACTION_ENTER:
+        /* Handle Enter: flush composition, end it, re-inject key.
+         *
+         * Two re-inject mechanisms are used simultaneously:
+         *
+         * 1) Immediate SendInput — delivers Enter during the current TSF
+         *    key processing cycle.  Browsers and KakaoTalk process this
+         *    for form submission / message send.
+         *
+         * 2) Async edit session with reinjectVk — delivers Enter from a
+         *    callback that runs outside TSF's keystroke manager.  Games
+         *    ignore the immediate SendInput but process this deferred one.
+         *
+         * Apps that handle the immediate Enter (browsers, KakaoTalk) will
+         * see a second Enter from the async callback, but it arrives after
+         * the action (page navigated / message sent), hitting an empty
+         * input field — harmless. */
+        {
+            HangulResult result = hangul_ic_flush(&ts->hangulCtx);
+            EditSession *es = NULL;
+
+            if (ts->pendingSession && ts->pendingSession->context == pic) {
+                /* Results still queued: flush and re-inject behind them */
+                hr = QueueHangulResult(ts, pic, &result, VK_RETURN);
             } else {
-                /* Sync succeeded: composition ended immediately.
-                 * Queue async for deferred reinject (needed by games). */
-                es->lpVtbl->Release((ITfEditSession *)es);
-                {
-                    EditSession *esR = NULL;
-                    hr = EditSession_Create(ts, pic, ES_HANDLE_RESULT, &esR);
-                    if (SUCCEEDED(hr)) {
-                        esR->data.hangulResult.type = HANGUL_RESULT_PASS;
-                        esR->reinjectVk = VK_RETURN;
+                hr = EditSession_Create(ts, pic, ES_HANDLE_RESULT, &es);
+                if (SUCCEEDED(hr)) {
+                    HRESULT hrSession;
+                    EditSession_AddResult(es, &result);
+
+                    hr = pic->lpVtbl->RequestEditSession(
+                        pic, ts->clientId,
+                        (ITfEditSession *)es,
+                        TF_ES_SYNC | TF_ES_READWRITE,
+                        &hrSession);
+
+                    if (hr == TF_E_SYNCHRONOUS) {
+                        /* Sync not available: async handles EndComposition + reinject */
+                        es->reinjectVk = VK_RETURN;
                         pic->lpVtbl->RequestEditSession(
                             pic, ts->clientId,
-                            (ITfEditSession *)esR,
+                            (ITfEditSession *)es,
                             TF_ES_ASYNC | TF_ES_READWRITE,
                             &hrSession);
-                        esR->lpVtbl->Release((ITfEditSession *)esR);
+                        es->lpVtbl->Release((ITfEditSession *)es);
+                    } else {
+                        /* Sync succeeded: composition ended immediately.
+                         * Queue async for deferred reinject (needed by games). */
+                        es->lpVtbl->Release((ITfEditSession *)es);
+                        {
+                            EditSession *esR = NULL;
+                            hr = EditSession_Create(ts, pic, ES_HANDLE_RESULT, &esR);
+                            if (SUCCEEDED(hr)) {
+                                esR->reinjectVk = VK_RETURN;
+                                pic->lpVtbl->RequestEditSession(
+                                    pic, ts->clientId,
+                                    (ITfEditSession *)esR,
+                                    TF_ES_ASYNC | TF_ES_READWRITE,
+                                    &hrSession);
+                                esR->lpVtbl->Release((ITfEditSession *)esR);
+                            }
+                        }
                     }
                 }
             }
-        }
 
-        /* Immediate re-inject for apps that handle Enter during TSF
-         * key processing (browsers, KakaoTalk).  Games ignore this;
-         * the async callback above covers them. */
-        {
-            INPUT inputs[2] = {0};
-            inputs[0].type = INPUT_KEYBOARD;
-            inputs[0].ki.wVk = VK_RETURN;
-            inputs[0].ki.wScan =
-                (WORD)MapVirtualKey(VK_RETURN, MAPVK_VK_TO_VSC);
-            inputs[1].type = INPUT_KEYBOARD;
-            inputs[1].ki.wVk = VK_RETURN;
-            inputs[1].ki.wScan =
-                (WORD)MapVirtualKey(VK_RETURN, MAPVK_VK_TO_VSC);
-            inputs[1].ki.dwFlags = KEYEVENTF_KEYUP;
-            SendInput(2, inputs, sizeof(INPUT));
+            /* Immediate re-inject for apps that handle Enter during TSF
+             * key processing (browsers, KakaoTalk).  Games ignore this;
+             * the async callback above covers them. */
+            {
+                INPUT inputs[2] = {0};
+                inputs[0].type = INPUT_KEYBOARD;
+                inputs[0].ki.wVk = VK_RETURN;
+                inputs[0].ki.wScan =
+                    (WORD)MapVirtualKey(VK_RETURN, MAPVK_VK_TO_VSC);
+                inputs[1].type = INPUT_KEYBOARD;
+                inputs[1].ki.wVk = VK_RETURN;
+                inputs[1].ki.wScan =
+                    (WORD)MapVirtualKey(VK_RETURN, MAPVK_VK_TO_VSC);
+                inputs[1].ki.dwFlags = KEYEVENTF_KEYUP;
+                SendInput(2, inputs, sizeof(INPUT));
+            }
         }
-
         *pfEaten = TRUE;
         return S_OK;
-    }
-
-    /* Handle Escape: flush composition */
-    if (vk == VK_ESCAPE && ts->hangulCtx.state != HANGUL_STATE_EMPTY)
-    {
-        HangulResult result = hangul_ic_flush(&ts->hangulCtx);
-        EditSession *es = NULL;
-
-        hr = EditSession_Create(ts, pic, ES_HANDLE_RESULT, &es);
-        if (SUCCEEDED(hr)) {
-            es->data.hangulResult = result;
-            RequestEditSession(ts, pic, ES_HANDLE_RESULT, es);
-            es->lpVtbl->Release((ITfEditSession *)es);
-        }
 
+    case KEY_ACTION_FLUSH:
+        /* Escape: flush composition */
+        FlushComposition(ts, pic, 0);
         *pfEaten = TRUE;
         return S_OK;
-    }
-
-    /* Navigation keys: flush composition and re-inject key */
-    if ((vk == VK_LEFT || vk == VK_RIGHT || vk == VK_UP || vk == VK_DOWN ||
-         vk == VK_HOME || vk == VK_END || vk == VK_DELETE || vk == VK_TAB) &&
-        ts->hangulCtx.state != HANGUL_STATE_EMPTY)
-    {
-        HangulResult result = hangul_ic_flush(&ts->hangulCtx);
-        EditSession *es = NULL;
 
-        hr = EditSession_Create(ts, pic, ES_HANDLE_RESULT, &es);
-        if (SUCCEEDED(hr)) {
-            es->data.hangulResult = result;
-            es->reinjectVk = vk;  /* Re-inject after edit session completes */
-            RequestEditSession(ts, pic, ES_HANDLE_RESULT, es);
-            es->lpVtbl->Release((ITfEditSession *)es);
-        }
+    case KEY_ACTION_FLUSH_REINJECT:
+        /* Navigation keys, and the catch-all for remaining keys eaten
+         * during composition that are not plain characters (numpad,
+         * function keys, shortcuts): flush and re-inject.  Without this,
+         * async edit sessions on Win10 cause misordering. */
+        FlushComposition(ts, pic, vk);
+        *pfEaten = TRUE;
+        return S_OK;
 
+    case KEY_ACTION_FLUSH_INSERT:
+        /* Space, digits and punctuation: commit the syllable and the
+         * character together rather than re-injecting the key */
+        FlushAndInsert(ts, pic, ka->ch[shift]);
         *pfEaten = TRUE;
         return S_OK;
-    }
 
-    /* Catch-all: flush composition for any remaining key (space, numbers,
-     * punctuation, etc.) that was eaten by ShouldEatKey during composition.
-     * Without this, async edit sessions on Win10 cause misordering. */
-    if (ts->koreanMode &&
-        ts->hangulCtx.state != HANGUL_STATE_EMPTY &&
-        !(vk >= 'A' && vk <= 'Z') &&
-        vk != VK_OEM_1 &&
-        vk != VK_BACK &&
-        vk != VK_SHIFT && vk != VK_LSHIFT && vk != VK_RSHIFT &&
-        vk != VK_CONTROL && vk != VK_LCONTROL && vk != VK_RCONTROL &&
-        vk != VK_MENU && vk != VK_LMENU && vk != VK_RMENU &&
-        vk != VK_LWIN && vk != VK_RWIN)
-    {
-        HangulResult result = hangul_ic_flush(&ts->hangulCtx);
-        EditSession *es = NULL;
+    case KEY_ACTION_FLUSH_PASS:
+        /* Modifier shortcuts (VK remapping is done by WH_GETMESSAGE hook)
+         * and non-jamo keys: flush Korean composition, then let the key
+         * pass through to the application. */
+        FlushComposition(ts, pic, 0);
+        return S_OK;
 
-        hr = EditSession_Create(ts, pic, ES_HANDLE_RESULT, &es);
-        if (SUCCEEDED(hr)) {
-            es->data.hangulResult = result;
-            es->reinjectVk = vk;  /* Re-inject after edit session completes */
-            RequestEditSession(ts, pic, ES_HANDLE_RESULT, es);
-            es->lpVtbl->Release((ITfEditSession *)es);
-        }
+    case KEY_ACTION_JAMO:
+        hr = HandleKoreanKey(ts, pic, ka, shift);
+        break;
 
+    case KEY_ACTION_FLUSH_CHAR:
+        /* Korean mode, not a jamo key (e.g. VK_P with semicolonSwap) in
+         * Colemak mode: flush, then Colemak character remapping (P→;),
+         * written by the same edit session */
+        FlushAndInsert(ts, pic, EnglishChar(ts, ka, shift));
         *pfEaten = TRUE;
         return S_OK;
-    }
 
-    /* Modifier shortcuts: VK remapping is done by WH_GETMESSAGE hook.
-     * Here we only flush Korean composition, then let the (already
-     * remapped) key pass through to the application. */
-    {
-        BOOL ctrl = (GetKeyState(VK_CONTROL) & 0x8000) != 0;
-        BOOL alt  = (GetKeyState(VK_MENU) & 0x8000) != 0;
-        BOOL win  = ((GetKeyState(VK_LWIN) & 0x8000) |
-                     (GetKeyState(VK_RWIN) & 0x8000)) != 0;
-        if (ctrl || alt || win) {
-            if (ts->koreanMode &&
-                ts->hangulCtx.state != HANGUL_STATE_EMPTY)
-            {
-                HangulResult result = hangul_ic_flush(&ts->hangulCtx);
-                EditSession *es = NULL;
-                hr = EditSession_Create(ts, pic, ES_HANDLE_RESULT, &es);
-                if (SUCCEEDED(hr)) {
-                    es->data.hangulResult = result;
-                    RequestEditSession(ts, pic, ES_HANDLE_RESULT, es);
-                    es->lpVtbl->Release((ITfEditSession *)es);
-                }
-            }
-            *pfEaten = FALSE;
-            return S_OK;
-        }
-    }
+    case KEY_ACTION_CHAR:
+        hr = HandleEnglishKey(ts, pic, ka, shift, lParam);
+        break;
 
-    /* Normal key processing */
-    if (ts->koreanMode) {
-        hr = HandleKoreanKey(ts, pic, vk, shift);
-        /* If Korean handler didn't consume the key (e.g. VK_P with
-         * semicolonSwap) and we're in Colemak mode, fall through to
-         * English handler for Colemak character remapping (e.g. P→;).
-         * Only for letter keys — VK_OEM_1 should pass through as ';'
-         * when semicolonSwap is off, not be remapped to 'O'. */
-        if (hr == S_FALSE && ts->colemakMode && vk >= 'A' && vk <= 'Z')
-            hr = HandleEnglishKey(ts, pic, vk, shift);
-    } else if (ts->colemakMode) {
-        hr = HandleEnglishKey(ts, pic, vk, shift);
-    } else {
-        /* QWERTY mode: pass through */
+    default:
+        /* QWERTY mode / unhandled key: pass through */
         hr = S_FALSE;
+        break;
     }
 
     *pfEaten = SUCCEEDED(hr) && hr != S_FALSE;
@@ -867,7 +921,13 @@ static HRESULT STDMETHODCALLTYPE KES_OnKeyUp(
     ITfKeyEventSink *pThis, ITfContext *pic,
     WPARAM wParam, LPARAM lParam, BOOL *pfEaten)
 {
-    (void)pThis; (void)pic; (void)wParam; (void)lParam;
+    TextService *ts = TS_FROM_KEY_EVENT_SINK(pThis);
+
+    (void)pic;
+
+    modstate_message(&ts->modState, (UINT)wParam, lParam, TRUE);
+
+    TRACE_KEY(ts, (UINT)wParam, lParam, KEYTRACE_KEYUP);
 
     *pfEaten = FALSE;
     return S_OK;
@@ -885,21 +945,13 @@ static HRESULT STDMETHODCALLTYPE KES_OnPreservedKey(
         /* Flush any ongoing composition before toggling */
         if (ts->hangulCtx.state != HANGUL_STATE_EMPTY) {
             HangulResult result = hangul_ic_flush(&ts->hangulCtx);
-            EditSession *es = NULL;
-            HRESULT hr;
-
-            hr = EditSession_Create(ts, pic, ES_HANDLE_RESULT, &es);
-            if (SUCCEEDED(hr)) {
-                es->data.hangulResult = result;
-                RequestEditSession(ts, pic, ES_HANDLE_RESULT, es);
-                es->lpVtbl->Release((ITfEditSession *)es);
-            }
+            QueueHangulResult(ts, pic, &result, 0);
         }
 
         ts->koreanMode = !ts->koreanMode;
-        TextService_SetKeyboardOpen(ts, ts->koreanMode);
-        if (ts->langBarButton)
-            LangBarButton_UpdateState(ts->langBarButton);
+        Settings_RememberAppModes(ts);
+        PostUi(ts, UIBUS_KEYBOARD_OPEN, ts->koreanMode);
+        PostUi(ts, UIBUS_LANGBAR, 0);
         *pfEaten = TRUE;
         return S_OK;
     }
@@ -908,21 +960,13 @@ static HRESULT STDMETHODCALLTYPE KES_OnPreservedKey(
         /* Flush any ongoing composition before toggling */
         if (ts->hangulCtx.state != HANGUL_STATE_EMPTY) {
             HangulResult result = hangul_ic_flush(&ts->hangulCtx);
-            EditSession *es = NULL;
-            HRESULT hr;
-
-            hr = EditSession_Create(ts, pic, ES_HANDLE_RESULT, &es);
-            if (SUCCEEDED(hr)) {
-                es->data.hangulResult = result;
-                RequestEditSession(ts, pic, ES_HANDLE_RESULT, es);
-                es->lpVtbl->Release((ITfEditSession *)es);
-            }
+            QueueHangulResult(ts, pic, &result, 0);
         }
 
         ts->colemakMode = !ts->colemakMode;
-        KolemakTooltip_Show(ts->colemakMode ? L"Colemak" : L"QWERTY");
-        if (ts->langBarButton)
-            LangBarButton_UpdateState(ts->langBarButton);
+        Settings_RememberAppModes(ts);
+        PostUi(ts, UIBUS_TOOLTIP, ts->colemakMode);
+        PostUi(ts, UIBUS_LANGBAR, 0);
         *pfEaten = TRUE;
         return S_OK;
     }
@@ -0,0 +1,193 @@
+/*
+ * keydispatch.c - Precompiled per-mode key dispatch tables
+ *
+ * ClassifyTestKey / ClassifyKeyDown are the key event sink's decision
+ * ladders, evaluated here once per VK instead of on every keystroke.
+ */
+
+#include "keydispatch.h"
+#include "keymap.h"
+
+static BOOL IsLetter(UINT vk)
+{
+    return vk >= 'A' && vk <= 'Z';
+}
+
+static BOOL IsShiftVk(UINT vk)
+{
+    return vk == VK_SHIFT || vk == VK_LSHIFT || vk == VK_RSHIFT;
+}
+
+/* Ctrl/Alt/Win keys themselves */
+static BOOL IsShortcutModifierVk(UINT vk)
+{
+    return vk == VK_CONTROL || vk == VK_LCONTROL || vk == VK_RCONTROL ||
+           vk == VK_MENU || vk == VK_LMENU || vk == VK_RMENU ||
+           vk == VK_LWIN || vk == VK_RWIN;
+}
+
+static BOOL IsNavigationVk(UINT vk)
+{
+    return vk == VK_LEFT || vk == VK_RIGHT || vk == VK_UP || vk == VK_DOWN ||
+           vk == VK_HOME || vk == VK_END || vk == VK_DELETE || vk == VK_TAB;
+}
+
+/* OnTestKeyDown: should the key be eaten? */
+static BOOL ClassifyTestKey(BYTE modes, UINT vk, BOOL composing, BOOL modHeld)
+{
+    BOOL korean  = (modes & KEYDISPATCH_KOREAN) != 0;
+    BOOL colemak = (modes & KEYDISPATCH_COLEMAK) != 0;
+
+    /* Remapped CapsLock (F13): always eat regardless of mode */
+    if (vk == VK_F13)
+        return TRUE;
+
+    /* CapsLock → Backspace: eat CapsLock when enabled (pre-reboot compat) */
+    if ((modes & KEYDISPATCH_CAPS_BACKSPACE) && vk == VK_CAPITAL)
+        return TRUE;
+
+    /* When a modifier (Ctrl/Alt/Win) is held, VK remapping is already
+     * handled by the WH_GETMESSAGE hook (KolemakGetMsgProc).
+     * Only eat the key if Korean composition needs flushing. */
+    if (modHeld)
+        return korean && composing;
+
+    /* QWERTY mode with no Korean: pass everything through */
+    if (!colemak && !korean)
+        return FALSE;
+
+    /* Always eat letter keys (for Colemak remap or Korean input) */
+    if (IsLetter(vk))
+        return TRUE;
+
+    /* Eat semicolon key: in English Colemak mode (maps ; -> O),
+     * or in Korean Colemak mode with semicolonSwap (maps ; -> ㅔ) */
+    if (vk == VK_OEM_1) {
+        if (colemak && !korean)
+            return TRUE;
+        if (korean && colemak && (modes & KEYDISPATCH_SEMISWAP))
+            return TRUE;
+    }
+
+    /* Eat everything else during composition (Backspace, Shift, Enter,
+     * navigation, space, numbers, punctuation) so it is flushed in
+     * order; async edit sessions on Win10 otherwise misorder it.
+     * Exclude Ctrl/Alt/Win so modifier shortcuts (Ctrl+A etc.) work. */
+    if (composing && !IsShortcutModifierVk(vk))
+        return TRUE;
+
+    return FALSE;
+}
+
+/* OnKeyDown: what to do with the key */
+static KeyActionType ClassifyKeyDown(BYTE modes, UINT vk, BOOL composing,
+                                     BOOL modHeld, JamoMapping *jamo)
+{
+    BOOL korean  = (modes & KEYDISPATCH_KOREAN) != 0;
+    BOOL colemak = (modes & KEYDISPATCH_COLEMAK) != 0;
+    WCHAR ch;
+
+    /* CapsLock handling: VK_F13 (remapped via Scancode Map) or
+     * VK_CAPITAL (pre-reboot / no scancode map fallback) */
+    if (vk == VK_F13 ||
+        ((modes & KEYDISPATCH_CAPS_BACKSPACE) && vk == VK_CAPITAL))
+        return KEY_ACTION_CAPSLOCK;
+
+    /* Shift keys eaten during composition: swallow silently */
+    if (IsShiftVk(vk))
+        return composing ? KEY_ACTION_SWALLOW : KEY_ACTION_PASS;
+
+    if (composing) {
+        if (vk == VK_BACK)
+            return KEY_ACTION_BACKSPACE;
+        if (vk == VK_RETURN)
+            return KEY_ACTION_ENTER;
+        if (vk == VK_ESCAPE)
+            return KEY_ACTION_FLUSH;
+        if (IsNavigationVk(vk))
+            return KEY_ACTION_FLUSH_REINJECT;
+
+        /* Catch-all: any remaining key (space, numbers, punctuation)
+         * that OnTestKeyDown ate during composition.  Keys that only
+         * type a character are written along with the flushed syllable;
+         * the rest must reach the app as key events. */
+        if (korean && !IsLetter(vk) && vk != VK_OEM_1 &&
+            !IsShortcutModifierVk(vk)) {
+            if (!modHeld && keymap_get_us_symbol(vk, FALSE, &ch))
+                return KEY_ACTION_FLUSH_INSERT;
+            return KEY_ACTION_FLUSH_REINJECT;
+        }
+    }
+
+    /* Modifier shortcuts: VK remapping is done by WH_GETMESSAGE hook.
+     * Only flush Korean composition and let the key through. */
+    if (modHeld)
+        return (korean && composing) ? KEY_ACTION_FLUSH_PASS : KEY_ACTION_PASS;
+
+    if (korean) {
+        /* Jamo keys are jamo with and without Shift alike */
+        *jamo = keymap_get_jamo(vk, FALSE,
+                                colemak && (modes & KEYDISPATCH_SEMISWAP));
+        if (jamo->cho >= 0 || jamo->jung >= 0)
+            return KEY_ACTION_JAMO;
+
+        /* Not a jamo key (e.g. P with semicolonSwap): flush, then
+         * remap through Colemak for letter keys only — VK_OEM_1
+         * passes through as ';' when semicolonSwap is off. */
+        if (colemak && IsLetter(vk) && keymap_get_colemak(vk, FALSE, &ch))
+            return composing ? KEY_ACTION_FLUSH_CHAR : KEY_ACTION_CHAR;
+        return composing ? KEY_ACTION_FLUSH_PASS : KEY_ACTION_PASS;
+    }
+
+    if (colemak && keymap_get_colemak(vk, FALSE, &ch))
+        return KEY_ACTION_CHAR;
+
+    /* QWERTY mode: pass through */
+    return KEY_ACTION_PASS;
+}
+
+static void BuildEntry(KeyAction *ka, BYTE modes, UINT vk,
+                       BOOL composing, BOOL modHeld)
+{
+    JamoMapping jamo = { -1, -1 };
+    int s;
+
+    ZeroMemory(ka, sizeof(*ka));
+    ka->action = (BYTE)ClassifyKeyDown(modes, vk, composing, modHeld, &jamo);
+    if (ClassifyTestKey(modes, vk, composing, modHeld))
+        ka->flags |= KEY_FLAG_EAT;
+
+    for (s = 0; s < 2; s++) {
+        if (ka->action == KEY_ACTION_JAMO) {
+            jamo = keymap_get_jamo(vk, s,
+                (modes & KEYDISPATCH_COLEMAK) && (modes & KEYDISPATCH_SEMISWAP));
+            ka->cho[s] = (signed char)jamo.cho;
+            ka->jung[s] = (signed char)jamo.jung;
+        } else {
+            ka->cho[s] = -1;
+            ka->jung[s] = -1;
+        }
+        if (ka->action == KEY_ACTION_CHAR || ka->action == KEY_ACTION_FLUSH_CHAR)
+            keymap_get_colemak(vk, s, &ka->ch[s]);
+        else if (ka->action == KEY_ACTION_FLUSH_INSERT)
+            keymap_get_us_symbol(vk, s, &ka->ch[s]);
+    }
+
+    /* CapsLock inverts case for letter keys.
+     * Include VK_OEM_1 (;) since Colemak maps it to O. */
+    if (IsLetter(vk) || vk == VK_OEM_1)
+        ka->flags |= KEY_FLAG_CAPS;
+}
+
+void keydispatch_build(KeyDispatch *kd, BYTE modes)
+{
+    int t;
+    UINT vk;
+
+    for (t = 0; t < KEYDISPATCH_TABLES; t++) {
+        for (vk = 0; vk < 256; vk++)
+            BuildEntry(&kd->table[t][vk], modes, vk, (t & 1) != 0, (t & 2) != 0);
+    }
+    kd->modes = modes;
+    kd->built = TRUE;
+}
@@ -0,0 +1,70 @@
+/*
+ * keydispatch.h - Precompiled per-mode key dispatch tables
+ *
+ * The key event sink's decisions (eat or pass in OnTestKeyDown, what
+ * OnKeyDown does, which jamo / Colemak character a key produces)
+ * depend only on the IME settings, whether a composition is active
+ * and whether Ctrl/Alt/Win is held.  keydispatch_build evaluates that
+ * logic once per VK for the current settings; classifying a key is
+ * then a single indexed load.  Shift and CapsLock are resolved from the
+ * entry at use time.
+ */
+
+#ifndef KEYDISPATCH_H
+#define KEYDISPATCH_H
+
+#include <windows.h>
+
+/* Settings a table set is built for */
+#define KEYDISPATCH_KOREAN          0x01
+#define KEYDISPATCH_COLEMAK         0x02
+#define KEYDISPATCH_SEMISWAP        0x04    /* ㅔ on ; (Korean Colemak) */
+#define KEYDISPATCH_CAPS_BACKSPACE  0x08    /* CapsLock acts as Backspace */
+
+/* What OnKeyDown does with the key */
+typedef enum {
+    KEY_ACTION_PASS,            /* Not handled */
+    KEY_ACTION_CAPSLOCK,        /* F13 / CapsLock: Backspace or caps toggle */
+    KEY_ACTION_SWALLOW,         /* Eat without effect (Shift while composing) */
+    KEY_ACTION_BACKSPACE,       /* Backspace within the composition */
+    KEY_ACTION_ENTER,           /* Flush, then re-inject Enter */
+    KEY_ACTION_FLUSH,           /* Flush and eat (Escape) */
+    KEY_ACTION_FLUSH_REINJECT,  /* Flush, eat, re-inject the key */
+    KEY_ACTION_FLUSH_INSERT,    /* Flush and insert ch[shift] in one session */
+    KEY_ACTION_FLUSH_PASS,      /* Flush, let the key through */
+    KEY_ACTION_JAMO,            /* Feed jamo[shift] to the Hangul engine */
+    KEY_ACTION_CHAR,            /* Send Colemak ch[shift] */
+    KEY_ACTION_FLUSH_CHAR,      /* Flush, then send Colemak ch[shift] */
+} KeyActionType;
+
+/* Entry flags */
+#define KEY_FLAG_EAT    0x01    /* OnTestKeyDown eats the key */
+#define KEY_FLAG_CAPS   0x02    /* CapsLock inverts Shift for ch[] */
+
+typedef struct {
+    BYTE        action;     /* KeyActionType */
+    BYTE        flags;      /* KEY_FLAG_* */
+    signed char cho[2];     /* Jamo for KEY_ACTION_JAMO, [shift] */
+    signed char jung[2];
+    WCHAR       ch[2];      /* Colemak or inserted character, [shift] */
+} KeyAction;
+
+/* One table per (composing, Ctrl/Alt/Win held) combination */
+#define KEYDISPATCH_TABLES  4
+
+typedef struct {
+    BOOL      built;
+    BYTE      modes;        /* KEYDISPATCH_* the tables were built for */
+    KeyAction table[KEYDISPATCH_TABLES][256];
+} KeyDispatch;
+
+/* Build all tables for the given KEYDISPATCH_* settings */
+void keydispatch_build(KeyDispatch *kd, BYTE modes);
+
+/* Entry for vk; rebuild first if the settings changed */
+#define keydispatch_stale(kd, m) \
+    (!(kd)->built || (kd)->modes != (BYTE)(m))
+#define keydispatch_lookup(kd, vk, composing, modHeld) \
+    (&(kd)->table[((composing) ? 1 : 0) | ((modHeld) ? 2 : 0)][(vk) & 0xFF])
+
+#endif /* KEYDISPATCH_H */
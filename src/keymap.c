@@ -117,6 +117,35 @@ static const ColemakEntry g_colemak[] = {
 
 #define COLEMAK_COUNT (sizeof(g_colemak) / sizeof(g_colemak[0]))
 
+/* ===== US layout symbols (space, digits, punctuation) ===== */
+
+static const ColemakEntry g_us_symbols[] = {
+    { VK_SPACE,      L' ',  L' ' },
+    { '0',           L'0',  L')' },
+    { '1',           L'1',  L'!' },
+    { '2',           L'2',  L'@' },
+    { '3',           L'3',  L'#' },
+    { '4',           L'4',  L'$' },
+    { '5',           L'5',  L'%' },
+    { '6',           L'6',  L'^' },
+    { '7',           L'7',  L'&' },
+    { '8',           L'8',  L'*' },
+    { '9',           L'9',  L'(' },
+    { VK_OEM_1,      L';',  L':' },
+    { VK_OEM_PLUS,   L'=',  L'+' },
+    { VK_OEM_COMMA,  L',',  L'<' },
+    { VK_OEM_MINUS,  L'-',  L'_' },
+    { VK_OEM_PERIOD, L'.',  L'>' },
+    { VK_OEM_2,      L'/',  L'?' },
+    { VK_OEM_3,      L'`',  L'~' },
+    { VK_OEM_4,      L'[',  L'{' },
+    { VK_OEM_5,      L'\\', L'|' },
+    { VK_OEM_6,      L']',  L'}' },
+    { VK_OEM_7,      L'\'', L'"' },
+};
+
+#define US_SYMBOL_COUNT (sizeof(g_us_symbols) / sizeof(g_us_symbols[0]))
+
 /* ===== Colemak VK-to-VK mapping for modifier shortcuts ===== */
 /* Maps QWERTY VK code to Colemak VK code (letter keys only) */
 
@@ -220,3 +249,16 @@ BOOL keymap_get_colemak(UINT vk, BOOL shift, WCHAR *ch)
 
     return FALSE;
 }
+
+BOOL keymap_get_us_symbol(UINT vk, BOOL shift, WCHAR *ch)
+{
+    int i;
+
+    for (i = 0; i < (int)US_SYMBOL_COUNT; i++) {
+        if (g_us_symbols[i].vk == vk) {
+            *ch = shift ? g_us_symbols[i].upper : g_us_symbols[i].lower;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
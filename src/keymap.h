@@ -27,6 +27,11 @@ JamoMapping keymap_get_jamo(UINT vk, BOOL shift, BOOL semicolonSwap);
  * Returns TRUE if the key was remapped, FALSE if passthrough. */
 BOOL keymap_get_colemak(UINT vk, BOOL shift, WCHAR *ch);
 
+/* Get the character a space, digit or punctuation key types on the US
+ * layout (the base layout Colemak is emulated over).
+ * Returns FALSE for letters and keys that type no character. */
+BOOL keymap_get_us_symbol(UINT vk, BOOL shift, WCHAR *ch);
+
 /* Get Colemak-remapped virtual key code for modifier shortcuts (Ctrl/Alt+key).
  * Maps QWERTY VK to Colemak VK. Returns the same vk if no change needed. */
 UINT keymap_get_colemak_vk(UINT vk);
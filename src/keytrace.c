@@ -0,0 +1,331 @@
+/*
+ * keytrace.c - Compact keystroke trace format
+ *
+ * The codec is portable; the recorder writes through Win32 file APIs
+ * on Windows and stdio elsewhere (host build).
+ */
+
+#include "keytrace.h"
+
+#include <stdio.h>
+#include <string.h>
+#ifndef _WIN32
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#endif
+
+/* ===== Varint (LEB128) ===== */
+
+static int put_varint(unsigned long long v, BYTE *out, int cap)
+{
+    int n = 0;
+
+    do {
+        BYTE b = (BYTE)(v & 0x7F);
+        v >>= 7;
+        if (n == cap)
+            return 0;
+        out[n++] = (BYTE)(b | (v ? 0x80 : 0));
+    } while (v);
+    return n;
+}
+
+static BOOL get_varint(const BYTE **pp, const BYTE *end, unsigned long long *v)
+{
+    const BYTE *p = *pp;
+    unsigned long long result = 0;
+    int shift = 0;
+
+    while (p < end && shift < 64) {
+        BYTE b = *p++;
+        result |= (unsigned long long)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            *pp = p;
+            *v = result;
+            return TRUE;
+        }
+        shift += 7;
+    }
+    return FALSE;
+}
+
+/* ===== Encoding ===== */
+
+void keytrace_writer_init(KeyTraceWriter *w)
+{
+    w->lastUs = 0;
+    w->modes = 0;
+    w->started = FALSE;
+}
+
+static int put_record(unsigned long long delta, BYTE vk, BYTE info,
+                      BYTE *out, int cap)
+{
+    int n = put_varint(delta, out, cap);
+    if (n == 0 || cap - n < 2)
+        return 0;
+    out[n++] = vk;
+    out[n++] = info;
+    return n;
+}
+
+int keytrace_encode(KeyTraceWriter *w, const KeyTraceEvent *ev,
+                    BYTE *out, int cap)
+{
+    unsigned long long delta;
+    int len = 0, n;
+
+    if (!w->started) {
+        if (cap < KEYTRACE_MAGIC_LEN)
+            return 0;
+        memcpy(out, KEYTRACE_MAGIC, KEYTRACE_MAGIC_LEN);
+        len = KEYTRACE_MAGIC_LEN;
+    }
+
+    delta = ev->timeUs >= w->lastUs ? ev->timeUs - w->lastUs : 0;
+
+    /* Mode record before the first event and on every change */
+    if (!w->started || ev->modes != w->modes) {
+        n = put_record(delta, 0, ev->modes, out + len, cap - len);
+        if (n == 0)
+            return 0;
+        len += n;
+        delta = 0;
+    }
+
+    n = put_record(delta, ev->vk,
+                   (BYTE)((ev->mods & 0x1F) | ((ev->flags & 0x07) << 5)),
+                   out + len, cap - len);
+    if (n == 0)
+        return 0;
+    len += n;
+
+    w->started = TRUE;
+    w->modes = ev->modes;
+    w->lastUs = ev->timeUs >= w->lastUs ? ev->timeUs : w->lastUs;
+    return len;
+}
+
+/* ===== Decoding ===== */
+
+BOOL keytrace_reader_init(KeyTraceReader *r, const BYTE *data, size_t len)
+{
+    if (len < KEYTRACE_MAGIC_LEN ||
+        memcmp(data, KEYTRACE_MAGIC, KEYTRACE_MAGIC_LEN) != 0)
+        return FALSE;
+    r->p = data + KEYTRACE_MAGIC_LEN;
+    r->end = data + len;
+    r->timeUs = 0;
+    r->modes = 0;
+    return TRUE;
+}
+
+int keytrace_next(KeyTraceReader *r, KeyTraceEvent *ev)
+{
+    for (;;) {
+        unsigned long long delta;
+        BYTE vk, info;
+
+        if (r->p == r->end)
+            return 0;
+        if (!get_varint(&r->p, r->end, &delta) || r->end - r->p < 2)
+            return -1;
+        vk = *r->p++;
+        info = *r->p++;
+        r->timeUs += delta;
+
+        if (vk == 0) {
+            r->modes = info;
+            continue;
+        }
+
+        ev->timeUs = r->timeUs;
+        ev->vk = vk;
+        ev->mods = (BYTE)(info & 0x1F);
+        ev->flags = (BYTE)(info >> 5);
+        ev->modes = r->modes;
+        return 1;
+    }
+}
+
+/* ===== Recorder =====
+ *
+ * Called from the key event sink of every thread with a text service
+ * in the process, so one lock guards the file and the buffer; records
+ * from different threads go out in the order they took it. */
+
+#define TRACE_BUFFER_SIZE 4096
+
+static struct {
+    BOOL tried;            /* open attempted (successfully or not) */
+    KeyTraceWriter writer;
+    unsigned long long startUs;
+    BYTE buf[TRACE_BUFFER_SIZE];
+    int len;
+#ifdef _WIN32
+    HANDLE file;
+#else
+    FILE *file;
+#endif
+} g_trace;
+
+#ifdef _WIN32
+static SRWLOCK g_traceLock = SRWLOCK_INIT;
+#define trace_lock()    AcquireSRWLockExclusive(&g_traceLock)
+#define trace_unlock()  ReleaseSRWLockExclusive(&g_traceLock)
+#else
+static pthread_mutex_t g_traceLock = PTHREAD_MUTEX_INITIALIZER;
+#define trace_lock()    pthread_mutex_lock(&g_traceLock)
+#define trace_unlock()  pthread_mutex_unlock(&g_traceLock)
+#endif
+
+static unsigned long long trace_now_us(void)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (!freq.QuadPart)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (unsigned long long)(now.QuadPart / freq.QuadPart) * 1000000ull +
+           (unsigned long long)(now.QuadPart % freq.QuadPart) * 1000000ull /
+           (unsigned long long)freq.QuadPart;
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (unsigned long long)t.tv_sec * 1000000ull +
+           (unsigned long long)t.tv_nsec / 1000ull;
+#endif
+}
+
+/* The functions below run with the lock held */
+
+static void trace_flush(void)
+{
+    if (!g_trace.file || g_trace.len == 0)
+        return;
+#ifdef _WIN32
+    {
+        DWORD written;
+        WriteFile(g_trace.file, g_trace.buf, (DWORD)g_trace.len, &written, NULL);
+    }
+#else
+    fwrite(g_trace.buf, 1, (size_t)g_trace.len, g_trace.file);
+    fflush(g_trace.file);
+#endif
+    g_trace.len = 0;
+}
+
+static void trace_close(void)
+{
+    trace_flush();
+    if (g_trace.file) {
+#ifdef _WIN32
+        CloseHandle(g_trace.file);
+#else
+        fclose(g_trace.file);
+#endif
+        g_trace.file = NULL;
+    }
+}
+
+static BOOL trace_open(const char *path)
+{
+    trace_close();
+    g_trace.tried = TRUE;
+
+#ifdef _WIN32
+    {
+        char name[MAX_PATH];
+        snprintf(name, sizeof(name), "%s.%lu", path,
+                 (unsigned long)GetCurrentProcessId());
+        g_trace.file = CreateFileA(name, GENERIC_WRITE, FILE_SHARE_READ,
+                                   NULL, CREATE_ALWAYS,
+                                   FILE_ATTRIBUTE_NORMAL, NULL);
+        if (g_trace.file == INVALID_HANDLE_VALUE) {
+            g_trace.file = NULL;
+            return FALSE;
+        }
+    }
+#else
+    g_trace.file = fopen(path, "wb");
+    if (!g_trace.file)
+        return FALSE;
+#endif
+
+    keytrace_writer_init(&g_trace.writer);
+    g_trace.startUs = trace_now_us();
+    g_trace.len = 0;
+    return TRUE;
+}
+
+static void trace_record(BYTE vk, BYTE mods, BYTE flags, BYTE modes)
+{
+    KeyTraceEvent ev;
+    int n;
+
+    if (!g_trace.tried) {
+#ifdef _WIN32
+        char path[MAX_PATH];
+        DWORD len = GetEnvironmentVariableA("KOLEMAK_TRACE", path, sizeof(path));
+        if (len > 0 && len < sizeof(path))
+            trace_open(path);
+#else
+        const char *path = getenv("KOLEMAK_TRACE");
+        if (path && *path)
+            trace_open(path);
+#endif
+        g_trace.tried = TRUE;
+    }
+    if (!g_trace.file)
+        return;
+
+    ev.timeUs = trace_now_us() - g_trace.startUs;
+    ev.vk = vk;
+    ev.mods = mods;
+    ev.flags = flags;
+    ev.modes = modes;
+
+    n = keytrace_encode(&g_trace.writer, &ev, g_trace.buf + g_trace.len,
+                        TRACE_BUFFER_SIZE - g_trace.len);
+    if (n == 0) {
+        trace_flush();
+        n = keytrace_encode(&g_trace.writer, &ev, g_trace.buf,
+                            TRACE_BUFFER_SIZE);
+    }
+    g_trace.len += n;
+}
+
+/* ===== Public API ===== */
+
+BOOL keytrace_open(const char *path)
+{
+    BOOL ok;
+
+    trace_lock();
+    ok = trace_open(path);
+    trace_unlock();
+    return ok;
+}
+
+void keytrace_record(BYTE vk, BYTE mods, BYTE flags, BYTE modes)
+{
+    trace_lock();
+    trace_record(vk, mods, flags, modes);
+    trace_unlock();
+}
+
+void keytrace_flush(void)
+{
+    trace_lock();
+    trace_flush();
+    trace_unlock();
+}
+
+void keytrace_close(void)
+{
+    trace_lock();
+    trace_close();
+    trace_unlock();
+}
@@ -0,0 +1,94 @@
+/*
+ * keytrace.h - Compact keystroke trace format
+ *
+ * Records key events as they enter the key event sink so that real
+ * typing sessions can be replayed deterministically (host/kolemak_replay).
+ *
+ * File layout: "KKT1" magic, then one record per event:
+ *   varint  time delta from previous record, microseconds (LEB128)
+ *   BYTE    virtual key (0 = mode record)
+ *   BYTE    modifiers (low 5 bits) | event flags (high 3 bits)
+ * A mode record carries the IME mode bits in its second byte and is
+ * written whenever koreanMode/colemakMode/semicolonSwap change.
+ * Typical events take 3 bytes.
+ */
+
+#ifndef KEYTRACE_H
+#define KEYTRACE_H
+
+#include <windows.h>
+
+#define KEYTRACE_MAGIC      "KKT1"
+#define KEYTRACE_MAGIC_LEN  4
+
+/* Longest encoded record: 10-byte varint + vk + flags */
+#define KEYTRACE_MAX_RECORD 12
+
+/* Modifier bits */
+#define KEYTRACE_MOD_SHIFT  0x01
+#define KEYTRACE_MOD_CTRL   0x02
+#define KEYTRACE_MOD_ALT    0x04
+#define KEYTRACE_MOD_WIN    0x08
+#define KEYTRACE_MOD_CAPS   0x10    /* IME-managed CapsLock is on */
+
+/* Event flag bits */
+#define KEYTRACE_KEYUP      0x01
+#define KEYTRACE_REPEAT     0x02
+#define KEYTRACE_TEST       0x04    /* OnTestKey*, otherwise OnKey* */
+
+/* Mode bits */
+#define KEYTRACE_MODE_KOREAN    0x01
+#define KEYTRACE_MODE_COLEMAK   0x02
+#define KEYTRACE_MODE_SEMISWAP  0x04
+
+typedef struct {
+    unsigned long long timeUs;   /* absolute time from trace start */
+    BYTE vk;
+    BYTE mods;
+    BYTE flags;
+    BYTE modes;                  /* mode bits in effect for this event */
+} KeyTraceEvent;
+
+/* ===== Encoding ===== */
+
+typedef struct {
+    unsigned long long lastUs;
+    BYTE modes;
+    BOOL started;
+} KeyTraceWriter;
+
+void keytrace_writer_init(KeyTraceWriter *w);
+
+/* Encode one event (plus the magic and/or a mode record as needed).
+ * Returns bytes written, or 0 if it does not fit in cap. */
+int keytrace_encode(KeyTraceWriter *w, const KeyTraceEvent *ev,
+                    BYTE *out, int cap);
+
+/* ===== Decoding ===== */
+
+typedef struct {
+    const BYTE *p;
+    const BYTE *end;
+    unsigned long long timeUs;
+    BYTE modes;
+} KeyTraceReader;
+
+/* Returns FALSE if the data does not start with the magic */
+BOOL keytrace_reader_init(KeyTraceReader *r, const BYTE *data, size_t len);
+
+/* Returns 1 for an event, 0 at end of trace, -1 if truncated/corrupt */
+int keytrace_next(KeyTraceReader *r, KeyTraceEvent *ev);
+
+/* ===== Recorder (KOLEMAK_KEY_TRACE builds) ===== */
+
+/* Start recording to path (appends "<path>.<pid>" on Windows, where the
+ * DLL runs in many processes).  keytrace_record opens KOLEMAK_TRACE
+ * from the environment on first use if no path was set.  The recorder
+ * is shared by every thread of the process and may be called from any
+ * of them. */
+BOOL keytrace_open(const char *path);
+void keytrace_record(BYTE vk, BYTE mods, BYTE flags, BYTE modes);
+void keytrace_flush(void);
+void keytrace_close(void);
+
+#endif /* KEYTRACE_H */
@@ -15,9 +15,14 @@
 #include <msctf.h>
 #include <olectl.h>
 
+#include "arena.h"
 #include "hangul.h"
+#include "initstage.h"
+#include "keydispatch.h"
 #include "keymap.h"
+#include "modstate.h"
 #include "tooltip.h"
+#include "uibus.h"
 
 /* ===== GUIDs ===== */
 extern const CLSID CLSID_KolemakTextService;
@@ -41,6 +46,83 @@ extern DWORD     g_tlsIndex;
 /* ===== TextService (main TIP COM object) ===== */
 typedef struct TextService TextService;
 
+/* ===== Edit session objects ===== */
+
+typedef enum {
+    ES_HANDLE_RESULT,       /* Process a HangulResult */
+    ES_INSERT_CHAR,         /* Insert characters (English mode) */
+    ES_CANCEL_COMPOSITION,  /* Cancel active composition */
+} EditSessionType;
+
+typedef struct EditSession EditSession;
+
+/* Hangul results one session can carry while queued asynchronously */
+#define EDIT_SESSION_MAX_RESULTS 16
+
+/* Characters one ES_INSERT_CHAR session inserts (auto-repeat batch) */
+#define EDIT_SESSION_MAX_CHARS   16
+
+struct EditSession {
+    const ITfEditSessionVtbl *lpVtbl;
+    LONG refCount;
+
+    TextService   *ts;
+    ITfContext     *context;
+    EditSessionType type;
+
+    union {
+        struct {
+            HangulResult items[EDIT_SESSION_MAX_RESULTS];
+            UINT         count;
+        } results;   /* applied in order by one ES_HANDLE_RESULT session */
+        struct {
+            WCHAR text[EDIT_SESSION_MAX_CHARS];
+            UINT  len;
+        } insert;    /* ES_INSERT_CHAR */
+    } data;
+
+    UINT reinjectVk;  /* VK code to re-inject after session completes (0 = none) */
+
+    EditSession *nextFree;   /* pool free list link */
+};
+
+/* Edit sessions recycled per TextService; more than EDIT_SESSION_POOL_SIZE
+ * outstanding at once are allocated from the arena (arena.h) */
+#define EDIT_SESSION_POOL_SIZE 8
+
+typedef struct {
+    EditSession  slots[EDIT_SESSION_POOL_SIZE];
+    EditSession *freeList;
+    UINT         carved;     /* slots handed out at least once */
+    ULONG        hits;
+    ULONG        misses;
+} EditSessionPool;
+
+/* TSF interfaces of the context last edited, and what it turned out to
+ * support; dropped on focus change and OnPopContext */
+#define CTXCAP_SYNC_REFUSED  0x01   /* TF_ES_SYNC returned TF_E_SYNCHRONOUS */
+#define CTXCAP_NO_INTERIM    0x02   /* SetSelection refused fInterimChar */
+#define CTXCAP_STATUS_KNOWN  0x04   /* GetStatus probed */
+#define CTXCAP_NO_INSERT     0x08   /* read-only or CUAS: type via SendInput */
+
+typedef struct {
+    ITfContext            *context;
+    ITfInsertAtSelection  *insertAtSelection;
+    ITfContextComposition *contextComposition;
+    ITfRange              *compositionRange;  /* clone of ts->composition's */
+    DWORD                  caps;              /* CTXCAP_* */
+} ContextCache;
+
+/* Key decision made in OnTestKeyDown and consumed by OnKeyDown */
+typedef struct {
+    UINT             vk;
+    LPARAM           lParam;
+    BYTE             modes;      /* KEYDISPATCH_* settings at decision time */
+    BOOL             composing;
+    BOOL             shift;      /* modifier snapshot */
+    const KeyAction *action;     /* entry in TextService.keyDispatch */
+} KeyDecision;
+
 struct TextService {
     /* Primary interface: ITfTextInputProcessorEx */
     const ITfTextInputProcessorExVtbl *lpVtbl;
@@ -53,6 +135,9 @@ struct TextService {
     /* Reference count */
     LONG refCount;
 
+    /* Subsystems brought up on first focus (text_service.c) */
+    InitStages      stages;
+
     /* TSF objects */
     ITfThreadMgr   *threadMgr;
     TfClientId      clientId;
@@ -60,6 +145,7 @@ struct TextService {
 
     /* Composition state */
     ITfComposition *composition;
+    ContextCache    ctxCache;
 
     /* Hangul engine */
     HangulContext   hangulCtx;
@@ -69,6 +155,25 @@ struct TextService {
     UINT            colemakRemapVk;    /* guard for Ctrl/Alt shortcut VK remap */
     BOOL            capsLockOn;        /* internal CapsLock state (managed by IME) */
     BOOL            semicolonSwap;     /* TRUE = ㅔ on ; key ("unchanged" mode) */
+    LONG            prefsGeneration;   /* sharedprefs generation last applied */
+    DWORD           appKey;            /* appmodes_key of the process, 0 = not
+                                          yet known */
+
+    /* Modifier state from key messages (GetKeyState view); resynced
+     * from the OS on focus changes */
+    ModState        modState;
+
+    /* Key classification, rebuilt when the settings above change */
+    KeyDispatch     keyDispatch;
+    KeyDecision     keyDecision;
+    BOOL            keyDecisionValid;
+
+    /* Edit session allocation */
+    EditSessionPool esPool;
+
+    /* Async ES_HANDLE_RESULT session not yet run; further results for
+     * its context are appended to it instead of queuing new sessions */
+    EditSession    *pendingSession;
 
     /* Custom hotkey for Colemak/QWERTY toggle */
     UINT            hotkeyVk;
@@ -79,10 +184,15 @@ struct TextService {
 
     /* Win+key Colemak remapping */
     BOOL            winKeyRemap;       /* TRUE = remap Win+alpha in Colemak mode */
-    HHOOK           llKeyboardHook;
+    struct LLHookClient *llHookClient; /* slot on the LL hook thread (llhook.h) */
 
     /* Language bar */
     struct LangBarButton *langBarButton;
+
+    /* UI updates posted by the key path, and the thread timer that
+     * applies them (text_service.c) */
+    UiBus           uiBus;
+    UINT_PTR        uiTimer;
 };
 
 /* Container-of macros to get TextService* from interface pointer */
@@ -109,6 +219,27 @@ void TextService_AddRefDll(void);
 void TextService_ReleaseDll(void);
 void TextService_SetKeyboardOpen(TextService *ts, BOOL open);
 
+/* Bring up what activation deferred; cheap once everything has run */
+void TextService_Ready(TextService *ts);
+
+/* Have KeyHandler_ApplyUi run once the thread has handled the input
+ * already queued (at once if there is no timer to wait on) */
+void TextService_ScheduleUi(TextService *ts);
+
+/* Apply the UI updates pending on ts->uiBus (key_handler.c) */
+void KeyHandler_ApplyUi(TextService *ts);
+
+/* Resync the modifier tracker from the OS (key_handler.c) */
+void KeyHandler_SyncModifiers(TextService *ts);
+
+/* Start the LL hook's per-key state over from the OS; on the hook
+ * thread, before the hook is installed */
+void KeyHandler_ResetLLHook(void);
+
+/* Resync only the LL hook's modifiers from the OS; on the hook thread,
+ * between keys (foreground and desktop switches) */
+void KeyHandler_SyncLLHookModifiers(void);
+
 /* WH_GETMESSAGE hook for modifier+key Colemak remapping */
 LRESULT CALLBACK KolemakGetMsgProc(int code, WPARAM wParam, LPARAM lParam);
 
@@ -124,48 +255,60 @@ LRESULT CALLBACK KolemakLowLevelKeyboardProc(int nCode, WPARAM wParam, LPARAM lP
 #endif
 #define KOLEMAK_MOD_WIN TF_MOD_WIN
 
-/* Global capture window for Win+key hotkey capture in settings dialog */
-extern HWND g_captureHwnd;
 
 /* ===== Edit session ===== */
 
-typedef enum {
-    ES_HANDLE_RESULT,       /* Process a HangulResult */
-    ES_INSERT_CHAR,         /* Insert a single character (English mode) */
-    ES_CANCEL_COMPOSITION,  /* Cancel active composition */
-} EditSessionType;
-
-typedef struct EditSession EditSession;
-
-struct EditSession {
-    const ITfEditSessionVtbl *lpVtbl;
-    LONG refCount;
-
-    TextService   *ts;
-    ITfContext     *context;
-    EditSessionType type;
-
-    union {
-        HangulResult hangulResult;
-        WCHAR        ch;
-    } data;
-
-    UINT reinjectVk;  /* VK code to re-inject after session completes (0 = none) */
-};
-
 HRESULT EditSession_Create(TextService *ts, ITfContext *ctx,
                            EditSessionType type, EditSession **ppSession);
 
+/* Append a result to an ES_HANDLE_RESULT session, folding composition
+ * updates the next result supersedes.  FALSE when the session is full
+ * or already ends with a re-injected key. */
+BOOL    EditSession_AddResult(EditSession *es, const HangulResult *result);
+
+/* Context cache (edit_session.c) */
+void    ContextCache_Invalidate(TextService *ts);
+void    ContextCache_DropCompositionRange(TextService *ts);
+DWORD   ContextCache_Caps(TextService *ts, ITfContext *ctx);
+BOOL    ContextCache_CanInsertText(TextService *ts, ITfContext *ctx);
+void    ContextCache_AddCaps(TextService *ts, ITfContext *ctx, DWORD caps);
+
 /* ===== Settings (settings.c) ===== */
 BOOL Settings_Load(TextService *ts);
 void Settings_Save(TextService *ts);
 void Settings_ReloadPrefs(TextService *ts);
 
+/* Share a value changed in this process with the others; the registry
+ * copy is written by the background writer */
+void Settings_PublishColemakMode(BOOL colemakMode);
+void Settings_PublishCapsLockState(TextService *ts);
+
+/* From the LL hook: FALSE if another writer held the settings too long
+ * to wait for; the thread the toggle is posted to then publishes it */
+BOOL Settings_TryPublishColemakMode(BOOL colemakMode);
+
+/* Modes remembered for this application (appmodes.h): restored when
+ * the thread gets focus, remembered when the user switches them */
+void Settings_RestoreAppModes(TextService *ts);
+void Settings_RememberAppModes(TextService *ts);
+
+/* Background registry writer: one per process, refcounted by
+ * activation.  Stop stores everything queued before returning. */
+void Settings_StartWriter(DWORD quietMs);
+void Settings_StopWriter(void);
+
+/* Start storing queued registry writes now */
+void Settings_Flush(void);
+
 /* ===== System Tray (tray.c) ===== */
 HRESULT KolemakTray_Register(TextService *ts);
 void    KolemakTray_Unregister(TextService *ts);
 void    KolemakTray_EnsureIcon(TextService *ts);
 
+/* Posted to a TextService thread when its process is elected to show
+ * the icon; the WH_GETMESSAGE hook calls KolemakTray_EnsureIcon */
+UINT    KolemakTray_Message(void);
+
 /* ===== Language Bar (langbar.c) ===== */
 HRESULT LangBarButton_Create(TextService *ts, LangBarButton **ppButton);
 void    LangBarButton_Destroy(LangBarButton *button);
@@ -70,7 +70,7 @@ static ULONG STDMETHODCALLTYPE LBB_Release(ITfLangBarItemButton *pThis)
             btn->sink->lpVtbl->Release(btn->sink);
             btn->sink = NULL;
         }
-        HeapFree(GetProcessHeap(), 0, btn);
+        arena_free(btn);
     }
     return c;
 }
@@ -170,6 +170,8 @@ static HRESULT STDMETHODCALLTYPE LBB_OnMenuSelect(
     }
 
     Settings_Save(ts);
+    if (wID == MENUITEM_COLEMAK_MODE)
+        Settings_RememberAppModes(ts);
     LangBarButton_UpdateState(btn);
     return S_OK;
 }
@@ -280,8 +282,8 @@ HRESULT LangBarButton_Create(TextService *ts, LangBarButton **ppButton)
 {
     LangBarButton *btn;
 
-    btn = (LangBarButton *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY,
-                                      sizeof(LangBarButton));
+    btn = (LangBarButton *)arena_alloc(ARENA_LANGBAR_BUTTON,
+                                       sizeof(LangBarButton));
     if (!btn) return E_OUTOFMEMORY;
 
     btn->lpVtbl = &g_langBarItemButtonVtbl;
@@ -0,0 +1,103 @@
+/*
+ * lldecide.c - What the WH_KEYBOARD_LL hook does with a key
+ *
+ * The decision ladder of KolemakLowLevelKeyboardProc, free of system
+ * calls so the host build can time it (kolemak-bench).
+ */
+
+#include "lldecide.h"
+#include "keymap.h"
+
+#include <string.h>
+
+static BOOL IsModifierOnlyVk(UINT vk)
+{
+    return vk == VK_LWIN || vk == VK_RWIN ||
+           vk == VK_CONTROL || vk == VK_LCONTROL || vk == VK_RCONTROL ||
+           vk == VK_SHIFT || vk == VK_LSHIFT || vk == VK_RSHIFT ||
+           vk == VK_MENU || vk == VK_LMENU || vk == VK_RMENU;
+}
+
+void lldecide_reset(LLDecideState *st, BYTE modsDown)
+{
+    memset(st, 0, sizeof(*st));
+    modstate_reset(&st->mods, modsDown);
+}
+
+/* Win+key down */
+static void DecideWinKey(LLDecideState *st, const LLDecideInput *in,
+                         UINT vk, BYTE held, LLDecision *out)
+{
+    UINT mods = TF_MOD_WIN;
+
+    if (held & MODSTATE_CTRL)
+        mods |= TF_MOD_CONTROL;
+    if (held & MODSTATE_SHIFT)
+        mods |= TF_MOD_SHIFT;
+    if (held & MODSTATE_ALT)
+        mods |= TF_MOD_ALT;
+
+    /* Forward Win+key to settings dialog when capturing hotkey */
+    if (in->capturing) {
+        out->action = LLDECIDE_CAPTURE;
+        out->vk = vk;
+        out->mods = mods;
+        return;
+    }
+
+    /* Only act when the IME is active in the foreground process */
+    if (!in->imeActive)
+        return;
+
+    /* Win-modifier toggle hotkey (e.g. Win+Space) */
+    if (!st->toggleVk &&
+        (in->hotkeyModifiers & TF_MOD_WIN) &&
+        vk == in->hotkeyVk && mods == in->hotkeyModifiers)
+    {
+        st->toggleVk = vk;
+        out->action = LLDECIDE_TOGGLE;
+        out->colemakMode = !in->colemakMode;
+        return;
+    }
+
+    /* Win+alpha Colemak remap */
+    if (in->colemakMode && in->winKeyRemap && vk < 256) {
+        UINT remapped = keymap_get_colemak_vk(vk);
+        if (remapped != vk) {
+            st->remapped[vk] = (BYTE)remapped;
+            out->action = LLDECIDE_REMAP;
+            out->vk = remapped;
+        }
+    }
+}
+
+void lldecide_key(LLDecideState *st, const LLDecideInput *in,
+                  UINT vk, UINT scanCode, BOOL extended, BOOL up,
+                  BOOL injected, LLDecision *out)
+{
+    out->action = LLDECIDE_PASS;
+
+    /* Track modifiers from every event, including injected ones */
+    modstate_key(&st->mods, vk, scanCode, extended, up);
+
+    /* Skip events we injected ourselves */
+    if (injected)
+        return;
+
+    if (!up) {
+        if ((st->mods.down & MODSTATE_WIN) && !IsModifierOnlyVk(vk))
+            DecideWinKey(st, in, vk, st->mods.down, out);
+        return;
+    }
+
+    /* Reset toggle key tracking */
+    if (vk == st->toggleVk)
+        st->toggleVk = 0;
+
+    /* Release tracked remap regardless of current Win state */
+    if (vk < 256 && st->remapped[vk]) {
+        out->action = LLDECIDE_RELEASE;
+        out->vk = st->remapped[vk];
+        st->remapped[vk] = 0;
+    }
+}
@@ -0,0 +1,70 @@
+/*
+ * lldecide.h - What the WH_KEYBOARD_LL hook does with a key
+ *
+ * The session's low-level keyboard hook (llhook.h) holds up every key
+ * on the desktop while it decides.  Everything the decision depends on
+ * is kept current outside the key path: the foreground process by a
+ * WinEvent hook, the modifiers from the hook's own event stream
+ * (resynced from the OS on foreground and desktop switches, since
+ * key-ups on the secure desktop never reach it), the settings through
+ * sharedprefs.  lldecide_key is then a pure function
+ * of that input and the state it carries between events, and the hook
+ * procedure only carries out the result; the one system call left on
+ * the path is SendInput when a key is remapped or eaten.
+ */
+
+#ifndef LLDECIDE_H
+#define LLDECIDE_H
+
+#include <windows.h>
+#include <msctf.h>
+#include "modstate.h"
+
+/* Win modifier flag for hotkeys (TF_MOD_* doesn't include Win) */
+#ifndef TF_MOD_WIN
+#define TF_MOD_WIN 0x0040
+#endif
+
+typedef enum {
+    LLDECIDE_PASS,      /* CallNextHookEx */
+    LLDECIDE_CAPTURE,   /* Eat; post vk and mods to the capture window */
+    LLDECIDE_TOGGLE,    /* Eat; switch to colemakMode and inject a no-op
+                           key so Win is not taken as a Start press */
+    LLDECIDE_REMAP,     /* Eat; inject vk down */
+    LLDECIDE_RELEASE,   /* Eat; inject vk up */
+} LLDecideAction;
+
+typedef struct {
+    BYTE action;        /* LLDecideAction */
+    BOOL colemakMode;   /* LLDECIDE_TOGGLE: the mode switched to */
+    UINT vk;            /* Key to inject, or the key captured */
+    UINT mods;          /* LLDECIDE_CAPTURE: TF_MOD_* | TF_MOD_WIN */
+} LLDecision;
+
+/* What the hook knows when the key arrives */
+typedef struct {
+    BOOL imeActive;         /* IME active in the foreground process */
+    BOOL capturing;         /* Settings dialog there captures a hotkey */
+    BOOL colemakMode;
+    BOOL winKeyRemap;
+    UINT hotkeyVk;
+    UINT hotkeyModifiers;   /* TF_MOD_* | TF_MOD_WIN */
+} LLDecideInput;
+
+/* Carried between events; owned by the hook thread */
+typedef struct {
+    ModState mods;             /* Modifiers seen by the hook */
+    BYTE     remapped[256];    /* Physical VK -> injected VK, until key-up */
+    UINT     toggleVk;         /* Toggle hotkey held down, 0 = none */
+} LLDecideState;
+
+/* Start over, with the modifiers currently held (MODSTATE_* bits) */
+void lldecide_reset(LLDecideState *st, BYTE modsDown);
+
+/* One KBDLLHOOKSTRUCT event.  injected = the event is one of ours; it
+ * only updates the modifiers. */
+void lldecide_key(LLDecideState *st, const LLDecideInput *in,
+                  UINT vk, UINT scanCode, BOOL extended, BOOL up,
+                  BOOL injected, LLDecision *out);
+
+#endif /* LLDECIDE_H */
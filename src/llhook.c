@@ -0,0 +1,396 @@
+/*
+ * llhook.c - Session-wide WH_KEYBOARD_LL hook
+ *
+ * The client table and settings are portable; installing the hook in
+ * the elected process is Win32 only.  The hook procedure itself lives
+ * in key_handler.c.
+ */
+
+#include "llhook.h"
+#include "broker.h"
+#include "sharedprefs.h"
+#include "shmsection.h"
+
+#include <stdio.h>
+
+#define LLHOOK_TAG  "LLHook.v2"
+
+/* Room for a tag with its integrity level or process suffix */
+#define LLHOOK_MAX_NAME 48
+
+/* Marks a slot that is being set up; never a valid thread id */
+#define LLHOOK_CLAIMING ((LONG)-1)
+
+typedef struct {
+    volatile LONG captureWnd;      /* HWND, valid in every process */
+    volatile LONG captureProcess;  /* Process that owns captureWnd */
+    volatile LONG generation;      /* Bumped when a slot is taken or freed */
+    LLHookClient clients[LLHOOK_MAX_CLIENTS];
+} LLHookTable;
+
+/* The table of this integrity level in the session, mapped for the
+ * life of the process, or a private one if it cannot be mapped (the
+ * process then runs a hook of its own) */
+static LLHookTable *volatile s_table;
+static LLHookTable s_localTable;
+
+static volatile UINT s_message;
+
+/* This process's settings, for when sharedprefs is unavailable */
+static volatile LONG s_colemakMode = 1;
+static volatile LONG s_winKeyRemap = 1;
+static volatile LONG s_hotkeyVk = VK_SPACE;
+static volatile LONG s_hotkeyModifiers = KOLEMAK_MOD_WIN;
+
+/* Hook thread only: last sharedprefs copy */
+static SharedPrefs s_prefs;
+static LONG s_prefsGeneration;
+
+/* Hook thread only: the foreground thread, pushed by the WinEvent
+ * hook, and its client as of a table generation */
+static volatile LONG s_fgThread;
+static volatile LONG s_fgProcess;
+static struct {
+    BOOL  valid;
+    LONG  thread;
+    LONG  process;
+    LONG  generation;
+    LLHookClient *client;
+} s_fgClient;
+
+static void TrackForeground(HWND hwnd)
+{
+    DWORD pid = 0;
+    DWORD tid = hwnd ? GetWindowThreadProcessId(hwnd, &pid) : 0;
+
+    InterlockedExchange(&s_fgThread, (LONG)tid);
+    InterlockedExchange(&s_fgProcess, (LONG)pid);
+}
+
+/* ===== Broker role ===== */
+
+static LONG    s_refs;
+static Broker *s_broker;
+
+static LLHookTable *GetTable(void);
+
+#ifdef _WIN32
+
+static SRWLOCK s_lifeLock = SRWLOCK_INIT;   /* serializes join/leave */
+static HHOOK   s_hook;
+static HWINEVENTHOOK s_fgHook;
+static HWINEVENTHOOK s_deskHook;
+
+/* Out of context: delivered on the broker thread by its message loop,
+ * between keys, so the hook reads the foreground without asking.
+ * Modifiers released where the hook could not see them are picked up
+ * here too. */
+static void CALLBACK OnForeground(HWINEVENTHOOK hook, DWORD event,
+                                  HWND hwnd, LONG idObject, LONG idChild,
+                                  DWORD eventThread, DWORD eventTime)
+{
+    (void)hook; (void)idObject; (void)idChild;
+    (void)eventThread; (void)eventTime;
+    if (event == EVENT_SYSTEM_FOREGROUND)
+        TrackForeground(hwnd);
+    KeyHandler_SyncLLHookModifiers();
+}
+
+/* On the broker thread, which then pumps the hook's messages */
+static BOOL ElectHook(void *ctx)
+{
+    (void)ctx;
+
+    s_fgHook = SetWinEventHook(EVENT_SYSTEM_FOREGROUND,
+                               EVENT_SYSTEM_FOREGROUND, NULL, OnForeground,
+                               0, 0, WINEVENT_OUTOFCONTEXT);
+    if (!s_fgHook)
+        return FALSE;
+    TrackForeground(GetForegroundWindow());
+
+    /* Back from the secure desktop; without it the next foreground
+     * change still resyncs */
+    s_deskHook = SetWinEventHook(EVENT_SYSTEM_DESKTOPSWITCH,
+                                 EVENT_SYSTEM_DESKTOPSWITCH, NULL,
+                                 OnForeground, 0, 0, WINEVENT_OUTOFCONTEXT);
+
+    s_hook = SetWindowsHookExW(WH_KEYBOARD_LL, KolemakLowLevelKeyboardProc,
+                               g_hInst, 0);
+    if (!s_hook) {
+        UnhookWinEvent(s_fgHook);
+        s_fgHook = NULL;
+        if (s_deskHook) {
+            UnhookWinEvent(s_deskHook);
+            s_deskHook = NULL;
+        }
+        return FALSE;
+    }
+
+    /* Every key on the desktop waits for this thread */
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+    s_prefsGeneration = 0;
+    s_fgClient.valid = FALSE;
+    KeyHandler_ResetLLHook();
+    return TRUE;
+}
+
+static void ResignHook(void *ctx)
+{
+    (void)ctx;
+    UnhookWindowsHookEx(s_hook);
+    UnhookWinEvent(s_fgHook);
+    if (s_deskHook)
+        UnhookWinEvent(s_deskHook);
+    s_hook = NULL;
+    s_fgHook = NULL;
+    s_deskHook = NULL;
+}
+
+/* Named when the election is joined; constant while s_broker runs */
+static char s_roleName[LLHOOK_MAX_NAME];
+
+static const BrokerRole s_hookRole = {
+    s_roleName, ElectHook, ResignHook, NULL
+};
+
+/* One election per integrity level, like the table: a broker can only
+ * post to and inject into windows of its own level (UIPI), so one at
+ * another level would eat keys it cannot deliver.  The other level's
+ * foreground is not in its table and its keys pass through. */
+static void JoinElection(void)
+{
+    AcquireSRWLockExclusive(&s_lifeLock);
+    s_refs++;
+
+    /* Retried by every attach until a broker thread is running */
+    if (!s_broker) {
+        /* Clients in a private table are seen by no other process:
+         * hold an election of one and serve them with a hook of this
+         * process's own */
+        if (GetTable() == &s_localTable)
+            snprintf(s_roleName, sizeof(s_roleName), "LLHookMutex.P%lu",
+                     (unsigned long)GetCurrentProcessId());
+        else
+            snprintf(s_roleName, sizeof(s_roleName), "LLHookMutex%s",
+                     shmsection_level());
+        s_broker = broker_start(&s_hookRole);
+    }
+    ReleaseSRWLockExclusive(&s_lifeLock);
+}
+
+static void LeaveElection(void)
+{
+    AcquireSRWLockExclusive(&s_lifeLock);
+    if (s_refs > 0 && --s_refs == 0) {
+        broker_stop(s_broker);
+        s_broker = NULL;
+    }
+    ReleaseSRWLockExclusive(&s_lifeLock);
+}
+
+#else
+
+/* Host build: the pipeline calls the hook procedure directly, and
+ * kolemak-broker drives broker.c on its own.  The shim's foreground
+ * window never changes, so it is read once. */
+static void JoinElection(void)
+{
+    if (s_refs++ == 0) {
+        s_fgClient.valid = FALSE;
+        TrackForeground(GetForegroundWindow());
+    }
+}
+
+static void LeaveElection(void) { if (s_refs > 0) s_refs--; }
+
+#endif
+
+BOOL LLHook_IsBroker(void)
+{
+    return broker_is_owner(s_broker);
+}
+
+/* ===== Client table ===== */
+
+static LLHookTable *GetTable(void)
+{
+    LLHookTable *table;
+    HANDLE handle = NULL;
+    char name[LLHOOK_MAX_NAME];
+
+    if (s_table)
+        return s_table;
+
+    snprintf(name, sizeof(name), "%s%s", LLHOOK_TAG, shmsection_level());
+    table = (LLHookTable *)shmsection_map(name, sizeof(LLHookTable),
+                                          &handle);
+    if (!table)
+        table = &s_localTable;
+
+    /* Two threads may race here; the loser drops its view */
+    if (InterlockedCompareExchangePointer((void *volatile *)&s_table,
+                                          table, NULL) != NULL &&
+        table != &s_localTable)
+        shmsection_unmap(table, sizeof(LLHookTable), handle);
+    return s_table;
+}
+
+static LLHookClient *ClaimSlot(LLHookTable *table)
+{
+    int i;
+
+    for (i = 0; i < LLHOOK_MAX_CLIENTS; i++) {
+        if (InterlockedCompareExchange(&table->clients[i].threadId,
+                                       LLHOOK_CLAIMING, 0) == 0)
+            return &table->clients[i];
+    }
+    return NULL;
+}
+
+/* Free the slots of processes that died without detaching */
+static void ReapSlots(LLHookTable *table)
+{
+    int i;
+
+    for (i = 0; i < LLHOOK_MAX_CLIENTS; i++) {
+        LLHookClient *c = &table->clients[i];
+        LONG tid = c->threadId;
+
+        if (tid == 0 || tid == LLHOOK_CLAIMING)
+            continue;
+        if (!shmsection_process_alive((DWORD)c->processId) &&
+            InterlockedCompareExchange(&c->threadId, 0, tid) == tid)
+            InterlockedIncrement(&table->generation);
+    }
+}
+
+BOOL LLHook_Attach(TextService *ts)
+{
+    LLHookTable *table = GetTable();
+    LLHookClient *c = ClaimSlot(table);
+
+    if (!c) {
+        ReapSlots(table);
+        c = ClaimSlot(table);
+    }
+
+    LLHook_Message();
+    LLHook_Publish(ts);
+    if (c) {
+        InterlockedExchange(&c->processId, (LONG)GetCurrentProcessId());
+        InterlockedExchange(&c->threadId, (LONG)GetCurrentThreadId());
+        InterlockedIncrement(&table->generation);
+    }
+    ts->llHookClient = c;
+
+    JoinElection();
+    return c != NULL;
+}
+
+void LLHook_Detach(TextService *ts)
+{
+    LLHookClient *c = ts->llHookClient;
+
+    if (c) {
+        ts->llHookClient = NULL;
+        InterlockedExchange(&c->threadId, 0);
+        InterlockedIncrement(&GetTable()->generation);
+    }
+    LeaveElection();
+}
+
+/* The slot of threadId, or another slot of its process if that thread
+ * has none (a window on a thread without TSF); NULL when the IME is not
+ * active there */
+static LLHookClient *FindClient(LLHookTable *table, LONG threadId,
+                                LONG processId)
+{
+    LLHookClient *any = NULL;
+    int i;
+
+    for (i = 0; i < LLHOOK_MAX_CLIENTS; i++) {
+        LLHookClient *c = &table->clients[i];
+        LONG tid = c->threadId;
+
+        if (tid == 0 || tid == LLHOOK_CLAIMING || c->processId != processId)
+            continue;
+        if (tid == threadId)
+            return c;
+        if (!any)
+            any = c;
+    }
+    return any;
+}
+
+/* Rescanned only when the foreground or the table changed */
+static LLHookClient *ForegroundClient(LLHookTable *table)
+{
+    LONG thread = s_fgThread;
+    LONG process = s_fgProcess;
+    LONG generation = table->generation;
+
+    if (!s_fgClient.valid || s_fgClient.thread != thread ||
+        s_fgClient.process != process ||
+        s_fgClient.generation != generation) {
+        s_fgClient.client = FindClient(table, thread, process);
+        s_fgClient.thread = thread;
+        s_fgClient.process = process;
+        s_fgClient.generation = generation;
+        s_fgClient.valid = TRUE;
+    }
+    return s_fgClient.client;
+}
+
+void LLHook_SetCaptureWindow(HWND hwnd)
+{
+    LLHookTable *table = GetTable();
+
+    InterlockedExchange(&table->captureProcess, (LONG)GetCurrentProcessId());
+    InterlockedExchange(&table->captureWnd, (LONG)(LONG_PTR)hwnd);
+}
+
+/* ===== Settings ===== */
+
+void LLHook_Publish(TextService *ts)
+{
+    InterlockedExchange(&s_colemakMode, ts->colemakMode ? 1 : 0);
+    InterlockedExchange(&s_winKeyRemap, ts->winKeyRemap ? 1 : 0);
+    InterlockedExchange(&s_hotkeyVk, (LONG)ts->hotkeyVk);
+    InterlockedExchange(&s_hotkeyModifiers, (LONG)ts->hotkeyModifiers);
+}
+
+LLHookClient *LLHook_GetInput(LLDecideInput *in, HWND *capture)
+{
+    LLHookTable *table = GetTable();
+    LLHookClient *client = ForegroundClient(table);
+    LONG captureWnd = table->captureWnd;
+
+    /* The dialog captures while it is in the foreground; a stale
+     * window left by a process that died is ignored the same way */
+    in->capturing = captureWnd && table->captureProcess == s_fgProcess;
+    *capture = in->capturing ? (HWND)(LONG_PTR)captureWnd : NULL;
+    in->imeActive = (client != NULL);
+
+    /* One load while nothing changed */
+    if (sharedprefs_read(&s_prefs, &s_prefsGeneration)
+            == SHAREDPREFS_UNAVAILABLE) {
+        s_prefsGeneration = 0;
+        in->colemakMode = (s_colemakMode != 0);
+        in->winKeyRemap = (s_winKeyRemap != 0);
+        in->hotkeyVk = (UINT)s_hotkeyVk;
+        in->hotkeyModifiers = (UINT)s_hotkeyModifiers;
+        return client;
+    }
+    in->colemakMode = (s_prefs.v[SHAREDPREFS_COLEMAK_MODE] != 0);
+    in->winKeyRemap = (s_prefs.v[SHAREDPREFS_WINKEY_REMAP] != 0);
+    in->hotkeyVk = s_prefs.v[SHAREDPREFS_HOTKEY_VK];
+    in->hotkeyModifiers = s_prefs.v[SHAREDPREFS_HOTKEY_MOD];
+    return client;
+}
+
+UINT LLHook_Message(void)
+{
+    if (!s_message)
+        s_message = RegisterWindowMessageW(L"KolemakLLHook");
+    return s_message;
+}
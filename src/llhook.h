@@ -0,0 +1,81 @@
+/*
+ * llhook.h - Session-wide WH_KEYBOARD_LL hook
+ *
+ * A low-level keyboard hook runs on the thread that installed it, and
+ * every key on the desktop waits for it.  Rather than one hook per
+ * process that loads the IME (each looking at every key only to find
+ * the foreground window is not its own), one process of the session is
+ * elected broker (broker.h) and runs the only hook, on a thread of its
+ * own that does nothing but pump the hook's messages.  Processes join
+ * the election with their first activated TextService and leave it with
+ * the last; when the broker leaves or dies, a waiting process takes
+ * over.
+ *
+ * Each activated TextService registers its thread in a client table in
+ * shared memory (shmsection.h).  The broker follows the foreground
+ * window with a WinEvent hook; the LL hook finds the foreground thread
+ * in the table, reads the settings from sharedprefs, lets lldecide.h
+ * decide, and posts the Colemak toggle to that thread as
+ * LLHook_Message(); the owner applies it from its WH_GETMESSAGE hook.
+ * The hook never waits for any app.
+ *
+ * The election and the table are per integrity level: an elevated app
+ * is served by a broker among the elevated processes, since a medium
+ * one could neither post to it nor inject into it.  A process that
+ * cannot map the table runs a hook of its own for its own clients, and
+ * one that could not start its broker thread tries again on its next
+ * attach; meanwhile keys pass through untouched.
+ *
+ * In the host build there is no broker thread: the pipeline calls the
+ * hook procedure itself and the posted message goes to the shim's queue.
+ */
+
+#ifndef LLHOOK_H
+#define LLHOOK_H
+
+#include "kolemak.h"
+#include "lldecide.h"
+
+#define LLHOOK_MAX_CLIENTS  64
+
+/* wParam of LLHook_Message(): the mode the toggle hotkey switched to.
+ * lParam is nonzero if the hook could not publish it and the receiving
+ * thread has to. */
+typedef enum {
+    LLHOOK_CMD_QWERTY,
+    LLHOOK_CMD_COLEMAK,
+} LLHookCmd;
+
+typedef struct LLHookClient {
+    volatile LONG threadId;        /* 0 = free slot */
+    volatile LONG processId;
+} LLHookClient;
+
+/* Refcounted per process: the first attach joins the broker election,
+ * the last detach leaves it.  Call on the thread that owns ts. */
+BOOL LLHook_Attach(TextService *ts);
+void LLHook_Detach(TextService *ts);
+
+/* Copy ts's settings for the hook to use when the sharedprefs section
+ * is unavailable */
+void LLHook_Publish(TextService *ts);
+
+/* The settings dialog capturing a hotkey, in whichever process it
+ * runs: while it is in the foreground, Win+key combinations go to it
+ * as WM_APP (vk, TF_MOD_*) */
+void LLHook_SetCaptureWindow(HWND hwnd);
+
+/* Hook thread: fill in with the foreground and the session's settings,
+ * from memory only.  Returns the foreground thread's slot, or another
+ * slot of its process if that thread has none (a window on a thread
+ * without TSF); NULL when the IME is not active there.  *capture is
+ * the capture window when in->capturing. */
+LLHookClient *LLHook_GetInput(LLDecideInput *in, HWND *capture);
+
+/* The thread message that carries an LLHookCmd */
+UINT LLHook_Message(void);
+
+/* Whether this process runs the session's hook, for diagnostics */
+BOOL LLHook_IsBroker(void);
+
+#endif /* LLHOOK_H */
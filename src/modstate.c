@@ -0,0 +1,46 @@
+/*
+ * modstate.c - Modifier key state tracked from observed key events
+ */
+
+#include "modstate.h"
+
+/* Scan code of the right Shift key (left is 0x2A) */
+#define SCAN_RSHIFT 0x36
+
+void modstate_reset(ModState *ms, BYTE down)
+{
+    ms->down = down;
+}
+
+BOOL modstate_key(ModState *ms, UINT vk, UINT scanCode, BOOL extended, BOOL up)
+{
+    BYTE bit;
+
+    switch (vk) {
+    case VK_LSHIFT:   bit = MODSTATE_LSHIFT; break;
+    case VK_RSHIFT:   bit = MODSTATE_RSHIFT; break;
+    case VK_LCONTROL: bit = MODSTATE_LCTRL; break;
+    case VK_RCONTROL: bit = MODSTATE_RCTRL; break;
+    case VK_LMENU:    bit = MODSTATE_LALT; break;
+    case VK_RMENU:    bit = MODSTATE_RALT; break;
+    case VK_LWIN:     bit = MODSTATE_LWIN; break;
+    case VK_RWIN:     bit = MODSTATE_RWIN; break;
+    case VK_SHIFT:
+        bit = (scanCode == SCAN_RSHIFT) ? MODSTATE_RSHIFT : MODSTATE_LSHIFT;
+        break;
+    case VK_CONTROL:
+        bit = extended ? MODSTATE_RCTRL : MODSTATE_LCTRL;
+        break;
+    case VK_MENU:
+        bit = extended ? MODSTATE_RALT : MODSTATE_LALT;
+        break;
+    default:
+        return FALSE;
+    }
+
+    if (up)
+        ms->down &= (BYTE)~bit;
+    else
+        ms->down |= bit;
+    return TRUE;
+}
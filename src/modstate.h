@@ -0,0 +1,55 @@
+/*
+ * modstate.h - Modifier key state tracked from observed key events
+ *
+ * Keeps the Shift/Ctrl/Alt/Win state as a bitmask updated from the key
+ * events the IME already receives, so the key path reads one snapshot
+ * per event instead of calling GetKeyState/GetAsyncKeyState for each
+ * modifier.  Left and right keys are tracked separately, so releasing
+ * one Shift while the other is held keeps Shift down.
+ *
+ * A tracker only sees events delivered to it; key-ups that happen while
+ * another window has focus are missed.  Owners resync it from the OS
+ * (modstate_reset) when focus returns.
+ */
+
+#ifndef MODSTATE_H
+#define MODSTATE_H
+
+#include <windows.h>
+
+/* Per-side bits */
+#define MODSTATE_LSHIFT     0x01
+#define MODSTATE_RSHIFT     0x02
+#define MODSTATE_LCTRL      0x04
+#define MODSTATE_RCTRL      0x08
+#define MODSTATE_LALT       0x10
+#define MODSTATE_RALT       0x20
+#define MODSTATE_LWIN       0x40
+#define MODSTATE_RWIN       0x80
+
+/* Either side */
+#define MODSTATE_SHIFT      (MODSTATE_LSHIFT | MODSTATE_RSHIFT)
+#define MODSTATE_CTRL       (MODSTATE_LCTRL | MODSTATE_RCTRL)
+#define MODSTATE_ALT        (MODSTATE_LALT | MODSTATE_RALT)
+#define MODSTATE_WIN        (MODSTATE_LWIN | MODSTATE_RWIN)
+
+typedef struct {
+    BYTE down;      /* MODSTATE_* bits currently held */
+} ModState;
+
+/* Replace the state, e.g. with a snapshot read from the OS */
+void modstate_reset(ModState *ms, BYTE down);
+
+/* Apply one key event.  vk may be sided (VK_LSHIFT, as WH_KEYBOARD_LL
+ * reports) or generic (VK_SHIFT, as key messages report); for generic
+ * keys the side comes from the scan code (Shift) or the extended-key
+ * flag (Ctrl/Alt).  Returns TRUE if vk is a modifier key. */
+BOOL modstate_key(ModState *ms, UINT vk, UINT scanCode, BOOL extended, BOOL up);
+
+/* Apply a WM_KEYDOWN/WM_KEYUP style event (scan code and extended
+ * flag taken from lParam) */
+#define modstate_message(ms, vk, lParam, up) \
+    modstate_key((ms), (vk), (UINT)(((lParam) >> 16) & 0xFF), \
+                 (BOOL)(((lParam) >> 24) & 1), (up))
+
+#endif /* MODSTATE_H */
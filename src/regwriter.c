@@ -0,0 +1,284 @@
+/*
+ * regwriter.c - Background writer for values persisted to the registry
+ *
+ * The queue logic is portable; the worker uses a Win32 thread with an
+ * SRW lock and condition variable on Windows and pthreads elsewhere
+ * (host build).
+ */
+
+#include "regwriter.h"
+
+#include <string.h>
+#ifndef _WIN32
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#define REGWRITER_FOREVER ((DWORD)-1)
+
+static void worker(void);
+
+/* ===== Thread primitives ===== */
+
+#ifdef _WIN32
+
+static SRWLOCK s_lock = SRWLOCK_INIT;
+static SRWLOCK s_lifeLock = SRWLOCK_INIT;   /* serializes start/stop */
+static CONDITION_VARIABLE s_cond = CONDITION_VARIABLE_INIT;
+static HANDLE s_thread;
+
+static void lock(void)        { AcquireSRWLockExclusive(&s_lock); }
+static void unlock(void)      { ReleaseSRWLockExclusive(&s_lock); }
+static void life_lock(void)   { AcquireSRWLockExclusive(&s_lifeLock); }
+static void life_unlock(void) { ReleaseSRWLockExclusive(&s_lifeLock); }
+static void wake_all(void)    { WakeAllConditionVariable(&s_cond); }
+
+static void wait_for(DWORD ms)
+{
+    SleepConditionVariableSRW(&s_cond, &s_lock,
+                              ms == REGWRITER_FOREVER ? INFINITE : ms, 0);
+}
+
+static DWORD WINAPI worker_entry(void *arg)
+{
+    (void)arg;
+    worker();
+    return 0;
+}
+
+static BOOL thread_start(void)
+{
+    s_thread = CreateThread(NULL, 0, worker_entry, NULL, 0, NULL);
+    return s_thread != NULL;
+}
+
+static void thread_join(void)
+{
+    WaitForSingleObject(s_thread, INFINITE);
+    CloseHandle(s_thread);
+    s_thread = NULL;
+}
+
+#else
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t s_lifeLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t s_thread;
+
+static void lock(void)        { pthread_mutex_lock(&s_lock); }
+static void unlock(void)      { pthread_mutex_unlock(&s_lock); }
+static void life_lock(void)   { pthread_mutex_lock(&s_lifeLock); }
+static void life_unlock(void) { pthread_mutex_unlock(&s_lifeLock); }
+static void wake_all(void)    { pthread_cond_broadcast(&s_cond); }
+
+static void wait_for(DWORD ms)
+{
+    struct timespec until;
+
+    if (ms == REGWRITER_FOREVER) {
+        pthread_cond_wait(&s_cond, &s_lock);
+        return;
+    }
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += ms / 1000;
+    until.tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (until.tv_nsec >= 1000000000L) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&s_cond, &s_lock, &until);
+}
+
+static void *worker_entry(void *arg)
+{
+    (void)arg;
+    worker();
+    return NULL;
+}
+
+static BOOL thread_start(void)
+{
+    return pthread_create(&s_thread, NULL, worker_entry, NULL) == 0;
+}
+
+static void thread_join(void)
+{
+    pthread_join(s_thread, NULL);
+}
+
+#endif
+
+/* ===== Queue (guarded by s_lock) ===== */
+
+static RegWriterCmd s_cmds[REGWRITER_MAX_SLOTS];
+static UINT  s_count;
+static BYTE  s_pos[REGWRITER_MAX_SLOTS];   /* index in s_cmds + 1, 0 = none */
+static ULONG s_putSeq;
+static ULONG s_flushWanted;
+static ULONG s_flushDone;
+static BOOL  s_running;
+static BOOL  s_stopping;
+static LONG  s_refs;
+static DWORD s_quietMs;
+static RegWriterStoreFn s_store;
+static RegWriterStats s_stats;
+
+static BOOL flush_pending(void)
+{
+    return s_flushDone != s_flushWanted;
+}
+
+static void worker(void)
+{
+    RegWriterCmd batch[REGWRITER_MAX_SLOTS];
+    UINT count;
+    ULONG target;
+
+    lock();
+    for (;;) {
+        while (!s_count && !s_stopping && !flush_pending())
+            wait_for(REGWRITER_FOREVER);
+
+        /* Quiet period, restarted by every put */
+        while (s_count && !s_stopping && !flush_pending()) {
+            ULONG seen = s_putSeq;
+            wait_for(s_quietMs ? s_quietMs : REGWRITER_FOREVER);
+            if (s_quietMs && s_putSeq == seen)
+                break;
+        }
+
+        target = s_flushWanted;
+        count = s_count;
+        memcpy(batch, s_cmds, count * sizeof(batch[0]));
+        memset(s_pos, 0, sizeof(s_pos));
+        s_count = 0;
+
+        if (count) {
+            RegWriterStoreFn store = s_store;
+            unlock();
+            store(batch, count);
+            lock();
+            s_stats.batches++;
+            s_stats.stored += count;
+        }
+        s_flushDone = target;
+
+        /* Later puts store synchronously until the next start */
+        if (s_stopping && !s_count) {
+            s_running = FALSE;
+            wake_all();
+            break;
+        }
+        wake_all();
+    }
+    unlock();
+}
+
+/* ===== Public API ===== */
+
+BOOL regwriter_start(RegWriterStoreFn store, DWORD quietMs)
+{
+    BOOL running;
+
+    life_lock();
+    lock();
+    s_store = store;
+    s_quietMs = quietMs;
+    if (s_refs++ == 0) {
+        s_stopping = FALSE;
+        s_running = thread_start();
+    }
+    running = s_running;
+    unlock();
+    life_unlock();
+    return running;
+}
+
+void regwriter_stop(void)
+{
+    BOOL join;
+
+    life_lock();
+    lock();
+    if (s_refs == 0) {
+        unlock();
+        life_unlock();
+        return;
+    }
+    if (--s_refs > 0) {
+        unlock();
+        life_unlock();
+        regwriter_flush(TRUE);
+        return;
+    }
+    join = s_running;
+    s_stopping = TRUE;
+    wake_all();
+    unlock();
+
+    if (join)
+        thread_join();
+    life_unlock();
+}
+
+void regwriter_put(UINT slot, DWORD value)
+{
+    RegWriterStoreFn store;
+    RegWriterCmd cmd;
+
+    if (slot >= REGWRITER_MAX_SLOTS)
+        return;
+
+    lock();
+    s_stats.puts++;
+    if (s_running) {
+        if (s_pos[slot]) {
+            s_cmds[s_pos[slot] - 1].value = value;
+            s_stats.coalesced++;
+        } else {
+            s_cmds[s_count].slot = slot;
+            s_cmds[s_count].value = value;
+            s_pos[slot] = (BYTE)++s_count;
+        }
+        s_putSeq++;
+        wake_all();
+        unlock();
+        return;
+    }
+
+    /* No worker: store on this thread */
+    store = s_store;
+    if (store) {
+        s_stats.batches++;
+        s_stats.stored++;
+    }
+    unlock();
+
+    if (store) {
+        cmd.slot = slot;
+        cmd.value = value;
+        store(&cmd, 1);
+    }
+}
+
+void regwriter_flush(BOOL wait)
+{
+    ULONG mine;
+
+    lock();
+    if (s_running) {
+        mine = ++s_flushWanted;
+        wake_all();
+        while (wait && s_running && (LONG)(s_flushDone - mine) < 0)
+            wait_for(REGWRITER_FOREVER);
+    }
+    unlock();
+}
+
+void regwriter_stats(RegWriterStats *stats)
+{
+    lock();
+    *stats = s_stats;
+    unlock();
+}
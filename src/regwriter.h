@@ -0,0 +1,49 @@
+/*
+ * regwriter.h - Background writer for values persisted to the registry
+ *
+ * Key handling changes a few persisted values (Colemak mode, CapsLock
+ * state) many times in a row.  Writers queue the new value and return;
+ * a worker thread stores the queue once no value has been queued for
+ * the quiet period, or when asked to flush.  The queue holds one entry
+ * per slot: queuing a slot that is still pending replaces its value in
+ * place, so only the latest value is stored and slots are stored in the
+ * order they were first queued.
+ *
+ * The store callback runs on the worker thread (the caller's thread if
+ * the worker could not be started).
+ */
+
+#ifndef REGWRITER_H
+#define REGWRITER_H
+
+#include <windows.h>
+
+#define REGWRITER_MAX_SLOTS 16
+
+typedef struct {
+    UINT  slot;
+    DWORD value;
+} RegWriterCmd;
+
+typedef void (*RegWriterStoreFn)(const RegWriterCmd *cmds, UINT count);
+
+/* Refcounted: the first start creates the worker, the last stop stores
+ * what is pending and joins it.  quietMs 0 stores only on flush. */
+BOOL regwriter_start(RegWriterStoreFn store, DWORD quietMs);
+void regwriter_stop(void);
+
+void regwriter_put(UINT slot, DWORD value);
+
+/* Store the queue now; with wait, return once it is stored */
+void regwriter_flush(BOOL wait);
+
+typedef struct {
+    ULONG puts;
+    ULONG coalesced;    /* puts that replaced a pending value */
+    ULONG batches;      /* store callbacks */
+    ULONG stored;       /* values passed to them */
+} RegWriterStats;
+
+void regwriter_stats(RegWriterStats *stats);
+
+#endif /* REGWRITER_H */
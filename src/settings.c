@@ -1,10 +1,32 @@
 /*
  * settings.c - Registry-based settings for Kolemak IME
  *
- * Stores/loads user preferences in HKCU\Software\Kolemak.
+ * Stores/loads user preferences in HKCU\Software\Kolemak.  While the
+ * IME runs, processes exchange the current values through sharedprefs;
+ * registry writes are queued to a background writer (regwriter.h).
+ * The modes remembered per application (appmodes.h) are one binary
+ * value, queued the same way.
  */
 
 #include "settings.h"
+#include "appmodes.h"
+#include "llhook.h"
+#include "regwriter.h"
+#include "sharedprefs.h"
+
+/* Registry value of each sharedprefs slot */
+static const WCHAR *const g_prefNames[SHAREDPREFS_COUNT] = {
+    KOLEMAK_REG_COLEMAK_MODE,
+    KOLEMAK_REG_CAPSLOCK_BS,
+    KOLEMAK_REG_SEMICOLON_SWAP,
+    KOLEMAK_REG_HOTKEY_VK,
+    KOLEMAK_REG_HOTKEY_MOD,
+    KOLEMAK_REG_CAPSLOCK_STATE,
+    KOLEMAK_REG_WINKEY_REMAP,
+};
+
+/* Writer slot of the AppModes snapshot, after the sharedprefs slots */
+#define SETTINGS_SLOT_APPMODES  SHAREDPREFS_COUNT
 
 static BOOL ReadRegDWORD(HKEY hKey, const WCHAR *name, DWORD *pValue)
 {
@@ -21,105 +43,176 @@ static void WriteRegDWORD(HKEY hKey, const WCHAR *name, DWORD value)
                    (const BYTE *)&value, sizeof(DWORD));
 }
 
-BOOL Settings_Load(TextService *ts)
+/* ===== Conversions ===== */
+
+static void PrefsFromTs(const TextService *ts, SharedPrefs *p)
+{
+    p->v[SHAREDPREFS_COLEMAK_MODE]   = ts->colemakMode ? 1 : 0;
+    p->v[SHAREDPREFS_CAPSLOCK_BS]    = ts->capsLockAsBackspace ? 1 : 0;
+    p->v[SHAREDPREFS_SEMICOLON_SWAP] = ts->semicolonSwap ? 1 : 0;
+    p->v[SHAREDPREFS_HOTKEY_VK]      = ts->hotkeyVk;
+    p->v[SHAREDPREFS_HOTKEY_MOD]     = ts->hotkeyModifiers;
+    p->v[SHAREDPREFS_CAPSLOCK_STATE] = ts->capsLockOn ? 1 : 0;
+    p->v[SHAREDPREFS_WINKEY_REMAP]   = ts->winKeyRemap ? 1 : 0;
+}
+
+/* Everything but colemakMode, which Settings_ReloadPrefs applies */
+static void PrefsToTs(TextService *ts, const SharedPrefs *p)
+{
+    ts->capsLockAsBackspace = (p->v[SHAREDPREFS_CAPSLOCK_BS] != 0);
+    ts->semicolonSwap       = (p->v[SHAREDPREFS_SEMICOLON_SWAP] != 0);
+    ts->hotkeyVk            = p->v[SHAREDPREFS_HOTKEY_VK];
+    ts->hotkeyModifiers     = p->v[SHAREDPREFS_HOTKEY_MOD];
+    ts->capsLockOn          = (p->v[SHAREDPREFS_CAPSLOCK_STATE] != 0);
+    ts->winKeyRemap         = (p->v[SHAREDPREFS_WINKEY_REMAP] != 0);
+}
+
+/* Overlay the values present in the registry; FALSE if there is no key */
+static BOOL PrefsFromRegistry(SharedPrefs *p)
 {
     HKEY hKey = NULL;
-    LONG ret;
     DWORD val;
+    UINT i;
 
-    ret = RegOpenKeyExW(HKEY_CURRENT_USER, KOLEMAK_REG_KEY,
-                        0, KEY_READ, &hKey);
-    if (ret != ERROR_SUCCESS)
-        return FALSE; /* No settings yet, use defaults */
+    if (RegOpenKeyExW(HKEY_CURRENT_USER, KOLEMAK_REG_KEY,
+                      0, KEY_READ, &hKey) != ERROR_SUCCESS)
+        return FALSE;
 
-    /* colemakMode는 저장/복원하지 않음: 항상 Colemak으로 시작 */
+    for (i = 0; i < SHAREDPREFS_COUNT; i++) {
+        if (ReadRegDWORD(hKey, g_prefNames[i], &val))
+            p->v[i] = val;
+    }
 
-    if (ReadRegDWORD(hKey, KOLEMAK_REG_CAPSLOCK_BS, &val))
-        ts->capsLockAsBackspace = (val != 0);
+    RegCloseKey(hKey);
+    return TRUE;
+}
 
-    if (ReadRegDWORD(hKey, KOLEMAK_REG_SEMICOLON_SWAP, &val))
-        ts->semicolonSwap = (val != 0);
+/* The table as it is now, however many changes were queued */
+static void StoreAppModes(HKEY hKey)
+{
+    BYTE data[APPMODES_SNAPSHOT_MAX];
+    DWORD size = appmodes_save(data, sizeof(data));
 
-    if (ReadRegDWORD(hKey, KOLEMAK_REG_HOTKEY_VK, &val))
-        ts->hotkeyVk = val;
+    if (size)
+        RegSetValueExW(hKey, KOLEMAK_REG_APPMODES, 0, REG_BINARY, data, size);
+}
 
-    if (ReadRegDWORD(hKey, KOLEMAK_REG_HOTKEY_MOD, &val))
-        ts->hotkeyModifiers = val;
+/* Runs on the writer thread */
+static void StorePrefs(const RegWriterCmd *cmds, UINT count)
+{
+    HKEY hKey = NULL;
+    UINT i;
 
-    if (ReadRegDWORD(hKey, KOLEMAK_REG_CAPSLOCK_STATE, &val))
-        ts->capsLockOn = (val != 0);
+    if (RegCreateKeyExW(HKEY_CURRENT_USER, KOLEMAK_REG_KEY,
+                        0, NULL, 0, KEY_WRITE, NULL, &hKey, NULL) != ERROR_SUCCESS)
+        return;
 
-    if (ReadRegDWORD(hKey, KOLEMAK_REG_WINKEY_REMAP, &val))
-        ts->winKeyRemap = (val != 0);
+    for (i = 0; i < count; i++) {
+        if (cmds[i].slot == SETTINGS_SLOT_APPMODES)
+            StoreAppModes(hKey);
+        else
+            WriteRegDWORD(hKey, g_prefNames[cmds[i].slot], cmds[i].value);
+    }
 
     RegCloseKey(hKey);
+}
+
+/* ===== Writer ===== */
+
+void Settings_StartWriter(DWORD quietMs)
+{
+    regwriter_start(StorePrefs, quietMs);
+}
+
+void Settings_StopWriter(void)
+{
+    regwriter_stop();
+}
+
+void Settings_Flush(void)
+{
+    regwriter_flush(FALSE);
+}
+
+/* ===== Load / save ===== */
+
+BOOL Settings_Load(TextService *ts)
+{
+    SharedPrefs prefs;
+    LONG generation = 0;
+
+    /* colemakMode는 저장/복원하지 않음: 항상 Colemak으로 시작.
+     * ts->prefsGeneration stays 0 so the first Settings_ReloadPrefs
+     * still picks up a mode toggled in another process. */
+    ts->prefsGeneration = 0;
+
+    if (sharedprefs_read(&prefs, &generation) == SHAREDPREFS_CHANGED) {
+        PrefsToTs(ts, &prefs);
+        return TRUE;
+    }
+
+    PrefsFromTs(ts, &prefs);
+    if (!PrefsFromRegistry(&prefs))
+        return FALSE; /* No settings yet, use defaults */
+
+    PrefsToTs(ts, &prefs);
+    sharedprefs_init(&prefs);
     return TRUE;
 }
 
 void Settings_Save(TextService *ts)
 {
-    HKEY hKey = NULL;
-    LONG ret;
+    SharedPrefs prefs;
+    UINT i;
 
-    ret = RegCreateKeyExW(HKEY_CURRENT_USER, KOLEMAK_REG_KEY,
-                          0, NULL, 0, KEY_WRITE, NULL, &hKey, NULL);
-    if (ret != ERROR_SUCCESS)
-        return;
+    PrefsFromTs(ts, &prefs);
+    if (!sharedprefs_publish(&prefs, SHAREDPREFS_ALL))
+        sharedprefs_init(&prefs);
+    LLHook_Publish(ts);
 
     /* colemakMode는 저장하지 않음: 항상 Colemak으로 시작 */
-    WriteRegDWORD(hKey, KOLEMAK_REG_CAPSLOCK_BS, ts->capsLockAsBackspace ? 1 : 0);
-    WriteRegDWORD(hKey, KOLEMAK_REG_SEMICOLON_SWAP, ts->semicolonSwap ? 1 : 0);
-    WriteRegDWORD(hKey, KOLEMAK_REG_HOTKEY_VK, ts->hotkeyVk);
-    WriteRegDWORD(hKey, KOLEMAK_REG_HOTKEY_MOD, ts->hotkeyModifiers);
-    WriteRegDWORD(hKey, KOLEMAK_REG_CAPSLOCK_STATE, ts->capsLockOn ? 1 : 0);
-    WriteRegDWORD(hKey, KOLEMAK_REG_WINKEY_REMAP, ts->winKeyRemap ? 1 : 0);
+    for (i = 0; i < SHAREDPREFS_COUNT; i++) {
+        if (i != SHAREDPREFS_COLEMAK_MODE)
+            regwriter_put(i, prefs.v[i]);
+    }
 
-    RegCloseKey(hKey);
+    /* Saved on request (settings dialog, first run): wait as before */
+    regwriter_flush(TRUE);
 }
 
 void Settings_ReloadPrefs(TextService *ts)
 {
-    HKEY hKey = NULL;
-    LONG ret;
-    DWORD val;
+    SharedPrefs prefs;
     UINT oldHotkeyVk, oldHotkeyMod;
+    BOOL newMode;
 
-    ret = RegOpenKeyExW(HKEY_CURRENT_USER, KOLEMAK_REG_KEY,
-                        0, KEY_READ, &hKey);
-    if (ret != ERROR_SUCCESS)
+    /* Unchanged since the last reload: one load, no registry access */
+    switch (sharedprefs_read(&prefs, &ts->prefsGeneration)) {
+    case SHAREDPREFS_UNCHANGED:
         return;
-
-    if (ReadRegDWORD(hKey, KOLEMAK_REG_CAPSLOCK_BS, &val))
-        ts->capsLockAsBackspace = (val != 0);
-
-    if (ReadRegDWORD(hKey, KOLEMAK_REG_SEMICOLON_SWAP, &val))
-        ts->semicolonSwap = (val != 0);
-
-    if (ReadRegDWORD(hKey, KOLEMAK_REG_CAPSLOCK_STATE, &val))
-        ts->capsLockOn = (val != 0);
-
-    if (ReadRegDWORD(hKey, KOLEMAK_REG_WINKEY_REMAP, &val))
-        ts->winKeyRemap = (val != 0);
-
-    /* Sync colemakMode from registry (cross-process toggle sync) */
-    if (ReadRegDWORD(hKey, KOLEMAK_REG_COLEMAK_MODE, &val)) {
-        BOOL newMode = (val != 0);
-        if (ts->colemakMode != newMode) {
-            ts->colemakMode = newMode;
-            if (ts->langBarButton)
-                LangBarButton_UpdateState(ts->langBarButton);
-        }
+    case SHAREDPREFS_CHANGED:
+        break;
+    default:
+        PrefsFromTs(ts, &prefs);
+        if (!PrefsFromRegistry(&prefs))
+            return;
+        break;
     }
 
-    /* Re-register preserved key if hotkey changed (e.g. by another process) */
     oldHotkeyVk = ts->hotkeyVk;
     oldHotkeyMod = ts->hotkeyModifiers;
+    PrefsToTs(ts, &prefs);
 
-    if (ReadRegDWORD(hKey, KOLEMAK_REG_HOTKEY_VK, &val))
-        ts->hotkeyVk = val;
-    if (ReadRegDWORD(hKey, KOLEMAK_REG_HOTKEY_MOD, &val))
-        ts->hotkeyModifiers = val;
+    /* Sync colemakMode (cross-process toggle sync) */
+    newMode = (prefs.v[SHAREDPREFS_COLEMAK_MODE] != 0);
+    if (ts->colemakMode != newMode) {
+        ts->colemakMode = newMode;
+        if (uibus_post(&ts->uiBus, UIBUS_LANGBAR, 0))
+            TextService_ScheduleUi(ts);
+    }
+    LLHook_Publish(ts);
 
+    /* Re-register preserved key if hotkey changed (e.g. by another process) */
     if (ts->hotkeyVk != oldHotkeyVk || ts->hotkeyModifiers != oldHotkeyMod) {
         ITfKeystrokeMgr *pKeyMgr = NULL;
         if (ts->threadMgr &&
@@ -143,6 +236,137 @@ void Settings_ReloadPrefs(TextService *ts)
             pKeyMgr->lpVtbl->Release(pKeyMgr);
         }
     }
+}
 
-    RegCloseKey(hKey);
+/* ===== Cross-process values ===== */
+
+/* Share a value this process changed and queue it for the registry */
+static void PublishPref(UINT slot, DWORD value)
+{
+    SharedPrefs prefs;
+
+    prefs.v[slot] = value;
+    sharedprefs_publish(&prefs, SHAREDPREFS_BIT(slot));
+    regwriter_put(slot, value);
+}
+
+void Settings_PublishColemakMode(BOOL colemakMode)
+{
+    PublishPref(SHAREDPREFS_COLEMAK_MODE, colemakMode ? 1 : 0);
+}
+
+BOOL Settings_TryPublishColemakMode(BOOL colemakMode)
+{
+    SharedPrefs prefs;
+    DWORD value = colemakMode ? 1 : 0;
+
+    prefs.v[SHAREDPREFS_COLEMAK_MODE] = value;
+    if (!sharedprefs_try_publish(&prefs,
+                                 SHAREDPREFS_BIT(SHAREDPREFS_COLEMAK_MODE)))
+        return FALSE;
+    regwriter_put(SHAREDPREFS_COLEMAK_MODE, value);
+    return TRUE;
+}
+
+void Settings_PublishCapsLockState(TextService *ts)
+{
+    PublishPref(SHAREDPREFS_CAPSLOCK_STATE, ts->capsLockOn ? 1 : 0);
+}
+
+/* ===== Per-application modes ===== */
+
+static DWORD AppKey(TextService *ts)
+{
+    WCHAR path[MAX_PATH];
+    DWORD len;
+
+    if (ts->appKey)
+        return ts->appKey;
+
+    len = GetModuleFileNameW(NULL, path, MAX_PATH);
+    if (len == 0 || len >= MAX_PATH)
+        return 0;
+    path[len] = 0;
+    ts->appKey = appmodes_key(path);
+    return ts->appKey;
+}
+
+/* The first process of the session to need the table fills it from the
+ * registry; the others find it loaded */
+static void LoadAppModes(void)
+{
+    BYTE data[APPMODES_SNAPSHOT_MAX];
+    DWORD type = 0, size = sizeof(data);
+    HKEY hKey = NULL;
+
+    if (appmodes_loaded())
+        return;
+
+    if (RegOpenKeyExW(HKEY_CURRENT_USER, KOLEMAK_REG_KEY,
+                      0, KEY_READ, &hKey) != ERROR_SUCCESS) {
+        size = 0;
+    } else {
+        if (RegQueryValueExW(hKey, KOLEMAK_REG_APPMODES, NULL, &type,
+                             data, &size) != ERROR_SUCCESS ||
+            type != REG_BINARY)
+            size = 0;
+        RegCloseKey(hKey);
+    }
+    appmodes_load(size ? data : NULL, size);
+}
+
+void Settings_RestoreAppModes(TextService *ts)
+{
+    DWORD key = AppKey(ts);
+    BYTE modes;
+    BOOL korean, colemak, changed = FALSE;
+
+    if (!key)
+        return;
+    LoadAppModes();
+    if (!appmodes_get(key, &modes))
+        return; /* New application: keep the modes it starts with */
+
+    /* A syllable still being composed keeps the mode it was typed in */
+    if (ts->hangulCtx.state != HANGUL_STATE_EMPTY)
+        return;
+
+    korean = (modes & APPMODE_KOREAN) != 0;
+    colemak = (modes & APPMODE_COLEMAK) != 0;
+
+    if (ts->koreanMode != korean) {
+        ts->koreanMode = korean;
+        if (uibus_post(&ts->uiBus, UIBUS_KEYBOARD_OPEN, korean))
+            TextService_ScheduleUi(ts);
+        changed = TRUE;
+    }
+
+    /* Colemak mode is session-wide: the LL hook and the other processes
+     * follow, and apply their own memory when they get focus */
+    if (ts->colemakMode != colemak) {
+        ts->colemakMode = colemak;
+        LLHook_Publish(ts);
+        Settings_PublishColemakMode(colemak);
+        changed = TRUE;
+    }
+
+    if (changed && uibus_post(&ts->uiBus, UIBUS_LANGBAR, 0))
+        TextService_ScheduleUi(ts);
+}
+
+void Settings_RememberAppModes(TextService *ts)
+{
+    DWORD key = AppKey(ts);
+    BYTE modes = 0;
+
+    if (!key)
+        return;
+    LoadAppModes();
+
+    if (ts->koreanMode)
+        modes |= APPMODE_KOREAN;
+    if (ts->colemakMode)
+        modes |= APPMODE_COLEMAK;
+    if (appmodes_put(key, modes))
+        regwriter_put(SETTINGS_SLOT_APPMODES, 0);
 }
@@ -16,5 +16,10 @@
 #define KOLEMAK_REG_HOTKEY_MOD       L"HotkeyModifiers"
 #define KOLEMAK_REG_CAPSLOCK_STATE   L"CapsLockState"
 #define KOLEMAK_REG_WINKEY_REMAP    L"WinKeyRemap"
+#define KOLEMAK_REG_APPMODES        L"AppModes"   /* REG_BINARY (appmodes.h) */
+
+/* Queued registry writes are stored once nothing new was queued for
+ * this long (and on focus loss and deactivation) */
+#define KOLEMAK_REG_QUIET_MS        500
 
 #endif /* SETTINGS_H */
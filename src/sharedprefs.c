@@ -0,0 +1,314 @@
+/*
+ * sharedprefs.c - Settings snapshot shared by every process of the session
+ *
+ * The seqlock is portable; the section comes from shmsection.h.
+ */
+
+#include "sharedprefs.h"
+#include "shmsection.h"
+
+/* Reads and writes give up after this many attempts, so a writer that
+ * never finishes sends everyone back to the registry instead of hanging
+ * the key path */
+#define SHAREDPREFS_SPIN_LIMIT  (1 << 20)
+
+/* A store takes nanoseconds: a sequence still odd after this many spins
+ * belongs to a writer that was preempted or died, which is checked */
+#define SHAREDPREFS_STALL_SPINS (1 << 10)
+
+#define SHAREDPREFS_STR_(x) #x
+#define SHAREDPREFS_STR(x)  SHAREDPREFS_STR_(x)
+
+typedef struct {
+    volatile LONG  seq;        /* odd while a writer is storing */
+    volatile LONG  writer;     /* pid holding the write side, 0 = none;
+                                  set before seq turns odd, cleared after
+                                  it is even again */
+    volatile DWORD layout;     /* SHAREDPREFS_LAYOUT once populated */
+    volatile DWORD v[SHAREDPREFS_COUNT];
+} SharedPrefsBlock;
+
+static SharedPrefsBlock *volatile s_block;
+static BOOL s_openFailed;
+static volatile LONG s_readRetries;
+static volatile LONG s_writeSpins;
+static volatile LONG s_recoveries;
+static volatile LONG s_stalledSeq;   /* odd seq a live writer sat on */
+
+/* ===== Section mapping ===== */
+
+#define SHAREDPREFS_TAG  "Prefs.v" SHAREDPREFS_STR(SHAREDPREFS_LAYOUT)
+
+static HANDLE s_mapping;
+
+BOOL sharedprefs_open(void)
+{
+    SharedPrefsBlock *block;
+    HANDLE handle;
+
+    if (s_block)
+        return TRUE;
+    if (s_openFailed)
+        return FALSE;
+
+    /* A new section is zero-filled: layout 0 = not yet populated */
+    block = (SharedPrefsBlock *)shmsection_map(SHAREDPREFS_TAG,
+                                               sizeof(SharedPrefsBlock),
+                                               &handle);
+    if (!block) {
+        s_openFailed = TRUE;
+        return FALSE;
+    }
+
+    /* Two threads may race here; the loser drops its view */
+    if (InterlockedCompareExchangePointer((void *volatile *)&s_block,
+                                          block, NULL) != NULL) {
+        shmsection_unmap(block, sizeof(SharedPrefsBlock), handle);
+        return TRUE;
+    }
+    s_mapping = handle;
+    return TRUE;
+}
+
+void sharedprefs_close(void)
+{
+    if (s_block) {
+        shmsection_unmap((void *)s_block, sizeof(SharedPrefsBlock),
+                         s_mapping);
+        s_block = NULL;
+    }
+    s_openFailed = FALSE;
+}
+
+void sharedprefs_unlink(void)
+{
+    shmsection_unlink(SHAREDPREFS_TAG);
+}
+
+/* ===== Seqlock ===== */
+
+static SharedPrefsBlock *get_block(void)
+{
+    if (!s_block && !sharedprefs_open())
+        return NULL;
+    return s_block;
+}
+
+/* The process holding the write side died: take it over, and end the
+ * store it left unfinished under a new generation.  Each value it wrote
+ * is whole, so every slot holds its old or its new value. */
+static BOOL take_over(SharedPrefsBlock *b, LONG holder, LONG self)
+{
+    LONG s;
+
+    if (holder == 0 || shmsection_process_alive((DWORD)holder) ||
+        InterlockedCompareExchange(&b->writer, self, holder) != holder)
+        return FALSE;
+
+    s = b->seq;
+    if (s & 1) {
+        ULONG next = (ULONG)s + 1;
+        InterlockedExchange(&b->seq, next ? (LONG)next : 2);
+    }
+    InterlockedIncrement(&s_recoveries);
+    return TRUE;
+}
+
+/* Take the write side and make the sequence odd; FALSE if another
+ * writer holds it for limit spins */
+static BOOL write_begin(SharedPrefsBlock *b, LONG *seq, UINT limit)
+{
+    LONG self = (LONG)shmsection_process_id();
+    UINT spins;
+
+    for (spins = 0; spins < limit; spins++) {
+        LONG w = b->writer;
+
+        if (w == 0 && InterlockedCompareExchange(&b->writer, self, 0) == 0)
+            break;
+        if ((spins & (SHAREDPREFS_STALL_SPINS - 1)) ==
+                SHAREDPREFS_STALL_SPINS - 1 && take_over(b, w, self))
+            break;
+        YieldProcessor();
+    }
+    if (spins)
+        InterlockedExchangeAdd(&s_writeSpins, (LONG)spins);
+    if (spins == limit)
+        return FALSE;
+
+    *seq = b->seq;
+    InterlockedExchange(&b->seq, (LONG)((ULONG)*seq + 1));
+    return TRUE;
+}
+
+/* Make the sequence even again: the next generation if values changed,
+ * otherwise the one readers already hold.  Zero stays reserved for
+ * "never read".  Then let the next writer in. */
+static void write_end(SharedPrefsBlock *b, LONG seq, BOOL changed)
+{
+    ULONG next = (ULONG)seq;
+
+    if (changed) {
+        next += 2;
+        if (next == 0)
+            next = 2;
+    }
+    MemoryBarrier();
+    b->seq = (LONG)next;
+    InterlockedExchange(&b->writer, 0);
+}
+
+/* The sequence stayed odd for SHAREDPREFS_STALL_SPINS: TRUE if it was
+ * a dead writer's and has been ended, so reading can go on */
+static BOOL recover_stall(SharedPrefsBlock *b, LONG seq)
+{
+    if (!take_over(b, b->writer, (LONG)shmsection_process_id())) {
+        /* A live writer, preempted: the next read does not wait on the
+         * same store again */
+        s_stalledSeq = seq;
+        return FALSE;
+    }
+    InterlockedExchange(&b->writer, 0);
+    return TRUE;
+}
+
+BOOL sharedprefs_init(const SharedPrefs *in)
+{
+    SharedPrefsBlock *b = get_block();
+    LONG seq;
+    UINT i;
+
+    if (!b)
+        return FALSE;
+    if (b->layout == SHAREDPREFS_LAYOUT)
+        return TRUE;
+    if (!write_begin(b, &seq, SHAREDPREFS_SPIN_LIMIT))
+        return FALSE;
+
+    if (b->layout != SHAREDPREFS_LAYOUT) {
+        for (i = 0; i < SHAREDPREFS_COUNT; i++)
+            b->v[i] = in->v[i];
+        b->layout = SHAREDPREFS_LAYOUT;
+        write_end(b, seq, TRUE);
+    } else {
+        write_end(b, seq, FALSE);
+    }
+    return TRUE;
+}
+
+SharedPrefsStatus sharedprefs_read(SharedPrefs *out, LONG *generation)
+{
+    SharedPrefsBlock *b = get_block();
+    SharedPrefs copy;
+    UINT spins, stall, i;
+
+    if (!b)
+        return SHAREDPREFS_UNAVAILABLE;
+
+    for (spins = 0, stall = 0; spins < SHAREDPREFS_SPIN_LIMIT; spins++) {
+        LONG s1 = b->seq;
+        DWORD layout;
+
+        if (s1 & 1) {
+            if (s1 == s_stalledSeq)
+                return SHAREDPREFS_UNAVAILABLE;
+            if (++stall == SHAREDPREFS_STALL_SPINS) {
+                stall = 0;
+                if (!recover_stall(b, s1))
+                    return SHAREDPREFS_UNAVAILABLE;
+                continue;
+            }
+            YieldProcessor();
+            continue;
+        }
+        if (s1 == *generation)
+            return SHAREDPREFS_UNCHANGED;
+
+        MemoryBarrier();
+        layout = b->layout;
+        for (i = 0; i < SHAREDPREFS_COUNT; i++)
+            copy.v[i] = b->v[i];
+        MemoryBarrier();
+
+        if (b->seq != s1) {
+            InterlockedIncrement(&s_readRetries);
+            continue;
+        }
+        if (layout != SHAREDPREFS_LAYOUT)
+            return SHAREDPREFS_UNAVAILABLE;
+        *out = copy;
+        *generation = s1;
+        return SHAREDPREFS_CHANGED;
+    }
+    return SHAREDPREFS_UNAVAILABLE;
+}
+
+BOOL sharedprefs_get(UINT index, DWORD *value)
+{
+    SharedPrefsBlock *b = get_block();
+
+    if (!b || index >= SHAREDPREFS_COUNT ||
+        b->layout != SHAREDPREFS_LAYOUT)
+        return FALSE;
+    *value = b->v[index];
+    return TRUE;
+}
+
+static BOOL publish(const SharedPrefs *in, DWORD mask, UINT limit)
+{
+    SharedPrefsBlock *b = get_block();
+    BOOL changed = FALSE;
+    LONG seq;
+    UINT i;
+
+    if (!b || b->layout != SHAREDPREFS_LAYOUT)
+        return FALSE;
+    if (!write_begin(b, &seq, limit))
+        return FALSE;
+
+    /* Reset under us: the caller repopulates through the registry */
+    if (b->layout != SHAREDPREFS_LAYOUT) {
+        write_end(b, seq, FALSE);
+        return FALSE;
+    }
+
+    for (i = 0; i < SHAREDPREFS_COUNT; i++) {
+        if (!(mask & SHAREDPREFS_BIT(i)) || b->v[i] == in->v[i])
+            continue;
+        b->v[i] = in->v[i];
+        changed = TRUE;
+    }
+    write_end(b, seq, changed);
+    return TRUE;
+}
+
+BOOL sharedprefs_publish(const SharedPrefs *in, DWORD mask)
+{
+    return publish(in, mask, SHAREDPREFS_SPIN_LIMIT);
+}
+
+BOOL sharedprefs_try_publish(const SharedPrefs *in, DWORD mask)
+{
+    return publish(in, mask, SHAREDPREFS_STALL_SPINS);
+}
+
+void sharedprefs_reset(void)
+{
+    SharedPrefsBlock *b = get_block();
+    LONG seq;
+    UINT i;
+
+    if (!b || !write_begin(b, &seq, SHAREDPREFS_SPIN_LIMIT))
+        return;
+    for (i = 0; i < SHAREDPREFS_COUNT; i++)
+        b->v[i] = 0;
+    b->layout = 0;
+    write_end(b, seq, TRUE);
+}
+
+void sharedprefs_stats(SharedPrefsStats *stats)
+{
+    stats->readRetries = s_readRetries;
+    stats->writeSpins = s_writeSpins;
+    stats->recoveries = s_recoveries;
+}
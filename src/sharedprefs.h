@@ -0,0 +1,101 @@
+/*
+ * sharedprefs.h - Settings snapshot shared by every process of the session
+ *
+ * Each process hosting the IME maps one small named section holding the
+ * current settings, so a change made in one process (Colemak toggle,
+ * CapsLock, the settings dialog) is seen by the others without going
+ * through the registry.  The values are guarded by a seqlock: writers
+ * make the sequence odd, store, then make it even again; readers copy
+ * between two loads of the sequence and retry if it moved.  The even
+ * sequence doubles as the generation, so a reader that already holds
+ * the latest copy pays one load.  The write side records the writer's
+ * pid, so a process that dies in the middle of a store is noticed and
+ * its store ended by whoever next waits on it; a reader waits on a
+ * live writer only briefly, and not again for the same store.
+ *
+ * The registry stays the persistent store; processes write back their
+ * own changes (regwriter.h).
+ *
+ * The section is a file mapping on Windows and POSIX shared memory
+ * elsewhere (host build, shmsection.h).  When it cannot be mapped (e.g. inside an
+ * AppContainer) every call reports it unavailable and callers fall back
+ * to the registry.
+ */
+
+#ifndef SHAREDPREFS_H
+#define SHAREDPREFS_H
+
+#include <windows.h>
+
+/* Value slots */
+enum {
+    SHAREDPREFS_COLEMAK_MODE,
+    SHAREDPREFS_CAPSLOCK_BS,
+    SHAREDPREFS_SEMICOLON_SWAP,
+    SHAREDPREFS_HOTKEY_VK,
+    SHAREDPREFS_HOTKEY_MOD,
+    SHAREDPREFS_CAPSLOCK_STATE,
+    SHAREDPREFS_WINKEY_REMAP,
+    SHAREDPREFS_COUNT
+};
+
+#define SHAREDPREFS_BIT(i)  (1UL << (i))
+#define SHAREDPREFS_ALL     (SHAREDPREFS_BIT(SHAREDPREFS_COUNT) - 1)
+
+/* Bumped whenever the section layout changes; part of the section name
+ * so DLL versions loaded side by side never share a section */
+#define SHAREDPREFS_LAYOUT  2
+
+typedef struct {
+    DWORD v[SHAREDPREFS_COUNT];
+} SharedPrefs;
+
+typedef enum {
+    SHAREDPREFS_UNAVAILABLE,   /* no section, not yet populated, or a
+                                  live writer is taking long */
+    SHAREDPREFS_UNCHANGED,     /* generation matches; nothing copied */
+    SHAREDPREFS_CHANGED,       /* *out and *generation updated */
+} SharedPrefsStatus;
+
+/* Map the section if not done yet.  Safe to call from any thread. */
+BOOL sharedprefs_open(void);
+void sharedprefs_close(void);
+
+/* Remove the section's name, e.g. a private one set up through
+ * KOLEMAK_SHM (shmsection.h) */
+void sharedprefs_unlink(void);
+
+/* Populate an empty section (e.g. from the registry).  Does nothing if
+ * another process got there first. */
+BOOL sharedprefs_init(const SharedPrefs *in);
+
+/* Copy the values if the generation differs from *generation.  Pass a
+ * zero generation to force a copy. */
+SharedPrefsStatus sharedprefs_read(SharedPrefs *out, LONG *generation);
+
+/* One value, without the seqlock (a single DWORD is read whole) */
+BOOL sharedprefs_get(UINT index, DWORD *value);
+
+/* Store the values selected by mask */
+BOOL sharedprefs_publish(const SharedPrefs *in, DWORD mask);
+
+/* The same, but give up as soon as another writer is seen holding the
+ * write side for long (a dead one is still taken over), for callers
+ * that must not wait, like the LL hook */
+BOOL sharedprefs_try_publish(const SharedPrefs *in, DWORD mask);
+
+/* Forget the published values, as if the section were new (host runs) */
+void sharedprefs_reset(void);
+
+/* Contention seen by this process: reads repeated because a writer
+ * was storing, spins waiting for another writer, and stores a writer
+ * that died left unfinished, ended by this process */
+typedef struct {
+    LONG readRetries;
+    LONG writeSpins;
+    LONG recoveries;
+} SharedPrefsStats;
+
+void sharedprefs_stats(SharedPrefsStats *stats);
+
+#endif /* SHAREDPREFS_H */
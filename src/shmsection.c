@@ -0,0 +1,227 @@
+/*
+ * shmsection.c - Named shared memory for state kept per desktop session
+ *
+ * A named file mapping on Windows, POSIX shared memory elsewhere.
+ */
+
+#include "shmsection.h"
+
+#ifdef _WIN32
+#include <sddl.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define SHMSECTION_MAX_NAME 96
+
+#ifdef _WIN32
+
+/* Room for the SDDL below around one user SID */
+#define SHMSECTION_MAX_SDDL 256
+
+static SECURITY_ATTRIBUTES s_security;
+static INIT_ONCE s_securityOnce = INIT_ONCE_STATIC_INIT;
+static const char *volatile s_level;
+
+/* The session user and SYSTEM get full access, and the low-integrity
+ * label lets every level up to it write */
+static BOOL CALLBACK build_security(PINIT_ONCE once, PVOID param,
+                                    PVOID *ctx)
+{
+    HANDLE token;
+    DWORD user[32], size;
+    WCHAR *sid = NULL;
+    WCHAR sddl[SHMSECTION_MAX_SDDL];
+    PSECURITY_DESCRIPTOR sd = NULL;
+    BOOL ok;
+
+    (void)once; (void)param; (void)ctx;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &token))
+        return TRUE;
+    ok = GetTokenInformation(token, TokenUser, user, sizeof(user), &size) &&
+         ConvertSidToStringSidW(((TOKEN_USER *)user)->User.Sid, &sid);
+    CloseHandle(token);
+    if (!ok)
+        return TRUE;
+
+    if (lstrlenW(sid) < SHMSECTION_MAX_SDDL - 64) {
+        wsprintfW(sddl, L"D:P(A;;GA;;;%s)(A;;GA;;;SY)S:(ML;;NW;;;LW)", sid);
+        if (ConvertStringSecurityDescriptorToSecurityDescriptorW(
+                sddl, SDDL_REVISION_1, &sd, NULL)) {
+            s_security.nLength = sizeof(s_security);
+            s_security.lpSecurityDescriptor = sd;
+            s_security.bInheritHandle = FALSE;
+        }
+    }
+    LocalFree(sid);
+    return TRUE;
+}
+
+SECURITY_ATTRIBUTES *shmsection_security(void)
+{
+    InitOnceExecuteOnce(&s_securityOnce, build_security, NULL, NULL);
+    return s_security.lpSecurityDescriptor ? &s_security : NULL;
+}
+
+const char *shmsection_level(void)
+{
+    const char *level = s_level;
+    HANDLE token;
+    DWORD buf[32], size;
+
+    if (level)
+        return level;
+
+    level = "";
+    if (OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &token)) {
+        if (GetTokenInformation(token, TokenIntegrityLevel, buf, sizeof(buf),
+                                &size)) {
+            PSID sid = ((TOKEN_MANDATORY_LABEL *)buf)->Label.Sid;
+            DWORD rid = *GetSidSubAuthority(sid,
+                            *GetSidSubAuthorityCount(sid) - 1);
+
+            if (rid >= SECURITY_MANDATORY_SYSTEM_RID)
+                level = ".System";
+            else if (rid >= SECURITY_MANDATORY_HIGH_RID)
+                level = ".High";
+            else if (rid < SECURITY_MANDATORY_MEDIUM_RID)
+                level = ".Low";
+        }
+        CloseHandle(token);
+    }
+    /* Threads that race here find the same level */
+    s_level = level;
+    return level;
+}
+
+void *shmsection_map(const char *tag, size_t size, HANDLE *handle)
+{
+    WCHAR name[SHMSECTION_MAX_NAME];
+    const WCHAR prefix[] = L"Local\\Kolemak";
+    size_t n = 0, i;
+    HANDLE h;
+    void *view;
+
+    for (i = 0; prefix[i]; i++)
+        name[n++] = prefix[i];
+    for (i = 0; tag[i] && n < SHMSECTION_MAX_NAME - 1; i++)
+        name[n++] = (WCHAR)(BYTE)tag[i];
+    name[n] = 0;
+
+    h = CreateFileMappingW(INVALID_HANDLE_VALUE, shmsection_security(),
+                           PAGE_READWRITE, 0, (DWORD)size, name);
+    if (!h)
+        return NULL;
+    view = MapViewOfFile(h, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (!view) {
+        CloseHandle(h);
+        return NULL;
+    }
+    *handle = h;
+    return view;
+}
+
+void shmsection_unmap(void *view, size_t size, HANDLE handle)
+{
+    (void)size;
+    UnmapViewOfFile(view);
+    CloseHandle(handle);
+}
+
+void shmsection_unlink(const char *tag)
+{
+    (void)tag;
+}
+
+DWORD shmsection_process_id(void)
+{
+    return GetCurrentProcessId();
+}
+
+BOOL shmsection_process_alive(DWORD pid)
+{
+    HANDLE h = OpenProcess(SYNCHRONIZE, FALSE, pid);
+    BOOL alive;
+
+    if (!h)
+        return GetLastError() == ERROR_ACCESS_DENIED;
+    alive = (WaitForSingleObject(h, 0) == WAIT_TIMEOUT);
+    CloseHandle(h);
+    return alive;
+}
+
+#else
+
+static void section_name(const char *tag, char *name, size_t size)
+{
+    const char *env = getenv("KOLEMAK_SHM");
+
+    if (env && *env)
+        snprintf(name, size, "%s.%s", env, tag);
+    else
+        snprintf(name, size, "/kolemak-%s-%u", tag, (unsigned)getuid());
+}
+
+void *shmsection_map(const char *tag, size_t size, HANDLE *handle)
+{
+    char name[SHMSECTION_MAX_NAME];
+    void *view;
+    int fd;
+
+    section_name(tag, name, sizeof(name));
+    fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+    if (fd < 0)
+        return NULL;
+    if (ftruncate(fd, (off_t)size) != 0) {
+        close(fd);
+        return NULL;
+    }
+    view = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED)
+        return NULL;
+    *handle = NULL;    /* no fd is kept open */
+    return view;
+}
+
+void shmsection_unmap(void *view, size_t size, HANDLE handle)
+{
+    (void)handle;
+    munmap(view, size);
+}
+
+void shmsection_unlink(const char *tag)
+{
+    char name[SHMSECTION_MAX_NAME];
+
+    section_name(tag, name, sizeof(name));
+    shm_unlink(name);
+}
+
+SECURITY_ATTRIBUTES *shmsection_security(void)
+{
+    return NULL;
+}
+
+const char *shmsection_level(void)
+{
+    return "";
+}
+
+DWORD shmsection_process_id(void)
+{
+    return (DWORD)getpid();
+}
+
+BOOL shmsection_process_alive(DWORD pid)
+{
+    return kill((pid_t)pid, 0) == 0 || errno == EPERM;
+}
+
+#endif
@@ -0,0 +1,47 @@
+/*
+ * shmsection.h - Named shared memory for state kept per desktop session
+ *
+ * A section is named after a short ASCII tag: "Local\Kolemak<tag>" on
+ * Windows and POSIX shared memory "/kolemak-<tag>-<uid>" elsewhere
+ * (host build).  When KOLEMAK_SHM is set the POSIX name is
+ * "<KOLEMAK_SHM>.<tag>" instead, so host runs and benchmarks can use
+ * sections of their own.  A new section is zero-filled.
+ *
+ * Processes of one session run at different integrity levels (an
+ * elevated app, a low-integrity sandbox).  Sections and the broker's
+ * mutexes are created with shmsection_security(), which grants the
+ * session user at every level, so whichever process comes first does
+ * not lock the others out.
+ */
+
+#ifndef SHMSECTION_H
+#define SHMSECTION_H
+
+#include <windows.h>
+#include <stddef.h>
+
+/* Map the section, creating it if needed; NULL if that fails (e.g.
+ * inside an AppContainer).  *handle is passed back to unmap. */
+void *shmsection_map(const char *tag, size_t size, HANDLE *handle);
+void  shmsection_unmap(void *view, size_t size, HANDLE handle);
+
+/* Remove the name so the next map starts from zero (POSIX; on Windows
+ * a section disappears with its last handle) */
+void  shmsection_unlink(const char *tag);
+
+/* Security for named objects of the session: the user's DACL with a
+ * low-integrity label; NULL (the default) where there is none */
+SECURITY_ATTRIBUTES *shmsection_security(void);
+
+/* The calling process's integrity level as a tag suffix: "" for
+ * medium (and the host build), ".High", ".Low" or ".System".  State
+ * that is only valid within one level, like the windows a broker can
+ * post to, is named with it. */
+const char *shmsection_level(void);
+
+/* The calling process, and whether process pid still runs: state left
+ * in a section by a process that died can then be taken over */
+DWORD shmsection_process_id(void);
+BOOL  shmsection_process_alive(DWORD pid);
+
+#endif /* SHMSECTION_H */
@@ -7,6 +7,10 @@
 
 #include "kolemak.h"
 #include "settings.h"
+#include "llhook.h"
+#ifdef KOLEMAK_KEY_TRACE
+#include "keytrace.h"
+#endif
 
 /* Forward declarations for vtables defined in key_handler.c */
 extern const ITfKeyEventSinkVtbl g_keyEventSinkVtbl;
@@ -57,6 +61,7 @@ static ULONG STDMETHODCALLTYPE TS_Release(ITfTextInputProcessorEx *pThis)
     TextService *ts = TS_FROM_TIP(pThis);
     LONG c = InterlockedDecrement(&ts->refCount);
     if (c == 0) {
+        ContextCache_Invalidate(ts);
         if (ts->composition) {
             ts->composition->lpVtbl->Release(ts->composition);
             ts->composition = NULL;
@@ -65,7 +70,7 @@ static ULONG STDMETHODCALLTYPE TS_Release(ITfTextInputProcessorEx *pThis)
             ts->threadMgr->lpVtbl->Release(ts->threadMgr);
             ts->threadMgr = NULL;
         }
-        HeapFree(GetProcessHeap(), 0, ts);
+        arena_free(ts);
         TextService_ReleaseDll();
     }
     return c;
@@ -218,25 +223,191 @@ static HRESULT STDMETHODCALLTYPE TS_Activate(
     return E_NOTIMPL; /* Use ActivateEx instead */
 }
 
-static HRESULT STDMETHODCALLTYPE TS_Deactivate(
-    ITfTextInputProcessorEx *pThis)
+/* ===== Deferred subsystems =====
+ *
+ * Activation only hooks the thread manager and the key event sink; the
+ * rest waits until the thread first has focus (TextService_Ready), so
+ * threads that never take input do not load settings, register
+ * hotkeys, install hooks or create windows.  The tooltip window class
+ * is registered by the first tooltip shown. */
+
+enum {
+    TS_STAGE_SETTINGS,
+    TS_STAGE_HOTKEYS,
+    TS_STAGE_HOOKS,
+    TS_STAGE_LANGBAR,
+    TS_STAGE_TRAY,
+    TS_STAGE_COUNT
+};
+
+static BOOL Stage_InitSettings(void *ctx)
 {
-    TextService *ts = TS_FROM_TIP(pThis);
+    TextService *ts = (TextService *)ctx;
 
-    if (ts->llKeyboardHook) {
-        UnhookWindowsHookEx(ts->llKeyboardHook);
-        ts->llKeyboardHook = NULL;
-    }
+    /* Load saved settings from registry; create defaults if key doesn't exist */
+    Settings_StartWriter(KOLEMAK_REG_QUIET_MS);
+    if (!Settings_Load(ts))
+        Settings_Save(ts);
+
+    /* Set initial keyboard open/close state for system tray indicator */
+    TextService_SetKeyboardOpen(ts, ts->koreanMode);
+    return TRUE;
+}
+
+static void Stage_UninitSettings(void *ctx)
+{
+    (void)ctx;
+    Settings_StopWriter();    /* Stores queued settings */
+}
+
+static BOOL Stage_InitHotkeys(void *ctx)
+{
+    return SUCCEEDED(TS_RegisterPreservedKey((TextService *)ctx));
+}
+
+static void Stage_UninitHotkeys(void *ctx)
+{
+    TS_UnregisterPreservedKey((TextService *)ctx);
+}
+
+static BOOL Stage_InitHooks(void *ctx)
+{
+    TextService *ts = (TextService *)ctx;
+
+    if (g_tlsIndex == TLS_OUT_OF_INDEXES)
+        return FALSE;
+
+    /* Install per-thread message hook for Colemak modifier+key remapping.
+     * This remaps VK codes in WM_KEYDOWN before TSF processes them,
+     * ensuring correct behavior regardless of keyboard open/close state. */
+    TlsSetValue(g_tlsIndex, ts);
+    ts->msgHook = SetWindowsHookExW(WH_GETMESSAGE, KolemakGetMsgProc,
+                                     NULL, GetCurrentThreadId());
+
+    /* Join the process's low-level keyboard hook for Win+key Colemak
+     * remapping.  Shell hotkeys (Win+E, Win+R, etc.) are processed
+     * before messages reach the app queue, so WH_GETMESSAGE can't
+     * intercept them.  WH_KEYBOARD_LL runs before the shell sees the
+     * keys; it runs on a thread of its own (llhook.h) so a busy UI
+     * thread here never delays keys elsewhere. */
+    LLHook_Attach(ts);
+    return TRUE;
+}
+
+static void Stage_UninitHooks(void *ctx)
+{
+    TextService *ts = (TextService *)ctx;
+
+    LLHook_Detach(ts);
     if (ts->msgHook) {
         UnhookWindowsHookEx(ts->msgHook);
         ts->msgHook = NULL;
     }
-    if (g_tlsIndex != TLS_OUT_OF_INDEXES)
-        TlsSetValue(g_tlsIndex, NULL);
 
-    LangBar_Unregister(ts);
-    KolemakTray_Unregister(ts);
-    TS_UnregisterPreservedKey(ts);
+    /* The UI timer finds ts through the TLS slot */
+    if (ts->uiTimer) {
+        KillTimer(NULL, ts->uiTimer);
+        ts->uiTimer = 0;
+    }
+    uibus_clear(&ts->uiBus);
+    TlsSetValue(g_tlsIndex, NULL);
+}
+
+static BOOL Stage_InitLangBar(void *ctx)
+{
+    return SUCCEEDED(LangBar_Register((TextService *)ctx));
+}
+
+static void Stage_UninitLangBar(void *ctx)
+{
+    LangBar_Unregister((TextService *)ctx);
+}
+
+static BOOL Stage_InitTray(void *ctx)
+{
+    return SUCCEEDED(KolemakTray_Register((TextService *)ctx));
+}
+
+static void Stage_UninitTray(void *ctx)
+{
+    KolemakTray_Unregister((TextService *)ctx);
+}
+
+/* In dependency order: hotkeys and hooks act on the loaded settings */
+static const InitStage g_stages[TS_STAGE_COUNT] = {
+    { "settings", Stage_InitSettings, Stage_UninitSettings },
+    { "hotkeys",  Stage_InitHotkeys,  Stage_UninitHotkeys  },
+    { "hooks",    Stage_InitHooks,    Stage_UninitHooks    },
+    { "langbar",  Stage_InitLangBar,  Stage_UninitLangBar  },
+    { "tray",     Stage_InitTray,     Stage_UninitTray     },
+};
+
+void TextService_Ready(TextService *ts)
+{
+    if (ts->threadMgr &&
+        initstage_pending(&ts->stages, INITSTAGE_ALL(&ts->stages)))
+        initstage_run(&ts->stages, INITSTAGE_ALL(&ts->stages), ts);
+}
+
+/* ===== UI updates ===== */
+
+/* Long enough for a burst of toggles to land in one update, short
+ * enough to read as immediate; WM_TIMER also waits for queued input */
+#define TS_UI_DELAY_MS 16
+
+static VOID CALLBACK TS_UiTimerProc(HWND hwnd, UINT msg, UINT_PTR id,
+                                    DWORD time)
+{
+    TextService *ts = (TextService *)TlsGetValue(g_tlsIndex);
+
+    (void)hwnd; (void)msg; (void)time;
+
+    KillTimer(NULL, id);
+    if (ts && ts->uiTimer == id) {
+        ts->uiTimer = 0;
+        KeyHandler_ApplyUi(ts);
+    }
+}
+
+void TextService_ScheduleUi(TextService *ts)
+{
+    if (!ts->uiTimer && g_tlsIndex != TLS_OUT_OF_INDEXES &&
+        TlsGetValue(g_tlsIndex) == ts)
+        ts->uiTimer = SetTimer(NULL, 0, TS_UI_DELAY_MS, TS_UiTimerProc);
+
+    /* Hooks stage not up, or no timer available */
+    if (!ts->uiTimer)
+        KeyHandler_ApplyUi(ts);
+}
+
+/* Whether a document of this thread has focus right now */
+static BOOL TS_HasFocus(TextService *ts)
+{
+    ITfDocumentMgr *docMgr = NULL;
+
+    if (FAILED(ts->threadMgr->lpVtbl->GetFocus(ts->threadMgr, &docMgr)) ||
+        !docMgr)
+        return FALSE;
+    docMgr->lpVtbl->Release(docMgr);
+    return TRUE;
+}
+
+static HRESULT STDMETHODCALLTYPE TS_Deactivate(
+    ITfTextInputProcessorEx *pThis)
+{
+    TextService *ts = TS_FROM_TIP(pThis);
+
+#ifdef KOLEMAK_KEY_TRACE
+    if (ts->threadMgr) {
+        char line[256];
+        initstage_format(&ts->stages, line, sizeof(line));
+        OutputDebugStringA("Kolemak: ");
+        OutputDebugStringA(line);
+        OutputDebugStringA("\n");
+    }
+#endif
+
+    initstage_undo(&ts->stages, ts);
     TS_UnadviseKeyEventSink(ts);
     TS_UnadviseThreadMgrSink(ts);
 
@@ -247,6 +418,11 @@ static HRESULT STDMETHODCALLTYPE TS_Deactivate(
 
     hangul_ic_reset(&ts->hangulCtx);
     ts->koreanMode = FALSE;
+    ContextCache_Invalidate(ts);
+
+#ifdef KOLEMAK_KEY_TRACE
+    keytrace_flush();
+#endif
 
     return S_OK;
 }
@@ -256,6 +432,7 @@ static HRESULT STDMETHODCALLTYPE TS_ActivateEx(
     TfClientId tid, DWORD dwFlags)
 {
     TextService *ts = TS_FROM_TIP(pThis);
+    unsigned long long t0 = initstage_now_ns();
     HRESULT hr;
 
     (void)dwFlags;
@@ -276,10 +453,8 @@ static HRESULT STDMETHODCALLTYPE TS_ActivateEx(
     ts->composition = NULL;
     ts->langBarButton = NULL;
     ts->threadMgrSinkCookie = TF_INVALID_COOKIE;
-
-    /* Load saved settings from registry; create defaults if key doesn't exist */
-    if (!Settings_Load(ts))
-        Settings_Save(ts);
+    initstage_setup(&ts->stages, g_stages, TS_STAGE_COUNT);
+    KeyHandler_SyncModifiers(ts);
 
     hr = TS_AdviseThreadMgrSink(ts);
     if (FAILED(hr)) goto fail;
@@ -287,33 +462,11 @@ static HRESULT STDMETHODCALLTYPE TS_ActivateEx(
     hr = TS_AdviseKeyEventSink(ts);
     if (FAILED(hr)) goto fail;
 
-    hr = TS_RegisterPreservedKey(ts);
-    if (FAILED(hr)) goto fail;
-
-    /* Initialize tooltip, tray icon, and language bar button (non-fatal) */
-    KolemakTooltip_Init(g_hInst);
-    KolemakTray_Register(ts);
-    LangBar_Register(ts);
+    ts->stages.activateNs = initstage_now_ns() - t0;
 
-    /* Set initial keyboard open/close state for system tray indicator */
-    TextService_SetKeyboardOpen(ts, ts->koreanMode);
-
-    /* Install per-thread message hook for Colemak modifier+key remapping.
-     * This remaps VK codes in WM_KEYDOWN before TSF processes them,
-     * ensuring correct behavior regardless of keyboard open/close state. */
-    if (g_tlsIndex != TLS_OUT_OF_INDEXES) {
-        TlsSetValue(g_tlsIndex, ts);
-        ts->msgHook = SetWindowsHookExW(WH_GETMESSAGE, KolemakGetMsgProc,
-                                         NULL, GetCurrentThreadId());
-
-        /* Install low-level keyboard hook for Win+key Colemak remapping.
-         * Shell hotkeys (Win+E, Win+R, etc.) are processed before messages
-         * reach the app queue, so WH_GETMESSAGE can't intercept them.
-         * WH_KEYBOARD_LL runs before the shell sees the keys. */
-        ts->llKeyboardHook = SetWindowsHookExW(
-            WH_KEYBOARD_LL, KolemakLowLevelKeyboardProc,
-            g_hInst, 0);
-    }
+    /* Activated for a thread that is already being typed into */
+    if (TS_HasFocus(ts))
+        TextService_Ready(ts);
 
     return S_OK;
 
@@ -374,9 +527,20 @@ static HRESULT STDMETHODCALLTYPE TMES_OnSetFocus(
     ITfDocumentMgr *pdimFocus, ITfDocumentMgr *pdimPrevFocus)
 {
     TextService *ts = TS_FROM_THREAD_MGR_SINK(pThis);
-    (void)pdimFocus; (void)pdimPrevFocus;
+    (void)pdimPrevFocus;
+    ContextCache_Invalidate(ts);
+
+    /* Nothing to refresh until the thread has been used */
+    if (pdimFocus)
+        TextService_Ready(ts);
+    if (!(ts->stages.done & (1u << TS_STAGE_SETTINGS)))
+        return S_OK;
+
     Settings_ReloadPrefs(ts);
-    KolemakTray_EnsureIcon(ts);
+    if (pdimFocus)
+        Settings_RestoreAppModes(ts);
+    if (ts->stages.done & (1u << TS_STAGE_TRAY))
+        KolemakTray_EnsureIcon(ts);
     return S_OK;
 }
 
@@ -390,7 +554,10 @@ static HRESULT STDMETHODCALLTYPE TMES_OnPushContext(
 static HRESULT STDMETHODCALLTYPE TMES_OnPopContext(
     ITfThreadMgrEventSink *pThis, ITfContext *pic)
 {
-    (void)pThis; (void)pic;
+    TextService *ts = TS_FROM_THREAD_MGR_SINK(pThis);
+
+    if (ts->ctxCache.context == pic)
+        ContextCache_Invalidate(ts);
     return S_OK;
 }
 
@@ -456,6 +623,7 @@ static HRESULT STDMETHODCALLTYPE CS_OnCompositionTerminated(
         ts->composition->lpVtbl->Release(ts->composition);
         ts->composition = NULL;
     }
+    ContextCache_DropCompositionRange(ts);
     hangul_ic_reset(&ts->hangulCtx);
 
     return S_OK;
@@ -508,8 +676,7 @@ HRESULT TextService_Create(IClassFactory *pFactory, IUnknown *pOuter,
     if (pOuter != NULL)
         return CLASS_E_NOAGGREGATION;
 
-    ts = (TextService *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY,
-                                   sizeof(TextService));
+    ts = (TextService *)arena_alloc(ARENA_TEXT_SERVICE, sizeof(TextService));
     if (!ts) return E_OUTOFMEMORY;
 
     ts->lpVtbl = &g_tipVtbl;
@@ -0,0 +1,60 @@
+/*
+ * tiplabel.c - Layout and pixels of the mode switch tooltip
+ */
+
+#include "tiplabel.h"
+
+static const WCHAR *const g_texts[TIPLABEL_COUNT] = {
+    L"Colemak",
+    L"QWERTY",
+};
+
+/* At 96 DPI: 13 px Segoe UI, 10 px padding left and right, 5 px above
+ * and below, 20 px from the top-left corner of the screen */
+#define TIPLABEL_FONT_PX   13
+#define TIPLABEL_PAD_X     10
+#define TIPLABEL_PAD_Y     5
+#define TIPLABEL_MARGIN    20
+
+static int Scale(int px, UINT dpi)
+{
+    return (int)(((long)px * (long)dpi + 48) / 96);
+}
+
+const WCHAR *tiplabel_text(UINT label)
+{
+    return label < TIPLABEL_COUNT ? g_texts[label] : L"";
+}
+
+int tiplabel_font_height(UINT dpi)
+{
+    return -Scale(TIPLABEL_FONT_PX, dpi);
+}
+
+void tiplabel_layout(int textCx, int textCy, UINT dpi, TipLabelLayout *out)
+{
+    int padX = Scale(TIPLABEL_PAD_X, dpi);
+    int padY = Scale(TIPLABEL_PAD_Y, dpi);
+
+    out->x = Scale(TIPLABEL_MARGIN, dpi);
+    out->y = out->x;
+    out->width = textCx + 2 * padX;
+    out->height = textCy + 2 * padY;
+    out->textX = padX;
+    out->textY = padY;
+}
+
+void tiplabel_compose(DWORD *pixels, size_t count)
+{
+    size_t i;
+
+    /* Blend background to foreground by coverage, then premultiply by
+     * the popup's opacity */
+    for (i = 0; i < count; i++) {
+        DWORD c = pixels[i] & 0xFF;
+        DWORD v = (TIPLABEL_BACKGROUND * (255 - c) +
+                   TIPLABEL_FOREGROUND * c + 127) / 255;
+        DWORD p = (v * TIPLABEL_OPACITY + 127) / 255;
+        pixels[i] = ((DWORD)TIPLABEL_OPACITY << 24) | (p << 16) | (p << 8) | p;
+    }
+}
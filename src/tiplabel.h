@@ -0,0 +1,47 @@
+/*
+ * tiplabel.h - Layout and pixels of the mode switch tooltip
+ *
+ * The tooltip shows one of a few fixed labels.  tooltip.c renders each
+ * of them once per DPI: GDI draws the text white on black into a 32-bit
+ * DIB (grayscale antialiasing, so any channel is the glyph coverage),
+ * tiplabel_compose turns that into the tooltip's premultiplied BGRA
+ * pixels, and every later show only hands the bitmap to
+ * UpdateLayeredWindow.  Free of system calls so the host build can
+ * check and time it against a software stand-in (kolemak-bench).
+ */
+
+#ifndef TIPLABEL_H
+#define TIPLABEL_H
+
+#include <stddef.h>
+#include <windows.h>
+
+enum {
+    TIPLABEL_COLEMAK,
+    TIPLABEL_QWERTY,
+    TIPLABEL_COUNT
+};
+
+/* Colors and opacity of the popup */
+#define TIPLABEL_BACKGROUND 50     /* gray level */
+#define TIPLABEL_FOREGROUND 255
+#define TIPLABEL_OPACITY    220
+
+typedef struct {
+    int x, y;              /* Window position on the screen */
+    int width, height;     /* Window and bitmap size */
+    int textX, textY;      /* Text origin in the bitmap */
+} TipLabelLayout;
+
+const WCHAR *tiplabel_text(UINT label);
+
+/* Font height for CreateFontW (negative = character height) */
+int tiplabel_font_height(UINT dpi);
+
+/* Place text measuring textCx x textCy pixels, padded and centered */
+void tiplabel_layout(int textCx, int textCy, UINT dpi, TipLabelLayout *out);
+
+/* Coverage (low byte of each pixel) -> premultiplied BGRA, in place */
+void tiplabel_compose(DWORD *pixels, size_t count);
+
+#endif /* TIPLABEL_H */
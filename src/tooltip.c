@@ -3,6 +3,10 @@
  *
  * Shows a small popup at the top-left of the screen for 2 seconds
  * when the user toggles between Colemak/QWERTY or Korean/English.
+ *
+ * The labels are rendered once per DPI into premultiplied bitmaps
+ * (tiplabel.h); showing one is a single UpdateLayeredWindow, with no
+ * font or text measuring on the toggle path.
  */
 
 #define WIN32_LEAN_AND_MEAN
@@ -13,45 +17,136 @@
 #define TOOLTIP_DURATION   2000  /* milliseconds */
 #define TOOLTIP_CLASS_NAME L"KolemakTooltip"
 
+#ifndef WM_DPICHANGED
+#define WM_DPICHANGED 0x02E0
+#endif
+
+typedef struct {
+    HBITMAP        bitmap;
+    TipLabelLayout layout;
+} TooltipLabel;
+
+static HINSTANCE g_tooltipInst = NULL;
 static HWND  g_tooltipWnd = NULL;
 static BOOL  g_classRegistered = FALSE;
-static WCHAR g_tooltipText[64] = {0};
+
+/* Rendered labels; the one shown last is selected into g_labelDC */
+static TooltipLabel g_labels[TIPLABEL_COUNT];
+static HDC     g_labelDC = NULL;
+static HBITMAP g_labelDCBitmap = NULL;   /* the DC's own bitmap */
+static UINT    g_labelDpi = 0;           /* 0 = not rendered */
+
+/* ===== Label bitmaps ===== */
+
+static void FreeLabels(void)
+{
+    UINT i;
+
+    if (g_labelDC) {
+        SelectObject(g_labelDC, g_labelDCBitmap);
+        DeleteDC(g_labelDC);
+        g_labelDC = NULL;
+    }
+    for (i = 0; i < TIPLABEL_COUNT; i++) {
+        if (g_labels[i].bitmap) {
+            DeleteObject(g_labels[i].bitmap);
+            g_labels[i].bitmap = NULL;
+        }
+    }
+    g_labelDpi = 0;
+}
+
+/* Draw the label white on black into a DIB, then compose it */
+static BOOL RenderLabel(UINT label, UINT dpi)
+{
+    TooltipLabel *l = &g_labels[label];
+    const WCHAR *text = tiplabel_text(label);
+    int len = lstrlenW(text);
+    BITMAPINFO bmi;
+    SIZE textSize;
+    void *bits = NULL;
+    RECT rc;
+
+    if (!GetTextExtentPoint32W(g_labelDC, text, len, &textSize))
+        return FALSE;
+    tiplabel_layout(textSize.cx, textSize.cy, dpi, &l->layout);
+
+    ZeroMemory(&bmi, sizeof(bmi));
+    bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+    bmi.bmiHeader.biWidth = l->layout.width;
+    bmi.bmiHeader.biHeight = -l->layout.height;   /* top-down */
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+    l->bitmap = CreateDIBSection(g_labelDC, &bmi, DIB_RGB_COLORS,
+                                 &bits, NULL, 0);
+    if (!l->bitmap)
+        return FALSE;
+
+    SelectObject(g_labelDC, l->bitmap);
+    SetRect(&rc, 0, 0, l->layout.width, l->layout.height);
+    ExtTextOutW(g_labelDC, l->layout.textX, l->layout.textY, ETO_OPAQUE,
+                &rc, text, (UINT)len, NULL);
+    GdiFlush();
+
+    tiplabel_compose((DWORD *)bits,
+                     (size_t)l->layout.width * (size_t)l->layout.height);
+    return TRUE;
+}
+
+/* Render every label for the screen's DPI */
+static BOOL RenderLabels(void)
+{
+    HDC screen;
+    HFONT hFont, hOldFont;
+    UINT dpi, i;
+    BOOL ok = TRUE;
+
+    screen = GetDC(NULL);
+    if (!screen)
+        return FALSE;
+    dpi = (UINT)GetDeviceCaps(screen, LOGPIXELSY);
+    g_labelDC = CreateCompatibleDC(screen);
+    ReleaseDC(NULL, screen);
+    if (!g_labelDC)
+        return FALSE;
+    g_labelDCBitmap = (HBITMAP)GetCurrentObject(g_labelDC, OBJ_BITMAP);
+
+    /* Grayscale antialiasing: ClearType coverage differs per channel */
+    hFont = CreateFontW(tiplabel_font_height(dpi), 0, 0, 0, FW_SEMIBOLD,
+                        FALSE, FALSE, FALSE,
+                        DEFAULT_CHARSET, OUT_DEFAULT_PRECIS,
+                        CLIP_DEFAULT_PRECIS, ANTIALIASED_QUALITY,
+                        DEFAULT_PITCH | FF_SWISS, L"Segoe UI");
+    if (!hFont) {
+        FreeLabels();
+        return FALSE;
+    }
+    hOldFont = (HFONT)SelectObject(g_labelDC, hFont);
+    SetTextColor(g_labelDC, RGB(255, 255, 255));
+    SetBkColor(g_labelDC, RGB(0, 0, 0));
+
+    for (i = 0; i < TIPLABEL_COUNT && ok; i++)
+        ok = RenderLabel(i, dpi);
+
+    SelectObject(g_labelDC, hOldFont);
+    DeleteObject(hFont);
+
+    if (!ok) {
+        FreeLabels();
+        return FALSE;
+    }
+    g_labelDpi = dpi;
+    return TRUE;
+}
+
+/* ===== Window ===== */
 
 static LRESULT CALLBACK TooltipWndProc(HWND hwnd, UINT msg,
                                         WPARAM wParam, LPARAM lParam)
 {
     switch (msg) {
 
-    case WM_PAINT:
-    {
-        PAINTSTRUCT ps;
-        HDC hdc = BeginPaint(hwnd, &ps);
-        RECT rc;
-        HFONT hFont, hOldFont;
-
-        GetClientRect(hwnd, &rc);
-
-        /* Dark background */
-        SetBkColor(hdc, RGB(50, 50, 50));
-        ExtTextOutW(hdc, 0, 0, ETO_OPAQUE, &rc, NULL, 0, NULL);
-
-        /* White text */
-        SetTextColor(hdc, RGB(255, 255, 255));
-        hFont = CreateFontW(-13, 0, 0, 0, FW_SEMIBOLD, FALSE, FALSE, FALSE,
-                             DEFAULT_CHARSET, OUT_DEFAULT_PRECIS,
-                             CLIP_DEFAULT_PRECIS, CLEARTYPE_QUALITY,
-                             DEFAULT_PITCH | FF_SWISS, L"Segoe UI");
-        hOldFont = (HFONT)SelectObject(hdc, hFont);
-
-        DrawTextW(hdc, g_tooltipText, -1, &rc,
-                  DT_CENTER | DT_VCENTER | DT_SINGLELINE);
-
-        SelectObject(hdc, hOldFont);
-        DeleteObject(hFont);
-        EndPaint(hwnd, &ps);
-        return 0;
-    }
-
     case WM_TIMER:
         if (wParam == TOOLTIP_TIMER_ID) {
             KillTimer(hwnd, TOOLTIP_TIMER_ID);
@@ -59,6 +154,14 @@ static LRESULT CALLBACK TooltipWndProc(HWND hwnd, UINT msg,
         }
         return 0;
 
+    case WM_DISPLAYCHANGE:
+    case WM_DPICHANGED:
+        /* Rendered for another DPI; render again on the next show */
+        KillTimer(hwnd, TOOLTIP_TIMER_ID);
+        ShowWindow(hwnd, SW_HIDE);
+        FreeLabels();
+        return DefWindowProcW(hwnd, msg, wParam, lParam);
+
     case WM_NCHITTEST:
         return HTTRANSPARENT; /* click-through */
 
@@ -68,62 +171,66 @@ static LRESULT CALLBACK TooltipWndProc(HWND hwnd, UINT msg,
 }
 
 void KolemakTooltip_Init(HINSTANCE hInst)
+{
+    g_tooltipInst = hInst;
+}
+
+void KolemakTooltip_Uninit(void)
+{
+    FreeLabels();
+}
+
+/* Most threads never show a tooltip; the class waits for the first */
+static void RegisterTooltipClass(void)
 {
     if (!g_classRegistered) {
         WNDCLASSEXW wc = {0};
         wc.cbSize = sizeof(wc);
         wc.lpfnWndProc = TooltipWndProc;
-        wc.hInstance = hInst;
-        wc.hbrBackground = (HBRUSH)GetStockObject(BLACK_BRUSH);
+        wc.hInstance = g_tooltipInst;
         wc.lpszClassName = TOOLTIP_CLASS_NAME;
         if (RegisterClassExW(&wc))
             g_classRegistered = TRUE;
     }
 }
 
-void KolemakTooltip_Show(const WCHAR *text)
+void KolemakTooltip_Show(UINT label)
 {
-    SIZE textSize = {0};
-    int w, h;
-    HDC hdc;
-    HFONT hFont;
+    BLENDFUNCTION blend = { AC_SRC_OVER, 0, 255, AC_SRC_ALPHA };
+    const TooltipLabel *l;
+    POINT pt, src = {0, 0};
+    SIZE size;
 
-    if (!g_classRegistered) return;
-
-    lstrcpynW(g_tooltipText, text, 64);
+    if (label >= TIPLABEL_COUNT) return;
 
-    /* Measure text to size the window */
-    hdc = GetDC(NULL);
-    hFont = CreateFontW(-13, 0, 0, 0, FW_SEMIBOLD, FALSE, FALSE, FALSE,
-                         DEFAULT_CHARSET, OUT_DEFAULT_PRECIS,
-                         CLIP_DEFAULT_PRECIS, CLEARTYPE_QUALITY,
-                         DEFAULT_PITCH | FF_SWISS, L"Segoe UI");
-    SelectObject(hdc, hFont);
-    GetTextExtentPoint32W(hdc, text, lstrlenW(text), &textSize);
-    DeleteObject(hFont);
-    ReleaseDC(NULL, hdc);
+    RegisterTooltipClass();
+    if (!g_classRegistered) return;
 
-    w = textSize.cx + 20;
-    h = textSize.cy + 10;
+    if (!g_labelDpi && !RenderLabels()) return;
+    l = &g_labels[label];
 
     if (!g_tooltipWnd) {
         g_tooltipWnd = CreateWindowExW(
             WS_EX_TOPMOST | WS_EX_TOOLWINDOW | WS_EX_LAYERED,
             TOOLTIP_CLASS_NAME, NULL,
             WS_POPUP,
-            20, 20, w, h,
+            l->layout.x, l->layout.y, l->layout.width, l->layout.height,
             NULL, NULL, NULL, NULL);
 
         if (!g_tooltipWnd) return;
-
-        /* Semi-transparent */
-        SetLayeredWindowAttributes(g_tooltipWnd, 0, 220, LWA_ALPHA);
     } else {
-        SetWindowPos(g_tooltipWnd, HWND_TOPMOST, 20, 20, w, h,
-                     SWP_NOACTIVATE);
+        SetWindowPos(g_tooltipWnd, HWND_TOPMOST, 0, 0, 0, 0,
+                     SWP_NOMOVE | SWP_NOSIZE | SWP_NOACTIVATE);
     }
 
-    InvalidateRect(g_tooltipWnd, NULL, TRUE);
+    /* Position, size and (semi-transparent) pixels in one call */
+    pt.x = l->layout.x;
+    pt.y = l->layout.y;
+    size.cx = l->layout.width;
+    size.cy = l->layout.height;
+    SelectObject(g_labelDC, l->bitmap);
+    UpdateLayeredWindow(g_tooltipWnd, NULL, &pt, &size, g_labelDC, &src,
+                        0, &blend, ULW_ALPHA);
     ShowWindow(g_tooltipWnd, SW_SHOWNOACTIVATE);
 
     /* Reset timer */
@@ -6,8 +6,16 @@
 #define TOOLTIP_H
 
 #include <windows.h>
+#include "tiplabel.h"
 
+/* Remember the module; the window class is registered and the labels
+ * are rendered by the first KolemakTooltip_Show */
 void KolemakTooltip_Init(HINSTANCE hInst);
-void KolemakTooltip_Show(const WCHAR *text);
+
+/* Free the rendered labels (DLL unload) */
+void KolemakTooltip_Uninit(void);
+
+/* Show a TIPLABEL_* label */
+void KolemakTooltip_Show(UINT label);
 
 #endif /* TOOLTIP_H */
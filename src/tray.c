@@ -1,15 +1,17 @@
 /*
  * tray.c - System tray icon and settings dialog
  *
- * Uses a named mutex to ensure only one tray icon across all
- * processes that load the IME DLL.
+ * One process in the session shows the icon; the processes that load
+ * the IME DLL elect it through broker.c.
  */
 
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #include <shellapi.h>
 #include "tray.h"
+#include "broker.h"
 #include "settings.h"
+#include "llhook.h"
 #include "keymap.h"
 #include "resource.h"
 #include "version.h"
@@ -23,7 +25,6 @@
 
 #define TRAY_WND_CLASS      L"KolemakTrayWnd"
 #define SETTINGS_WND_CLASS  L"KolemakSettingsWnd"
-#define TRAY_MUTEX_NAME     L"KolemakTrayMutex"
 #define WM_TRAYICON         (WM_USER + 100)
 #define TRAY_ICON_ID        1
 
@@ -41,7 +42,6 @@
 
 /* ===== Globals ===== */
 
-static HANDLE g_trayMutex = NULL;
 static HWND   g_trayWnd = NULL;
 static HWND   g_settingsWnd = NULL;
 static BOOL   g_trayClassRegistered = FALSE;
@@ -130,7 +130,7 @@ static LRESULT CALLBACK SettingsWndProc(HWND hwnd, UINT msg,
             sd->capturedVk = vk;
             sd->capturedMod = mod;
             sd->capturing = FALSE;
-            g_captureHwnd = NULL;
+            LLHook_SetCaptureWindow(NULL);
 
             FormatHotkey(mod, vk, buf, 64);
             SetWindowTextW(sd->lblHotkeyVal, buf);
@@ -148,7 +148,7 @@ static LRESULT CALLBACK SettingsWndProc(HWND hwnd, UINT msg,
                 /* Cancel capture */
                 WCHAR buf[64];
                 sd->capturing = FALSE;
-                g_captureHwnd = NULL;
+                LLHook_SetCaptureWindow(NULL);
                 SetWindowTextW(sd->btnHotkey,
                     L"\xBCC0\xACBD...");  /* 변경... */
                 FormatHotkey(
@@ -182,7 +182,7 @@ static LRESULT CALLBACK SettingsWndProc(HWND hwnd, UINT msg,
                     ? keymap_get_qwerty_vk(vk) : vk;
                 sd->capturedMod = mod;
                 sd->capturing = FALSE;
-                g_captureHwnd = NULL;
+                LLHook_SetCaptureWindow(NULL);
 
                 FormatHotkey(mod, sd->capturedVk, buf, 64);
                 SetWindowTextW(sd->lblHotkeyVal, buf);
@@ -260,7 +260,7 @@ static LRESULT CALLBACK SettingsWndProc(HWND hwnd, UINT msg,
             if (HIWORD(wParam) == BN_CLICKED) {
                 if (!sd->capturing) {
                     sd->capturing = TRUE;
-                    g_captureHwnd = hwnd;
+                    LLHook_SetCaptureWindow(hwnd);
                     SetWindowTextW(sd->lblHotkeyVal,
                         /* 조합키 + 키를 누르세요... */
                         L"\xC870\xD569\xD0A4 + \xD0A4\xB97C "
@@ -272,7 +272,7 @@ static LRESULT CALLBACK SettingsWndProc(HWND hwnd, UINT msg,
                     /* Cancel capture */
                     WCHAR buf[64];
                     sd->capturing = FALSE;
-                    g_captureHwnd = NULL;
+                    LLHook_SetCaptureWindow(NULL);
                     FormatHotkey(
                         sd->capturedVk ? sd->capturedMod
                                        : sd->ts->hotkeyModifiers,
@@ -468,6 +468,25 @@ static void ShowSettingsDialog(void)
 
 static BOOL CreateTrayIcon(HWND hwnd);
 
+/* The IME's memory in this process (arena.h), one line per object type
+ * in use; out needs room for ARENA_TYPES + 2 lines of 64 */
+static void FormatMemory(WCHAR *out)
+{
+    ArenaStats st;
+    UINT i;
+
+    arena_stats(ARENA_TYPES, &st);
+    out += wsprintfW(out, L"Memory: %ld objects, %ld bytes (peak %ld)",
+                     st.live, st.bytes, st.peakBytes);
+    for (i = 0; i < ARENA_TYPES; i++) {
+        arena_stats(i, &st);
+        if (st.allocs)
+            out += wsprintfW(out, L"\n  %hs: %ld (peak %ld), %ld bytes",
+                             arena_type_name(i), st.live, st.peakLive,
+                             st.bytes);
+    }
+}
+
 static void ShowTrayContextMenu(HWND hwnd)
 {
     HMENU hMenu;
@@ -494,11 +513,13 @@ static void ShowTrayContextMenu(HWND hwnd)
     if (cmd == IDM_SETTINGS) {
         ShowSettingsDialog();
     } else if (cmd == IDM_ABOUT) {
-        MessageBoxW(NULL,
+        WCHAR text[512];
+
+        lstrcpyW(text,
             L"Kolemak IME v" KOLEMAK_VER_W(KOLEMAK_VERSION) L"\n\n"
-            L"https://github.com/rayshoo/kolemak",
-            L"Kolemak",
-            MB_OK | MB_ICONINFORMATION);
+            L"https://github.com/rayshoo/kolemak\n\n");
+        FormatMemory(text + lstrlenW(text));
+        MessageBoxW(NULL, text, L"Kolemak", MB_OK | MB_ICONINFORMATION);
     }
 }
 
@@ -549,19 +570,12 @@ static BOOL CreateTrayIcon(HWND hwnd)
     return Shell_NotifyIconW(NIM_ADD, &nid);
 }
 
-HRESULT KolemakTray_Register(TextService *ts)
+/* Message-only window for the icon, on ts's thread */
+static BOOL CreateTrayWindow(TextService *ts)
 {
-    /* Try to be the sole tray icon owner */
-    g_trayMutex = CreateMutexW(NULL, TRUE, TRAY_MUTEX_NAME);
-    if (!g_trayMutex || GetLastError() == ERROR_ALREADY_EXISTS) {
-        if (g_trayMutex) {
-            CloseHandle(g_trayMutex);
-            g_trayMutex = NULL;
-        }
-        return S_OK; /* Another process owns the tray */
-    }
-
-    g_trayTs = ts;
+    /* Another thread of this process may be at it */
+    if (InterlockedCompareExchangePointer((PVOID *)&g_trayTs, ts, NULL))
+        return FALSE;
 
     /* Register window class */
     if (!g_trayClassRegistered) {
@@ -574,94 +588,176 @@ HRESULT KolemakTray_Register(TextService *ts)
             g_trayClassRegistered = TRUE;
     }
 
-    if (!g_trayClassRegistered) {
-        ReleaseMutex(g_trayMutex);
-        CloseHandle(g_trayMutex);
-        g_trayMutex = NULL;
-        return E_FAIL;
-    }
-
-    /* Create hidden message-only window */
-    g_trayWnd = CreateWindowExW(0, TRAY_WND_CLASS, L"KolemakTray",
-                                 0, 0, 0, 0, 0,
-                                 HWND_MESSAGE, NULL, g_hInst, NULL);
+    if (g_trayClassRegistered)
+        g_trayWnd = CreateWindowExW(0, TRAY_WND_CLASS, L"KolemakTray",
+                                    0, 0, 0, 0, 0,
+                                    HWND_MESSAGE, NULL, g_hInst, NULL);
     if (!g_trayWnd) {
-        ReleaseMutex(g_trayMutex);
-        CloseHandle(g_trayMutex);
-        g_trayMutex = NULL;
-        return E_FAIL;
+        InterlockedExchangePointer((PVOID *)&g_trayTs, NULL);
+        return FALSE;
     }
 
     /* Register for Explorer restart notification */
     g_wmTaskbarCreated = RegisterWindowMessageW(L"TaskbarCreated");
 
     CreateTrayIcon(g_trayWnd);
-    return S_OK;
+    return TRUE;
 }
 
-void KolemakTray_Unregister(TextService *ts)
+/* ===== Tray ownership =====
+ *
+ * Every process with a TextService competes for the icon on a broker
+ * thread (broker.h).  The losers sleep in the wait for the mutex, so a
+ * focus change costs them nothing; when the owner exits or dies, one of
+ * them is elected.  The icon window itself must live on a TextService
+ * thread (the settings dialog acts on its thread manager), so election
+ * only marks the process and asks the thread that last registered or
+ * had focus to create it, with KolemakTray_Message() (handled from the
+ * WH_GETMESSAGE hook).  Any thread of the process creates it on its
+ * next focus otherwise.  When the thread showing the icon deactivates,
+ * the icon is handed to another registered thread the same way; with
+ * none left to take it, the process resigns so another one is elected.
+ */
+
+#define TRAY_MAX_THREADS 64
+
+static SRWLOCK       s_trayLock = SRWLOCK_INIT;   /* serializes join/leave */
+static LONG          s_trayRefs;
+static Broker       *s_trayBroker;
+static volatile LONG s_trayElected;
+static volatile LONG s_trayThread;     /* where to create the icon */
+static UINT          s_trayMessage;
+
+/* Threads with a registered TextService, under s_trayLock */
+static DWORD         s_trayThreads[TRAY_MAX_THREADS];
+static UINT          s_trayThreadCount;
+
+/* On the broker thread */
+static BOOL ElectTray(void *ctx)
 {
-    (void)ts;
+    DWORD tid = (DWORD)s_trayThread;
 
-    if (g_trayWnd) {
-        DestroyWindow(g_trayWnd);
-        g_trayWnd = NULL;
-    }
+    (void)ctx;
+    InterlockedExchange(&s_trayElected, 1);
+    if (tid)
+        PostThreadMessageW(tid, KolemakTray_Message(), 0, 0);
+    return TRUE;
+}
 
-    if (g_trayMutex) {
-        ReleaseMutex(g_trayMutex);
-        CloseHandle(g_trayMutex);
-        g_trayMutex = NULL;
-    }
+/* After the last KolemakTray_Unregister, which took the icon down */
+static void ResignTray(void *ctx)
+{
+    (void)ctx;
+    InterlockedExchange(&s_trayElected, 0);
+}
 
-    g_trayTs = NULL;
+static const BrokerRole s_trayRole = {
+    "TrayMutex", ElectTray, ResignTray, NULL
+};
+
+UINT KolemakTray_Message(void)
+{
+    if (!s_trayMessage)
+        s_trayMessage = RegisterWindowMessageW(L"KolemakTray");
+    return s_trayMessage;
 }
 
-void KolemakTray_EnsureIcon(TextService *ts)
+static void RememberThread(DWORD tid)
 {
-    /* Already owns the tray icon */
-    if (g_trayWnd)
-        return;
+    if (s_trayThreadCount < TRAY_MAX_THREADS)
+        s_trayThreads[s_trayThreadCount++] = tid;
+}
+
+static void ForgetThread(DWORD tid)
+{
+    UINT i;
+
+    for (i = 0; i < s_trayThreadCount; i++) {
+        if (s_trayThreads[i] == tid) {
+            s_trayThreadCount--;
+            for (; i < s_trayThreadCount; i++)
+                s_trayThreads[i] = s_trayThreads[i + 1];
+            return;
+        }
+    }
+}
+
+/* Ask a remaining thread, the latest registered first, to show the
+ * icon; FALSE if none could be reached */
+static BOOL HandOffIcon(void)
+{
+    UINT i = s_trayThreadCount;
 
-    /* Try to acquire the mutex (non-blocking) */
-    g_trayMutex = CreateMutexW(NULL, TRUE, TRAY_MUTEX_NAME);
-    if (!g_trayMutex || GetLastError() == ERROR_ALREADY_EXISTS) {
-        if (g_trayMutex) {
-            CloseHandle(g_trayMutex);
-            g_trayMutex = NULL;
+    while (i-- > 0) {
+        DWORD tid = s_trayThreads[i];
+        if (PostThreadMessageW(tid, KolemakTray_Message(), 0, 0)) {
+            s_trayThread = (LONG)tid;
+            return TRUE;
         }
-        return; /* Another process still owns it */
     }
+    return FALSE;
+}
 
-    g_trayTs = ts;
+HRESULT KolemakTray_Register(TextService *ts)
+{
+    DWORD tid = GetCurrentThreadId();
+    BOOL joined;
+
+    s_trayThread = (LONG)tid;
+
+    /* Joins the election on the first registration, and again if the
+     * process resigned while it had no thread to show the icon on */
+    AcquireSRWLockExclusive(&s_trayLock);
+    if (!s_trayBroker)
+        s_trayBroker = broker_start(&s_trayRole);
+    joined = (s_trayBroker != NULL);
+    if (joined) {
+        s_trayRefs++;
+        RememberThread(tid);
+    }
+    ReleaseSRWLockExclusive(&s_trayLock);
 
-    if (!g_trayClassRegistered) {
-        WNDCLASSEXW wc = {0};
-        wc.cbSize = sizeof(wc);
-        wc.lpfnWndProc = TrayWndProc;
-        wc.hInstance = g_hInst;
-        wc.lpszClassName = TRAY_WND_CLASS;
-        if (RegisterClassExW(&wc))
-            g_trayClassRegistered = TRUE;
+    if (!joined)
+        return E_FAIL;
+
+    KolemakTray_EnsureIcon(ts);
+    return S_OK;
+}
+
+void KolemakTray_Unregister(TextService *ts)
+{
+    BOOL owned = FALSE;
+
+    if (g_trayTs == ts) {
+        if (g_trayWnd) {
+            DestroyWindow(g_trayWnd);
+            g_trayWnd = NULL;
+        }
+        InterlockedExchangePointer((PVOID *)&g_trayTs, NULL);
+        owned = TRUE;
     }
 
-    if (!g_trayClassRegistered) {
-        ReleaseMutex(g_trayMutex);
-        CloseHandle(g_trayMutex);
-        g_trayMutex = NULL;
-        return;
+    AcquireSRWLockExclusive(&s_trayLock);
+    ForgetThread(GetCurrentThreadId());
+    if (s_trayRefs > 0 && --s_trayRefs == 0) {
+        /* The last one hands the icon to another process */
+        broker_stop(s_trayBroker);
+        s_trayBroker = NULL;
+    } else if (owned && s_trayElected && !HandOffIcon()) {
+        /* Nobody here can show it: let another process have it */
+        broker_stop(s_trayBroker);
+        s_trayBroker = NULL;
     }
+    ReleaseSRWLockExclusive(&s_trayLock);
+}
 
-    g_trayWnd = CreateWindowExW(0, TRAY_WND_CLASS, L"KolemakTray",
-                                 0, 0, 0, 0, 0,
-                                 HWND_MESSAGE, NULL, g_hInst, NULL);
-    if (!g_trayWnd) {
-        ReleaseMutex(g_trayMutex);
-        CloseHandle(g_trayMutex);
-        g_trayMutex = NULL;
+void KolemakTray_EnsureIcon(TextService *ts)
+{
+    s_trayThread = (LONG)GetCurrentThreadId();
+
+    /* Shown already, or another process owns it */
+    if (g_trayTs || !s_trayElected)
         return;
-    }
 
-    g_wmTaskbarCreated = RegisterWindowMessageW(L"TaskbarCreated");
-    CreateTrayIcon(g_trayWnd);
+    CreateTrayWindow(ts);
 }
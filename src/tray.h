@@ -11,4 +11,8 @@ HRESULT KolemakTray_Register(TextService *ts);
 void    KolemakTray_Unregister(TextService *ts);
 void    KolemakTray_EnsureIcon(TextService *ts);
 
+/* Posted to a TextService thread when its process is elected to show
+ * the icon; the WH_GETMESSAGE hook calls KolemakTray_EnsureIcon */
+UINT    KolemakTray_Message(void);
+
 #endif /* TRAY_H */
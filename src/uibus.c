@@ -0,0 +1,38 @@
+/*
+ * uibus.c - Coalesced UI updates from the key path
+ */
+
+#include "uibus.h"
+
+#include <string.h>
+
+BOOL uibus_post(UiBus *bus, UINT target, LONG value)
+{
+    BOOL idle = (bus->dirty == 0);
+
+    if (target >= UIBUS_TARGETS)
+        return FALSE;
+    bus->value[target] = value;
+    bus->dirty |= 1u << target;
+    bus->posted++;
+    return idle;
+}
+
+UINT uibus_take(UiBus *bus, LONG *value)
+{
+    UINT dirty = bus->dirty;
+    UINT i;
+
+    memcpy(value, bus->value, sizeof(bus->value));
+    for (i = 0; i < UIBUS_TARGETS; i++) {
+        if (dirty & (1u << i))
+            bus->applied++;
+    }
+    bus->dirty = 0;
+    return dirty;
+}
+
+void uibus_clear(UiBus *bus)
+{
+    bus->dirty = 0;
+}
@@ -0,0 +1,42 @@
+/*
+ * uibus.h - Coalesced UI updates from the key path
+ *
+ * A mode change has UI side effects: the mode tooltip (which creates a
+ * font and measures its text), the language bar button, the keyboard
+ * open/close compartment.  The key path only records the latest state
+ * for each of them here; the owner applies what is pending once the
+ * thread has handled the input already queued (a thread timer in
+ * text_service.c), so a burst of toggles costs one update per target.
+ */
+
+#ifndef UIBUS_H
+#define UIBUS_H
+
+#include <windows.h>
+
+enum {
+    UIBUS_KEYBOARD_OPEN,   /* value: open (Korean mode) */
+    UIBUS_TOOLTIP,         /* value: Colemak mode to show */
+    UIBUS_LANGBAR,         /* value unused; the button reads the state */
+    UIBUS_TARGETS
+};
+
+typedef struct {
+    UINT  dirty;                    /* Bit per target with a pending value */
+    LONG  value[UIBUS_TARGETS];
+    ULONG posted;
+    ULONG applied;
+} UiBus;
+
+/* Record the latest state for target.  TRUE = nothing was pending: the
+ * caller schedules one flush. */
+BOOL uibus_post(UiBus *bus, UINT target, LONG value);
+
+/* Take what is pending (bit per target, values into value[]) and count
+ * it as applied */
+UINT uibus_take(UiBus *bus, LONG *value);
+
+/* Drop what is pending */
+void uibus_clear(UiBus *bus);
+
+#endif /* UIBUS_H */